@@ -12,7 +12,7 @@ fn main() {
             return;
         }
     };
-    let semaphore = match polyos_std::sync::Semaphore::create(0) {
+    let semaphore = match polyos_std::sync::Semaphore::create_shared(0) {
         Ok(semaphore) => semaphore,
         Err(err) => {
             println!("sem_create failed: {}", err);
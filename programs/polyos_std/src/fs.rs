@@ -41,7 +41,7 @@ pub struct DirEntry {
 }
 
 pub fn errno() -> i32 {
-    unsafe { crate::bindings::errno }
+    unsafe { *crate::bindings::__errno_location() }
 }
 
 pub fn open(path: &str, flags: i32, mode: i32) -> Result<i32, i32> {
@@ -15,6 +15,7 @@ mod memory;
 pub mod prelude;
 pub mod process;
 pub mod sync;
+pub mod thread;
 
 pub use prelude::*;
 
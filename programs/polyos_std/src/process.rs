@@ -63,6 +63,97 @@ fn execve_raw_env(path: &str, args: &[&str], envp: *const *mut i8) -> i32 {
     unsafe { crate::bindings::execve(path.as_ptr() as *const i8, argv.as_ptr(), envp) }
 }
 
+/// Descriptor change made in a spawned child before its program starts.
+pub enum SpawnAction<'a> {
+    Close(i32),
+    /// Makes `to` a copy of `from`.
+    Dup2 {
+        from: i32,
+        to: i32,
+    },
+    /// Opens `path` as descriptor `fd`.
+    Open {
+        fd: i32,
+        path: &'a str,
+        flags: i32,
+        mode: i32,
+    },
+}
+
+/// Starts `path` in a new child process with `args` and `env`, applying
+/// `actions` in the child first. Unlike `fork` then `execve_with_env`, this
+/// process is not copied. Returns the child's pid or an errno value.
+pub fn spawn(path: &str, args: &[&str], env: &[&str], actions: &[SpawnAction]) -> Result<i32, i32> {
+    let path = nul_terminated(path);
+    let arg_storage: Vec<Vec<u8>> = args.iter().map(|arg| nul_terminated(arg)).collect();
+    let env_storage: Vec<Vec<u8>> = env.iter().map(|entry| nul_terminated(entry)).collect();
+
+    let mut argv: Vec<*mut i8> = arg_storage
+        .iter()
+        .map(|arg| arg.as_ptr() as *mut i8)
+        .collect();
+    argv.push(core::ptr::null_mut());
+
+    let mut envp: Vec<*mut i8> = env_storage
+        .iter()
+        .map(|entry| entry.as_ptr() as *mut i8)
+        .collect();
+    envp.push(core::ptr::null_mut());
+
+    let mut file_actions: crate::bindings::posix_spawn_file_actions_t =
+        unsafe { core::mem::zeroed() };
+    unsafe { crate::bindings::posix_spawn_file_actions_init(&mut file_actions) };
+
+    let mut result = 0;
+    for action in actions {
+        result = match *action {
+            SpawnAction::Close(fd) => unsafe {
+                crate::bindings::posix_spawn_file_actions_addclose(&mut file_actions, fd)
+            },
+            SpawnAction::Dup2 { from, to } => unsafe {
+                crate::bindings::posix_spawn_file_actions_adddup2(&mut file_actions, from, to)
+            },
+            SpawnAction::Open {
+                fd,
+                path,
+                flags,
+                mode,
+            } => {
+                let path = nul_terminated(path);
+                unsafe {
+                    crate::bindings::posix_spawn_file_actions_addopen(
+                        &mut file_actions,
+                        fd,
+                        path.as_ptr() as *const i8,
+                        flags,
+                        mode,
+                    )
+                }
+            }
+        };
+        if result != 0 {
+            break;
+        }
+    }
+
+    let mut pid = 0;
+    if result == 0 {
+        result = unsafe {
+            crate::bindings::posix_spawn(
+                &mut pid,
+                path.as_ptr() as *const i8,
+                &file_actions,
+                core::ptr::null(),
+                argv.as_ptr(),
+                envp.as_ptr(),
+            )
+        };
+    }
+    unsafe { crate::bindings::posix_spawn_file_actions_destroy(&mut file_actions) };
+
+    if result == 0 { Ok(pid) } else { Err(result) }
+}
+
 pub fn fork() -> i32 {
     unsafe { crate::bindings::fork() }
 }
@@ -95,6 +186,21 @@ pub fn getegid() -> u32 {
     unsafe { crate::bindings::getegid() }
 }
 
+/// Adds `increment` to the nice value of the calling process and returns the
+/// new value, or -1 on error.
+pub fn nice(increment: i32) -> i32 {
+    unsafe { crate::bindings::nice(increment) }
+}
+
+/// Nice value of process `pid` (0 for the caller), or -1 on error.
+pub fn getpriority(pid: i32) -> i32 {
+    unsafe { crate::bindings::getpriority(crate::bindings::PRIO_PROCESS as i32, pid) }
+}
+
+pub fn setpriority(pid: i32, nice: i32) -> i32 {
+    unsafe { crate::bindings::setpriority(crate::bindings::PRIO_PROCESS as i32, pid, nice) }
+}
+
 pub fn initialize(argc: i32, argv: *const *const u8, envp: *const *const u8) {
     unsafe {
         ARGC = argc.max(0) as usize;
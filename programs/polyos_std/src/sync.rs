@@ -1,27 +1,63 @@
-#[derive(Clone, Copy)]
+use core::{
+    cell::UnsafeCell,
+    ops::{Deref, DerefMut},
+};
+
+/// Counting semaphore. Private ones stay in user space until a task has to
+/// wait; shared ones are kernel objects and survive `fork`.
 pub struct Semaphore {
-    sem: crate::bindings::sem_t,
+    sem: UnsafeCell<crate::bindings::sem_t>,
 }
 
+unsafe impl Send for Semaphore {}
+unsafe impl Sync for Semaphore {}
+
 impl Semaphore {
     pub fn create(initial_count: i32) -> Result<Self, i32> {
-        let mut sem = 0 as crate::bindings::sem_t;
-        let result = unsafe { crate::bindings::sem_init(&mut sem, 0, initial_count as u32) };
+        Self::init(0, initial_count)
+    }
+
+    /// A semaphore that parent and child can both use after `fork`.
+    pub fn create_shared(initial_count: i32) -> Result<Self, i32> {
+        Self::init(1, initial_count)
+    }
+
+    fn init(pshared: i32, initial_count: i32) -> Result<Self, i32> {
+        let semaphore = Self {
+            sem: UnsafeCell::new(crate::bindings::sem_t {
+                value: 0,
+                waiters: 0,
+                id: 0,
+            }),
+        };
+        let result = unsafe {
+            crate::bindings::sem_init(semaphore.sem.get(), pshared, initial_count as u32)
+        };
 
         if result == 0 {
-            Ok(Self { sem })
+            Ok(semaphore)
         } else {
             Err(result)
         }
     }
 
-    pub fn id(self) -> i32 {
-        self.sem as i32
+    /// Kernel id of a shared semaphore, 0 for a private one.
+    pub fn id(&self) -> i32 {
+        unsafe { (*self.sem.get()).id }
+    }
+
+    pub fn wait(&self) -> Result<(), i32> {
+        let result = unsafe { crate::bindings::sem_wait(self.sem.get()) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err(result)
+        }
     }
 
-    pub fn wait(self) -> Result<(), i32> {
-        let mut sem = self.sem;
-        let result = unsafe { crate::bindings::sem_wait(&mut sem) };
+    pub fn try_wait(&self) -> Result<(), i32> {
+        let result = unsafe { crate::bindings::sem_trywait(self.sem.get()) };
 
         if result == 0 {
             Ok(())
@@ -30,9 +66,8 @@ impl Semaphore {
         }
     }
 
-    pub fn signal(self) -> Result<(), i32> {
-        let mut sem = self.sem;
-        let result = unsafe { crate::bindings::sem_post(&mut sem) };
+    pub fn signal(&self) -> Result<(), i32> {
+        let result = unsafe { crate::bindings::sem_post(self.sem.get()) };
 
         if result == 0 {
             Ok(())
@@ -42,8 +77,7 @@ impl Semaphore {
     }
 
     pub fn close(self) -> Result<(), i32> {
-        let mut sem = self.sem;
-        let result = unsafe { crate::bindings::sem_destroy(&mut sem) };
+        let result = unsafe { crate::bindings::sem_destroy(self.sem.get()) };
 
         if result == 0 {
             Ok(())
@@ -52,3 +86,94 @@ impl Semaphore {
         }
     }
 }
+
+/// Futex-backed mutual exclusion around a `T`.
+pub struct Mutex<T> {
+    raw: UnsafeCell<crate::bindings::pthread_mutex_t>,
+    data: UnsafeCell<T>,
+}
+
+unsafe impl<T: Send> Send for Mutex<T> {}
+unsafe impl<T: Send> Sync for Mutex<T> {}
+
+impl<T> Mutex<T> {
+    pub const fn new(data: T) -> Self {
+        Self {
+            raw: UnsafeCell::new(crate::bindings::pthread_mutex_t { state: 0 }),
+            data: UnsafeCell::new(data),
+        }
+    }
+
+    pub fn lock(&self) -> MutexGuard<'_, T> {
+        unsafe { crate::bindings::pthread_mutex_lock(self.raw.get()) };
+        MutexGuard { mutex: self }
+    }
+
+    pub fn try_lock(&self) -> Option<MutexGuard<'_, T>> {
+        let result = unsafe { crate::bindings::pthread_mutex_trylock(self.raw.get()) };
+        (result == 0).then_some(MutexGuard { mutex: self })
+    }
+
+    pub fn into_inner(self) -> T {
+        self.data.into_inner()
+    }
+}
+
+pub struct MutexGuard<'a, T> {
+    mutex: &'a Mutex<T>,
+}
+
+impl<T> Deref for MutexGuard<'_, T> {
+    type Target = T;
+
+    fn deref(&self) -> &T {
+        unsafe { &*self.mutex.data.get() }
+    }
+}
+
+impl<T> DerefMut for MutexGuard<'_, T> {
+    fn deref_mut(&mut self) -> &mut T {
+        unsafe { &mut *self.mutex.data.get() }
+    }
+}
+
+impl<T> Drop for MutexGuard<'_, T> {
+    fn drop(&mut self) {
+        unsafe { crate::bindings::pthread_mutex_unlock(self.mutex.raw.get()) };
+    }
+}
+
+/// Condition variable used together with a `Mutex`.
+pub struct Condvar {
+    raw: UnsafeCell<crate::bindings::pthread_cond_t>,
+}
+
+unsafe impl Send for Condvar {}
+unsafe impl Sync for Condvar {}
+
+impl Condvar {
+    pub const fn new() -> Self {
+        Self {
+            raw: UnsafeCell::new(crate::bindings::pthread_cond_t {
+                sequence: 0,
+                waiters: 0,
+            }),
+        }
+    }
+
+    /// Releases the mutex of `guard`, sleeps until notified and takes the
+    /// mutex again. Wakeups can be spurious, so callers re-check their
+    /// condition.
+    pub fn wait<'a, T>(&self, guard: MutexGuard<'a, T>) -> MutexGuard<'a, T> {
+        unsafe { crate::bindings::pthread_cond_wait(self.raw.get(), guard.mutex.raw.get()) };
+        guard
+    }
+
+    pub fn notify_one(&self) {
+        unsafe { crate::bindings::pthread_cond_signal(self.raw.get()) };
+    }
+
+    pub fn notify_all(&self) {
+        unsafe { crate::bindings::pthread_cond_broadcast(self.raw.get()) };
+    }
+}
@@ -0,0 +1,89 @@
+use alloc::{boxed::Box, sync::Arc};
+use core::{cell::UnsafeCell, ffi::c_void};
+
+/// Result slot shared by a thread and its `JoinHandle`. The thread writes it
+/// before exiting; the handle reads it only after `pthread_join`.
+struct Packet<T> {
+    result: UnsafeCell<Option<T>>,
+}
+
+unsafe impl<T: Send> Sync for Packet<T> {}
+
+/// Owned permission to join a thread. Dropping it detaches the thread.
+pub struct JoinHandle<T> {
+    thread: crate::bindings::pthread_t,
+    packet: Arc<Packet<T>>,
+}
+
+unsafe impl<T: Send> Send for JoinHandle<T> {}
+
+impl<T> JoinHandle<T> {
+    /// Waits for the thread to finish and returns its result.
+    pub fn join(self) -> Result<T, i32> {
+        let thread = self.thread;
+        let packet = self.packet.clone();
+        core::mem::forget(self);
+
+        let result = unsafe { crate::bindings::pthread_join(thread, core::ptr::null_mut()) };
+        if result != 0 {
+            return Err(result);
+        }
+
+        unsafe { (*packet.result.get()).take() }.ok_or(crate::bindings::EINVAL as i32)
+    }
+}
+
+impl<T> Drop for JoinHandle<T> {
+    fn drop(&mut self) {
+        unsafe { crate::bindings::pthread_detach(self.thread) };
+    }
+}
+
+struct Start<T> {
+    main: Box<dyn FnOnce() -> T + Send>,
+    packet: Arc<Packet<T>>,
+}
+
+unsafe extern "C" fn thread_start<T>(arg: *mut c_void) -> *mut c_void {
+    let start = unsafe { Box::from_raw(arg as *mut Start<T>) };
+    let result = (start.main)();
+    unsafe { *start.packet.result.get() = Some(result) };
+    core::ptr::null_mut()
+}
+
+/// Runs `f` on a new thread of the current process.
+pub fn spawn<F, T>(f: F) -> Result<JoinHandle<T>, i32>
+where
+    F: FnOnce() -> T + Send + 'static,
+    T: Send + 'static,
+{
+    let packet = Arc::new(Packet {
+        result: UnsafeCell::new(None),
+    });
+    let start = Box::into_raw(Box::new(Start {
+        main: Box::new(f),
+        packet: packet.clone(),
+    }));
+
+    let mut thread: crate::bindings::pthread_t = core::ptr::null_mut();
+    let result = unsafe {
+        crate::bindings::pthread_create(
+            &mut thread,
+            core::ptr::null(),
+            Some(thread_start::<T>),
+            start as *mut c_void,
+        )
+    };
+
+    if result == 0 {
+        Ok(JoinHandle { thread, packet })
+    } else {
+        drop(unsafe { Box::from_raw(start) });
+        Err(result)
+    }
+}
+
+/// Kernel id of the calling thread.
+pub fn current_id() -> i32 {
+    unsafe { crate::bindings::gettid() }
+}
@@ -98,6 +98,134 @@ static int test_devices(void)
     return failed == local_failed;
 }
 
+static int buffer_contains(const char *buf, int len, const char *needle)
+{
+    int needle_len = strlen(needle);
+    for (int i = 0; i + needle_len <= len; i++) {
+        if (memcmp(buf + i, needle, needle_len) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int read_all(int fd, char *buf, int size)
+{
+    int total = 0;
+    while (total < size) {
+        ssize_t n = read(fd, buf + total, size - total);
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+static int test_syscall_trace(void)
+{
+    int local_failed = failed;
+    static char buf[8192];
+
+    int ctl = open("/dev/syscalls", O_RDWR, 0);
+    expect("open /dev/syscalls", ctl >= 0, ctl);
+    if (ctl < 0) {
+        return 0;
+    }
+
+    expect("enable syscall tracing", write(ctl, "on", 2) == 2, -1);
+    getpid();
+    expect("disable syscall tracing", write(ctl, "off", 3) == 3, -1);
+    expect("reject bad trace command", write(ctl, "maybe", 5) < 0, -1);
+
+    int len = read_all(ctl, buf, sizeof(buf));
+    expect("syscall stats list getpid", buffer_contains(buf, len, "GetPid"), len);
+    expect("close /dev/syscalls", close(ctl) == 0, -1);
+
+    int fd = open("/dev/strace", O_RDONLY, 0);
+    expect("open /dev/strace", fd >= 0, fd);
+    if (fd >= 0) {
+        len = read_all(fd, buf, sizeof(buf));
+        expect("strace records getpid", buffer_contains(buf, len, "GetPid("), len);
+        expect("close /dev/strace", close(fd) == 0, -1);
+    }
+
+    return failed == local_failed;
+}
+
+static int test_block_cache(void)
+{
+    int local_failed = failed;
+    static char buf[1024];
+
+    int fd = open("/dev/blockcache", O_RDWR, 0);
+    expect("open /dev/blockcache", fd >= 0, fd);
+    if (fd < 0) {
+        return 0;
+    }
+
+    int len = read_all(fd, buf, sizeof(buf));
+    expect("block cache header", buffer_contains(buf, len, "EVICTIONS"), len);
+    expect("block queue header", buffer_contains(buf, len, "DISPATCHES"), len);
+    expect("reject zero cache size", write(fd, "0", 1) < 0, -1);
+    expect("reset block cache stats", write(fd, "reset", 5) == 5, -1);
+
+    expect("shrink block cache", write(fd, "256", 3) == 3, -1);
+    len = read_all(fd, buf, sizeof(buf));
+    expect("block cache capacity", buffer_contains(buf, len, "      256"), len);
+    expect("restore block cache", write(fd, "8192", 4) == 4, -1);
+    expect("close /dev/blockcache", close(fd) == 0, -1);
+
+    fd = open("/bin/selftest.elf", O_RDONLY, 0);
+    expect("open for fadvise", fd >= 0, fd);
+    if (fd < 0) {
+        return 0;
+    }
+    expect("fadvise sequential", posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL) == 0, -1);
+    expect("fadvise willneed", posix_fadvise(fd, 0, 4096, POSIX_FADV_WILLNEED) == 0, -1);
+    expect("readahead", readahead(fd, 4096, 4096) == 0, -1);
+    expect("read after readahead", read(fd, buf, 4) == 4 && buf[1] == 'E', -1);
+    expect("fadvise dontneed", posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0, -1);
+    expect("fadvise bad advice", posix_fadvise(fd, 0, 0, 42) == EINVAL, -1);
+    expect("close fadvise file", close(fd) == 0, -1);
+
+    return failed == local_failed;
+}
+
+static int test_ram_disk(void)
+{
+    int local_failed = failed;
+    static char buf[16];
+    const char msg[] = "scratch";
+
+    int fd = open("/ram/scratch.txt", O_CREAT | O_RDWR, 0);
+    expect("create on /ram", fd >= 0, fd);
+    if (fd < 0) {
+        return 0;
+    }
+    expect("write /ram", write(fd, msg, sizeof(msg)) == (ssize_t)sizeof(msg), -1);
+    expect("fsync /ram", fsync(fd) == 0, -1);
+    expect("close /ram file", close(fd) == 0, -1);
+
+    fd = open("/ram/scratch.txt", O_RDONLY, 0);
+    expect("reopen on /ram", fd >= 0, fd);
+    if (fd >= 0) {
+        expect("read /ram", read(fd, buf, sizeof(buf)) == (ssize_t)sizeof(msg), -1);
+        expect("content /ram", memcmp(buf, msg, sizeof(msg)) == 0, -1);
+        expect("close reopened /ram file", close(fd) == 0, -1);
+    }
+    expect("unlink on /ram", unlink("/ram/scratch.txt") == 0, -1);
+
+    fd = open("/dev/ram0", O_RDONLY, 0);
+    expect("open /dev/ram0", fd >= 0, fd);
+    if (fd >= 0) {
+        expect("read boot sector", read(fd, buf, 3) == 3 && (unsigned char)buf[0] == 0xEB, -1);
+        expect("close /dev/ram0", close(fd) == 0, -1);
+    }
+
+    return failed == local_failed;
+}
+
 static int test_file_io(void)
 {
     int local_failed = failed;
@@ -123,7 +251,10 @@ static int test_file_io(void)
     expect("fstat /tmp file", fstat(fd, &stat) == 0 && stat.size >= (int)(sizeof(msg) - 1), stat.size);
     expect("fstat regular mode", S_ISREG(stat.mode), stat.mode);
     expect("lseek SEEK_END", lseek(fd, 0, SEEK_END) == (off_t)(sizeof(msg) - 1), -1);
+    expect("fsync /tmp file", fsync(fd) == 0, -1);
+    expect("fdatasync /tmp file", fdatasync(fd) == 0, -1);
     expect("close /tmp file", close(fd) == 0, -1);
+    expect("fsync closed fd", fsync(fd) < 0, -1);
 
     fd = open(path, O_WRONLY | O_TRUNC, 0);
     expect("open O_TRUNC", fd >= 0, fd);
@@ -138,6 +269,7 @@ static int test_file_io(void)
         expect("write O_APPEND", write(fd, "z", 1) == 1, -1);
         expect("close O_APPEND", close(fd) == 0, -1);
     }
+    sync();
 
     fd = open(path, O_RDONLY, 0);
     expect("open after append", fd >= 0, fd);
@@ -421,33 +553,80 @@ static int test_pipe(void)
         }
     }
 
+    expect("pipe eof wake create", pipe(fds) == 0, -1);
+    if (failed == local_failed) {
+        pid_t pid = fork();
+        expect("pipe eof wake fork", pid >= 0, pid);
+        if (pid == 0) {
+            close(fds[0]);
+            sleep_ms(10);
+            close(fds[1]);
+            _exit(0);
+        }
+        if (pid >= 0) {
+            close(fds[1]);
+            expect("pipe eof wakes reader", read(fds[0], buf, 1) == 0, -1);
+            close(fds[0]);
+            int status = -1;
+            expect("pipe eof wake wait", waitpid(pid, &status, 0) == pid && WIFEXITED(status), status);
+        }
+    }
+
+    expect("pipe epipe wake create", pipe(fds) == 0, -1);
+    if (failed == local_failed) {
+        char fill[4096];
+        memset(fill, 'x', sizeof(fill));
+        expect("pipe epipe fill", write(fds[1], fill, sizeof(fill)) == (ssize_t)sizeof(fill), -1);
+        pid_t pid = fork();
+        expect("pipe epipe wake fork", pid >= 0, pid);
+        if (pid == 0) {
+            close(fds[1]);
+            sleep_ms(10);
+            close(fds[0]);
+            _exit(0);
+        }
+        if (pid >= 0) {
+            const char one = 'y';
+            close(fds[0]);
+            expect("pipe close wakes writer", write(fds[1], &one, 1) == -1 && errno == EPIPE, errno);
+            close(fds[1]);
+            int status = -1;
+            expect("pipe epipe wake wait", waitpid(pid, &status, 0) == pid && WIFEXITED(status), status);
+        }
+    }
+
     return failed == local_failed;
 }
 
 static int test_semaphore_basic(void)
 {
     int local_failed = failed;
-    sem_t sem = -1;
-    expect("sem_init", sem_init(&sem, 0, 1) == 0 && sem > 0, sem);
-    if (sem <= 0) {
-        return 0;
-    }
-
+    sem_t sem;
+    expect("sem_init", sem_init(&sem, 0, 1) == 0 && sem.value == 1 && sem.id == 0, sem.value);
     expect("sem_wait immediate", sem_wait(&sem) == 0, -1);
+    errno = 0;
+    expect("sem_trywait empty errno", sem_trywait(&sem) == -1 && errno == EAGAIN, errno);
     expect("sem_post", sem_post(&sem) == 0, -1);
+    expect("sem_trywait", sem_trywait(&sem) == 0 && sem.value == 0, sem.value);
     expect("sem_destroy", sem_destroy(&sem) == 0, -1);
+
+    expect("sem_init pshared", sem_init(&sem, 1, 1) == 0 && sem.id > 0, sem.id);
+    if (sem.id > 0) {
+        expect("sem_wait pshared", sem_wait(&sem) == 0, -1);
+        expect("sem_post pshared", sem_post(&sem) == 0, -1);
+        expect("sem_destroy pshared", sem_destroy(&sem) == 0 && sem.id == 0, -1);
+    }
+
     errno = 0;
     expect("sem_init NULL errno", sem_init(NULL, 0, 1) == -1 && errno == EFAULT, errno);
     errno = 0;
-    expect("sem_init pshared errno", sem_init(&sem, 1, 1) == -1 && errno == ENOTSUP, errno);
-    errno = 0;
     expect("sem_wait NULL errno", sem_wait(NULL) == -1 && errno == EFAULT, errno);
     errno = 0;
     expect("sem_post NULL errno", sem_post(NULL) == -1 && errno == EFAULT, errno);
     errno = 0;
     expect("sem_destroy NULL errno", sem_destroy(NULL) == -1 && errno == EFAULT, errno);
 
-    sem = 999999;
+    sem.id = 999999;
     errno = 0;
     expect("sem_wait invalid errno", sem_wait(&sem) == -1 && errno == EINVAL, errno);
     errno = 0;
@@ -458,6 +637,195 @@ static int test_semaphore_basic(void)
     return failed == local_failed;
 }
 
+static int test_futex_sync(void)
+{
+    int local_failed = failed;
+    volatile int word = 1;
+    struct timespec timeout = { 0, 20000000 };
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+    errno = 0;
+    expect("futex wait mismatch errno", futex(&word, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, 0, NULL) == -1 && errno == EAGAIN, errno);
+    errno = 0;
+    expect("futex wait timeout errno", futex(&word, FUTEX_WAIT | FUTEX_PRIVATE_FLAG, 1, &timeout) == -1 && errno == ETIMEDOUT, errno);
+    expect("futex wake nobody", futex(&word, FUTEX_WAKE, 1, NULL) == 0, -1);
+    errno = 0;
+    expect("futex misaligned errno", futex((volatile int *)((char *)&word + 1), FUTEX_WAKE, 1, NULL) == -1 && errno == EINVAL, errno);
+    errno = 0;
+    expect("futex bad op errno", futex(&word, 99, 0, NULL) == -1 && errno == ENOSYS, errno);
+
+    expect("mutex lock", pthread_mutex_lock(&mutex) == 0 && mutex.state == 1, mutex.state);
+    expect("mutex trylock busy", pthread_mutex_trylock(&mutex) == EBUSY, -1);
+    expect("mutex destroy busy", pthread_mutex_destroy(&mutex) == EBUSY, -1);
+    expect("mutex unlock", pthread_mutex_unlock(&mutex) == 0 && mutex.state == 0, mutex.state);
+    expect("mutex unlock unlocked", pthread_mutex_unlock(&mutex) == EPERM, -1);
+    expect("mutex trylock", pthread_mutex_trylock(&mutex) == 0, -1);
+    expect("cond signal no waiters", pthread_cond_signal(&cond) == 0 && cond.sequence == 1, cond.sequence);
+    expect("cond broadcast no waiters", pthread_cond_broadcast(&cond) == 0 && cond.sequence == 2, cond.sequence);
+    expect("mutex unlock after trylock", pthread_mutex_unlock(&mutex) == 0, -1);
+    expect("cond destroy", pthread_cond_destroy(&cond) == 0, -1);
+    expect("mutex destroy", pthread_mutex_destroy(&mutex) == 0, -1);
+
+    return failed == local_failed;
+}
+
+struct thread_counter {
+    pthread_mutex_t mutex;
+    int value;
+};
+
+static void *thread_add_one(void *arg)
+{
+    return (void *)((int)arg + 1);
+}
+
+static void *thread_count(void *arg)
+{
+    struct thread_counter *counter = arg;
+    for (int i = 0; i < 1000; i++) {
+        pthread_mutex_lock(&counter->mutex);
+        counter->value++;
+        pthread_mutex_unlock(&counter->mutex);
+    }
+    return (void *)gettid();
+}
+
+static void *thread_errno(void *arg)
+{
+    struct timespec delay = { 0, 10000000 };
+    (void)arg;
+    errno = ENOENT;
+    nanosleep(&delay, NULL);
+    return (void *)errno;
+}
+
+static int test_threads(void)
+{
+    int local_failed = failed;
+    pthread_t threads[3];
+    pthread_attr_t attr;
+    struct thread_counter counter = { PTHREAD_MUTEX_INITIALIZER, 0 };
+    void *result = NULL;
+
+    expect("gettid main thread", gettid() > 0, gettid());
+    expect("pthread_self equal", pthread_equal(pthread_self(), pthread_self()), -1);
+    expect("pthread_create", pthread_create(&threads[0], NULL, thread_add_one, (void *)41) == 0, -1);
+    expect("pthread_join result", pthread_join(threads[0], &result) == 0 && result == (void *)42, (int)result);
+    expect("pthread_join self", pthread_join(pthread_self(), NULL) == EINVAL, -1);
+
+    for (int i = 0; i < 3; i++) {
+        expect("pthread_create counter", pthread_create(&threads[i], NULL, thread_count, &counter) == 0, i);
+    }
+    for (int i = 0; i < 3; i++) {
+        result = NULL;
+        expect("pthread_join counter", pthread_join(threads[i], &result) == 0, i);
+        expect("thread own tid", (int)result > 0 && (int)result != gettid(), (int)result);
+    }
+    expect("threads share memory", counter.value == 3000, counter.value);
+
+    errno = 0;
+    expect("pthread_create errno thread", pthread_create(&threads[0], NULL, thread_errno, NULL) == 0, -1);
+    expect("errno per thread", pthread_join(threads[0], &result) == 0 && result == (void *)ENOENT && errno == 0, errno);
+
+    expect("pthread_attr_init", pthread_attr_init(&attr) == 0, -1);
+    expect("pthread_attr small stack", pthread_attr_setstacksize(&attr, 16) == EINVAL, -1);
+    expect("pthread_attr detached", pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0, -1);
+    expect("pthread_create detached", pthread_create(&threads[0], &attr, thread_add_one, NULL) == 0, -1);
+    expect("pthread_join detached", pthread_join(threads[0], NULL) == EINVAL, -1);
+    expect("pthread_attr_destroy", pthread_attr_destroy(&attr) == 0, -1);
+    expect("pthread_create then detach", pthread_create(&threads[1], NULL, thread_add_one, NULL) == 0, -1);
+    expect("pthread_detach", pthread_detach(threads[1]) == 0, -1);
+
+    return failed == local_failed;
+}
+
+/* x87 control words and MXCSR values with rounding toward zero or up,
+ * all exceptions masked. */
+#define FPU_CW_DEFAULT 0x037F
+#define FPU_CW_TRUNCATE 0x0F7F
+#define FPU_CW_ROUND_UP 0x0B7F
+#define MXCSR_DEFAULT 0x1F80
+#define MXCSR_TRUNCATE 0x7F80
+#define MXCSR_ROUND_UP 0x5F80
+
+static u16 fpu_control_word(void)
+{
+    u16 cw;
+    __asm__ volatile("fnstcw %0" : "=m"(cw));
+    return cw;
+}
+
+static void set_fpu_control_word(u16 cw)
+{
+    __asm__ volatile("fldcw %0" : : "m"(cw));
+}
+
+static u32 sse_control(void)
+{
+    u32 mxcsr;
+    __asm__ volatile("stmxcsr %0" : "=m"(mxcsr));
+    return mxcsr;
+}
+
+static void set_sse_control(u32 mxcsr)
+{
+    __asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+/* Checks that the FPU modes of `cw`/`mxcsr` are still set after sleeping
+ * while other tasks run with different ones. */
+static int fpu_modes_survive_sleep(u16 cw, u32 mxcsr)
+{
+    set_fpu_control_word(cw);
+    set_sse_control(mxcsr);
+    sleep_ms(10);
+    return fpu_control_word() == cw && sse_control() == mxcsr;
+}
+
+static void *thread_fpu_modes(void *arg)
+{
+    int inherited = fpu_control_word() == FPU_CW_TRUNCATE && sse_control() == MXCSR_TRUNCATE;
+    return (void *)(inherited && fpu_modes_survive_sleep(FPU_CW_ROUND_UP, MXCSR_ROUND_UP));
+}
+
+static int test_fpu_context(void)
+{
+    int local_failed = failed;
+    pthread_t thread;
+    void *result = NULL;
+    int status = 0;
+    volatile double third = 1.0;
+
+    third /= 3.0;
+    expect("x87 double math", third > 0.3333 && third < 0.3334, (int)(third * 10000));
+    expect("fpu default modes", fpu_control_word() == FPU_CW_DEFAULT && sse_control() == MXCSR_DEFAULT,
+           fpu_control_word());
+
+    set_fpu_control_word(FPU_CW_TRUNCATE);
+    set_sse_control(MXCSR_TRUNCATE);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int inherited = fpu_control_word() == FPU_CW_TRUNCATE && sse_control() == MXCSR_TRUNCATE;
+        _exit(inherited && fpu_modes_survive_sleep(FPU_CW_ROUND_UP, MXCSR_ROUND_UP) ? 0 : 1);
+    }
+    expect("fork fpu child", pid > 0, pid);
+
+    expect("pthread_create fpu", pthread_create(&thread, NULL, thread_fpu_modes, NULL) == 0, -1);
+    expect("fpu modes kept across switches", fpu_modes_survive_sleep(FPU_CW_TRUNCATE, MXCSR_TRUNCATE),
+           fpu_control_word());
+    expect("thread fpu modes", pthread_join(thread, &result) == 0 && result == (void *)1, (int)result);
+    if (pid > 0) {
+        expect("fork fpu modes", waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0,
+               status);
+    }
+
+    set_fpu_control_word(FPU_CW_DEFAULT);
+    set_sse_control(MXCSR_DEFAULT);
+    return failed == local_failed;
+}
+
 static int test_socket_errno(void)
 {
     int local_failed = failed;
@@ -527,7 +895,7 @@ static int test_fork_pipe_semaphore(void)
 {
     int local_failed = failed;
     int fds[2];
-    sem_t sem = -1;
+    sem_t sem;
     volatile int cow_value = 0x11112222;
     const char msg[] = "fork-sync-ok";
     char buf[32];
@@ -540,9 +908,9 @@ static int test_fork_pipe_semaphore(void)
     memset(cow_heap, 0x5a, 32);
     cow_global_value = 0x55667788;
 
-    expect("fork sem_init", sem_init(&sem, 0, 0) == 0 && sem > 0, sem);
+    expect("fork sem_init", sem_init(&sem, 1, 0) == 0 && sem.id > 0, sem.id);
     expect("fork pipe create", pipe(fds) == 0, -1);
-    if (sem <= 0 || failed != local_failed) {
+    if (failed != local_failed) {
         free(cow_heap);
         return 0;
     }
@@ -632,6 +1000,35 @@ static int test_fork_fd_state(void)
     return failed == local_failed;
 }
 
+static int test_priority(void)
+{
+    int local_failed = failed;
+
+    errno = 0;
+    expect("priority default", getpriority(PRIO_PROCESS, 0) == 0 && errno == 0, errno);
+    expect("priority set", setpriority(PRIO_PROCESS, 0, 5) == 0, errno);
+    expect("priority get", getpriority(PRIO_PROCESS, getpid()) == 5, -1);
+    expect("priority nice", nice(2) == 7, errno);
+    expect("priority clamp", setpriority(PRIO_PROCESS, 0, 100) == 0 && getpriority(PRIO_PROCESS, 0) == 19, -1);
+    expect("priority which", setpriority(PRIO_PROCESS + 1, 0, 0) == -1 && errno == EINVAL, errno);
+    expect("priority missing pid", getpriority(PRIO_PROCESS, 0x7fff) == -1 && errno == ESRCH, errno);
+
+    pid_t pid = fork();
+    expect("priority fork", pid >= 0, pid);
+    if (pid == 0) {
+        _exit(getpriority(PRIO_PROCESS, 0) == 19 ? 0 : 53);
+    }
+    if (pid > 0) {
+        int status = -1;
+        pid_t waited = waitpid(pid, &status, 0);
+        expect("priority inherited", waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0, status);
+    }
+
+    expect("priority restore", setpriority(PRIO_PROCESS, 0, 0) == 0, errno);
+
+    return failed == local_failed;
+}
+
 static int test_waitpid_zombie_reparent(void)
 {
     int local_failed = failed;
@@ -882,6 +1279,76 @@ static int test_time_syscalls(void)
     return failed == local_failed;
 }
 
+static void burn_cpu_ms(u32 duration_ms)
+{
+    struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (timespec_to_ms(&now) - timespec_to_ms(&start) < duration_ms);
+}
+
+static int rusage_ms(const struct rusage *usage)
+{
+    return usage->ru_utime.tv_sec * 1000 + usage->ru_utime.tv_usec / 1000 + usage->ru_stime.tv_sec * 1000 + usage->ru_stime.tv_usec / 1000;
+}
+
+static int test_cpu_accounting(void)
+{
+    int local_failed = failed;
+    static char buf[4096];
+    struct rusage before;
+    struct rusage after;
+    struct tms tms;
+    int status = 0;
+
+    expect("getrusage self", getrusage(RUSAGE_SELF, &before) == 0, errno);
+    burn_cpu_ms(30);
+    sleep_ms(5);
+    expect("getrusage self again", getrusage(RUSAGE_SELF, &after) == 0, errno);
+
+    expect("cpu time charged", rusage_ms(&after) - rusage_ms(&before) >= 20, rusage_ms(&after) - rusage_ms(&before));
+    expect("voluntary switch counted", after.ru_nvcsw > before.ru_nvcsw, after.ru_nvcsw);
+    expect("getrusage thread", getrusage(RUSAGE_THREAD, &after) == 0, errno);
+    errno = 0;
+    expect("getrusage invalid who", getrusage(5, &after) == -1 && errno == EINVAL, errno);
+    errno = 0;
+    expect("getrusage bad pointer", getrusage(RUSAGE_SELF, NULL) == -1 && errno == EFAULT, errno);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        burn_cpu_ms(30);
+        _exit(0);
+    }
+    expect("fork cpu child", pid > 0, pid);
+    if (pid > 0) {
+        expect("wait cpu child", waitpid(pid, &status, 0) == pid, errno);
+        expect("times", times(&tms) > 0, errno);
+        expect("times children", tms.tms_cutime + tms.tms_cstime >= 20 * CLK_TCK / 1000, tms.tms_cutime + tms.tms_cstime);
+        expect("getrusage children", getrusage(RUSAGE_CHILDREN, &after) == 0 && rusage_ms(&after) >= 20, rusage_ms(&after));
+    }
+
+    int fd = open("/dev/top", O_RDONLY, 0);
+    expect("open /dev/top", fd >= 0, fd);
+    if (fd >= 0) {
+        int len = read_all(fd, buf, sizeof(buf) - 1);
+        expect("top lists selftest", buffer_contains(buf, len, "selftest"), len);
+        expect("top has header", buffer_contains(buf, len, "IVCSW"), len);
+        expect("close /dev/top", close(fd) == 0, -1);
+    }
+
+    fd = open("/dev/ps", O_RDONLY, 0);
+    expect("open /dev/ps", fd >= 0, fd);
+    if (fd >= 0) {
+        int len = read_all(fd, buf, sizeof(buf) - 1);
+        expect("ps lists selftest", buffer_contains(buf, len, "selftest"), len);
+        expect("close /dev/ps", close(fd) == 0, -1);
+    }
+
+    return failed == local_failed;
+}
+
 static int wait_for_dhcp_bound(struct network_info *info)
 {
     for (int i = 0; i < 5000; i++) {
@@ -894,6 +1361,203 @@ static int wait_for_dhcp_bound(struct network_info *info)
     return 0;
 }
 
+/* Neither is touched by the program before the syscalls below, so the kernel
+ * has to fault their pages in itself. */
+static const char lazy_rodata_message[] = "demand-paged rodata";
+static char lazy_bss_buffer[3 * 4096];
+
+static int test_demand_paging(void)
+{
+    int local_failed = failed;
+    int fds[2];
+
+    expect("demand paging pipe", pipe(fds) == 0, -1);
+    if (failed != local_failed) {
+        return 0;
+    }
+
+    ssize_t len = sizeof(lazy_rodata_message) - 1;
+    char *target = &lazy_bss_buffer[2 * 4096 - 4];
+    expect("demand paging write from rodata", write(fds[1], lazy_rodata_message, len) == len, -1);
+    expect("demand paging read into bss", read(fds[0], target, len) == len, -1);
+    expect("demand paging copied", memcmp(target, lazy_rodata_message, len) == 0, -1);
+    close(fds[0]);
+    close(fds[1]);
+
+    int zeroed = 1;
+    for (int i = 0; i < (int)sizeof(lazy_bss_buffer); i += 512) {
+        if ((i < 2 * 4096 - 4 || i >= 2 * 4096 - 4 + len) && lazy_bss_buffer[i] != 0) {
+            zeroed = 0;
+        }
+    }
+    expect("demand paging bss zeroed", zeroed, -1);
+
+    // Pages not yet touched are still read from the running image.
+    expect("write running image", open("/bin/selftest.elf", O_WRONLY, 0) == -1 && errno == ETXTBSY, errno);
+    expect("unlink running image", unlink("/bin/selftest.elf") == -1 && errno == ETXTBSY, errno);
+
+    return failed == local_failed;
+}
+
+/* Uses about `depth` KiB of stack. */
+static int deep_recursion(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = (char)depth;
+    frame[sizeof(frame) - 1] = (char)depth;
+    if (depth == 0) {
+        return frame[0];
+    }
+    return deep_recursion(depth - 1) + frame[sizeof(frame) - 1] - (char)depth + 1;
+}
+
+static int test_stack_growth(void)
+{
+    int local_failed = failed;
+    struct rlimit limit;
+
+    expect("getrlimit stack", getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur >= 1024 * 1024 &&
+                                  limit.rlim_max >= limit.rlim_cur,
+           errno);
+    /* Far past the 16 KiB stack programs used to get. */
+    expect("deep recursion", deep_recursion(512) == 512, -1);
+
+    struct rlimit invalid = { limit.rlim_max, limit.rlim_cur - 1 };
+    errno = 0;
+    expect("setrlimit cur above max", setrlimit(RLIMIT_STACK, &invalid) == -1 && errno == EINVAL, errno);
+    errno = 0;
+    expect("getrlimit other resource", getrlimit(0, &limit) == -1 && errno == EINVAL, errno);
+
+    pid_t pid = fork();
+    expect("stack limit fork", pid >= 0, pid);
+    if (pid == 0) {
+        struct rlimit small = { 64 * 1024, limit.rlim_max };
+        if (setrlimit(RLIMIT_STACK, &small) != 0) {
+            _exit(2);
+        }
+        deep_recursion(256);
+        _exit(0);
+    }
+    if (pid > 0) {
+        int status = -1;
+        expect("stack limit fault", waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 1,
+               status);
+    }
+
+    return failed == local_failed;
+}
+
+#define SPAWN_CHILD_MESSAGE "spawned\n"
+
+static int wait_exit_zero(pid_t pid)
+{
+    int status = -1;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int test_posix_spawn(void)
+{
+    int local_failed = failed;
+    char *child_args[] = { "selftest.elf", "spawn-child", NULL };
+    posix_spawn_file_actions_t actions;
+    pid_t pid = -1;
+    char buf[32];
+    int fds[2];
+
+    expect("spawn pipe", pipe(fds) == 0, -1);
+    if (failed != local_failed) {
+        return 0;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    int result = posix_spawn(&pid, "/bin/selftest.elf", &actions, NULL, child_args, NULL);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    expect("posix_spawn dup2", result == 0 && pid > 0, result);
+    if (result == 0) {
+        memset(buf, 0, sizeof(buf));
+        ssize_t len = read(fds[0], buf, sizeof(buf) - 1);
+        expect("posix_spawn pipe output", len == (ssize_t)strlen(SPAWN_CHILD_MESSAGE) &&
+                                              memcmp(buf, SPAWN_CHILD_MESSAGE, strlen(SPAWN_CHILD_MESSAGE)) == 0,
+               (int)len);
+        expect("posix_spawn wait", wait_exit_zero(pid), pid);
+    }
+    close(fds[0]);
+
+    const char path[] = "/tmp/selftest-spawn.txt";
+    unlink(path);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    result = posix_spawn(&pid, "/bin/selftest.elf", &actions, NULL, child_args, NULL);
+    posix_spawn_file_actions_destroy(&actions);
+    expect("posix_spawn open", result == 0 && wait_exit_zero(pid), result);
+    int fd = open(path, O_RDONLY, 0);
+    memset(buf, 0, sizeof(buf));
+    expect("posix_spawn file output", fd >= 0 && read(fd, buf, sizeof(buf) - 1) > 0 &&
+                                          memcmp(buf, SPAWN_CHILD_MESSAGE, strlen(SPAWN_CHILD_MESSAGE)) == 0,
+           fd);
+    close(fd);
+    unlink(path);
+
+    expect("posix_spawn missing", posix_spawn(&pid, "/bin/selftest-missing.elf", NULL, NULL, child_args, NULL) == ENOENT,
+           -1);
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    result = posix_spawnp(&pid, "selftest", &actions, NULL, child_args, NULL);
+    posix_spawn_file_actions_destroy(&actions);
+    expect("posix_spawnp path search", result == 0 && wait_exit_zero(pid), result);
+
+    return failed == local_failed;
+}
+
+/* /bin/read.elf links against libpolyos.so, so it only runs if the kernel
+ * loaded and relocated the library at exec. */
+static int test_shared_library(void)
+{
+    int local_failed = failed;
+    const char path[] = "/tmp/selftest-shared.txt";
+    const char expected[] = "File content: shared";
+    char *child_args[] = { "read.elf", (char *)path, NULL };
+    posix_spawn_file_actions_t actions;
+    pid_t pid = -1;
+    char buf[64];
+    int fds[2];
+
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    expect("shared library fixture", fd >= 0 && write(fd, "shared", 7) == 7, fd);
+    close(fd);
+    expect("shared library pipe", pipe(fds) == 0, -1);
+    if (failed != local_failed) {
+        unlink(path);
+        return 0;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    int result = posix_spawn(&pid, "/bin/read.elf", &actions, NULL, child_args, NULL);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    expect("shared library spawn", result == 0 && pid > 0, result);
+    if (result == 0) {
+        memset(buf, 0, sizeof(buf));
+        ssize_t len = read(fds[0], buf, sizeof(buf) - 1);
+        expect("shared library output", len >= (ssize_t)strlen(expected) &&
+                                            memcmp(buf, expected, strlen(expected)) == 0,
+               (int)len);
+        expect("shared library exit", wait_exit_zero(pid), pid);
+    }
+    close(fds[0]);
+    unlink(path);
+
+    return failed == local_failed;
+}
+
 static int test_environment(void)
 {
     int local_failed = failed;
@@ -946,24 +1610,46 @@ static int wants_network(int argc, char **argv)
     return argc > 1 && strncmp(argv[1], "net", 4) == 0;
 }
 
+static int is_spawn_child(int argc, char **argv)
+{
+    return argc > 1 && strncmp(argv[1], "spawn-child", 12) == 0;
+}
+
 int main(int argc, char **argv)
 {
+    if (is_spawn_child(argc, argv)) {
+        write(STDOUT_FILENO, SPAWN_CHILD_MESSAGE, strlen(SPAWN_CHILD_MESSAGE));
+        return 0;
+    }
+
     printf("selftest: start\n");
 
     expect("kernel selftest", kernel_selftest() == 0, -1);
     test_memory_and_sleep();
     test_time_syscalls();
+    test_cpu_accounting();
     test_devices();
+    test_syscall_trace();
+    test_block_cache();
+    test_ram_disk();
     test_file_io();
     test_unix_errno_dup_and_cwd();
     test_pipe();
     test_semaphore_basic();
+    test_futex_sync();
+    test_threads();
+    test_fpu_context();
     test_socket_errno();
     test_fork_pipe_semaphore();
     test_fork_fd_state();
+    test_priority();
     test_waitpid_zombie_reparent();
     test_signals();
     test_environment();
+    test_demand_paging();
+    test_stack_growth();
+    test_posix_spawn();
+    test_shared_library();
 
     if (wants_network(argc, argv)) {
         test_network();
@@ -6,6 +6,9 @@ use core::ffi::c_void;
 use bindings::{clear_screen, malloc, print_memory, reboot};
 use polyos_std::*;
 
+/// Screens `top` shows when no count is given.
+const TOP_DEFAULT_REFRESHES: u32 = 5;
+
 #[polyos_std::main]
 fn main() {
     let mut buffer = [0u8; 1024];
@@ -208,14 +211,14 @@ fn run_simple_command(command: &ParsedCommand, env: &mut ShellEnv) -> bool {
 }
 
 fn run_external_command(command: &ParsedCommand, env: &ShellEnv) -> i32 {
-    let pid = process::fork();
-    if pid < 0 {
-        return -1;
-    }
+    let path = match find_executable(command, env) {
+        Ok(path) => path,
+        Err(status) => return status,
+    };
 
-    if pid == 0 {
-        exec_search(command, env);
-    }
+    let Ok(pid) = process::spawn(path.as_str(), &command.args, &env.as_strs(), &[]) else {
+        return -1;
+    };
 
     let mut status = 0;
     if process::waitpid(pid, &mut status, 0) < 0 {
@@ -225,6 +228,19 @@ fn run_external_command(command: &ParsedCommand, env: &ShellEnv) -> i32 {
     (status >> 8) & 0xff
 }
 
+/// Commands `run_builtin` handles itself.
+const BUILTINS: &[&str] = &[
+    "help", "pwd", "id", "cd", "ls", "cat", "touch", "cp", "mv", "mkdir", "rmdir", "rm", "stat",
+    "chmod", "echo", "env", "export", "memory", "exit", "malloc", "clear", "ps", "top", "winsize",
+    "devtest", "net", "dhcp", "ping", "dns", "reboot", "shutdown",
+];
+
+fn is_builtin(command: &ParsedCommand) -> bool {
+    command
+        .command()
+        .is_some_and(|name| BUILTINS.contains(&name))
+}
+
 fn run_builtin(command: &ParsedCommand, env: &mut ShellEnv) -> Option<BuiltinResult> {
     let name = command.command()?;
     let args = &command.args[1..];
@@ -311,6 +327,14 @@ fn run_builtin(command: &ParsedCommand, env: &mut ShellEnv) -> Option<BuiltinRes
             unsafe { clear_screen() };
             Some(BuiltinResult::Continue(0))
         }
+        "ps" => {
+            cat_file("/dev/ps");
+            Some(BuiltinResult::Continue(0))
+        }
+        "top" => {
+            top_command(args);
+            Some(BuiltinResult::Continue(0))
+        }
         "winsize" => {
             print_winsize();
             Some(BuiltinResult::Continue(0))
@@ -381,8 +405,14 @@ fn run_pipeline(commands: &[ParsedCommand], env: &ShellEnv) -> Result<(), &'stat
             Some(io::pipe().map_err(|_| "pipe failed")?)
         };
 
-        let pid = process::fork();
-        if pid < 0 {
+        // External commands start straight from their file; only builtins
+        // need a copy of the shell to run in.
+        let pid = if is_builtin(command) {
+            process::fork()
+        } else {
+            spawn_stage(command, env, previous_read, pipe)
+        };
+        if pid < 0 && is_builtin(command) {
             close_if_open(previous_read);
             if let Some((read_fd, write_fd)) = pipe {
                 close_if_open(read_fd);
@@ -412,18 +442,16 @@ fn run_pipeline(commands: &[ParsedCommand], env: &ShellEnv) -> Result<(), &'stat
             }
 
             let mut child_env = env.clone();
-            if let Some(result) = run_builtin(command, &mut child_env) {
-                let status = match result {
-                    BuiltinResult::Continue(status) => status,
-                    BuiltinResult::Exit => 0,
-                };
-                process::exit(status);
-            }
-
-            exec_search(command, env);
+            let status = match run_builtin(command, &mut child_env) {
+                Some(BuiltinResult::Continue(status)) => status,
+                Some(BuiltinResult::Exit) | None => 0,
+            };
+            process::exit(status);
         }
 
-        pids.push(pid);
+        if pid > 0 {
+            pids.push(pid);
+        }
         close_if_open(previous_read);
         if let Some((read_fd, write_fd)) = pipe {
             close_if_open(write_fd);
@@ -443,6 +471,92 @@ fn run_pipeline(commands: &[ParsedCommand], env: &ShellEnv) -> Result<(), &'stat
     Ok(())
 }
 
+/// Starts the external `command` of a pipeline stage reading `previous_read`
+/// and writing `pipe`, with its redirections applied on top. Returns the pid,
+/// or -1 once the error is reported.
+fn spawn_stage(
+    command: &ParsedCommand,
+    env: &ShellEnv,
+    previous_read: i32,
+    pipe: Option<(i32, i32)>,
+) -> i32 {
+    let (stdin_fd, stdout_fd) = match open_redirections(command) {
+        Ok(fds) => fds,
+        Err(error) => {
+            print_redirection_error(&error);
+            return -1;
+        }
+    };
+
+    let pid = match find_executable(command, env) {
+        Ok(path) => {
+            let (pipe_read, pipe_write) = pipe.unwrap_or((-1, -1));
+            let input = if stdin_fd >= 0 {
+                stdin_fd
+            } else {
+                previous_read
+            };
+            let output = if stdout_fd >= 0 {
+                stdout_fd
+            } else {
+                pipe_write
+            };
+
+            let mut actions = Vec::new();
+            if input >= 0 {
+                actions.push(process::SpawnAction::Dup2 {
+                    from: input,
+                    to: bindings::STDIN_FILENO as i32,
+                });
+            }
+            if output >= 0 {
+                actions.push(process::SpawnAction::Dup2 {
+                    from: output,
+                    to: bindings::STDOUT_FILENO as i32,
+                });
+            }
+            for fd in [previous_read, pipe_read, pipe_write, stdin_fd, stdout_fd] {
+                if fd > bindings::STDERR_FILENO as i32 {
+                    actions.push(process::SpawnAction::Close(fd));
+                }
+            }
+
+            process::spawn(path.as_str(), &command.args, &env.as_strs(), &actions).unwrap_or(-1)
+        }
+        Err(_) => -1,
+    };
+
+    close_if_open(stdin_fd);
+    close_if_open(stdout_fd);
+    pid
+}
+
+/// Opens the redirection files of `command`; -1 for a missing redirection.
+fn open_redirections<'a>(command: &ParsedCommand<'a>) -> Result<(i32, i32), RedirectionError<'a>> {
+    let stdin_fd = match command.stdin {
+        Some(path) => {
+            fs::open(path, fs::O_RDONLY, 0).map_err(|error| RedirectionError { path, error })?
+        }
+        None => -1,
+    };
+
+    let stdout_fd = match command.stdout {
+        Some(stdout) => {
+            let (path, flags) = redirect_target(stdout);
+            match fs::open(path, flags, 0) {
+                Ok(fd) => fd,
+                Err(error) => {
+                    close_if_open(stdin_fd);
+                    return Err(RedirectionError { path, error });
+                }
+            }
+        }
+        None => -1,
+    };
+
+    Ok((stdin_fd, stdout_fd))
+}
+
 fn apply_redirections<'a>(command: &ParsedCommand<'a>) -> Result<(), RedirectionError<'a>> {
     if let Some(path) = command.stdin {
         let fd =
@@ -455,11 +569,7 @@ fn apply_redirections<'a>(command: &ParsedCommand<'a>) -> Result<(), Redirection
     }
 
     if let Some(stdout) = command.stdout {
-        let (path, flags) = match stdout {
-            Redirect::Truncate(path) => (path, fs::O_CREAT | fs::O_WRONLY | fs::O_TRUNC),
-            Redirect::Append(path) => (path, fs::O_CREAT | fs::O_WRONLY | fs::O_APPEND),
-        };
-
+        let (path, flags) = redirect_target(stdout);
         let fd = fs::open(path, flags, 0).map_err(|error| RedirectionError { path, error })?;
         io::dup2(fd, bindings::STDOUT_FILENO as i32).map_err(|_| RedirectionError {
             path,
@@ -471,54 +581,46 @@ fn apply_redirections<'a>(command: &ParsedCommand<'a>) -> Result<(), Redirection
     Ok(())
 }
 
-fn exec_search(command: &ParsedCommand, env: &ShellEnv) -> ! {
+/// Path and open flags of an output redirection.
+fn redirect_target<'a>(stdout: Redirect<'a>) -> (&'a str, i32) {
+    match stdout {
+        Redirect::Truncate(path) => (path, fs::O_CREAT | fs::O_WRONLY | fs::O_TRUNC),
+        Redirect::Append(path) => (path, fs::O_CREAT | fs::O_WRONLY | fs::O_APPEND),
+    }
+}
+
+/// Path of the program `command` runs, searched in `PATH` as itself and
+/// with the `.elf` extension when it has no slash. Otherwise the exit status
+/// the command gets: 126 once the denial is reported, or 127.
+fn find_executable(command: &ParsedCommand, env: &ShellEnv) -> Result<String, i32> {
     let Some(name) = command.command() else {
-        process::exit(127);
+        return Err(127);
     };
 
-    let env_entries = env.as_strs();
+    let mut candidates = Vec::new();
     if name.contains('/') {
-        match executable_status(name) {
-            ExecutableStatus::Executable => {
-                process::execve_with_env(name, &command.args, &env_entries);
-            }
-            ExecutableStatus::PermissionDenied => {
-                println!("{}: Permission denied", name);
-                process::exit(126);
-            }
-            _ => {}
-        }
+        candidates.push(String::from(name));
     } else {
-        let path = env.get("PATH").unwrap_or("/bin");
-        for directory in path.split(':') {
+        for directory in env.get("PATH").unwrap_or("/bin").split(':') {
             let directory = if directory.is_empty() { "." } else { directory };
             let path = join_path(directory, name);
-            match executable_status(path.as_str()) {
-                ExecutableStatus::Executable => {
-                    process::execve_with_env(path.as_str(), &command.args, &env_entries);
-                }
-                ExecutableStatus::PermissionDenied => {
-                    println!("{}: Permission denied", path);
-                    process::exit(126);
-                }
-                _ => {}
-            }
+            candidates.push(path.clone());
+            candidates.push(format!("{}.elf", path));
+        }
+    }
 
-            let path = format!("{}.elf", path);
-            match executable_status(path.as_str()) {
-                ExecutableStatus::Executable => {
-                    process::execve_with_env(path.as_str(), &command.args, &env_entries);
-                }
-                ExecutableStatus::PermissionDenied => {
-                    println!("{}: Permission denied", path);
-                    process::exit(126);
-                }
-                _ => {}
+    for path in candidates {
+        match executable_status(path.as_str()) {
+            ExecutableStatus::Executable => return Ok(path),
+            ExecutableStatus::PermissionDenied => {
+                println!("{}: Permission denied", path);
+                return Err(126);
             }
+            _ => {}
         }
     }
 
-    process::exit(127);
+    Err(127)
 }
 
 enum ExecutableStatus {
@@ -574,6 +676,8 @@ fn print_help() {
     println!("  env           print environment");
     println!("  export A=B    set environment variable");
     println!("  clear         clear screen");
+    println!("  ps            list tasks with their CPU time");
+    println!("  top [count]   show tasks by CPU use, refreshed every second");
     println!("  memory winsize devtest net dhcp ping dns reboot shutdown exit");
 }
 
@@ -842,6 +946,27 @@ fn cat_fd(fd: i32, label: &str) {
     }
 }
 
+fn top_command(args: &[&str]) {
+    let refreshes = match args.first() {
+        Some(arg) => match arg.parse::<u32>() {
+            Ok(count) if count > 0 => count,
+            _ => {
+                println!("Usage: top [count]");
+                return;
+            }
+        },
+        None => TOP_DEFAULT_REFRESHES,
+    };
+
+    for refresh in 0..refreshes {
+        if refresh > 0 {
+            unsafe { bindings::sleep(1) };
+        }
+        unsafe { clear_screen() };
+        cat_file("/dev/top");
+    }
+}
+
 fn touch_files(paths: &[&str]) {
     if paths.is_empty() {
         println!("Usage: touch <file>...");
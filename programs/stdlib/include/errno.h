@@ -1,18 +1,23 @@
 #ifndef POLYOS_ERRNO_H
 #define POLYOS_ERRNO_H
 
-extern int errno;
+/* Each thread has its own errno. */
+int *__errno_location(void);
+#define errno (*__errno_location())
 
 #define EPERM 1
 #define ENOENT 2
 #define ESRCH 3
+#define EINTR 4
 #define EIO 5
+#define ENOEXEC 8
 #define EBADF 9
 #define ECHILD 10
 #define EAGAIN 11
 #define ENOMEM 12
 #define EACCES 13
 #define EFAULT 14
+#define EBUSY 16
 #define EEXIST 17
 #define ENODEV 19
 #define ENOTDIR 20
@@ -20,12 +25,15 @@ extern int errno;
 #define EINVAL 22
 #define EMFILE 24
 #define ENOTTY 25
+#define ETXTBSY 26
 #define EPIPE 32
+#define EDEADLK 35
 #define ENOSYS 38
 #define ENOTEMPTY 39
 #define EMSGSIZE 90
 #define ENOTSUP 95
 #define ENETDOWN 100
 #define ENOTCONN 107
+#define ETIMEDOUT 110
 
 #endif
@@ -30,6 +30,13 @@ struct network_info {
 #define SOL_SOCKET 1
 #define SO_REUSEADDR 2
 #define WNOHANG 1
+#define PRIO_PROCESS 0
+#define POSIX_FADV_NORMAL 0
+#define POSIX_FADV_RANDOM 1
+#define POSIX_FADV_SEQUENTIAL 2
+#define POSIX_FADV_WILLNEED 3
+#define POSIX_FADV_DONTNEED 4
+#define POSIX_FADV_NOREUSE 5
 #define WIFEXITED(status) (((status) & 0x7f) == 0)
 #define WEXITSTATUS(status) (((status) >> 8) & 0xff)
 #define WIFSIGNALED(status) ((((status) & 0x7f) != 0) && (((status) & 0x7f) != 0x7f))
@@ -62,7 +69,72 @@ struct network_info {
 typedef u32 socklen_t;
 typedef u32 sigset_t;
 typedef void (*sighandler_t)(int);
-typedef int sem_t;
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_PRIVATE_FLAG 128
+
+/* Process-private semaphores live in `value`/`waiters` and only enter the
+ * kernel on contention. Process-shared ones (pshared != 0) are backed by the
+ * kernel semaphore `id`, so they keep working across fork. */
+typedef struct {
+    volatile int value;
+    volatile int waiters;
+    int id;
+} sem_t;
+
+/* 0 unlocked, 1 locked, 2 locked with tasks parked on the futex. */
+typedef struct {
+    volatile int state;
+} pthread_mutex_t;
+
+typedef struct {
+    volatile int sequence;
+    volatile int waiters;
+} pthread_cond_t;
+
+typedef int pthread_mutexattr_t;
+typedef int pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER { 0 }
+#define PTHREAD_COND_INITIALIZER { 0, 0 }
+
+/* Threads share the address space, descriptors and signal handlers of their
+ * process. Exiting the main thread, or calling exit() from any thread, ends
+ * the whole process. */
+typedef struct pthread *pthread_t;
+
+#define PTHREAD_CREATE_JOINABLE 0
+#define PTHREAD_CREATE_DETACHED 1
+
+typedef struct {
+    size_t stack_size;
+    int detach_state;
+} pthread_attr_t;
+
+/* posix_spawn starts a program in a new child without copying the caller's
+ * address space first, as fork followed by execve would. File actions run in
+ * the child, in the order they were added, before the program starts. */
+#define POSIX_SPAWN_MAX_ACTIONS 16
+
+struct polyos_spawn_action {
+    int kind;
+    int fd;
+    int source_fd;
+    int flags;
+    unsigned int mode;
+    const char *path;
+};
+
+typedef struct {
+    int count;
+    struct polyos_spawn_action actions[POSIX_SPAWN_MAX_ACTIONS];
+} posix_spawn_file_actions_t;
+
+/* No spawn attributes are supported yet; `flags` must stay 0. */
+typedef struct {
+    int flags;
+} posix_spawnattr_t;
 
 struct sigaction {
     sighandler_t sa_handler;
@@ -93,6 +165,11 @@ int open(const char *pathname, int flags, int mode);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, const void *buf, size_t count);
 off_t lseek(int fd, off_t offset, int whence);
+ssize_t readahead(int fd, off_t offset, size_t count);
+int posix_fadvise(int fd, off_t offset, off_t len, int advice);
+int fsync(int fd);
+int fdatasync(int fd);
+void sync(void);
 int stat(const char *pathname, struct file_stat *stat);
 int lstat(const char *pathname, struct file_stat *stat);
 int ioctl(int fd, unsigned long request, unsigned long arg);
@@ -112,26 +189,68 @@ int chdir(const char *pathname);
 int chown(const char *pathname, unsigned int uid, unsigned int gid);
 char *getcwd(char *buf, size_t size);
 int getdents(int fd, struct dirent *dirp, size_t count);
+int futex(volatile int *uaddr, int op, int val, const struct timespec *timeout);
 int sem_init(sem_t *sem, int pshared, unsigned int value);
 int sem_wait(sem_t *sem);
+int sem_trywait(sem_t *sem);
 int sem_post(sem_t *sem);
 int sem_destroy(sem_t *sem);
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
+int pthread_cond_destroy(pthread_cond_t *cond);
+int pthread_attr_init(pthread_attr_t *attr);
+int pthread_attr_destroy(pthread_attr_t *attr);
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stack_size);
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int detach_state);
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);
+int pthread_join(pthread_t thread, void **result);
+int pthread_detach(pthread_t thread);
+void pthread_exit(void *result) __attribute__((noreturn));
+pthread_t pthread_self(void);
+int pthread_equal(pthread_t a, pthread_t b);
 int kernel_selftest();
 int execve(const char *pathname, char *const argv[], char *const envp[]);
 pid_t fork();
 pid_t waitpid(pid_t pid, int *status, int options);
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attr, char *const argv[], char *const envp[]);
+int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+                 const posix_spawnattr_t *attr, char *const argv[], char *const envp[]);
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd);
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int new_fd);
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int fd, const char *path, int flags,
+                                     int mode);
+int posix_spawnattr_init(posix_spawnattr_t *attr);
+int posix_spawnattr_destroy(posix_spawnattr_t *attr);
 pid_t getpid();
+pid_t gettid();
 pid_t getppid();
 uid_t getuid();
 gid_t getgid();
 uid_t geteuid();
 gid_t getegid();
 int kill(pid_t pid, int sig);
+int nice(int inc);
+int getpriority(int which, int who);
+int setpriority(int which, int who, int prio);
+int getrlimit(int resource, struct rlimit *rlim);
+int setrlimit(int resource, const struct rlimit *rlim);
 int sigaction(int signum, const struct sigaction *act, struct sigaction *oldact);
 sighandler_t signal(int signum, sighandler_t handler);
 int nanosleep(const struct timespec *req, struct timespec *rem);
 int gettimeofday(struct timeval *tv, struct timezone *tz);
 int clock_gettime(clockid_t clockid, struct timespec *tp);
+clock_t times(struct tms *buf);
+int getrusage(int who, struct rusage *usage);
 unsigned int sleep(unsigned int seconds);
 void _exit(int code) __attribute__((noreturn));
 void exit(int code) __attribute__((noreturn));
@@ -30,6 +30,7 @@ typedef u32 uintptr_t;
 typedef s32 time_t;
 typedef s32 suseconds_t;
 typedef s32 clockid_t;
+typedef s32 clock_t;
 
 #define CLOCK_REALTIME 0
 #define CLOCK_MONOTONIC 1
@@ -52,6 +53,54 @@ struct timezone
     s32 tz_dsttime;
 };
 
+/* Clock ticks per second of times() and clock_t values. */
+#define CLK_TCK 1000
+
+struct tms
+{
+    clock_t tms_utime;
+    clock_t tms_stime;
+    clock_t tms_cutime;
+    clock_t tms_cstime;
+};
+
+/* Stack size of the main thread; the only limit PolyOS keeps. Values above
+ * the 8 MiB the stack can grow to are capped to it. */
+#define RLIMIT_STACK 3
+#define RLIM_INFINITY ((rlim_t)-1)
+
+typedef u32 rlim_t;
+
+struct rlimit
+{
+    rlim_t rlim_cur;
+    rlim_t rlim_max;
+};
+
+#define RUSAGE_SELF 0
+#define RUSAGE_CHILDREN (-1)
+#define RUSAGE_THREAD 1
+
+struct rusage
+{
+    struct timeval ru_utime;
+    struct timeval ru_stime;
+    s32 ru_maxrss;
+    s32 ru_ixrss;
+    s32 ru_idrss;
+    s32 ru_isrss;
+    s32 ru_minflt;
+    s32 ru_majflt;
+    s32 ru_nswap;
+    s32 ru_inblock;
+    s32 ru_oublock;
+    s32 ru_msgsnd;
+    s32 ru_msgrcv;
+    s32 ru_nsignals;
+    s32 ru_nvcsw;
+    s32 ru_nivcsw;
+};
+
 #define F_DUPFD 0
 #define F_GETFD 1
 #define F_SETFD 2
@@ -1,3 +0,0 @@
-#include "errno.h"
-
-int errno = 0;
@@ -14,11 +14,14 @@
 %define SYS_LSEEK 19
 %define SYS_GETPID 20
 %define SYS_GETUID 24
+%define SYS_NICE 34
+%define SYS_SYNC 36
 %define SYS_KILL 37
 %define SYS_MKDIR 39
 %define SYS_RMDIR 40
 %define SYS_DUP 41
 %define SYS_PIPE 42
+%define SYS_TIMES 43
 %define SYS_BRK 45
 %define SYS_GETGID 47
 %define SYS_GETEUID 49
@@ -29,17 +32,31 @@
 %define SYS_DUP2 63
 %define SYS_GETPPID 64
 %define SYS_SIGACTION 67
+%define SYS_SETRLIMIT 75
+%define SYS_GETRLIMIT 76
+%define SYS_GETRUSAGE 77
 %define SYS_GETTIMEOFDAY 78
 %define SYS_REBOOT 88
+%define SYS_GETPRIORITY 96
+%define SYS_SETPRIORITY 97
 %define SYS_SOCKETCALL 102
 %define SYS_STAT 106
 %define SYS_LSTAT 107
 %define SYS_FSTAT 108
+%define SYS_FSYNC 118
 %define SYS_SIGRETURN 119
+%define SYS_CLONE 120
 %define SYS_GETDENTS 141
+%define SYS_FDATASYNC 148
 %define SYS_NANOSLEEP 162
 %define SYS_CHOWN 182
 %define SYS_GETCWD 183
+%define SYS_GETTID 224
+%define SYS_READAHEAD 225
+%define SYS_FUTEX 240
+%define SYS_SET_THREAD_AREA 243
+%define SYS_FADVISE64 250
+%define SYS_EXIT_GROUP 252
 %define SYS_CLOCK_GETTIME 265
 
 %define POLYOS_SYS_PRINT_MEMORY 503
@@ -50,6 +67,7 @@
 %define POLYOS_SYS_NETWORK_DNS_QUERY 524
 %define POLYOS_SYS_NETWORK_PING_NAME 525
 %define POLYOS_SYS_RECVFROM_WAIT 529
+%define POLYOS_SYS_SPAWN 540
 %define POLYOS_SYS_SEM_CREATE 560
 %define POLYOS_SYS_SEM_WAIT 561
 %define POLYOS_SYS_SEM_SIGNAL 562
@@ -60,15 +78,28 @@ section .asm
 
 global __sys_execve:function
 global __sys_fork:function
+global __sys_spawn:function
 global __sys_waitpid:function
 global __sys_nanosleep:function
+global __sys_futex:function
+global __polyos_clone:function
+global __polyos_thread_exit:function
+global __sys_set_thread_area:function
 global __sys_gettimeofday:function
 global __sys_clock_gettime:function
+global __sys_times:function
+global __sys_getrusage:function
 global __sys_socketcall:function
 global __sys_kill:function
+global __sys_nice:function
+global __sys_getpriority:function
+global __sys_setpriority:function
+global __sys_getrlimit:function
+global __sys_setrlimit:function
 global __sys_sigaction:function
 global __polyos_signal_trampoline:function
 global getpid:function
+global gettid:function
 global getuid:function
 global getppid:function
 global getgid:function
@@ -92,6 +123,11 @@ global __sys_open:function
 global __sys_read:function
 global __sys_write:function
 global __sys_lseek:function
+global __sys_readahead:function
+global __sys_fadvise64:function
+global __sys_fsync:function
+global __sys_fdatasync:function
+global sync:function
 global __sys_stat:function
 global __sys_lstat:function
 global __sys_fstat:function
@@ -138,6 +174,21 @@ __sys_fork:
     pop ebp
     ret
 
+; int __sys_spawn(const char *path, char *const argv[], char *const envp[], const struct polyos_spawn_action *actions, int action_count)
+__sys_spawn:
+    push ebp
+    mov ebp, esp
+    mov eax, POLYOS_SYS_SPAWN
+    push dword [ebp+24] ; action_count
+    push dword [ebp+20] ; actions
+    push dword [ebp+16] ; envp
+    push dword [ebp+12] ; argv
+    push dword [ebp+8] ; path
+    int 0x80
+    add esp, 20
+    pop ebp
+    ret
+
 ; int __sys_kill(int pid, int sig)
 __sys_kill:
     push ebp
@@ -150,6 +201,66 @@ __sys_kill:
     pop ebp
     ret
 
+; int __sys_nice(int inc)
+__sys_nice:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_NICE
+    push dword [ebp+8] ; inc
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
+; int __sys_getpriority(int which, int who)
+__sys_getpriority:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_GETPRIORITY
+    push dword [ebp+12] ; who
+    push dword [ebp+8] ; which
+    int 0x80
+    add esp, 8
+    pop ebp
+    ret
+
+; int __sys_setpriority(int which, int who, int prio)
+__sys_setpriority:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_SETPRIORITY
+    push dword [ebp+16] ; prio
+    push dword [ebp+12] ; who
+    push dword [ebp+8] ; which
+    int 0x80
+    add esp, 12
+    pop ebp
+    ret
+
+; int __sys_getrlimit(int resource, struct rlimit *rlim)
+__sys_getrlimit:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_GETRLIMIT
+    push dword [ebp+12] ; rlim
+    push dword [ebp+8] ; resource
+    int 0x80
+    add esp, 8
+    pop ebp
+    ret
+
+; int __sys_setrlimit(int resource, const struct rlimit *rlim)
+__sys_setrlimit:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_SETRLIMIT
+    push dword [ebp+12] ; rlim
+    push dword [ebp+8] ; resource
+    int 0x80
+    add esp, 8
+    pop ebp
+    ret
+
 ; int __sys_sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
 __sys_sigaction:
     push ebp
@@ -177,7 +288,7 @@ _exit:
 exit:
     push ebp
     mov ebp, esp
-    mov eax, SYS_EXIT
+    mov eax, SYS_EXIT_GROUP
     push dword [ebp+8] ; code
     int 0x80
     add esp, 4
@@ -245,6 +356,67 @@ __sys_lseek:
     pop ebp
     ret
 
+; ssize_t __sys_readahead(int fd, int offset, size_t count)
+__sys_readahead:
+    push ebp
+    mov ebp, esp
+    push dword [ebp+16] ; count
+    mov eax, [ebp+12]
+    cdq
+    push edx ; offset high
+    push eax ; offset low
+    push dword [ebp+8] ; fd
+    mov eax, SYS_READAHEAD
+    int 0x80
+    add esp, 16
+    pop ebp
+    ret
+
+; int __sys_fadvise64(int fd, int offset, size_t len, int advice)
+__sys_fadvise64:
+    push ebp
+    mov ebp, esp
+    push dword [ebp+20] ; advice
+    push dword [ebp+16] ; len
+    mov eax, [ebp+12]
+    cdq
+    push edx ; offset high
+    push eax ; offset low
+    push dword [ebp+8] ; fd
+    mov eax, SYS_FADVISE64
+    int 0x80
+    add esp, 20
+    pop ebp
+    ret
+
+; int __sys_fsync(int fd)
+__sys_fsync:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_FSYNC
+    push dword [ebp+8] ; fd
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
+; int __sys_fdatasync(int fd)
+__sys_fdatasync:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_FDATASYNC
+    push dword [ebp+8] ; fd
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
+; void sync()
+sync:
+    mov eax, SYS_SYNC
+    int 0x80
+    ret
+
 ; int __sys_fstat(int fd, struct stat *stat)
 __sys_fstat:
     push ebp
@@ -442,6 +614,71 @@ __sys_nanosleep:
     pop ebp
     ret
 
+; int __sys_futex(volatile int *uaddr, int op, int val, const struct timespec *timeout)
+__sys_futex:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_FUTEX
+    push dword [ebp+20] ; timeout
+    push dword [ebp+16] ; val
+    push dword [ebp+12] ; op
+    push dword [ebp+8] ; uaddr
+    int 0x80
+    add esp, 16
+    pop ebp
+    ret
+
+; int __polyos_clone(int flags, void *stack, int *parent_tid, struct user_desc *tls, int *child_tid, void (*fn)(void *), void *arg)
+; The child starts on `stack` with fn and arg stored there, calls fn(arg)
+; and ends the thread if fn returns.
+__polyos_clone:
+    push ebp
+    mov ebp, esp
+    mov ecx, [ebp+12] ; stack
+    and ecx, -16
+    sub ecx, 20 ; fn, then arg 16-byte aligned for the call
+    mov eax, [ebp+28] ; fn
+    mov [ecx], eax
+    mov eax, [ebp+32] ; arg
+    mov [ecx+4], eax
+    mov eax, SYS_CLONE
+    push dword [ebp+24] ; child_tid
+    push dword [ebp+20] ; tls
+    push dword [ebp+16] ; parent_tid
+    push ecx ; stack
+    push dword [ebp+8] ; flags
+    int 0x80
+    test eax, eax
+    jz .child
+    add esp, 20
+    pop ebp
+    ret
+.child:
+    xor ebp, ebp
+    pop eax ; fn
+    call eax
+    push 0
+    call __polyos_thread_exit
+
+; void __polyos_thread_exit(int code)
+__polyos_thread_exit:
+    mov eax, SYS_EXIT
+    push dword [esp+4] ; code
+    int 0x80
+.thread_exit_failed:
+    jmp .thread_exit_failed
+
+; int __sys_set_thread_area(struct user_desc *u_info)
+__sys_set_thread_area:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_SET_THREAD_AREA
+    push dword [ebp+8] ; u_info
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
 ; int __sys_gettimeofday(struct timeval *tv, struct timezone *tz)
 __sys_gettimeofday:
     push ebp
@@ -466,12 +703,41 @@ __sys_clock_gettime:
     pop ebp
     ret
 
+; clock_t __sys_times(struct tms *buf)
+__sys_times:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_TIMES
+    push dword [ebp+8] ; buf
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
+; int __sys_getrusage(int who, struct rusage *usage)
+__sys_getrusage:
+    push ebp
+    mov ebp, esp
+    mov eax, SYS_GETRUSAGE
+    push dword [ebp+12] ; usage
+    push dword [ebp+8] ; who
+    int 0x80
+    add esp, 8
+    pop ebp
+    ret
+
 ; int getpid()
 getpid:
     mov eax, SYS_GETPID
     int 0x80
     ret
 
+; int gettid()
+gettid:
+    mov eax, SYS_GETTID
+    int 0x80
+    ret
+
 ; int getuid()
 getuid:
     mov eax, SYS_GETUID
@@ -1,3 +1,4 @@
+#include "errno.h"
 #include "polyos.h"
 #include "stdlib.h"
 #include "string.h"
@@ -89,94 +90,6 @@ int fclose(int fd){
     return close(fd);
 }
 
-static int contains_slash(const char *value){
-    for (int i = 0; value[i]; i++){
-        if (value[i] == '/'){
-            return 1;
-        }
-    }
-    return 0;
-}
-
-static int build_exec_path(char *out, int out_size, const char *prefix, const char *command, const char *suffix){
-    int pos = 0;
-
-    for (int i = 0; prefix[i]; i++){
-        if (pos + 1 >= out_size){
-            return 0;
-        }
-        out[pos++] = prefix[i];
-    }
-
-    for (int i = 0; command[i]; i++){
-        if (pos + 1 >= out_size){
-            return 0;
-        }
-        out[pos++] = command[i];
-    }
-
-    for (int i = 0; suffix[i]; i++){
-        if (pos + 1 >= out_size){
-            return 0;
-        }
-        out[pos++] = suffix[i];
-    }
-
-    out[pos] = '\0';
-    return 1;
-}
-
-static void exec_if_present(const char *path, char *const argv[]){
-    struct file_stat stat_buf;
-    if (stat(path, &stat_buf) == 0 && !S_ISDIR(stat_buf.mode)){
-        execve(path, argv, environ);
-    }
-}
-
-static void exec_from_path(const char *command, char *const argv[]){
-    const char *path_env = getenv("PATH");
-    if (!path_env || !path_env[0]){
-        path_env = "/bin";
-    }
-
-    char directory[256];
-    char prefix_buf[256];
-    char path[256];
-    int dir_len = 0;
-
-    for (int i = 0;; i++){
-        char c = path_env[i];
-        if (c != ':' && c != '\0'){
-            if (dir_len + 1 < (int)sizeof(directory)){
-                directory[dir_len++] = c;
-            }
-            continue;
-        }
-
-        directory[dir_len] = '\0';
-        const char *prefix = dir_len == 0 ? "." : directory;
-        if (!build_exec_path(prefix_buf, sizeof(prefix_buf), prefix, "/", "")){
-            if (c == '\0'){
-                break;
-            }
-            dir_len = 0;
-            continue;
-        }
-
-        if (build_exec_path(path, sizeof(path), prefix_buf, command, "")){
-            exec_if_present(path, argv);
-        }
-        if (build_exec_path(path, sizeof(path), prefix_buf, command, ".elf")){
-            exec_if_present(path, argv);
-        }
-
-        if (c == '\0'){
-            break;
-        }
-        dir_len = 0;
-    }
-}
-
 int polyos_system_run(const char *command){
     char buff[1024];
     char *argv[64];
@@ -196,18 +109,13 @@ int polyos_system_run(const char *command){
         return -1;
     }
 
-    pid_t pid = fork();
-    if (pid < 0){
-        return -1;
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (error == ENOENT || error == EACCES){
+        return 127;
     }
-
-    if (pid == 0){
-        if (contains_slash(argv[0])){
-            exec_if_present(argv[0], argv);
-        } else {
-            exec_from_path(argv[0], argv);
-        }
-        _exit(127);
+    if (error){
+        return -1;
     }
 
     int status = 0;
@@ -0,0 +1,281 @@
+#include "errno.h"
+#include "memory.h"
+#include "polyos.h"
+#include "stdlib.h"
+#include "types.h"
+
+#define CLONE_VM 0x00000100
+#define CLONE_FS 0x00000200
+#define CLONE_FILES 0x00000400
+#define CLONE_SIGHAND 0x00000800
+#define CLONE_THREAD 0x00010000
+#define CLONE_SYSVSEM 0x00040000
+#define CLONE_SETTLS 0x00080000
+#define CLONE_PARENT_SETTID 0x00100000
+#define CLONE_CHILD_CLEARTID 0x00200000
+
+#define THREAD_CLONE_FLAGS (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD | \
+                            CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID | CLONE_CHILD_CLEARTID)
+
+#define THREAD_DEFAULT_STACK_SIZE (64 * 1024)
+#define THREAD_MIN_STACK_SIZE (4 * 1024)
+
+/* Lets the kernel pick the TLS slot in set_thread_area/clone. */
+#define TLS_ENTRY_ANY 0xFFFFFFFFu
+/* 32-bit, 4 KiB granular, usable: a flat data segment. */
+#define TLS_DESC_FLAGS 0x51
+
+struct user_desc {
+    unsigned int entry_number;
+    unsigned int base_addr;
+    unsigned int limit;
+    unsigned int flags;
+};
+
+enum thread_state {
+    THREAD_RUNNING,
+    THREAD_DETACHED,
+    THREAD_EXITED,
+};
+
+/* Thread control block. The TLS segment of a thread starts here, so %gs:0
+ * always holds the running thread. Created threads keep it above their
+ * stack in one heap block. */
+struct pthread {
+    struct pthread *self;
+    int errno_value;
+    /* Thread id; the kernel zeroes it and wakes the futex when the thread
+     * is gone, which is what join waits for. */
+    volatile int tid;
+    int state;
+    void *(*start_routine)(void *);
+    void *arg;
+    void *result;
+    void *block;
+    struct pthread *next_exited;
+};
+
+extern int __polyos_clone(int flags, void *stack, volatile int *parent_tid, struct user_desc *tls,
+                          volatile int *child_tid, void (*fn)(void *), void *arg);
+extern void __polyos_thread_exit(int code) __attribute__((noreturn));
+extern int __sys_set_thread_area(struct user_desc *u_info);
+
+static struct pthread main_thread = { &main_thread, 0, 0, THREAD_RUNNING, NULL, NULL, NULL, NULL, NULL };
+static int tls_ready = 0;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Detached threads that have exited; their memory is freed once the kernel
+ * has cleared their tid, since they ran on it until the very end. */
+static struct pthread *exited_detached = NULL;
+
+static struct pthread *current_thread(void)
+{
+    if (!tls_ready) {
+        return &main_thread;
+    }
+
+    struct pthread *self;
+    __asm__ volatile("movl %%gs:0, %0" : "=r"(self));
+    return self;
+}
+
+int *__errno_location(void)
+{
+    return &current_thread()->errno_value;
+}
+
+/* Called once from c_start before main. Without a TLS segment the process
+ * still runs, but cannot create threads. */
+void __polyos_init_threads(void)
+{
+    struct user_desc desc = { TLS_ENTRY_ANY, (unsigned int)&main_thread, 0xFFFFF, TLS_DESC_FLAGS };
+
+    main_thread.tid = gettid();
+    if (__sys_set_thread_area(&desc) == 0) {
+        tls_ready = 1;
+    }
+}
+
+static void free_exited_detached(void)
+{
+    struct pthread **link = &exited_detached;
+    while (*link) {
+        struct pthread *thread = *link;
+        if (__atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE) != 0) {
+            link = &thread->next_exited;
+            continue;
+        }
+
+        *link = thread->next_exited;
+        free(thread->block);
+    }
+}
+
+static void wait_thread_gone(struct pthread *thread)
+{
+    int saved_errno = errno;
+    int tid;
+    while ((tid = __atomic_load_n(&thread->tid, __ATOMIC_ACQUIRE)) != 0) {
+        futex(&thread->tid, FUTEX_WAIT, tid, NULL);
+    }
+    errno = saved_errno;
+}
+
+static void thread_start(void *arg)
+{
+    struct pthread *thread = arg;
+    pthread_exit(thread->start_routine(thread->arg));
+}
+
+int pthread_attr_init(pthread_attr_t *attr)
+{
+    if (!attr) {
+        return EINVAL;
+    }
+
+    attr->stack_size = THREAD_DEFAULT_STACK_SIZE;
+    attr->detach_state = PTHREAD_CREATE_JOINABLE;
+    return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t *attr)
+{
+    return attr ? 0 : EINVAL;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stack_size)
+{
+    if (!attr || stack_size < THREAD_MIN_STACK_SIZE) {
+        return EINVAL;
+    }
+
+    attr->stack_size = stack_size;
+    return 0;
+}
+
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int detach_state)
+{
+    if (!attr || (detach_state != PTHREAD_CREATE_JOINABLE && detach_state != PTHREAD_CREATE_DETACHED)) {
+        return EINVAL;
+    }
+
+    attr->detach_state = detach_state;
+    return 0;
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg)
+{
+    if (!thread || !start_routine) {
+        return EINVAL;
+    }
+    if (!tls_ready) {
+        return EAGAIN;
+    }
+
+    size_t stack_size = attr ? attr->stack_size : THREAD_DEFAULT_STACK_SIZE;
+    stack_size = (stack_size + 15) & ~(size_t)15;
+
+    pthread_mutex_lock(&threads_lock);
+    free_exited_detached();
+    pthread_mutex_unlock(&threads_lock);
+
+    char *block = malloc(stack_size + sizeof(struct pthread));
+    if (!block) {
+        return EAGAIN;
+    }
+
+    struct pthread *created = (struct pthread *)(block + stack_size);
+    memset(created, 0, sizeof(*created));
+    created->self = created;
+    created->state = attr && attr->detach_state == PTHREAD_CREATE_DETACHED ? THREAD_DETACHED : THREAD_RUNNING;
+    created->start_routine = start_routine;
+    created->arg = arg;
+    created->block = block;
+
+    struct user_desc desc = { TLS_ENTRY_ANY, (unsigned int)created, 0xFFFFF, TLS_DESC_FLAGS };
+    int tid = __polyos_clone(THREAD_CLONE_FLAGS, created, &created->tid, &desc, &created->tid, thread_start,
+                             created);
+    if (tid < 0) {
+        free(block);
+        return -tid;
+    }
+
+    *thread = created;
+    return 0;
+}
+
+void pthread_exit(void *result)
+{
+    struct pthread *self = current_thread();
+    if (self == &main_thread) {
+        exit(0);
+    }
+
+    self->result = result;
+    pthread_mutex_lock(&threads_lock);
+    if (self->state == THREAD_DETACHED) {
+        self->next_exited = exited_detached;
+        exited_detached = self;
+    } else {
+        self->state = THREAD_EXITED;
+    }
+    pthread_mutex_unlock(&threads_lock);
+
+    __polyos_thread_exit(0);
+}
+
+int pthread_join(pthread_t thread, void **result)
+{
+    if (!thread || thread == &main_thread) {
+        return EINVAL;
+    }
+    if (thread == current_thread()) {
+        return EDEADLK;
+    }
+
+    pthread_mutex_lock(&threads_lock);
+    int detached = thread->state == THREAD_DETACHED;
+    pthread_mutex_unlock(&threads_lock);
+    if (detached) {
+        return EINVAL;
+    }
+
+    wait_thread_gone(thread);
+    if (result) {
+        *result = thread->result;
+    }
+    free(thread->block);
+    return 0;
+}
+
+int pthread_detach(pthread_t thread)
+{
+    if (!thread || thread == &main_thread) {
+        return EINVAL;
+    }
+
+    pthread_mutex_lock(&threads_lock);
+    int state = thread->state;
+    if (state == THREAD_RUNNING) {
+        thread->state = THREAD_DETACHED;
+    }
+    pthread_mutex_unlock(&threads_lock);
+
+    if (state == THREAD_DETACHED) {
+        return EINVAL;
+    }
+    if (state == THREAD_EXITED) {
+        wait_thread_gone(thread);
+        free(thread->block);
+    }
+    return 0;
+}
+
+pthread_t pthread_self(void)
+{
+    return current_thread();
+}
+
+int pthread_equal(pthread_t a, pthread_t b)
+{
+    return a == b;
+}
@@ -0,0 +1,226 @@
+#include "errno.h"
+#include "memory.h"
+#include "polyos.h"
+#include "stdlib.h"
+#include "string.h"
+#include "types.h"
+
+#define SPAWN_ACTION_CLOSE 1
+#define SPAWN_ACTION_DUP2 2
+#define SPAWN_ACTION_OPEN 3
+
+#define SPAWN_PATH_MAX 256
+
+extern int __sys_spawn(const char *path, char *const argv[], char *const envp[],
+                       const struct polyos_spawn_action *actions, int action_count);
+
+static struct polyos_spawn_action *add_action(posix_spawn_file_actions_t *file_actions, int kind, int fd)
+{
+    if (!file_actions || file_actions->count >= POSIX_SPAWN_MAX_ACTIONS) {
+        return NULL;
+    }
+
+    struct polyos_spawn_action *action = &file_actions->actions[file_actions->count++];
+    memset(action, 0, sizeof(*action));
+    action->kind = kind;
+    action->fd = fd;
+    return action;
+}
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions)
+{
+    if (!file_actions) {
+        return EINVAL;
+    }
+
+    file_actions->count = 0;
+    return 0;
+}
+
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *file_actions)
+{
+    if (!file_actions) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < file_actions->count; i++) {
+        if (file_actions->actions[i].kind == SPAWN_ACTION_OPEN) {
+            free((void *)file_actions->actions[i].path);
+        }
+    }
+    file_actions->count = 0;
+    return 0;
+}
+
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions, int fd)
+{
+    if (fd < 0) {
+        return EBADF;
+    }
+    return add_action(file_actions, SPAWN_ACTION_CLOSE, fd) ? 0 : ENOMEM;
+}
+
+int posix_spawn_file_actions_adddup2(posix_spawn_file_actions_t *file_actions, int fd, int new_fd)
+{
+    if (fd < 0 || new_fd < 0) {
+        return EBADF;
+    }
+
+    struct polyos_spawn_action *action = add_action(file_actions, SPAWN_ACTION_DUP2, new_fd);
+    if (!action) {
+        return ENOMEM;
+    }
+    action->source_fd = fd;
+    return 0;
+}
+
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions, int fd, const char *path, int flags,
+                                     int mode)
+{
+    if (fd < 0) {
+        return EBADF;
+    }
+    if (!path) {
+        return EINVAL;
+    }
+
+    /* The path is copied, so the caller's buffer may go away before the spawn. */
+    char *copy = malloc(strlen(path) + 1);
+    if (!copy) {
+        return ENOMEM;
+    }
+    strcpy(copy, path);
+
+    struct polyos_spawn_action *action = add_action(file_actions, SPAWN_ACTION_OPEN, fd);
+    if (!action) {
+        free(copy);
+        return ENOMEM;
+    }
+    action->flags = flags;
+    action->mode = mode;
+    action->path = copy;
+    return 0;
+}
+
+int posix_spawnattr_init(posix_spawnattr_t *attr)
+{
+    if (!attr) {
+        return EINVAL;
+    }
+
+    attr->flags = 0;
+    return 0;
+}
+
+int posix_spawnattr_destroy(posix_spawnattr_t *attr)
+{
+    return attr ? 0 : EINVAL;
+}
+
+int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+{
+    if (!path || (attr && attr->flags != 0)) {
+        return EINVAL;
+    }
+
+    int child = __sys_spawn(path, argv, envp ? envp : environ, file_actions ? file_actions->actions : NULL,
+                            file_actions ? file_actions->count : 0);
+    if (child < 0) {
+        return -child;
+    }
+
+    if (pid) {
+        *pid = child;
+    }
+    return 0;
+}
+
+static int contains_slash(const char *value)
+{
+    for (int i = 0; value[i]; i++) {
+        if (value[i] == '/') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Joins `directory`, `file` and `suffix` into `out`; 0 if it does not fit. */
+static int build_path(char *out, const char *directory, const char *file, const char *suffix)
+{
+    int dir_len = strlen(directory);
+    int file_len = strlen(file);
+    int suffix_len = strlen(suffix);
+    if (dir_len + 1 + file_len + suffix_len + 1 > SPAWN_PATH_MAX) {
+        return 0;
+    }
+
+    memcpy(out, directory, dir_len);
+    out[dir_len] = '/';
+    memcpy(out + dir_len + 1, file, file_len);
+    memcpy(out + dir_len + 1 + file_len, suffix, suffix_len + 1);
+    return 1;
+}
+
+/* Like posix_spawn, but a `file` without a slash is searched in PATH, as
+ * itself and with the `.elf` extension of PolyOS programs. */
+int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *file_actions,
+                 const posix_spawnattr_t *attr, char *const argv[], char *const envp[])
+{
+    static const char *const suffixes[] = { "", ".elf" };
+
+    if (!file || !file[0]) {
+        return ENOENT;
+    }
+    if (contains_slash(file)) {
+        return posix_spawn(pid, file, file_actions, attr, argv, envp);
+    }
+
+    const char *path_env = getenv("PATH");
+    if (!path_env || !path_env[0]) {
+        path_env = "/bin";
+    }
+
+    char directory[SPAWN_PATH_MAX];
+    char path[SPAWN_PATH_MAX];
+    int result = ENOENT;
+    int denied = 0;
+    const char *start = path_env;
+    for (;;) {
+        const char *end = start;
+        while (*end && *end != ':') {
+            end++;
+        }
+
+        int dir_len = end - start;
+        if (dir_len == 0) {
+            strcpy(directory, ".");
+        } else if (dir_len < SPAWN_PATH_MAX) {
+            memcpy(directory, start, dir_len);
+            directory[dir_len] = '\0';
+        } else {
+            directory[0] = '\0';
+        }
+
+        for (int i = 0; directory[0] && i < (int)(sizeof(suffixes) / sizeof(suffixes[0])); i++) {
+            if (!build_path(path, directory, file, suffixes[i])) {
+                continue;
+            }
+
+            result = posix_spawn(pid, path, file_actions, attr, argv, envp);
+            if (result == EACCES) {
+                denied = 1;
+            } else if (result != ENOENT) {
+                return result;
+            }
+        }
+
+        if (!*end) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    return denied ? EACCES : ENOENT;
+}
@@ -4,8 +4,10 @@
 char **environ;
 
 extern int main(int argc, char** argv, char** envp);
+extern void __polyos_init_threads(void);
 
 void c_start(int argc, char** argv, char** envp) {
+    __polyos_init_threads();
     environ = envp;
     int res = main(argc, argv, envp);
     if (argc > 0) {
@@ -9,6 +9,8 @@ typedef struct malloc_block {
 } malloc_block_t;
 
 static malloc_block_t *malloc_head = NULL;
+/* The heap is shared by all threads of the process. */
+static pthread_mutex_t malloc_lock = PTHREAD_MUTEX_INITIALIZER;
 static int environ_owned = 0;
 
 static size_t align_size(size_t size)
@@ -123,17 +125,20 @@ void* malloc(size_t size)
     }
 
     size = align_size(size);
+    pthread_mutex_lock(&malloc_lock);
     malloc_block_t *block = find_free_block(size);
     if (!block) {
         block = append_block(size);
     }
 
     if (!block) {
+        pthread_mutex_unlock(&malloc_lock);
         return NULL;
     }
 
     split_block(block, size);
     block->free = 0;
+    pthread_mutex_unlock(&malloc_lock);
     return (void *)(block + 1);
 }
 
@@ -144,9 +149,11 @@ void free(void* ptr)
     }
 
     malloc_block_t *block = ((malloc_block_t *)ptr) - 1;
+    pthread_mutex_lock(&malloc_lock);
     block->free = 1;
     coalesce_free_blocks();
     release_tail_blocks();
+    pthread_mutex_unlock(&malloc_lock);
 }
 
 static int env_name_len(const char *entry)
@@ -0,0 +1,301 @@
+#include "errno.h"
+#include "polyos.h"
+#include "types.h"
+
+extern int __sys_futex(volatile int *uaddr, int op, int val, const struct timespec *timeout);
+extern int __sys_sem_create(int initial_count);
+extern int __sys_sem_wait(int semid);
+extern int __sys_sem_signal(int semid);
+extern int __sys_sem_close(int semid);
+
+#define FUTEX_WAIT_PRIVATE (FUTEX_WAIT | FUTEX_PRIVATE_FLAG)
+#define FUTEX_WAKE_PRIVATE (FUTEX_WAKE | FUTEX_PRIVATE_FLAG)
+
+static int syscall_ret(int result)
+{
+    if (result < 0 && result >= -4095) {
+        errno = -result;
+        return -1;
+    }
+
+    return result;
+}
+
+static int compare_exchange(volatile int *word, int expected, int desired)
+{
+    return __atomic_compare_exchange_n(word, &expected, desired, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+int futex(volatile int *uaddr, int op, int val, const struct timespec *timeout)
+{
+    return syscall_ret(__sys_futex(uaddr, op, val, timeout));
+}
+
+int sem_init(sem_t *sem, int pshared, unsigned int value)
+{
+    if (!sem) {
+        errno = EFAULT;
+        return -1;
+    }
+
+    sem->value = 0;
+    sem->waiters = 0;
+    sem->id = 0;
+    if (pshared != 0) {
+        int id = syscall_ret(__sys_sem_create((int)value));
+        if (id < 0) {
+            return -1;
+        }
+        sem->id = id;
+        return 0;
+    }
+
+    sem->value = (int)value;
+    return 0;
+}
+
+int sem_trywait(sem_t *sem)
+{
+    if (!sem) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (sem->id != 0) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    int value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    while (value > 0) {
+        if (compare_exchange(&sem->value, value, value - 1)) {
+            return 0;
+        }
+        value = __atomic_load_n(&sem->value, __ATOMIC_RELAXED);
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+int sem_wait(sem_t *sem)
+{
+    if (!sem) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (sem->id != 0) {
+        return syscall_ret(__sys_sem_wait(sem->id));
+    }
+
+    int saved_errno = errno;
+    if (sem_trywait(sem) == 0) {
+        return 0;
+    }
+
+    // Announce the waiter before the last check, so a post that sees no
+    // waiters has already made the count visible to the loop below.
+    __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        int value = __atomic_load_n(&sem->value, __ATOMIC_SEQ_CST);
+        if (value > 0) {
+            if (compare_exchange(&sem->value, value, value - 1)) {
+                break;
+            }
+            continue;
+        }
+
+        if (futex(&sem->value, FUTEX_WAIT_PRIVATE, 0, NULL) < 0 && errno == EINTR) {
+            __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+            return -1;
+        }
+    }
+    __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_SEQ_CST);
+    errno = saved_errno;
+    return 0;
+}
+
+int sem_post(sem_t *sem)
+{
+    if (!sem) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (sem->id != 0) {
+        return syscall_ret(__sys_sem_signal(sem->id));
+    }
+
+    __atomic_fetch_add(&sem->value, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0) {
+        futex(&sem->value, FUTEX_WAKE_PRIVATE, 1, NULL);
+    }
+    return 0;
+}
+
+int sem_destroy(sem_t *sem)
+{
+    if (!sem) {
+        errno = EFAULT;
+        return -1;
+    }
+    if (sem->id != 0) {
+        int result = syscall_ret(__sys_sem_close(sem->id));
+        if (result == 0) {
+            sem->id = 0;
+        }
+        return result;
+    }
+
+    if (__atomic_load_n(&sem->waiters, __ATOMIC_SEQ_CST) > 0) {
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr)
+{
+    (void)attr;
+    if (!mutex) {
+        return EINVAL;
+    }
+
+    mutex->state = 0;
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+    if (!mutex) {
+        return EINVAL;
+    }
+
+    return compare_exchange(&mutex->state, 0, 1) ? 0 : EBUSY;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    if (!mutex) {
+        return EINVAL;
+    }
+    if (compare_exchange(&mutex->state, 0, 1)) {
+        return 0;
+    }
+
+    // Contended: mark the lock as having sleepers and park until the holder
+    // hands it back. Whoever takes it from here keeps the mark, so its
+    // unlock wakes the next sleeper.
+    int saved_errno = errno;
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex(&mutex->state, FUTEX_WAIT_PRIVATE, 2, NULL);
+    }
+    errno = saved_errno;
+    return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+    if (!mutex) {
+        return EINVAL;
+    }
+
+    int previous = __atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE);
+    if (previous == 0) {
+        return EPERM;
+    }
+    if (previous == 2) {
+        int saved_errno = errno;
+        futex(&mutex->state, FUTEX_WAKE_PRIVATE, 1, NULL);
+        errno = saved_errno;
+    }
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+    if (!mutex) {
+        return EINVAL;
+    }
+
+    return __atomic_load_n(&mutex->state, __ATOMIC_RELAXED) == 0 ? 0 : EBUSY;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr)
+{
+    (void)attr;
+    if (!cond) {
+        return EINVAL;
+    }
+
+    cond->sequence = 0;
+    cond->waiters = 0;
+    return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    if (!cond || !mutex) {
+        return EINVAL;
+    }
+
+    // Sample the sequence while still holding the mutex: a signal sent after
+    // the unlock bumps it and the futex wait returns at once.
+    int sequence = __atomic_load_n(&cond->sequence, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+
+    int result = pthread_mutex_unlock(mutex);
+    if (result != 0) {
+        __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+        return result;
+    }
+
+    int saved_errno = errno;
+    futex(&cond->sequence, FUTEX_WAIT_PRIVATE, sequence, NULL);
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+
+    // Other waiters may have been woken with us; relock in the contended
+    // state so our unlock wakes them in turn.
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        futex(&mutex->state, FUTEX_WAIT_PRIVATE, 2, NULL);
+    }
+    errno = saved_errno;
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+    if (!cond) {
+        return EINVAL;
+    }
+
+    __atomic_fetch_add(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) > 0) {
+        int saved_errno = errno;
+        futex(&cond->sequence, FUTEX_WAKE_PRIVATE, 1, NULL);
+        errno = saved_errno;
+    }
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+    if (!cond) {
+        return EINVAL;
+    }
+
+    __atomic_fetch_add(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) > 0) {
+        int saved_errno = errno;
+        futex(&cond->sequence, FUTEX_WAKE_PRIVATE, 0x7FFFFFFF, NULL);
+        errno = saved_errno;
+    }
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+    if (!cond) {
+        return EINVAL;
+    }
+
+    return __atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST) == 0 ? 0 : EBUSY;
+}
@@ -7,22 +7,29 @@ extern int __sys_execve(const char *pathname, char *const argv[], char *const en
 extern int __sys_fork(void);
 extern int __sys_waitpid(pid_t pid, int *status, int options);
 extern int __sys_kill(pid_t pid, int sig);
+extern int __sys_nice(int inc);
+extern int __sys_getpriority(int which, int who);
+extern int __sys_setpriority(int which, int who, int prio);
+extern int __sys_getrlimit(int resource, struct rlimit *rlim);
+extern int __sys_setrlimit(int resource, const struct rlimit *rlim);
 extern int __sys_sigaction(int signum, const struct sigaction *act, struct sigaction *oldact);
 extern void __polyos_signal_trampoline(void);
 extern int __sys_nanosleep(const struct timespec *req, struct timespec *rem);
 extern int __sys_gettimeofday(struct timeval *tv, struct timezone *tz);
 extern int __sys_clock_gettime(clockid_t clockid, struct timespec *tp);
+extern clock_t __sys_times(struct tms *buf);
+extern int __sys_getrusage(int who, struct rusage *usage);
 extern int __sys_reboot(int magic1, int magic2, int cmd, void *arg);
 extern int __sys_socketcall(int call, unsigned long *args);
 extern int __sys_recvfrom_wait(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen, u32 timeout_ticks);
-extern int __sys_sem_create(int initial_count);
-extern int __sys_sem_wait(int semid);
-extern int __sys_sem_signal(int semid);
-extern int __sys_sem_close(int semid);
 extern int __sys_open(const char *pathname, int flags, int mode);
 extern ssize_t __sys_read(int fd, void *buf, size_t count);
 extern ssize_t __sys_write(int fd, const void *buf, size_t count);
 extern off_t __sys_lseek(int fd, off_t offset, int whence);
+extern ssize_t __sys_readahead(int fd, off_t offset, size_t count);
+extern int __sys_fadvise64(int fd, off_t offset, off_t len, int advice);
+extern int __sys_fsync(int fd);
+extern int __sys_fdatasync(int fd);
 extern int __sys_stat(const char *pathname, struct file_stat *stat);
 extern int __sys_lstat(const char *pathname, struct file_stat *stat);
 extern int __sys_fstat(int fd, struct file_stat *stat);
@@ -89,6 +96,41 @@ int kill(pid_t pid, int sig)
     return syscall_ret(__sys_kill(pid, sig));
 }
 
+int nice(int inc)
+{
+    if (syscall_ret(__sys_nice(inc)) < 0) {
+        return -1;
+    }
+
+    return getpriority(PRIO_PROCESS, 0);
+}
+
+int getpriority(int which, int who)
+{
+    // The kernel returns 20 - nice so that success is never negative.
+    int result = syscall_ret(__sys_getpriority(which, who));
+    if (result < 0) {
+        return -1;
+    }
+
+    return 20 - result;
+}
+
+int setpriority(int which, int who, int prio)
+{
+    return syscall_ret(__sys_setpriority(which, who, prio));
+}
+
+int getrlimit(int resource, struct rlimit *rlim)
+{
+    return syscall_ret(__sys_getrlimit(resource, rlim));
+}
+
+int setrlimit(int resource, const struct rlimit *rlim)
+{
+    return syscall_ret(__sys_setrlimit(resource, rlim));
+}
+
 int sigaction(int signum, const struct sigaction *act, struct sigaction *oldact)
 {
     struct sigaction kernel_act;
@@ -137,6 +179,16 @@ int clock_gettime(clockid_t clockid, struct timespec *tp)
     return syscall_ret(__sys_clock_gettime(clockid, tp));
 }
 
+clock_t times(struct tms *buf)
+{
+    return syscall_ret(__sys_times(buf));
+}
+
+int getrusage(int who, struct rusage *usage)
+{
+    return syscall_ret(__sys_getrusage(who, usage));
+}
+
 int reboot(int cmd)
 {
     return syscall_ret(__sys_reboot(LINUX_REBOOT_MAGIC1, LINUX_REBOOT_MAGIC2, cmd, NULL));
@@ -276,59 +328,6 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     return syscall_ret(__sys_socketcall(SOCKETCALL_SETSOCKOPT, args));
 }
 
-int sem_init(sem_t *sem, int pshared, unsigned int value)
-{
-    if (!sem) {
-        errno = EFAULT;
-        return -1;
-    }
-    if (pshared != 0) {
-        errno = ENOTSUP;
-        return -1;
-    }
-
-    int id = syscall_ret(__sys_sem_create((int)value));
-    if (id < 0) {
-        return -1;
-    }
-
-    *sem = id;
-    return 0;
-}
-
-int sem_wait(sem_t *sem)
-{
-    if (!sem) {
-        errno = EFAULT;
-        return -1;
-    }
-
-    return syscall_ret(__sys_sem_wait(*sem));
-}
-
-int sem_post(sem_t *sem)
-{
-    if (!sem) {
-        errno = EFAULT;
-        return -1;
-    }
-
-    return syscall_ret(__sys_sem_signal(*sem));
-}
-
-int sem_destroy(sem_t *sem)
-{
-    if (!sem) {
-        errno = EFAULT;
-        return -1;
-    }
-
-    int result = syscall_ret(__sys_sem_close(*sem));
-    if (result == 0) {
-        *sem = -1;
-    }
-    return result;
-}
 
 unsigned int sleep(unsigned int seconds)
 {
@@ -359,6 +358,28 @@ off_t lseek(int fd, off_t offset, int whence)
     return syscall_ret(__sys_lseek(fd, offset, whence));
 }
 
+ssize_t readahead(int fd, off_t offset, size_t count)
+{
+    return syscall_ret(__sys_readahead(fd, offset, count));
+}
+
+int posix_fadvise(int fd, off_t offset, off_t len, int advice)
+{
+    // Reports the error instead of setting errno, as POSIX asks.
+    int res = __sys_fadvise64(fd, offset, len, advice);
+    return res < 0 ? -res : 0;
+}
+
+int fsync(int fd)
+{
+    return syscall_ret(__sys_fsync(fd));
+}
+
+int fdatasync(int fd)
+{
+    return syscall_ret(__sys_fdatasync(fd));
+}
+
 int fstat(int fd, struct file_stat *stat)
 {
     return syscall_ret(__sys_fstat(fd, stat));
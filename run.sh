@@ -16,8 +16,26 @@ fi
 
 mkdir -p log
 
+# AHCI_IMAGE=disk.img attaches a raw FAT image as a SATA disk, mounted at /sata
+SATA_ARGS=""
+if [ "$AHCI_IMAGE" ]; then
+    SATA_ARGS="-device ahci,id=ahci -drive if=none,id=sata0,format=raw,file=$AHCI_IMAGE -device ide-hd,drive=sata0,bus=ahci.0"
+fi
+
+# VIRTIO=1 also exposes the boot image over virtio-blk, which then holds the
+# root; the IDE copy is only read by the bootloader
+BOOT_DRIVE="format=raw,file=./bin/os.bin"
+VIRTIO_ARGS=""
+if [ "$VIRTIO" = "1" ]; then
+    BOOT_DRIVE="$BOOT_DRIVE,file.locking=off"
+    VIRTIO_ARGS="-drive if=virtio,format=raw,file=./bin/os.bin,file.locking=off"
+fi
+
 qemu-system-x86_64 \
-    -drive format=raw,file=./bin/os.bin \
+    -smp "${SMP:-4}" \
+    -drive $BOOT_DRIVE \
+    $VIRTIO_ARGS \
+    $SATA_ARGS \
     -netdev user,id=net0 \
     -device rtl8139,netdev=net0 \
     -serial stdio \
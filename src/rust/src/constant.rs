@@ -11,18 +11,51 @@ pub const PAGING_PAGE_TABLE_SIZE: usize = 1 << PAGING_PAGE_TABLE_SIZE_BIT;
 
 pub const MAX_PATH: usize = 256;
 
-pub const TOTAL_GDT_SEGMENTS: usize = 6;
+/// Sectors each block device caches at boot; `/dev/blockcache` changes it.
+pub const BLOCK_CACHE_SECTORS: usize = 8192; // 4MB
+/// Largest window of sectors a sequential reader gets ahead by.
+pub const READ_AHEAD_MAX_SECTORS: usize = 256; // 128KB
+/// Ticks a cached sector may stay dirty before the flusher writes it back.
+pub const WRITEBACK_EXPIRE_TICKS: u64 = 3000; // 3s
+/// Ticks between flusher passes while dirty sectors remain.
+pub const WRITEBACK_INTERVAL_TICKS: u64 = 500;
+/// Sectors the flusher writes back per device and pass; the rest wait for
+/// the next one.
+pub const WRITEBACK_PASS_SECTORS: usize = 256;
+/// Dirty share of a block cache, in percent, past which the flusher runs at once.
+pub const DIRTY_BACKGROUND_RATIO: usize = 10;
+/// Dirty share past which a writer writes the cache back itself.
+pub const DIRTY_RATIO: usize = 20;
+/// Sectors of the RAM disk at boot, 0 for none.
+pub const RAM_DISK_SECTORS: usize = 16384; // 8MB
+/// Image on the root volume the RAM disk starts from, grown to fit; without
+/// it the disk is formatted empty.
+pub const RAM_DISK_IMAGE: &str = "/ram0.img";
+
+pub const TOTAL_GDT_SEGMENTS: usize = 7;
 
 pub const PROGRAM_VIRTUAL_ADDRESS: usize = 0x00400000;
 pub const USER_HEAP_START: usize = 0x00800000;
 pub const USER_HEAP_END: usize = 0x01000000;
-pub const USER_PROGRAM_STACK_SIZE: usize = 1024 * 16; // 16KB
-pub const USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START: usize = 0x003FF000;
+/// Shared libraries are loaded one after the other from here.
+pub const USER_LIBRARY_ADDRESS_START: usize = 0x20000000;
+pub const USER_LIBRARY_ADDRESS_END: usize = 0x40000000;
+/// Address space set aside below the stack top. Pages are mapped as the
+/// stack grows into it; the lowest one is a guard page that is never mapped.
+pub const USER_PROGRAM_STACK_RESERVE: usize = 1024 * 1024 * 8; // 8MB
+/// Stack size limit (`RLIMIT_STACK`) a process starts with.
+pub const USER_PROGRAM_STACK_SIZE: usize = 1024 * 1024; // 1MB
+pub const USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START: usize = 0xC0000000;
 pub const USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END: usize =
-    USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START - USER_PROGRAM_STACK_SIZE;
+    USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START - USER_PROGRAM_STACK_RESERVE;
 
 pub const USER_DATA_SEGMENT: u32 = 0x23;
 pub const USER_CODE_SEGMENT: u32 = 0x1B;
+/// User data segment whose base is the thread pointer of the running task;
+/// user code always runs with it in `gs`.
+pub const USER_TLS_SEGMENT: u32 = 0x33;
+/// GDT slot of `USER_TLS_SEGMENT`, as `set_thread_area` reports it.
+pub const USER_TLS_ENTRY: u32 = 6;
 
 pub const PIC_MASTER_COMMAND_PORT: u16 = 0x20;
 pub const PIC_MASTER_DATA_PORT: u16 = 0x21;
@@ -35,6 +68,29 @@ pub const PIC_SLAVE_IRQ_MASK: u8 = 1u8 << PIC_SLAVE_IRQ_LINE;
 
 pub const PIT_BASE_FREQUENCY_HZ: u32 = 1_193_182;
 pub const TIMER_HZ: u32 = 1000;
+/// Program the PIT per event from a TSC clock instead of ticking at `TIMER_HZ`.
+pub const TIMER_DYNAMIC_TICK: bool = true;
+/// Number of multilevel feedback queue levels (0 = highest priority).
+pub const SCHEDULER_LEVELS: usize = 8;
+/// Quantum of the top level; it doubles every two levels further down.
+pub const SCHEDULER_TIME_SLICE_TICKS: u64 = 10;
+/// Every task returns to the top level allowed by its nice value this often,
+/// so CPU-bound tasks at the bottom cannot starve.
+pub const SCHEDULER_BOOST_TICKS: u64 = 1000;
+
+/// Start application processors found in the ACPI/MP tables.
+pub const SMP_ENABLED: bool = true;
+pub const MAX_CPUS: usize = 8;
+/// Kernel stack of each application processor, also used as its TSS `esp0`.
+pub const AP_KERNEL_STACK_SIZE: usize = 1024 * 64; // 64KB
+/// Real-mode page the AP start-up code is copied to; the SIPI vector is this
+/// address >> 12.
+pub const AP_TRAMPOLINE_ADDRESS: usize = 0x8000;
+/// Local APIC vectors, above the remapped PIC range.
+pub const LAPIC_TIMER_VECTOR: u16 = 0x40;
+pub const RESCHEDULE_VECTOR: u16 = 0x41;
+pub const TLB_SHOOTDOWN_VECTOR: u16 = 0x42;
+pub const LAPIC_SPURIOUS_VECTOR: u16 = 0xFF;
 
 pub const fn irq_to_vector(irq_line: u8) -> Option<u16> {
     if irq_line < 16 {
@@ -0,0 +1,640 @@
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::{constant::BLOCK_CACHE_SECTORS, memory::Page};
+
+use super::{
+    block_cache::{BlockCache, SECTOR_SIZE},
+    block_dev::{BlockDevice, BlockDeviceError, CacheInfo, WriteBackState, register_block_device},
+    driver::{DeviceDriver, DeviceProbeStage},
+    managed::ManagedDevice,
+    pci::{PciBar, PciDevice, find_device_by_class},
+};
+
+const PCI_CLASS_MASS_STORAGE: u8 = 0x01;
+const PCI_SUBCLASS_SATA: u8 = 0x06;
+const PCI_PROG_IF_AHCI: u8 = 0x01;
+const PCI_BAR_ABAR: u8 = 5;
+
+const HBA_CAP: usize = 0x00;
+const HBA_GHC: usize = 0x04;
+const HBA_PI: usize = 0x0C;
+const HBA_CAP_NCQ: u32 = 1 << 30;
+const HBA_GHC_AHCI_ENABLE: u32 = 1 << 31;
+const HBA_PORTS: usize = 32;
+
+const PORT_REGS: usize = 0x100;
+const PORT_REGS_SIZE: usize = 0x80;
+const PX_CLB: usize = 0x00;
+const PX_CLBU: usize = 0x04;
+const PX_FB: usize = 0x08;
+const PX_FBU: usize = 0x0C;
+const PX_IS: usize = 0x10;
+const PX_IE: usize = 0x14;
+const PX_CMD: usize = 0x18;
+const PX_TFD: usize = 0x20;
+const PX_SIG: usize = 0x24;
+const PX_SSTS: usize = 0x28;
+const PX_SERR: usize = 0x30;
+const PX_SACT: usize = 0x34;
+const PX_CI: usize = 0x38;
+
+const PX_CMD_START: u32 = 1 << 0;
+const PX_CMD_FIS_RECEIVE: u32 = 1 << 4;
+const PX_CMD_FIS_RUNNING: u32 = 1 << 14;
+const PX_CMD_LIST_RUNNING: u32 = 1 << 15;
+const PX_IS_TASK_FILE_ERROR: u32 = 1 << 30;
+const PX_TFD_ERR: u32 = 0x01;
+const PX_TFD_DRQ: u32 = 0x08;
+const PX_TFD_BSY: u32 = 0x80;
+const PX_SSTS_DET_PRESENT: u32 = 3;
+const PX_SIG_ATA: u32 = 0x0000_0101;
+
+const FIS_TYPE_REG_H2D: u8 = 0x27;
+const FIS_H2D_COMMAND: u8 = 0x80;
+const FIS_LENGTH_DWORDS: u32 = 5;
+const HEADER_WRITE: u32 = 1 << 6;
+const ATA_DEVICE_LBA: u8 = 0x40;
+
+const ATA_CMD_READ_DMA_EXT: u8 = 0x25;
+const ATA_CMD_WRITE_DMA_EXT: u8 = 0x35;
+const ATA_CMD_READ_FPDMA_QUEUED: u8 = 0x60;
+const ATA_CMD_WRITE_FPDMA_QUEUED: u8 = 0x61;
+const ATA_CMD_IDENTIFY: u8 = 0xEC;
+
+const ATA_IDENT_LBA28_SECTORS: usize = 60;
+const ATA_IDENT_QUEUE_DEPTH: usize = 75;
+const ATA_IDENT_SATA_CAPABILITIES: usize = 76;
+const ATA_IDENT_LBA48_SECTORS: usize = 100;
+const ATA_SATA_CAPABILITY_NCQ: u16 = 1 << 8;
+
+/// Command slots a port has at most; CAP.NCS says how many are implemented.
+const COMMAND_SLOTS: usize = 32;
+const COMMAND_HEADER_DWORDS: usize = 8;
+const COMMAND_LIST_BYTES: usize = COMMAND_SLOTS * COMMAND_HEADER_DWORDS * 4;
+const RECEIVED_FIS_BYTES: usize = 256;
+/// Command FIS and ATAPI area, then the PRD table.
+const COMMAND_TABLE_PRDT: usize = 0x80;
+const COMMAND_TABLE_BYTES: usize = 0x100;
+const PRD_MAX_BYTES: usize = 4 * 1024 * 1024;
+
+/// Sectors one command moves at most.
+const AHCI_COMMAND_SECTORS: usize = 128;
+/// Sectors a cache miss run may span; its commands are queued together.
+const AHCI_MAX_TRANSFER_SECTORS: usize = AHCI_COMMAND_SECTORS * COMMAND_SLOTS;
+const AHCI_WAIT_TIMEOUT: usize = 10_000_000;
+
+#[derive(Debug)]
+pub enum AhciError {
+    NotFound,
+    Timeout,
+    IoError,
+}
+
+fn read_reg(address: usize) -> u32 {
+    unsafe { core::ptr::read_volatile(address as *const u32) }
+}
+
+fn write_reg(address: usize, value: u32) {
+    unsafe { core::ptr::write_volatile(address as *mut u32, value) }
+}
+
+/// One port of an AHCI controller with a SATA disk behind it. Its command
+/// list, received FIS area and command tables live in kernel pages, which
+/// sit at the same physical addresses.
+#[derive(Debug)]
+struct AhciPort {
+    regs: usize,
+    command_list: Page<u32>,
+    received_fis: Page<u8>,
+    tables: Page<u8>,
+    /// Command slots the controller implements.
+    slots: usize,
+    /// Tagged commands the disk accepts at once; 0 without NCQ.
+    queue_depth: usize,
+    sectors: u64,
+}
+
+impl AhciPort {
+    fn new(regs: usize, slots: usize) -> Option<Self> {
+        Some(Self {
+            regs,
+            command_list: Page::new(COMMAND_LIST_BYTES / 4)?,
+            received_fis: Page::new(RECEIVED_FIS_BYTES)?,
+            tables: Page::new(COMMAND_SLOTS * COMMAND_TABLE_BYTES)?,
+            slots,
+            queue_depth: 0,
+            sectors: 0,
+        })
+    }
+
+    fn read(&self, register: usize) -> u32 {
+        read_reg(self.regs + register)
+    }
+
+    fn write(&self, register: usize, value: u32) {
+        write_reg(self.regs + register, value)
+    }
+
+    fn wait_clear(&self, register: usize, bits: u32) -> Result<(), AhciError> {
+        for _ in 0..AHCI_WAIT_TIMEOUT {
+            if self.read(register) & bits == 0 {
+                return Ok(());
+            }
+            core::hint::spin_loop();
+        }
+        Err(AhciError::Timeout)
+    }
+
+    fn stop(&self) -> Result<(), AhciError> {
+        let command = self.read(PX_CMD) & !(PX_CMD_START | PX_CMD_FIS_RECEIVE);
+        self.write(PX_CMD, command);
+        self.wait_clear(PX_CMD, PX_CMD_LIST_RUNNING | PX_CMD_FIS_RUNNING)
+    }
+
+    fn start(&self) -> Result<(), AhciError> {
+        self.wait_clear(PX_CMD, PX_CMD_LIST_RUNNING)?;
+        self.write(PX_CMD, self.read(PX_CMD) | PX_CMD_FIS_RECEIVE);
+        self.write(PX_CMD, self.read(PX_CMD) | PX_CMD_START);
+        Ok(())
+    }
+
+    /// Points the port at this driver's memory and starts it. Completions
+    /// are polled, so port interrupts stay off.
+    fn init(&mut self) -> Result<(), AhciError> {
+        self.stop()?;
+        self.write(PX_CLB, self.command_list.as_ptr() as u32);
+        self.write(PX_CLBU, 0);
+        self.write(PX_FB, self.received_fis.as_ptr() as u32);
+        self.write(PX_FBU, 0);
+        self.write(PX_IE, 0);
+        self.write(PX_SERR, u32::MAX);
+        self.write(PX_IS, u32::MAX);
+        self.start()?;
+        self.wait_clear(PX_TFD, PX_TFD_BSY | PX_TFD_DRQ)?;
+        self.identify()
+    }
+
+    fn identify(&mut self) -> Result<(), AhciError> {
+        let buf = Page::<u8>::new(SECTOR_SIZE).ok_or(AhciError::IoError)?;
+        let data = buf.as_mut_slice();
+        self.prepare(
+            0,
+            ATA_CMD_IDENTIFY,
+            0,
+            0,
+            data.as_mut_ptr(),
+            SECTOR_SIZE,
+            false,
+        );
+        self.issue(1 << 0, false);
+        self.wait(1 << 0)?;
+
+        let word = |index: usize| u16::from_le_bytes([data[index * 2], data[index * 2 + 1]]);
+        let dword = |index: usize| word(index) as u64 | (word(index + 1) as u64) << 16;
+        let lba48 = dword(ATA_IDENT_LBA48_SECTORS) | (dword(ATA_IDENT_LBA48_SECTORS + 2) << 32);
+        self.sectors = if lba48 != 0 {
+            lba48
+        } else {
+            dword(ATA_IDENT_LBA28_SECTORS)
+        };
+
+        if word(ATA_IDENT_SATA_CAPABILITIES) & ATA_SATA_CAPABILITY_NCQ != 0 {
+            let depth = (word(ATA_IDENT_QUEUE_DEPTH) & 0x1f) as usize + 1;
+            self.queue_depth = depth.min(self.slots);
+        }
+        Ok(())
+    }
+
+    /// Fills command slot `slot` for `count` sectors from `lba` in `len`
+    /// bytes at `buf`. NCQ commands carry the count in the features field
+    /// and the slot as their tag.
+    fn prepare(
+        &self,
+        slot: usize,
+        command: u8,
+        lba: u64,
+        count: usize,
+        buf: *mut u8,
+        len: usize,
+        write: bool,
+    ) {
+        let queued = matches!(
+            command,
+            ATA_CMD_READ_FPDMA_QUEUED | ATA_CMD_WRITE_FPDMA_QUEUED
+        );
+        let table = &mut self.tables.as_mut_slice()
+            [slot * COMMAND_TABLE_BYTES..(slot + 1) * COMMAND_TABLE_BYTES];
+        table.fill(0);
+
+        let (features, count_field) = if queued {
+            (count as u16, (slot as u16) << 3)
+        } else {
+            (0, count as u16)
+        };
+        let device = if command == ATA_CMD_IDENTIFY {
+            0
+        } else {
+            ATA_DEVICE_LBA
+        };
+        table[..16].copy_from_slice(&[
+            FIS_TYPE_REG_H2D,
+            FIS_H2D_COMMAND,
+            command,
+            features as u8,
+            lba as u8,
+            (lba >> 8) as u8,
+            (lba >> 16) as u8,
+            device,
+            (lba >> 24) as u8,
+            (lba >> 32) as u8,
+            (lba >> 40) as u8,
+            (features >> 8) as u8,
+            count_field as u8,
+            (count_field >> 8) as u8,
+            0,
+            0,
+        ]);
+
+        let mut regions = 0;
+        let mut offset = 0;
+        while offset < len {
+            let size = (len - offset).min(PRD_MAX_BYTES);
+            let entry = COMMAND_TABLE_PRDT + regions * 16;
+            let address = buf as u32 + offset as u32;
+            table[entry..entry + 4].copy_from_slice(&address.to_le_bytes());
+            table[entry + 12..entry + 16].copy_from_slice(&(size as u32 - 1).to_le_bytes());
+            offset += size;
+            regions += 1;
+        }
+
+        let header = &mut self.command_list.as_mut_slice()
+            [slot * COMMAND_HEADER_DWORDS..(slot + 1) * COMMAND_HEADER_DWORDS];
+        header.fill(0);
+        header[0] =
+            FIS_LENGTH_DWORDS | if write { HEADER_WRITE } else { 0 } | (regions as u32) << 16;
+        header[2] = table.as_ptr() as u32;
+    }
+
+    fn issue(&self, slots: u32, queued: bool) {
+        if queued {
+            self.write(PX_SACT, slots);
+        }
+        self.write(PX_CI, slots);
+    }
+
+    /// Polls until the commands in `slots` completed.
+    fn wait(&self, slots: u32) -> Result<(), AhciError> {
+        for _ in 0..AHCI_WAIT_TIMEOUT {
+            if self.read(PX_IS) & PX_IS_TASK_FILE_ERROR != 0 || self.read(PX_TFD) & PX_TFD_ERR != 0
+            {
+                self.recover();
+                return Err(AhciError::IoError);
+            }
+            if (self.read(PX_CI) | self.read(PX_SACT)) & slots == 0 {
+                return Ok(());
+            }
+            core::hint::spin_loop();
+        }
+        self.recover();
+        Err(AhciError::Timeout)
+    }
+
+    /// Restarts the port after an error, dropping every outstanding command.
+    fn recover(&self) {
+        let _ = self.stop();
+        self.write(PX_SERR, u32::MAX);
+        self.write(PX_IS, u32::MAX);
+        let _ = self.start();
+    }
+
+    /// Moves the whole sectors of `len` bytes at `buf` from `lba`. The
+    /// transfer is cut into commands of `AHCI_COMMAND_SECTORS`; with NCQ as
+    /// many as the disk queues are outstanding at once.
+    fn transfer(&self, lba: u64, buf: *mut u8, len: usize, write: bool) -> Result<(), AhciError> {
+        let count = len / SECTOR_SIZE;
+        if self.sectors != 0 && lba + count as u64 > self.sectors {
+            return Err(AhciError::IoError);
+        }
+
+        let in_flight = self.queue_depth.max(1);
+        let command = match (self.queue_depth > 0, write) {
+            (true, false) => ATA_CMD_READ_FPDMA_QUEUED,
+            (true, true) => ATA_CMD_WRITE_FPDMA_QUEUED,
+            (false, false) => ATA_CMD_READ_DMA_EXT,
+            (false, true) => ATA_CMD_WRITE_DMA_EXT,
+        };
+
+        let mut first = 0;
+        while first < count {
+            let mut slots = 0u32;
+            for slot in 0..in_flight {
+                let start = first + slot * AHCI_COMMAND_SECTORS;
+                if start >= count {
+                    break;
+                }
+                let sectors = (count - start).min(AHCI_COMMAND_SECTORS);
+                let offset = start * SECTOR_SIZE;
+                self.prepare(
+                    slot,
+                    command,
+                    lba + start as u64,
+                    sectors,
+                    unsafe { buf.add(offset) },
+                    sectors * SECTOR_SIZE,
+                    write,
+                );
+                slots |= 1 << slot;
+            }
+
+            self.issue(slots, self.queue_depth > 0);
+            self.wait(slots)?;
+            first += in_flight * AHCI_COMMAND_SECTORS;
+        }
+        Ok(())
+    }
+
+    /// Buffers must be word aligned for the controller; others go through
+    /// an aligned copy.
+    fn read_sectors(&self, lba: u64, buf: &mut [u8]) -> Result<(), AhciError> {
+        if buf.as_ptr() as usize & 1 == 0 {
+            return self.transfer(lba, buf.as_mut_ptr(), buf.len(), false);
+        }
+        let mut bounce = alloc::vec![0u16; buf.len() / 2];
+        let bytes: &mut [u8] = bytemuck::cast_slice_mut(&mut bounce);
+        self.transfer(lba, bytes.as_mut_ptr(), bytes.len(), false)?;
+        buf.copy_from_slice(bytes);
+        Ok(())
+    }
+
+    fn write_sectors(&self, lba: u64, buf: &[u8]) -> Result<(), AhciError> {
+        if buf.as_ptr() as usize & 1 == 0 {
+            return self.transfer(lba, buf.as_ptr() as *mut u8, buf.len(), true);
+        }
+        let mut bounce = alloc::vec![0u16; buf.len() / 2];
+        let bytes: &mut [u8] = bytemuck::cast_slice_mut(&mut bounce);
+        bytes.copy_from_slice(buf);
+        self.transfer(lba, bytes.as_mut_ptr(), bytes.len(), true)
+    }
+}
+
+/// First SATA disk of the AHCI controller, with its sector cache.
+#[derive(Debug)]
+pub struct AhciDisk {
+    port: AhciPort,
+    cache: BlockCache,
+}
+
+unsafe impl Send for AhciDisk {}
+
+impl AhciDisk {
+    /// Enables AHCI mode on `pci` and starts the first port with a disk.
+    fn new(pci: PciDevice) -> Result<Self, AhciError> {
+        let Some(PciBar::Memory(abar)) = pci.bar(PCI_BAR_ABAR) else {
+            return Err(AhciError::NotFound);
+        };
+        pci.enable_memory_space();
+        pci.enable_bus_mastering();
+
+        let abar = abar as usize;
+        write_reg(
+            abar + HBA_GHC,
+            read_reg(abar + HBA_GHC) | HBA_GHC_AHCI_ENABLE,
+        );
+        let capabilities = read_reg(abar + HBA_CAP);
+        let slots = ((capabilities >> 8) & 0x1f) as usize + 1;
+        let implemented = read_reg(abar + HBA_PI);
+
+        for index in 0..HBA_PORTS {
+            if implemented & (1 << index) == 0 {
+                continue;
+            }
+            let regs = abar + PORT_REGS + index * PORT_REGS_SIZE;
+            if read_reg(regs + PX_SSTS) & 0xf != PX_SSTS_DET_PRESENT
+                || read_reg(regs + PX_SIG) != PX_SIG_ATA
+            {
+                continue;
+            }
+
+            let mut port = AhciPort::new(regs, slots).ok_or(AhciError::IoError)?;
+            port.init()?;
+            if capabilities & HBA_CAP_NCQ == 0 {
+                port.queue_depth = 0;
+            }
+            serial_println!(
+                "ahci: port {} sectors={} slots={} ncq_depth={}",
+                index,
+                port.sectors,
+                slots,
+                port.queue_depth
+            );
+            return Ok(Self {
+                port,
+                cache: BlockCache::new(BLOCK_CACHE_SECTORS),
+            });
+        }
+        Err(AhciError::NotFound)
+    }
+
+    pub fn read_sectors_internal(
+        &mut self,
+        lba: u64,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<(), AhciError> {
+        self.cache.read_through(
+            lba,
+            &mut buf[..count * SECTOR_SIZE],
+            AHCI_MAX_TRANSFER_SECTORS,
+            |lba, data| self.port.read_sectors(lba, data),
+            |lba, data| self.port.write_sectors(lba, data),
+        )
+    }
+
+    pub fn write_sectors_internal(
+        &mut self,
+        lba: u64,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<(), AhciError> {
+        self.cache
+            .write_through(lba, &buf[..count * SECTOR_SIZE], |lba, data| {
+                self.port.write_sectors(lba, data)
+            })
+    }
+
+    pub fn sync(&mut self) -> Result<(), AhciError> {
+        self.cache
+            .flush(|lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn sync_ranges(&mut self, ranges: &[(u64, usize)]) -> Result<(), AhciError> {
+        self.cache
+            .flush_ranges(ranges, |lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn write_back(&mut self, now: u64, max: usize) -> Result<WriteBackState, AhciError> {
+        self.cache
+            .flush_due(now, max, |lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn cache_info(&self) -> CacheInfo {
+        CacheInfo {
+            sectors: self.cache.len(),
+            capacity: self.cache.capacity(),
+            dirty: self.cache.dirty(),
+            stats: self.cache.stats(),
+        }
+    }
+}
+
+pub struct AhciDriver {
+    device: ManagedDevice<AhciDisk>,
+    block_device_id: AtomicUsize,
+}
+
+impl core::fmt::Debug for AhciDriver {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("AhciDriver")
+            .field("block_device_id", &self.block_device_id())
+            .finish()
+    }
+}
+
+impl AhciDriver {
+    pub const fn new() -> Self {
+        Self {
+            device: ManagedDevice::new(),
+            block_device_id: AtomicUsize::new(usize::MAX),
+        }
+    }
+
+    pub fn block_device_id(&self) -> Option<usize> {
+        let id = self.block_device_id.load(Ordering::Acquire);
+        if id == usize::MAX { None } else { Some(id) }
+    }
+}
+
+pub static AHCI_DRIVER: AhciDriver = AhciDriver::new();
+
+impl BlockDevice for AhciDriver {
+    fn read_sectors(
+        &self,
+        lba: u64,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.read_sectors_internal(lba, count, buf)
+                    .map_err(|_| BlockDeviceError::IoError)?;
+                Ok(count)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn write_sectors(&self, lba: u64, count: usize, buf: &[u8]) -> Result<usize, BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.write_sectors_internal(lba, count, buf)
+                    .map_err(|_| BlockDeviceError::IoError)?;
+                Ok(count)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn sync(&self) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| disk.sync().map_err(|_| BlockDeviceError::IoError))
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn sync_ranges(&self, ranges: &[(u64, usize)]) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.sync_ranges(ranges)
+                    .map_err(|_| BlockDeviceError::IoError)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn write_back(&self, now: u64, max_sectors: usize) -> Result<WriteBackState, BlockDeviceError> {
+        self.device.try_with_mut(|disk| {
+            disk.write_back(now, max_sectors)
+                .map_err(|_| BlockDeviceError::IoError)
+        })?
+    }
+
+    fn sector_count(&self) -> u64 {
+        self.device.with(|disk| disk.port.sectors).unwrap_or(0)
+    }
+
+    fn cache_info(&self) -> Option<CacheInfo> {
+        self.device.with(|disk| disk.cache_info())
+    }
+
+    fn set_cache_capacity(&self, sectors: usize) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                let AhciDisk { port, cache } = disk;
+                cache
+                    .set_capacity(sectors, |lba, data| port.write_sectors(lba, data))
+                    .map_err(|_| BlockDeviceError::IoError)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn reset_cache_stats(&self) {
+        self.device.with_mut(|disk| disk.cache.reset_stats());
+    }
+
+    fn discard_cache(&self, lba: u64, count: usize) {
+        self.device.with_mut(|disk| disk.cache.discard(lba, count));
+    }
+}
+
+impl DeviceDriver for AhciDriver {
+    fn name(&self) -> &'static str {
+        "ahci"
+    }
+
+    fn stage(&self) -> DeviceProbeStage {
+        DeviceProbeStage::Normal
+    }
+
+    fn probe(&self) {
+        let Some(pci) = find_device_by_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_SATA)
+            .filter(|pci| pci.prog_if == PCI_PROG_IF_AHCI)
+        else {
+            return;
+        };
+
+        match AhciDisk::new(pci) {
+            Ok(disk) => {
+                self.device.probe(disk).expect("ahci device already probed");
+                let id = register_block_device(&AHCI_DRIVER);
+                self.block_device_id.store(id, Ordering::Release);
+            }
+            Err(AhciError::NotFound) => {
+                serial_println!(
+                    "ahci: no SATA disk on PCI {}:{}:{}",
+                    pci.bus,
+                    pci.device,
+                    pci.function
+                );
+            }
+            Err(error) => {
+                serial_println!("ahci: init failed: {:?}", error);
+            }
+        }
+    }
+
+    fn remove(&self) {
+        if let Some(mut disk) = self.device.remove() {
+            let _ = disk.sync();
+            let _ = disk.port.stop();
+        }
+        self.block_device_id.store(usize::MAX, Ordering::Release);
+    }
+}
+
+crate::register_device_driver!(AHCI_DRIVER_REG, AHCI_DRIVER);
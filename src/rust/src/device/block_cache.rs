@@ -0,0 +1,668 @@
+use alloc::{boxed::Box, collections::VecDeque, string::String, vec::Vec};
+use core::fmt::Write;
+
+use crate::fs::{FileHandle, FileMetadata, FileOps, FsError};
+
+use super::{
+    block_dev::{WriteBackState, block_devices},
+    block_queue,
+    timer::current_tick,
+    writeback,
+};
+
+/// Bytes in a cached sector.
+pub const SECTOR_SIZE: usize = 512;
+
+/// Hits a slot keeps credit for; each pass of the clock hand takes one away.
+const MAX_USES: u8 = 3;
+const NO_SLOT: u32 = u32::MAX;
+/// LBA of a slot whose sector was discarded; it is reused before any
+/// eviction.
+const FREE_LBA: u64 = u64::MAX;
+/// Largest run of consecutive dirty sectors a flush writes back at once.
+pub const MAX_WRITE_BACK_SECTORS: usize = 256;
+
+/// Counters of a block cache since boot or the last reset.
+#[derive(Clone, Copy, Debug, Default)]
+pub struct CacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub evictions: u64,
+    /// Dirty sectors written to the device, on eviction or flush.
+    pub writebacks: u64,
+}
+
+#[derive(Debug)]
+struct Slot {
+    lba: u64,
+    dirty: bool,
+    /// Tick the sector went dirty at, for the flusher.
+    dirtied: u64,
+    /// Number of the write that dirtied it, matching its `DirtyEntry`.
+    seq: u64,
+    uses: u8,
+    /// Next slot in the same hash chain.
+    next: u32,
+}
+
+/// Slot that went dirty, in the order they did. It is stale once the slot
+/// was written back, as its `seq` no longer matches.
+#[derive(Clone, Copy, Debug)]
+struct DirtyEntry {
+    index: u32,
+    seq: u64,
+}
+
+/// Write-back sector cache of one block device.
+///
+/// Slots form a CLOCK ring: a hit gives its slot some credit, and the hand
+/// takes credit away as it sweeps, so the first slot found without any is
+/// the victim. Sectors are found through a chained hash index on the LBA, so
+/// hits, inserts and evictions take constant time on average. Slots are
+/// allocated as the cache fills, up to its capacity. Dirty slots are also
+/// listed in the order they went dirty, so write-back looks at those only
+/// and the expired ones come first.
+///
+/// `write_back(lba, data)` writes whole sectors of `data` to the device from
+/// `lba`: one when a dirty sector is evicted, a run of them on flush.
+#[derive(Debug)]
+pub struct BlockCache {
+    slots: Vec<Slot>,
+    /// Sector data, `SECTOR_SIZE` bytes per slot.
+    data: Vec<u8>,
+    /// First slot of each hash chain.
+    buckets: Vec<u32>,
+    capacity: usize,
+    hand: usize,
+    /// Discarded slots, unlinked from the index.
+    free: Vec<u32>,
+    /// Dirty slots.
+    dirty: usize,
+    /// Oldest first; stale entries are dropped as they are met.
+    dirty_list: VecDeque<DirtyEntry>,
+    /// `seq` of the next slot to go dirty.
+    next_seq: u64,
+    stats: CacheStats,
+}
+
+impl BlockCache {
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(1);
+        Self {
+            slots: Vec::new(),
+            data: Vec::new(),
+            buckets: alloc::vec![NO_SLOT; capacity.next_power_of_two()],
+            capacity,
+            hand: 0,
+            free: Vec::new(),
+            dirty: 0,
+            dirty_list: VecDeque::new(),
+            next_seq: 0,
+            stats: CacheStats::default(),
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    pub fn len(&self) -> usize {
+        self.slots.len() - self.free.len()
+    }
+
+    /// Sectors written but not yet back on the device.
+    pub fn dirty(&self) -> usize {
+        self.dirty
+    }
+
+    pub fn stats(&self) -> CacheStats {
+        self.stats
+    }
+
+    pub fn reset_stats(&mut self) {
+        self.stats = CacheStats::default();
+    }
+
+    fn bucket(&self, lba: u64) -> usize {
+        // Fibonacci hashing spreads consecutive sectors over the buckets.
+        let hash = lba.wrapping_mul(0x9E37_79B9_7F4A_7C15);
+        (hash >> 32) as usize & (self.buckets.len() - 1)
+    }
+
+    fn find(&self, lba: u64) -> Option<usize> {
+        let mut index = self.buckets[self.bucket(lba)];
+        while index != NO_SLOT {
+            let slot = &self.slots[index as usize];
+            if slot.lba == lba {
+                return Some(index as usize);
+            }
+            index = slot.next;
+        }
+        None
+    }
+
+    fn link(&mut self, index: usize) {
+        let bucket = self.bucket(self.slots[index].lba);
+        self.slots[index].next = self.buckets[bucket];
+        self.buckets[bucket] = index as u32;
+    }
+
+    fn unlink(&mut self, index: usize) {
+        let bucket = self.bucket(self.slots[index].lba);
+        let next = self.slots[index].next;
+        if self.buckets[bucket] == index as u32 {
+            self.buckets[bucket] = next;
+            return;
+        }
+
+        let mut previous = self.buckets[bucket];
+        while previous != NO_SLOT {
+            let slot = &mut self.slots[previous as usize];
+            if slot.next == index as u32 {
+                slot.next = next;
+                return;
+            }
+            previous = slot.next;
+        }
+    }
+
+    fn sector(&self, index: usize) -> &[u8] {
+        &self.data[index * SECTOR_SIZE..(index + 1) * SECTOR_SIZE]
+    }
+
+    fn sector_mut(&mut self, index: usize) -> &mut [u8] {
+        &mut self.data[index * SECTOR_SIZE..(index + 1) * SECTOR_SIZE]
+    }
+
+    fn touch(&mut self, index: usize) {
+        let slot = &mut self.slots[index];
+        slot.uses = (slot.uses + 1).min(MAX_USES);
+    }
+
+    /// Copies sector `lba` into `buf` if it is cached.
+    pub fn read(&mut self, lba: u64, buf: &mut [u8]) -> bool {
+        let Some(index) = self.find(lba) else {
+            self.stats.misses += 1;
+            return false;
+        };
+        self.stats.hits += 1;
+        self.touch(index);
+        buf[..SECTOR_SIZE].copy_from_slice(self.sector(index));
+        true
+    }
+
+    /// Stores sector `lba` as read from the device.
+    pub fn insert<E>(
+        &mut self,
+        lba: u64,
+        buf: &[u8],
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        self.store(lba, buf, false, write_back)
+    }
+
+    /// Stores sector `lba` as written by the caller; it reaches the device
+    /// when evicted or flushed.
+    pub fn write<E>(
+        &mut self,
+        lba: u64,
+        buf: &[u8],
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        self.store(lba, buf, true, write_back)
+    }
+
+    /// Fills `buf` with the sectors from `lba`, reading the missing ones
+    /// with `read`. Each run of consecutive misses, up to `max_run` sectors,
+    /// goes to the device in one call.
+    pub fn read_through<E>(
+        &mut self,
+        lba: u64,
+        buf: &mut [u8],
+        max_run: usize,
+        mut read: impl FnMut(u64, &mut [u8]) -> Result<(), E>,
+        mut write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        let count = buf.len() / SECTOR_SIZE;
+        let mut first = 0;
+        while first < count {
+            let sector = first * SECTOR_SIZE;
+            if self.read(lba + first as u64, &mut buf[sector..sector + SECTOR_SIZE]) {
+                first += 1;
+                continue;
+            }
+
+            // Extend the run until the next hit, which fills its own sector.
+            let mut end = first + 1;
+            let mut hit = false;
+            while end < count && end - first < max_run {
+                let sector = end * SECTOR_SIZE;
+                if self.read(lba + end as u64, &mut buf[sector..sector + SECTOR_SIZE]) {
+                    hit = true;
+                    break;
+                }
+                end += 1;
+            }
+
+            let run = &mut buf[first * SECTOR_SIZE..end * SECTOR_SIZE];
+            read(lba + first as u64, run)?;
+            for (i, sector) in run.chunks_exact(SECTOR_SIZE).enumerate() {
+                self.insert(lba + (first + i) as u64, sector, &mut write_back)?;
+            }
+            first = if hit { end + 1 } else { end };
+        }
+        Ok(())
+    }
+
+    /// Stores the whole sectors of `buf` from `lba` as written. Missing ones
+    /// are not read from the device first.
+    pub fn write_through<E>(
+        &mut self,
+        lba: u64,
+        buf: &[u8],
+        mut write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        for (i, sector) in buf.chunks_exact(SECTOR_SIZE).enumerate() {
+            self.write(lba + i as u64, sector, &mut write_back)?;
+        }
+        Ok(())
+    }
+
+    fn store<E>(
+        &mut self,
+        lba: u64,
+        buf: &[u8],
+        dirty: bool,
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        let index = match self.find(lba) {
+            Some(index) => {
+                self.touch(index);
+                index
+            }
+            None => {
+                let index = self.allocate(write_back)?;
+                self.slots[index] = Slot {
+                    lba,
+                    dirty: false,
+                    dirtied: 0,
+                    seq: 0,
+                    uses: 0,
+                    next: NO_SLOT,
+                };
+                self.link(index);
+                index
+            }
+        };
+
+        self.sector_mut(index).copy_from_slice(&buf[..SECTOR_SIZE]);
+        let slot = &mut self.slots[index];
+        if dirty && !slot.dirty {
+            slot.dirty = true;
+            slot.dirtied = current_tick();
+            slot.seq = self.next_seq;
+            self.dirty_list.push_back(DirtyEntry {
+                index: index as u32,
+                seq: self.next_seq,
+            });
+            self.next_seq += 1;
+            self.dirty += 1;
+        }
+        Ok(())
+    }
+
+    fn is_live(&self, entry: &DirtyEntry) -> bool {
+        let slot = &self.slots[entry.index as usize];
+        slot.dirty && slot.seq == entry.seq
+    }
+
+    /// Marks slot `index` written back.
+    fn clean(&mut self, index: usize) {
+        self.slots[index].dirty = false;
+        self.dirty -= 1;
+        self.stats.writebacks += 1;
+    }
+
+    /// Drops stale entries: all of them once nothing is dirty, else the
+    /// ones in front, and the rest when they outnumber the slots.
+    fn prune_dirty_list(&mut self) {
+        if self.dirty == 0 {
+            self.dirty_list.clear();
+            return;
+        }
+        while let Some(entry) = self.dirty_list.front() {
+            if self.is_live(entry) {
+                break;
+            }
+            self.dirty_list.pop_front();
+        }
+        if self.dirty_list.len() > 2 * self.capacity {
+            let slots = &self.slots;
+            self.dirty_list.retain(|entry| {
+                let slot = &slots[entry.index as usize];
+                slot.dirty && slot.seq == entry.seq
+            });
+        }
+    }
+
+    /// Live dirty slots `select` picks, as (lba, slot), oldest first.
+    fn dirty_slots(&self, select: impl Fn(&Slot) -> bool) -> Vec<(u64, usize)> {
+        self.dirty_list
+            .iter()
+            .filter(|entry| self.is_live(entry))
+            .map(|entry| entry.index as usize)
+            .filter(|&index| select(&self.slots[index]))
+            .map(|index| (self.slots[index].lba, index))
+            .collect()
+    }
+
+    /// Returns an unlinked slot: a new one while the cache is filling, the
+    /// victim of the clock hand once it is full.
+    fn allocate<E>(
+        &mut self,
+        mut write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<usize, E> {
+        if let Some(index) = self.free.pop() {
+            return Ok(index as usize);
+        }
+        if self.slots.len() < self.capacity {
+            self.slots.push(Slot {
+                lba: 0,
+                dirty: false,
+                dirtied: 0,
+                seq: 0,
+                uses: 0,
+                next: NO_SLOT,
+            });
+            self.data.resize(self.slots.len() * SECTOR_SIZE, 0);
+            return Ok(self.slots.len() - 1);
+        }
+
+        // Each sweep ages every slot, so this ends within MAX_USES + 1 turns.
+        let victim = loop {
+            let index = self.hand;
+            self.hand = (self.hand + 1) % self.slots.len();
+            let slot = &mut self.slots[index];
+            if slot.uses == 0 {
+                break index;
+            }
+            slot.uses -= 1;
+        };
+
+        if self.slots[victim].dirty {
+            write_back(self.slots[victim].lba, self.sector(victim))?;
+            self.clean(victim);
+            self.prune_dirty_list();
+        }
+        self.unlink(victim);
+        self.stats.evictions += 1;
+        Ok(victim)
+    }
+
+    /// Writes every dirty sector back to the device.
+    pub fn flush<E>(
+        &mut self,
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        let dirty = self.dirty_slots(|_| true);
+        self.write_back_slots(dirty, write_back)
+    }
+
+    /// Flusher pass at tick `now`: writes back up to `max` of the sectors
+    /// `writeback::due_before` says are due, oldest first.
+    pub fn flush_due<E>(
+        &mut self,
+        now: u64,
+        max: usize,
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<WriteBackState, E> {
+        let before = writeback::due_before(self.dirty, self.capacity, now);
+        let mut due = Vec::new();
+        let mut more = false;
+        for entry in self.dirty_list.iter() {
+            if !self.is_live(entry) {
+                continue;
+            }
+            let slot = &self.slots[entry.index as usize];
+            // The list is in dirtying order, so the rest are younger.
+            if slot.dirtied > before {
+                break;
+            }
+            if due.len() == max {
+                more = true;
+                break;
+            }
+            due.push((slot.lba, entry.index as usize));
+        }
+        self.write_back_slots(due, write_back)?;
+
+        Ok(if more {
+            WriteBackState::Due
+        } else if self.dirty > 0 {
+            WriteBackState::Waiting
+        } else {
+            WriteBackState::Clean
+        })
+    }
+
+    /// Writes back the dirty sectors inside `ranges` of (first sector,
+    /// count), such as the blocks of one file.
+    pub fn flush_ranges<E>(
+        &mut self,
+        ranges: &[(u64, usize)],
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        let dirty = self.dirty_slots(|slot| {
+            ranges
+                .iter()
+                .any(|&(lba, count)| slot.lba >= lba && slot.lba - lba < count as u64)
+        });
+        self.write_back_slots(dirty, write_back)
+    }
+
+    /// Writes the `dirty` sectors, as (lba, slot), back to the device in LBA
+    /// order so the disk head sweeps once. Consecutive sectors go out
+    /// together, up to `MAX_WRITE_BACK_SECTORS` per call of `write_back`.
+    fn write_back_slots<E>(
+        &mut self,
+        mut dirty: Vec<(u64, usize)>,
+        mut write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        dirty.sort_unstable();
+
+        let mut run = Vec::new();
+        let mut result = Ok(());
+        'runs: for chunk in dirty.chunk_by(|a, b| a.0 + 1 == b.0) {
+            for sectors in chunk.chunks(MAX_WRITE_BACK_SECTORS) {
+                run.clear();
+                for &(_, index) in sectors {
+                    run.extend_from_slice(self.sector(index));
+                }
+                if let Err(error) = write_back(sectors[0].0, &run) {
+                    result = Err(error);
+                    break 'runs;
+                }
+                for &(_, index) in sectors {
+                    self.clean(index);
+                }
+            }
+        }
+        self.prune_dirty_list();
+        result
+    }
+
+    /// Changes how many sectors the cache holds. Sectors dropped by a
+    /// smaller capacity are written back first if dirty.
+    pub fn set_capacity<E>(
+        &mut self,
+        capacity: usize,
+        write_back: impl FnMut(u64, &[u8]) -> Result<(), E>,
+    ) -> Result<(), E> {
+        let capacity = capacity.max(1);
+        if capacity < self.slots.len() {
+            self.flush(write_back)?;
+            self.slots.truncate(capacity);
+            self.data.truncate(capacity * SECTOR_SIZE);
+            self.data.shrink_to_fit();
+            self.slots.shrink_to_fit();
+        }
+
+        self.capacity = capacity;
+        self.hand = 0;
+        self.free.retain(|&index| (index as usize) < capacity);
+        self.buckets = alloc::vec![NO_SLOT; capacity.next_power_of_two()];
+        for index in 0..self.slots.len() {
+            if self.slots[index].lba != FREE_LBA {
+                self.link(index);
+            }
+        }
+        Ok(())
+    }
+
+    /// Drops the clean sectors cached in `count` sectors from `lba`, as when
+    /// their reader says it will not need them again. Dirty ones stay until
+    /// written back.
+    pub fn discard(&mut self, lba: u64, count: usize) {
+        for lba in lba..lba + count as u64 {
+            let Some(index) = self.find(lba) else {
+                continue;
+            };
+            if self.slots[index].dirty {
+                continue;
+            }
+            self.unlink(index);
+            self.slots[index].lba = FREE_LBA;
+            self.slots[index].uses = 0;
+            self.free.push(index as u32);
+        }
+    }
+}
+
+fn render_caches() -> String {
+    let mut out = String::new();
+    let _ = writeln!(
+        out,
+        "{:>3} {:>8} {:>8} {:>8} {:>10} {:>10} {:>10} {:>10} {:>5}",
+        "DEV", "SECTORS", "CAPACITY", "DIRTY", "HITS", "MISSES", "EVICTIONS", "WRITEBACKS", "HIT%"
+    );
+    for (id, device) in block_devices().into_iter().enumerate() {
+        let Some(info) = device.cache_info() else {
+            continue;
+        };
+        let stats = info.stats;
+        let lookups = (stats.hits + stats.misses).max(1);
+        let _ = writeln!(
+            out,
+            "{:>3} {:>8} {:>8} {:>8} {:>10} {:>10} {:>10} {:>10} {:>5}",
+            id,
+            info.sectors,
+            info.capacity,
+            info.dirty,
+            stats.hits,
+            stats.misses,
+            stats.evictions,
+            stats.writebacks,
+            stats.hits * 100 / lookups
+        );
+    }
+
+    let _ = writeln!(
+        out,
+        "\n{:>3} {:>10} {:>10} {:>10}",
+        "DEV", "REQUESTS", "DISPATCHES", "MERGED"
+    );
+    for id in 0..block_devices().len() {
+        let Some(stats) = block_queue::stats(id) else {
+            continue;
+        };
+        let _ = writeln!(
+            out,
+            "{:>3} {:>10} {:>10} {:>10}",
+            id, stats.requests, stats.dispatches, stats.merged
+        );
+    }
+    out
+}
+
+/// Text snapshot served by the `blockcache` device node, rendered on the
+/// first read after open or after a write.
+struct CacheFile {
+    text: Option<Vec<u8>>,
+    pos: usize,
+}
+
+impl FileOps for CacheFile {
+    fn read(&mut self, buf: &mut [u8]) -> Result<usize, FsError> {
+        if self.text.is_none() {
+            self.text = Some(render_caches().into_bytes());
+        }
+
+        let text = self.text.as_ref().map(Vec::as_slice).unwrap_or_default();
+        let start = self.pos.min(text.len());
+        let len = buf.len().min(text.len() - start);
+        buf[..len].copy_from_slice(&text[start..start + len]);
+        self.pos = start + len;
+        Ok(len)
+    }
+
+    /// Accepts `reset` to clear the counters, or a number of sectors to
+    /// resize the cache of every device to.
+    fn write(&mut self, buf: &[u8]) -> Result<usize, FsError> {
+        let command = core::str::from_utf8(buf)
+            .map_err(|_| FsError::InvalidArgument)?
+            .trim();
+
+        if command == "reset" {
+            for (id, device) in block_devices().into_iter().enumerate() {
+                device.reset_cache_stats();
+                block_queue::reset_stats(id);
+            }
+        } else {
+            let sectors = command
+                .parse::<usize>()
+                .ok()
+                .filter(|&sectors| sectors > 0)
+                .ok_or(FsError::InvalidArgument)?;
+            for device in block_devices() {
+                if device.cache_info().is_some() {
+                    device
+                        .set_cache_capacity(sectors)
+                        .map_err(|_| FsError::IoError)?;
+                }
+            }
+        }
+
+        self.text = None;
+        self.pos = 0;
+        Ok(buf.len())
+    }
+
+    fn seek(&mut self, pos: usize) -> Result<usize, FsError> {
+        if pos == 0 {
+            self.text = None;
+        }
+        self.pos = pos;
+        Ok(pos)
+    }
+
+    fn stat(&self) -> Result<FileMetadata, FsError> {
+        Ok(FileMetadata {
+            uid: 0,
+            gid: 0,
+            mode: 0o644,
+            size: 0,
+            is_dir: false,
+            modified: 0,
+        })
+    }
+}
+
+fn open_block_cache() -> FileHandle {
+    FileHandle::new(Box::new(CacheFile { text: None, pos: 0 }))
+}
+
+crate::register_device_node!(
+    BLOCK_CACHE_DEVICE_NODE_REG,
+    ["blockcache"],
+    open_block_cache
+);
@@ -5,6 +5,13 @@ use core::{fmt::Debug, result::Result};
 use lazy_static::lazy_static;
 use spin::{Mutex, RwLock};
 
+use super::{
+    block_cache::CacheStats,
+    block_queue::{self, BlockRequest},
+    managed::ManagedDeviceError,
+    writeback,
+};
+
 pub trait BlockDevice: Send + Sync + Debug {
     /// Read `count` sectors from `lba` into `buf`.
     /// Return the number of sectors actually read or an error.
@@ -22,18 +29,89 @@ pub trait BlockDevice: Send + Sync + Debug {
         512
     }
 
+    /// Sectors on the device, 0 if it did not say.
+    fn sector_count(&self) -> u64 {
+        0
+    }
+
+    /// Writes back every dirty cached sector and has the device commit
+    /// its own write cache.
     fn sync(&self) -> Result<(), BlockDeviceError> {
         Ok(())
     }
+
+    /// Like `sync`, for the cached sectors inside `ranges` of (first
+    /// sector, count) only.
+    fn sync_ranges(&self, _ranges: &[(u64, usize)]) -> Result<(), BlockDeviceError> {
+        self.sync()
+    }
+
+    /// Flusher pass at tick `now`: writes back up to `max_sectors` of the
+    /// cached sectors that are due. Fails with `Busy` rather than wait for
+    /// another CPU using the device.
+    fn write_back(
+        &self,
+        _now: u64,
+        _max_sectors: usize,
+    ) -> Result<WriteBackState, BlockDeviceError> {
+        Ok(WriteBackState::Clean)
+    }
+
+    /// State of the device's sector cache, if it has one.
+    fn cache_info(&self) -> Option<CacheInfo> {
+        None
+    }
+
+    /// Resizes the sector cache to `sectors`, writing back what it drops.
+    fn set_cache_capacity(&self, _sectors: usize) -> Result<(), BlockDeviceError> {
+        Err(BlockDeviceError::InvalidArgument)
+    }
+
+    fn reset_cache_stats(&self) {}
+
+    /// Drops clean cached sectors in `count` sectors from `lba`.
+    fn discard_cache(&self, _lba: u64, _count: usize) {}
+}
+
+#[derive(Clone, Copy, Debug)]
+pub struct CacheInfo {
+    /// Sectors held.
+    pub sectors: usize,
+    pub capacity: usize,
+    /// Sectors not yet written back.
+    pub dirty: usize,
+    pub stats: CacheStats,
 }
 
-#[derive(Debug)]
+/// What a flusher pass left in a cache.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum WriteBackState {
+    Clean,
+    /// Dirty sectors remain, none due yet.
+    Waiting,
+    /// Due sectors remain past the pass's budget.
+    Due,
+}
+
+#[derive(Clone, Copy, Debug)]
 pub enum BlockDeviceError {
     IoError,
     OutOfRange,
     InvalidArgument,
     NoSpace,
     NotFound,
+    /// Another CPU holds the device.
+    Busy,
+}
+
+impl From<ManagedDeviceError> for BlockDeviceError {
+    fn from(error: ManagedDeviceError) -> Self {
+        match error {
+            ManagedDeviceError::Busy => BlockDeviceError::Busy,
+            ManagedDeviceError::NotProbed => BlockDeviceError::NotFound,
+            ManagedDeviceError::AlreadyProbed => BlockDeviceError::InvalidArgument,
+        }
+    }
 }
 
 impl fatfs::IoError for BlockDeviceError {
@@ -57,10 +135,17 @@ lazy_static! {
 pub fn register_block_device(device: &'static dyn BlockDevice) -> usize {
     let mut devices = BLOCK_DEVICES.write();
     devices.push(device);
-    devices.len() - 1
+    let id = devices.len() - 1;
+    block_queue::attach(id);
+    id
+}
+
+/// Registered devices, by id.
+pub fn block_devices() -> Vec<&'static dyn BlockDevice> {
+    BLOCK_DEVICES.read().clone()
 }
 
-fn block_device(id: usize) -> Option<&'static dyn BlockDevice> {
+pub(super) fn block_device(id: usize) -> Option<&'static dyn BlockDevice> {
     BLOCK_DEVICES.read().get(id).copied()
 }
 
@@ -70,9 +155,16 @@ pub fn read_sectors(
     count: usize,
     buf: &mut [u8],
 ) -> Result<usize, BlockDeviceError> {
-    block_device(id)
-        .ok_or(BlockDeviceError::NotFound)?
-        .read_sectors(lba, count, buf)
+    let len = count
+        * block_device(id)
+            .ok_or(BlockDeviceError::NotFound)?
+            .sector_size();
+    block_queue::submit(
+        id,
+        &mut [BlockRequest::read(lba, &mut buf[..len])],
+        |_, _| {},
+    )?;
+    Ok(count)
 }
 
 pub fn write_sectors(
@@ -81,9 +173,29 @@ pub fn write_sectors(
     count: usize,
     buf: &[u8],
 ) -> Result<usize, BlockDeviceError> {
+    let len = count
+        * block_device(id)
+            .ok_or(BlockDeviceError::NotFound)?
+            .sector_size();
+    block_queue::submit(id, &mut [BlockRequest::write(lba, &buf[..len])], |_, _| {})?;
+    writeback::wrote(id);
+    Ok(count)
+}
+
+pub fn sector_count(id: usize) -> Option<u64> {
     block_device(id)
-        .ok_or(BlockDeviceError::NotFound)?
-        .write_sectors(lba, count, buf)
+        .map(|device| device.sector_count())
+        .filter(|&sectors| sectors != 0)
+}
+
+pub fn discard_cache(id: usize, lba: u64, count: usize) {
+    if let Some(device) = block_device(id) {
+        device.discard_cache(lba, count);
+    }
+}
+
+pub fn sync(id: usize) -> Result<(), BlockDeviceError> {
+    block_device(id).ok_or(BlockDeviceError::NotFound)?.sync()
 }
 
 pub fn sync_all() {
@@ -0,0 +1,319 @@
+use alloc::{boxed::Box, vec::Vec};
+use core::sync::atomic::{AtomicUsize, Ordering};
+use lazy_static::lazy_static;
+use spin::{Mutex, RwLock};
+
+use super::block_dev::{BlockDevice, BlockDeviceError, block_device};
+use crate::smp;
+
+/// Sectors one merged dispatch may span.
+const MAX_MERGED_SECTORS: usize = 1024;
+
+/// Buffer of one request: read into, or written from.
+pub enum BlockBuffer<'a> {
+    Read(&'a mut [u8]),
+    Write(&'a [u8]),
+}
+
+/// Whole sectors from `lba`, as many as the buffer holds.
+pub struct BlockRequest<'a> {
+    pub lba: u64,
+    pub buffer: BlockBuffer<'a>,
+}
+
+impl<'a> BlockRequest<'a> {
+    pub fn read(lba: u64, buf: &'a mut [u8]) -> Self {
+        Self {
+            lba,
+            buffer: BlockBuffer::Read(buf),
+        }
+    }
+
+    pub fn write(lba: u64, buf: &'a [u8]) -> Self {
+        Self {
+            lba,
+            buffer: BlockBuffer::Write(buf),
+        }
+    }
+
+    fn len(&self) -> usize {
+        match &self.buffer {
+            BlockBuffer::Read(buf) => buf.len(),
+            BlockBuffer::Write(buf) => buf.len(),
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+pub struct QueueStats {
+    /// Requests submitted.
+    pub requests: usize,
+    /// Calls made to the driver.
+    pub dispatches: usize,
+    /// Requests that joined a neighbour's dispatch.
+    pub merged: usize,
+}
+
+type Completion = Mutex<Option<Result<(), BlockDeviceError>>>;
+
+/// Request waiting in a queue. Its buffer and completion belong to the
+/// submitter, which does not return before the request completed.
+struct Queued {
+    lba: u64,
+    count: usize,
+    data: *mut u8,
+    write: bool,
+    done: *const Completion,
+}
+
+unsafe impl Send for Queued {}
+
+impl Queued {
+    fn complete(&self, result: Result<(), BlockDeviceError>) {
+        *unsafe { &*self.done }.lock() = Some(result);
+    }
+}
+
+/// Requests waiting for the dispatcher.
+struct Pending {
+    requests: Vec<Queued>,
+    /// Sector after the last dispatch, where the sweep resumes.
+    head: u64,
+}
+
+/// Requests of every CPU for one device. Whichever submitter finds no
+/// dispatcher becomes it and drains the queue, requests of other CPUs
+/// included, sorted in one sweep over the disk and merged where they touch.
+struct RequestQueue {
+    pending: Mutex<Pending>,
+    /// CPU dispatching plus one, 0 when idle.
+    dispatcher: AtomicUsize,
+    requests: AtomicUsize,
+    dispatches: AtomicUsize,
+    merged: AtomicUsize,
+}
+
+impl RequestQueue {
+    const fn new() -> Self {
+        Self {
+            pending: Mutex::new(Pending {
+                requests: Vec::new(),
+                head: 0,
+            }),
+            dispatcher: AtomicUsize::new(0),
+            requests: AtomicUsize::new(0),
+            dispatches: AtomicUsize::new(0),
+            merged: AtomicUsize::new(0),
+        }
+    }
+
+    /// Runs batches until the queue is empty. Each batch is ordered by
+    /// C-LOOK from the current head, then runs of adjacent sectors going the
+    /// same way become one driver call.
+    fn dispatch(&self, device: &dyn BlockDevice, sector_size: usize) {
+        loop {
+            let (mut batch, mut head) = {
+                let mut pending = self.pending.lock();
+                (core::mem::take(&mut pending.requests), pending.head)
+            };
+            if batch.is_empty() {
+                return;
+            }
+
+            batch.sort_by_key(|request| (request.lba < head, request.lba));
+
+            let mut start = 0;
+            while start < batch.len() {
+                let first = &batch[start];
+                let mut end = start + 1;
+                let mut sectors = first.count;
+                while let Some(next) = batch.get(end) {
+                    let previous = &batch[end - 1];
+                    if next.write != first.write
+                        || next.lba != previous.lba + previous.count as u64
+                        || sectors + next.count > MAX_MERGED_SECTORS
+                    {
+                        break;
+                    }
+                    sectors += next.count;
+                    end += 1;
+                }
+
+                let run = &batch[start..end];
+                let result = Self::run(device, run, sectors, sector_size);
+                for request in run {
+                    request.complete(result);
+                }
+                self.dispatches.fetch_add(1, Ordering::Relaxed);
+                self.merged.fetch_add(run.len() - 1, Ordering::Relaxed);
+                head = first.lba + sectors as u64;
+                start = end;
+            }
+            // Only the dispatcher moves the head.
+            self.pending.lock().head = head;
+        }
+    }
+
+    /// One driver call for `run`. Buffers that follow each other in memory
+    /// are used in place; others go through one gathered copy.
+    fn run(
+        device: &dyn BlockDevice,
+        run: &[Queued],
+        sectors: usize,
+        sector_size: usize,
+    ) -> Result<(), BlockDeviceError> {
+        let first = &run[0];
+        let len = sectors * sector_size;
+        let in_place = run
+            .windows(2)
+            .all(|pair| pair[0].data.wrapping_add(pair[0].count * sector_size) == pair[1].data);
+
+        if in_place {
+            let buf = unsafe { core::slice::from_raw_parts_mut(first.data, len) };
+            return if first.write {
+                device.write_sectors(first.lba, sectors, buf).map(|_| ())
+            } else {
+                device.read_sectors(first.lba, sectors, buf).map(|_| ())
+            };
+        }
+
+        let mut gathered = vec![0u8; len];
+        let mut offset = 0;
+        if first.write {
+            for request in run {
+                let size = request.count * sector_size;
+                gathered[offset..offset + size]
+                    .copy_from_slice(unsafe { core::slice::from_raw_parts(request.data, size) });
+                offset += size;
+            }
+            return device
+                .write_sectors(first.lba, sectors, &gathered)
+                .map(|_| ());
+        }
+
+        device.read_sectors(first.lba, sectors, &mut gathered)?;
+        for request in run {
+            let size = request.count * sector_size;
+            unsafe { core::slice::from_raw_parts_mut(request.data, size) }
+                .copy_from_slice(&gathered[offset..offset + size]);
+            offset += size;
+        }
+        Ok(())
+    }
+}
+
+lazy_static! {
+    static ref QUEUES: RwLock<Vec<&'static RequestQueue>> = RwLock::new(Vec::new());
+}
+
+/// Gives block device `id` its request queue; called as it registers.
+pub(super) fn attach(id: usize) {
+    let mut queues = QUEUES.write();
+    while queues.len() <= id {
+        queues.push(Box::leak(Box::new(RequestQueue::new())));
+    }
+}
+
+fn queue(id: usize) -> Option<&'static RequestQueue> {
+    QUEUES.read().get(id).copied()
+}
+
+/// Submits `requests` to block device `id` as one batch and waits for
+/// them, calling `complete` with each request's index as it finishes.
+/// Requests of a batch must not overlap; they may run in any order. The
+/// first error is returned once every request completed.
+pub fn submit(
+    id: usize,
+    requests: &mut [BlockRequest<'_>],
+    mut complete: impl FnMut(usize, Result<(), BlockDeviceError>),
+) -> Result<(), BlockDeviceError> {
+    let device = block_device(id).ok_or(BlockDeviceError::NotFound)?;
+    let queue = queue(id).ok_or(BlockDeviceError::NotFound)?;
+    let sector_size = device.sector_size();
+    if requests
+        .iter()
+        .any(|request| request.len() == 0 || request.len() % sector_size != 0)
+    {
+        return Err(BlockDeviceError::InvalidArgument);
+    }
+
+    let completions: Vec<Completion> = requests.iter().map(|_| Mutex::new(None)).collect();
+    {
+        let mut pending = queue.pending.lock();
+        for (request, done) in requests.iter_mut().zip(completions.iter()) {
+            let (data, write) = match &mut request.buffer {
+                BlockBuffer::Read(buf) => (buf.as_mut_ptr(), false),
+                BlockBuffer::Write(buf) => (buf.as_ptr() as *mut u8, true),
+            };
+            pending.requests.push(Queued {
+                lba: request.lba,
+                count: request.len() / sector_size,
+                data,
+                write,
+                done,
+            });
+        }
+    }
+    queue.requests.fetch_add(requests.len(), Ordering::Relaxed);
+
+    let cpu = smp::cpu_id() + 1;
+    let mut finished = vec![false; requests.len()];
+    let mut remaining = requests.len();
+    let mut error = None;
+    while remaining > 0 {
+        for (index, done) in completions.iter().enumerate() {
+            if finished[index] {
+                continue;
+            }
+            let Some(result) = done.lock().take() else {
+                continue;
+            };
+            finished[index] = true;
+            remaining -= 1;
+            if let Err(err) = result {
+                error.get_or_insert(err);
+            }
+            complete(index, result);
+        }
+        if remaining == 0 {
+            break;
+        }
+
+        match queue
+            .dispatcher
+            .compare_exchange(0, cpu, Ordering::Acquire, Ordering::Relaxed)
+        {
+            Ok(_) => {
+                queue.dispatch(device, sector_size);
+                queue.dispatcher.store(0, Ordering::Release);
+            }
+            // Submitted from inside this CPU's own dispatch, as when the
+            // driver faults a page in: drain it here rather than wait on
+            // ourselves.
+            Err(owner) if owner == cpu => queue.dispatch(device, sector_size),
+            Err(_) => core::hint::spin_loop(),
+        }
+    }
+
+    match error {
+        Some(error) => Err(error),
+        None => Ok(()),
+    }
+}
+
+pub fn stats(id: usize) -> Option<QueueStats> {
+    let queue = queue(id)?;
+    Some(QueueStats {
+        requests: queue.requests.load(Ordering::Relaxed),
+        dispatches: queue.dispatches.load(Ordering::Relaxed),
+        merged: queue.merged.load(Ordering::Relaxed),
+    })
+}
+
+pub fn reset_stats(id: usize) {
+    if let Some(queue) = queue(id) {
+        queue.requests.store(0, Ordering::Relaxed);
+        queue.dispatches.store(0, Ordering::Relaxed);
+        queue.merged.store(0, Ordering::Relaxed);
+    }
+}
@@ -1,4 +1,11 @@
-use crate::device::block_dev::{read_sectors, sync_all, write_sectors};
+use alloc::{sync::Arc, vec::Vec};
+
+use crate::device::{
+    block_dev::{discard_cache, sector_count},
+    block_queue::{self, BlockRequest},
+    readahead::{HintCell, ReadAhead, ReadAheadHint},
+    writeback::{self, WriteLog},
+};
 use fatfs::{IoBase, Read, Seek, SeekFrom, Write};
 
 use super::block_dev::BlockDeviceError;
@@ -8,12 +15,24 @@ const BLOCK_SIZE: usize = 512;
 #[derive(Debug)]
 pub struct BufStream {
     id: usize,
-    pos: usize,
+    /// Byte offset on the device.
+    pos: u64,
+    /// Set by the file being read, for the duration of its call.
+    hint: Arc<HintCell>,
+    read_ahead: ReadAhead,
+    /// Takes the sectors written while a file records them.
+    log: Arc<WriteLog>,
 }
 
 impl BufStream {
-    pub fn new(id: usize) -> Self {
-        Self { id, pos: 0 }
+    pub fn new(id: usize, hint: Arc<HintCell>, log: Arc<WriteLog>) -> Self {
+        Self {
+            id,
+            pos: 0,
+            hint,
+            read_ahead: ReadAhead::default(),
+            log,
+        }
     }
 }
 
@@ -21,89 +40,210 @@ impl IoBase for BufStream {
     type Error = BlockDeviceError;
 }
 
-impl Read for BufStream {
-    fn read(&mut self, buf: &mut [u8]) -> Result<usize, BlockDeviceError> {
-        let mut total_read = 0;
+/// Blocks `len` bytes from a position touch. Whole blocks move between the
+/// caller's buffer and the device directly; only the partial blocks at
+/// either end go through a scratch buffer.
+struct Span {
+    lba: u64,
+    count: usize,
+    /// Offset of the position in the first block.
+    offset: usize,
+    len: usize,
+    /// The first block is partial.
+    head: bool,
+    /// The last block is partial, and not also the first.
+    tail: bool,
+}
 
-        while total_read < buf.len() {
-            let block_index = self.pos / BLOCK_SIZE;
-            let offset_in_block = self.pos % BLOCK_SIZE;
-            let to_read = core::cmp::min(BLOCK_SIZE - offset_in_block, buf.len() - total_read);
+impl Span {
+    fn new(pos: u64, len: usize) -> Self {
+        let offset = (pos % BLOCK_SIZE as u64) as usize;
+        let end = offset + len;
+        let count = end.div_ceil(BLOCK_SIZE);
+        Self {
+            lba: pos / BLOCK_SIZE as u64,
+            count,
+            offset,
+            len,
+            head: offset != 0 || end < BLOCK_SIZE,
+            tail: count > 1 && end % BLOCK_SIZE != 0,
+        }
+    }
+
+    fn edges(&self) -> usize {
+        self.head as usize + self.tail as usize
+    }
 
-            let mut block_buf = [0u8; BLOCK_SIZE];
+    /// First whole block, its count, and where it starts in the buffer.
+    fn whole(&self) -> (u64, usize, usize) {
+        let start = if self.head {
+            BLOCK_SIZE - self.offset
+        } else {
+            0
+        };
+        (
+            self.lba + self.head as u64,
+            self.count - self.edges(),
+            start,
+        )
+    }
 
-            match read_sectors(self.id, block_index as u64, 1, &mut block_buf) {
-                Ok(_) => {
-                    buf[total_read..total_read + to_read]
-                        .copy_from_slice(&block_buf[offset_in_block..offset_in_block + to_read]);
+    /// Bytes of the buffer in the head block, and in the tail block.
+    fn edge_lens(&self) -> (usize, usize) {
+        let head = if self.head {
+            self.len.min(BLOCK_SIZE - self.offset)
+        } else {
+            0
+        };
+        let tail = if self.tail {
+            (self.offset + self.len) % BLOCK_SIZE
+        } else {
+            0
+        };
+        (head, tail)
+    }
 
-                    self.pos += to_read;
-                    total_read += to_read;
-                }
-                Err(_) => {
-                    return Err(BlockDeviceError::IoError);
+    /// Read requests for the partial blocks into `scratch`, head first.
+    fn edge_reads<'a>(&self, scratch: &'a mut [u8]) -> Vec<BlockRequest<'a>> {
+        let mut requests = Vec::with_capacity(3);
+        let (head, rest) = scratch.split_at_mut(if self.head { BLOCK_SIZE } else { 0 });
+        if self.head {
+            requests.push(BlockRequest::read(self.lba, head));
+        }
+        if self.tail {
+            let lba = self.lba + self.count as u64 - 1;
+            requests.push(BlockRequest::read(lba, &mut rest[..BLOCK_SIZE]));
+        }
+        requests
+    }
+}
+
+impl Read for BufStream {
+    /// Whole blocks are read straight into `buf` in one request. The
+    /// partial blocks at either end and, when the read continues a
+    /// sequential stream, the read-ahead window follow in one batch; the
+    /// tail and the window sit next to each other on disk and in scratch,
+    /// so the queue merges them into one command. With a `Discard` hint the
+    /// whole blocks are dropped from the cache and not read at all.
+    fn read(&mut self, buf: &mut [u8]) -> Result<usize, BlockDeviceError> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
+
+        let span = Span::new(self.pos, buf.len());
+        let hint = self.hint.get();
+        let window = self.read_ahead.plan(span.lba, span.count, hint);
+
+        let (lba, count, start) = span.whole();
+        if count > 0 {
+            let whole = &mut buf[start..start + count * BLOCK_SIZE];
+            if hint == ReadAheadHint::Discard {
+                whole.fill(0);
+                discard_cache(self.id, lba, count);
+            } else {
+                block_queue::submit(self.id, &mut [BlockRequest::read(lba, whole)], |_, _| {})?;
+            }
+        }
+
+        let edges = span.edges();
+        let ahead = window.map_or(0, |(_, sectors)| sectors);
+        let mut scratch = vec![0u8; (edges + ahead) * BLOCK_SIZE];
+        if !scratch.is_empty() {
+            let (edge_blocks, window_blocks) = scratch.split_at_mut(edges * BLOCK_SIZE);
+            let mut requests = span.edge_reads(edge_blocks);
+            if let Some((start, _)) = window {
+                requests.push(BlockRequest::read(start, window_blocks));
+            }
+            let mut done = 0;
+            let result = block_queue::submit(self.id, &mut requests, |index, result| {
+                if index < edges && result.is_ok() {
+                    done += 1;
                 }
+            });
+            // The window ran past the end of the device.
+            if result.is_err() && done < edges {
+                block_queue::submit(self.id, &mut requests[..edges], |_, _| {})?;
             }
         }
 
-        Ok(total_read)
+        let (head, tail) = span.edge_lens();
+        let offset = span.offset;
+        buf[..head].copy_from_slice(&scratch[offset..offset + head]);
+        let tail_at = if span.head { BLOCK_SIZE } else { 0 };
+        let len = buf.len();
+        buf[len - tail..].copy_from_slice(&scratch[tail_at..tail_at + tail]);
+
+        self.pos += len as u64;
+        Ok(len)
     }
 }
 
 impl Write for BufStream {
+    /// Whole blocks are written straight from `buf` in one request. The
+    /// partial blocks at either end are read in one batch, patched, and
+    /// written back together.
     fn write(&mut self, buf: &[u8]) -> Result<usize, BlockDeviceError> {
-        let mut total_written = 0;
-
-        while total_written < buf.len() {
-            let block_index = self.pos / BLOCK_SIZE;
-            let offset_in_block = self.pos % BLOCK_SIZE;
-            let to_write = core::cmp::min(BLOCK_SIZE - offset_in_block, buf.len() - total_written);
-
-            let mut block_buf = [0u8; BLOCK_SIZE];
-
-            // Only read the block first if we're doing a partial write
-            if offset_in_block != 0 || to_write < BLOCK_SIZE {
-                match read_sectors(self.id, block_index as u64, 1, &mut block_buf) {
-                    Ok(_) => {}
-                    Err(_) => {
-                        return Err(BlockDeviceError::IoError);
-                    }
-                }
-            }
+        if buf.is_empty() {
+            return Ok(0);
+        }
 
-            // Copy data from input buffer into block buffer
-            block_buf[offset_in_block..offset_in_block + to_write]
-                .copy_from_slice(&buf[total_written..total_written + to_write]);
+        let span = Span::new(self.pos, buf.len());
+        let (lba, count, start) = span.whole();
+        if count > 0 {
+            let whole = &buf[start..start + count * BLOCK_SIZE];
+            block_queue::submit(self.id, &mut [BlockRequest::write(lba, whole)], |_, _| {})?;
+        }
 
-            match write_sectors(self.id, block_index as u64, 1, &block_buf) {
-                Ok(_) => {
-                    self.pos += to_write;
-                    total_written += to_write;
-                }
-                Err(_) => {
-                    return Err(BlockDeviceError::IoError);
-                }
+        let edges = span.edges();
+        if edges > 0 {
+            let mut scratch = vec![0u8; edges * BLOCK_SIZE];
+            block_queue::submit(self.id, &mut span.edge_reads(&mut scratch), |_, _| {})?;
+
+            let (head, tail) = span.edge_lens();
+            let offset = span.offset;
+            scratch[offset..offset + head].copy_from_slice(&buf[..head]);
+            let tail_at = if span.head { BLOCK_SIZE } else { 0 };
+            scratch[tail_at..tail_at + tail].copy_from_slice(&buf[buf.len() - tail..]);
+
+            let mut requests = Vec::with_capacity(2);
+            let (head_block, tail_block) = scratch.split_at(tail_at);
+            if span.head {
+                requests.push(BlockRequest::write(span.lba, head_block));
             }
+            if span.tail {
+                let lba = span.lba + span.count as u64 - 1;
+                requests.push(BlockRequest::write(lba, tail_block));
+            }
+            block_queue::submit(self.id, &mut requests, |_, _| {})?;
         }
 
-        Ok(total_written)
+        self.log.add(span.lba, span.count);
+        writeback::wrote(self.id);
+        self.pos += buf.len() as u64;
+        Ok(buf.len())
     }
 
+    /// fatfs flushes after most updates. Written sectors stay in the block
+    /// cache for the flusher, `fsync` or `sync` to write back.
     fn flush(&mut self) -> Result<(), BlockDeviceError> {
-        sync_all();
         Ok(())
     }
 }
 
 impl Seek for BufStream {
     fn seek(&mut self, pos: SeekFrom) -> Result<u64, BlockDeviceError> {
-        let new_pos = match pos {
-            SeekFrom::Current(_) => panic!("SeekFrom::Current not supported"),
-            SeekFrom::End(_) => panic!("SeekFrom::End not supported"),
-            SeekFrom::Start(x) => x as usize,
+        let (base, delta) = match pos {
+            SeekFrom::Start(offset) => (offset, 0),
+            SeekFrom::Current(delta) => (self.pos, delta),
+            SeekFrom::End(delta) => {
+                let sectors = sector_count(self.id).ok_or(BlockDeviceError::InvalidArgument)?;
+                (sectors * BLOCK_SIZE as u64, delta)
+            }
         };
 
-        self.pos = new_pos;
-        Ok(self.pos as u64)
+        self.pos = base
+            .checked_add_signed(delta)
+            .ok_or(BlockDeviceError::InvalidArgument)?;
+        Ok(self.pos)
     }
 }
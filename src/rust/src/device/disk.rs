@@ -1,14 +1,18 @@
 #![allow(unused)]
 
-use alloc::{collections::BTreeMap, sync::Arc, vec::Vec};
-use bytemuck::cast_slice;
 use core::sync::atomic::{AtomicUsize, Ordering};
-use spin::Mutex;
+
+use crate::{
+    constant::{BLOCK_CACHE_SECTORS, irq_to_vector},
+    interrupts::{InterruptDevice, InterruptSource, enable_irq_line},
+};
 
 use super::{
-    block_dev::{BlockDevice, BlockDeviceError, register_block_device},
+    block_cache::{BlockCache, SECTOR_SIZE},
+    block_dev::{BlockDevice, BlockDeviceError, CacheInfo, WriteBackState, register_block_device},
     driver::{DeviceDriver, DeviceProbeStage},
-    io::{inb, inw, outb, outw},
+    ide_dma::{BusMaster, DmaError},
+    io::{inb, insw, outb, outsw},
     managed::ManagedDevice,
 };
 
@@ -26,35 +30,71 @@ const ATA_STATUS_DF: u8 = 0x20;
 const ATA_STATUS_BSY: u8 = 0x80;
 
 const ATA_CMD_READ_SECTORS: u8 = 0x20;
+const ATA_CMD_READ_SECTORS_EXT: u8 = 0x24;
+const ATA_CMD_READ_MULTIPLE_EXT: u8 = 0x29;
 const ATA_CMD_WRITE_SECTORS: u8 = 0x30;
+const ATA_CMD_WRITE_SECTORS_EXT: u8 = 0x34;
+const ATA_CMD_WRITE_DMA_EXT: u8 = 0x35;
+const ATA_CMD_READ_DMA_EXT: u8 = 0x25;
+const ATA_CMD_WRITE_MULTIPLE_EXT: u8 = 0x39;
+const ATA_CMD_READ_MULTIPLE: u8 = 0xC4;
+const ATA_CMD_WRITE_MULTIPLE: u8 = 0xC5;
+const ATA_CMD_SET_MULTIPLE_MODE: u8 = 0xC6;
+const ATA_CMD_READ_DMA: u8 = 0xC8;
+const ATA_CMD_WRITE_DMA: u8 = 0xCA;
+const ATA_CMD_IDENTIFY: u8 = 0xEC;
+
+const ATA_DRIVE_MASTER: u8 = 0xA0;
 const ATA_DRIVE_LBA_MASTER: u8 = 0xE0;
 const ATA_WAIT_TIMEOUT: usize = 1_000_000;
 
+/// IDENTIFY DEVICE words.
+const ATA_IDENT_MAX_MULTIPLE: usize = 47;
+const ATA_IDENT_CAPABILITIES: usize = 49;
+const ATA_IDENT_LBA28_SECTORS: usize = 60;
+const ATA_IDENT_COMMAND_SETS: usize = 83;
+const ATA_IDENT_LBA48_SECTORS: usize = 100;
+const ATA_COMMAND_SET_LBA48: u16 = 1 << 10;
+const ATA_CAPABILITY_DMA: u16 = 1 << 8;
+
+const ATA_PRIMARY_BASE: u16 = 0x1F0;
+/// The primary channel interrupts on this line in compatibility mode,
+/// whatever the controller's PCI interrupt line says.
+const ATA_PRIMARY_IRQ: u8 = 14;
+
+/// Sectors one command moves at most; the 28-bit sector count register
+/// encodes 256 as 0.
+pub const ATA_MAX_TRANSFER_SECTORS: usize = 256;
+const ATA_LBA28_LIMIT: u64 = 1 << 28;
+
 pub enum DiskError {
     Timeout,
     IoError,
 }
 
-#[derive(Debug)]
-pub struct CacheEntry {
-    pub data: [u16; 256],
-    pub dirty: bool,
-    pub nb_use: u64,
-}
-
+/// Command block registers of an ATA channel, driving its master drive.
 #[derive(Debug, Default)]
-pub struct Disk {
+struct AtaPort {
     base: u16,
-    cache: BTreeMap<u64, Arc<Mutex<CacheEntry>>>,
-    cache_size: usize,
+    /// The drive takes 48-bit LBAs, so sectors past 128 GiB are reachable.
+    lba48: bool,
+    /// Sectors per data request of READ/WRITE MULTIPLE; 1 when the drive
+    /// has no multiple mode and plain READ/WRITE SECTORS is used.
+    multiple: usize,
+    /// Addressable sectors, 0 if the drive did not say.
+    sectors: u64,
+    /// Bus master of the controller, set when the drive also does DMA.
+    dma: Option<BusMaster>,
 }
 
-impl Disk {
-    pub fn new(base: u16) -> Self {
+impl AtaPort {
+    fn new(base: u16) -> Self {
         Self {
             base,
-            cache: BTreeMap::new(),
-            cache_size: 128,
+            lba48: false,
+            multiple: 1,
+            sectors: 0,
+            dma: None,
         }
     }
 
@@ -65,7 +105,11 @@ impl Disk {
     fn wait_ready(&self) -> Result<(), DiskError> {
         let mut timeout = ATA_WAIT_TIMEOUT;
         while timeout > 0 {
-            if self.status() & ATA_STATUS_BSY == 0 {
+            let status = self.status();
+            if status & ATA_STATUS_BSY == 0 {
+                if status & (ATA_STATUS_ERR | ATA_STATUS_DF) != 0 {
+                    return Err(DiskError::IoError);
+                }
                 return Ok(());
             }
             timeout -= 1;
@@ -90,105 +134,231 @@ impl Disk {
         Err(DiskError::Timeout)
     }
 
-    fn select_lba_sector(&self, lba: u64) -> Result<(), DiskError> {
+    /// Reads IDENTIFY DEVICE and turns on the largest multiple mode the
+    /// drive offers. A drive that does not answer keeps single-sector,
+    /// 28-bit transfers.
+    fn identify(&mut self) -> Result<(), DiskError> {
+        unsafe {
+            outb(self.base + ATA_REG_DRIVE, ATA_DRIVE_MASTER);
+            outb(self.base + ATA_REG_SECTOR_COUNT, 0);
+            outb(self.base + ATA_REG_LBA_LOW, 0);
+            outb(self.base + ATA_REG_LBA_MID, 0);
+            outb(self.base + ATA_REG_LBA_HIGH, 0);
+            outb(self.base + ATA_REG_STATUS_COMMAND, ATA_CMD_IDENTIFY);
+        }
+        if self.status() == 0 {
+            return Err(DiskError::IoError);
+        }
+        self.wait_data_request()?;
+
+        let mut raw = [0u8; SECTOR_SIZE];
+        unsafe { insw(self.base + ATA_REG_DATA, &mut raw) };
+        let word = |index: usize| u16::from_le_bytes([raw[index * 2], raw[index * 2 + 1]]);
+        let dword = |index: usize| word(index) as u64 | (word(index + 1) as u64) << 16;
+
+        self.lba48 = word(ATA_IDENT_COMMAND_SETS) & ATA_COMMAND_SET_LBA48 != 0;
+        self.sectors = if self.lba48 {
+            dword(ATA_IDENT_LBA48_SECTORS) | (dword(ATA_IDENT_LBA48_SECTORS + 2) << 32)
+        } else {
+            dword(ATA_IDENT_LBA28_SECTORS)
+        };
+
+        if word(ATA_IDENT_CAPABILITIES) & ATA_CAPABILITY_DMA != 0 {
+            self.dma = BusMaster::probe();
+        }
+
+        let multiple = (word(ATA_IDENT_MAX_MULTIPLE) & 0xff) as u8;
+        if multiple > 1 {
+            self.wait_ready()?;
+            unsafe {
+                outb(self.base + ATA_REG_DRIVE, ATA_DRIVE_LBA_MASTER);
+                outb(self.base + ATA_REG_SECTOR_COUNT, multiple);
+                outb(
+                    self.base + ATA_REG_STATUS_COMMAND,
+                    ATA_CMD_SET_MULTIPLE_MODE,
+                );
+            }
+            if self.wait_ready().is_ok() {
+                self.multiple = multiple as usize;
+            }
+        }
+        Ok(())
+    }
+
+    /// Loads the task file for `count` sectors (at most
+    /// `ATA_MAX_TRANSFER_SECTORS`) from `lba`. Returns whether the 48-bit
+    /// command set must be used.
+    fn select(&self, lba: u64, count: usize) -> Result<bool, DiskError> {
+        let end = lba + count as u64;
+        let extended = end > ATA_LBA28_LIMIT;
+        if (extended && !self.lba48) || (self.sectors != 0 && end > self.sectors) {
+            return Err(DiskError::IoError);
+        }
+
         self.wait_ready()?;
         unsafe {
-            outb(
-                self.base + ATA_REG_DRIVE,
-                ATA_DRIVE_LBA_MASTER | ((lba >> 24) as u8 & 0x0f),
-            );
-            outb(self.base + ATA_REG_SECTOR_COUNT, 1);
+            if extended {
+                // High-order bytes go first; each register keeps the last two.
+                outb(self.base + ATA_REG_DRIVE, ATA_DRIVE_LBA_MASTER);
+                outb(self.base + ATA_REG_SECTOR_COUNT, (count >> 8) as u8);
+                outb(self.base + ATA_REG_LBA_LOW, (lba >> 24) as u8);
+                outb(self.base + ATA_REG_LBA_MID, (lba >> 32) as u8);
+                outb(self.base + ATA_REG_LBA_HIGH, (lba >> 40) as u8);
+            } else {
+                outb(
+                    self.base + ATA_REG_DRIVE,
+                    ATA_DRIVE_LBA_MASTER | ((lba >> 24) as u8 & 0x0f),
+                );
+            }
+            outb(self.base + ATA_REG_SECTOR_COUNT, count as u8);
             outb(self.base + ATA_REG_LBA_LOW, lba as u8);
             outb(self.base + ATA_REG_LBA_MID, (lba >> 8) as u8);
             outb(self.base + ATA_REG_LBA_HIGH, (lba >> 16) as u8);
         }
-        Ok(())
+        Ok(extended)
     }
 
-    fn evict(&mut self) -> Result<(), DiskError> {
-        if self.cache.len() >= self.cache_size {
-            if let Some(&key) = self
-                .cache
-                .iter()
-                .filter(|&(_, entry)| !entry.lock().dirty)
-                .min_by_key(|&(_, entry)| entry.lock().nb_use)
-                .map(|(k, _)| k)
-            {
-                self.cache.remove(&key);
-            } else if let Some(&key) = self
-                .cache
-                .iter()
-                .min_by_key(|&(_, entry)| entry.lock().nb_use)
-                .map(|(k, _)| k)
-            {
-                self.write_cache(key)?;
-                self.cache.remove(&key);
-            }
+    fn read_command(&self, extended: bool) -> u8 {
+        match (extended, self.multiple > 1) {
+            (false, false) => ATA_CMD_READ_SECTORS,
+            (false, true) => ATA_CMD_READ_MULTIPLE,
+            (true, false) => ATA_CMD_READ_SECTORS_EXT,
+            (true, true) => ATA_CMD_READ_MULTIPLE_EXT,
         }
+    }
 
-        Ok(())
+    fn write_command(&self, extended: bool) -> u8 {
+        match (extended, self.multiple > 1) {
+            (false, false) => ATA_CMD_WRITE_SECTORS,
+            (false, true) => ATA_CMD_WRITE_MULTIPLE,
+            (true, false) => ATA_CMD_WRITE_SECTORS_EXT,
+            (true, true) => ATA_CMD_WRITE_MULTIPLE_EXT,
+        }
     }
 
-    fn write_cache(&mut self, lba: u64) -> Result<(), DiskError> {
-        if let Some(entry) = self.cache.get(&lba).cloned() {
-            let mut entry = entry.lock();
-            if entry.dirty {
-                self.select_lba_sector(lba)?;
-                unsafe { outb(self.base + ATA_REG_STATUS_COMMAND, ATA_CMD_WRITE_SECTORS) };
-                self.wait_data_request()?;
+    /// Moves `len` bytes at `buf` with one DMA command. The CPU only polls
+    /// the controller until it is done.
+    fn transfer_dma(
+        &self,
+        dma: &BusMaster,
+        lba: u64,
+        buf: *const u8,
+        len: usize,
+        read: bool,
+    ) -> Result<(), DmaError> {
+        dma.prepare(buf, len, read)?;
+        let extended = self
+            .select(lba, len / SECTOR_SIZE)
+            .map_err(|_| DmaError::IoError)?;
+        let command = match (read, extended) {
+            (true, false) => ATA_CMD_READ_DMA,
+            (true, true) => ATA_CMD_READ_DMA_EXT,
+            (false, false) => ATA_CMD_WRITE_DMA,
+            (false, true) => ATA_CMD_WRITE_DMA_EXT,
+        };
+        unsafe { outb(self.base + ATA_REG_STATUS_COMMAND, command) };
+        dma.start();
+        dma.finish()?;
+        // Reading the status also lowers the drive's interrupt request.
+        self.wait_ready().map_err(|_| DmaError::IoError)
+    }
 
-                for j in 0..256 {
-                    unsafe { outw(self.base + ATA_REG_DATA, entry.data[j]) };
+    /// Reads the whole sectors of `buf` from `lba`, one command per
+    /// `ATA_MAX_TRANSFER_SECTORS`: by DMA when the buffer allows it,
+    /// otherwise with one string read per data request.
+    fn read_sectors(&self, lba: u64, buf: &mut [u8]) -> Result<(), DiskError> {
+        let per_command = ATA_MAX_TRANSFER_SECTORS * SECTOR_SIZE;
+        for (i, chunk) in buf.chunks_mut(per_command).enumerate() {
+            let lba = lba + (i * ATA_MAX_TRANSFER_SECTORS) as u64;
+            if let Some(dma) = &self.dma {
+                match self.transfer_dma(dma, lba, chunk.as_ptr(), chunk.len(), true) {
+                    Ok(()) => continue,
+                    Err(DmaError::Unsupported) => {}
+                    Err(DmaError::Timeout) => return Err(DiskError::Timeout),
+                    Err(DmaError::IoError) => return Err(DiskError::IoError),
                 }
-
-                self.wait_ready()?;
-                entry.dirty = false;
             }
 
-            entry.nb_use = 0;
+            let extended = self.select(lba, chunk.len() / SECTOR_SIZE)?;
+            unsafe {
+                outb(
+                    self.base + ATA_REG_STATUS_COMMAND,
+                    self.read_command(extended),
+                )
+            };
+
+            for block in chunk.chunks_mut(self.multiple * SECTOR_SIZE) {
+                self.wait_data_request()?;
+                unsafe { insw(self.base + ATA_REG_DATA, block) };
+            }
+            self.wait_ready()?;
         }
         Ok(())
     }
 
-    fn read_cache(&mut self, lba: u64) -> Result<Arc<Mutex<CacheEntry>>, DiskError> {
-        if let Some(entry) = self.cache.get_mut(&lba) {
-            entry.lock().nb_use += 1;
-            return Ok(entry.clone());
-        }
+    /// Writes the whole sectors of `buf` from `lba`, like `read_sectors`.
+    fn write_sectors(&self, lba: u64, buf: &[u8]) -> Result<(), DiskError> {
+        let per_command = ATA_MAX_TRANSFER_SECTORS * SECTOR_SIZE;
+        for (i, chunk) in buf.chunks(per_command).enumerate() {
+            let lba = lba + (i * ATA_MAX_TRANSFER_SECTORS) as u64;
+            if let Some(dma) = &self.dma {
+                match self.transfer_dma(dma, lba, chunk.as_ptr(), chunk.len(), false) {
+                    Ok(()) => continue,
+                    Err(DmaError::Unsupported) => {}
+                    Err(DmaError::Timeout) => return Err(DiskError::Timeout),
+                    Err(DmaError::IoError) => return Err(DiskError::IoError),
+                }
+            }
 
-        let mut buf: [u16; 256] = [0; 256];
+            let extended = self.select(lba, chunk.len() / SECTOR_SIZE)?;
+            unsafe {
+                outb(
+                    self.base + ATA_REG_STATUS_COMMAND,
+                    self.write_command(extended),
+                )
+            };
 
-        self.select_lba_sector(lba)?;
-        unsafe { outb(self.base + ATA_REG_STATUS_COMMAND, ATA_CMD_READ_SECTORS) };
-        self.wait_data_request()?;
-
-        for e in buf.iter_mut() {
-            *e = unsafe { inw(self.base + ATA_REG_DATA) };
+            for block in chunk.chunks(self.multiple * SECTOR_SIZE) {
+                self.wait_data_request()?;
+                unsafe { outsw(self.base + ATA_REG_DATA, block) };
+            }
+            self.wait_ready()?;
         }
-        self.wait_ready()?;
+        Ok(())
+    }
+}
 
-        let entry = Arc::new(Mutex::new(CacheEntry {
-            data: buf,
-            dirty: false,
-            nb_use: 0,
-        }));
-        self.evict()?;
-        self.cache.insert(lba, entry.clone());
-        Ok(entry)
+#[derive(Debug)]
+pub struct Disk {
+    port: AtaPort,
+    cache: BlockCache,
+}
+
+impl Disk {
+    pub fn new(base: u16) -> Self {
+        let mut port = AtaPort::new(base);
+        let _ = port.identify();
+        Self {
+            port,
+            cache: BlockCache::new(BLOCK_CACHE_SECTORS),
+        }
     }
 
+    /// Sectors missing from the cache are read with as few commands as
+    /// possible: each run of consecutive misses goes in one transfer.
     pub fn read_sectors_internal(
         &mut self,
         lba: u64,
         count: usize,
         buf: &mut [u8],
     ) -> Result<(), DiskError> {
-        for i in 0..count {
-            let entry = self.read_cache(lba + i as u64)?;
-            let entry = entry.lock();
-            buf[i * 512..(i + 1) * 512].copy_from_slice(cast_slice(&entry.data));
-        }
-        Ok(())
+        self.cache.read_through(
+            lba,
+            &mut buf[..count * SECTOR_SIZE],
+            ATA_MAX_TRANSFER_SECTORS,
+            |lba, data| self.port.read_sectors(lba, data),
+            |lba, data| self.port.write_sectors(lba, data),
+        )
     }
 
     pub fn write_sectors_internal(
@@ -197,29 +367,57 @@ impl Disk {
         count: usize,
         buf: &[u8],
     ) -> Result<(), DiskError> {
-        for i in 0..count {
-            let entry = self.read_cache(lba + i as u64)?;
-            let mut entry = entry.lock();
-            entry
-                .data
-                .copy_from_slice(cast_slice(&buf[i * 512..(i + 1) * 512]));
-            entry.dirty = true;
-        }
-        Ok(())
+        self.cache
+            .write_through(lba, &buf[..count * SECTOR_SIZE], |lba, data| {
+                self.port.write_sectors(lba, data)
+            })
     }
 
     pub fn sync(&mut self) -> Result<(), DiskError> {
-        let keys = self.cache.keys().cloned().collect::<Vec<_>>();
-        for &lba in keys.iter() {
-            self.write_cache(lba)?;
+        self.cache
+            .flush(|lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn sync_ranges(&mut self, ranges: &[(u64, usize)]) -> Result<(), DiskError> {
+        self.cache
+            .flush_ranges(ranges, |lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn write_back(&mut self, now: u64, max: usize) -> Result<WriteBackState, DiskError> {
+        self.cache
+            .flush_due(now, max, |lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn cache_info(&self) -> CacheInfo {
+        CacheInfo {
+            sectors: self.cache.len(),
+            capacity: self.cache.capacity(),
+            dirty: self.cache.dirty(),
+            stats: self.cache.stats(),
         }
-        Ok(())
+    }
+
+    pub fn set_cache_capacity(&mut self, sectors: usize) -> Result<(), DiskError> {
+        self.cache
+            .set_capacity(sectors, |lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn reset_cache_stats(&mut self) {
+        self.cache.reset_stats();
+    }
+
+    pub fn discard_cache(&mut self, lba: u64, count: usize) {
+        self.cache.discard(lba, count);
     }
 }
 
 pub struct DiskDriver {
     device: ManagedDevice<Disk>,
     block_device_id: AtomicUsize,
+    /// Bus-master registers for the interrupt handler, 0 without DMA.
+    dma_base: AtomicUsize,
+    /// DMA completion interrupts taken.
+    dma_interrupts: AtomicUsize,
 }
 
 impl core::fmt::Debug for DiskDriver {
@@ -235,6 +433,8 @@ impl DiskDriver {
         Self {
             device: ManagedDevice::new(),
             block_device_id: AtomicUsize::new(usize::MAX),
+            dma_base: AtomicUsize::new(0),
+            dma_interrupts: AtomicUsize::new(0),
         }
     }
 
@@ -242,6 +442,10 @@ impl DiskDriver {
         let id = self.block_device_id.load(Ordering::Acquire);
         if id == usize::MAX { None } else { Some(id) }
     }
+
+    pub fn dma_interrupts(&self) -> usize {
+        self.dma_interrupts.load(Ordering::Relaxed)
+    }
 }
 
 pub static DISK_DRIVER: DiskDriver = DiskDriver::new();
@@ -277,6 +481,47 @@ impl BlockDevice for DiskDriver {
             .with_mut(|disk| disk.sync().map_err(|_| BlockDeviceError::IoError))
             .ok_or(BlockDeviceError::NotFound)?
     }
+
+    fn sync_ranges(&self, ranges: &[(u64, usize)]) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.sync_ranges(ranges)
+                    .map_err(|_| BlockDeviceError::IoError)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn write_back(&self, now: u64, max_sectors: usize) -> Result<WriteBackState, BlockDeviceError> {
+        self.device.try_with_mut(|disk| {
+            disk.write_back(now, max_sectors)
+                .map_err(|_| BlockDeviceError::IoError)
+        })?
+    }
+
+    fn sector_count(&self) -> u64 {
+        self.device.with(|disk| disk.port.sectors).unwrap_or(0)
+    }
+
+    fn cache_info(&self) -> Option<CacheInfo> {
+        self.device.with(|disk| disk.cache_info())
+    }
+
+    fn set_cache_capacity(&self, sectors: usize) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.set_cache_capacity(sectors)
+                    .map_err(|_| BlockDeviceError::IoError)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn reset_cache_stats(&self) {
+        self.device.with_mut(|disk| disk.reset_cache_stats());
+    }
+
+    fn discard_cache(&self, lba: u64, count: usize) {
+        self.device.with_mut(|disk| disk.discard_cache(lba, count));
+    }
 }
 
 impl DeviceDriver for DiskDriver {
@@ -289,9 +534,17 @@ impl DeviceDriver for DiskDriver {
     }
 
     fn probe(&self) {
-        self.device
-            .probe(Disk::new(0x1F0))
-            .expect("disk device already probed");
+        let disk = Disk::new(ATA_PRIMARY_BASE);
+        if let Some(dma) = &disk.port.dma {
+            self.dma_base.store(dma.base() as usize, Ordering::Release);
+            if let Some(vector) = irq_to_vector(ATA_PRIMARY_IRQ) {
+                InterruptSource::new(vector).register_device(&DISK_DRIVER);
+                enable_irq_line(ATA_PRIMARY_IRQ);
+            }
+            serial_println!("disk: bus-master DMA io=0x{:x}", dma.base());
+        }
+
+        self.device.probe(disk).expect("disk device already probed");
         let id = register_block_device(&DISK_DRIVER);
         self.block_device_id.store(id, Ordering::Release);
     }
@@ -300,8 +553,21 @@ impl DeviceDriver for DiskDriver {
         if let Some(mut disk) = self.device.remove() {
             let _ = disk.sync();
         }
+        self.dma_base.store(0, Ordering::Release);
         self.block_device_id.store(usize::MAX, Ordering::Release);
     }
 }
 
+impl InterruptDevice for DiskDriver {
+    /// Acknowledges a finished DMA transfer. The CPU that started it sees
+    /// the completion in the controller's status, so nothing else is done.
+    fn interrupt(&self) {
+        let base = self.dma_base.load(Ordering::Acquire) as u16;
+        if base != 0 && BusMaster::acknowledge(base) {
+            unsafe { inb(ATA_PRIMARY_BASE + ATA_REG_STATUS_COMMAND) };
+            self.dma_interrupts.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
 crate::register_device_driver!(DISK_DRIVER_REG, DISK_DRIVER);
@@ -0,0 +1,165 @@
+use super::{
+    io::{inb, outb, outl},
+    pci::{PciBar, find_device_by_class},
+};
+use crate::memory::Page;
+
+const PCI_CLASS_MASS_STORAGE: u8 = 0x01;
+const PCI_SUBCLASS_IDE: u8 = 0x01;
+/// Programming interface bit of IDE controllers that can master the bus.
+const PCI_PROG_IF_BUS_MASTER: u8 = 0x80;
+const PCI_BAR_BUS_MASTER: u8 = 4;
+
+const BM_REG_COMMAND: u16 = 0x0;
+const BM_REG_STATUS: u16 = 0x2;
+const BM_REG_PRDT: u16 = 0x4;
+
+const BM_COMMAND_START: u8 = 0x01;
+/// Direction bit: the controller writes to memory, as for a disk read.
+const BM_COMMAND_TO_MEMORY: u8 = 0x08;
+
+const BM_STATUS_ACTIVE: u8 = 0x01;
+const BM_STATUS_ERROR: u8 = 0x02;
+const BM_STATUS_IRQ: u8 = 0x04;
+
+const PRD_END_OF_TABLE: u64 = 1 << 63;
+/// A region may not cross a 64 KiB boundary, and 0 encodes 64 KiB.
+const PRD_BOUNDARY: usize = 0x10000;
+const PRD_ENTRIES: usize = 512;
+const BM_WAIT_TIMEOUT: usize = 10_000_000;
+
+#[derive(Debug)]
+pub enum DmaError {
+    /// The buffer cannot be described by the PRD table; use PIO instead.
+    Unsupported,
+    Timeout,
+    IoError,
+}
+
+/// Bus-master registers of the primary channel of a PCI IDE controller,
+/// with the physical region descriptor table its transfers run from.
+#[derive(Debug)]
+pub struct BusMaster {
+    base: u16,
+    prdt: Page<u64>,
+}
+
+unsafe impl Send for BusMaster {}
+
+impl BusMaster {
+    /// Finds a bus-master capable IDE controller and lets it master the bus.
+    pub fn probe() -> Option<Self> {
+        let pci = find_device_by_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE)?;
+        if pci.prog_if & PCI_PROG_IF_BUS_MASTER == 0 {
+            return None;
+        }
+        let Some(PciBar::Io(base)) = pci.bar(PCI_BAR_BUS_MASTER) else {
+            return None;
+        };
+
+        pci.enable_io_space();
+        pci.enable_bus_mastering();
+        Some(Self {
+            base,
+            prdt: Page::new(PRD_ENTRIES)?,
+        })
+    }
+
+    pub fn base(&self) -> u16 {
+        self.base
+    }
+
+    fn status(&self) -> u8 {
+        unsafe { inb(self.base + BM_REG_STATUS) }
+    }
+
+    /// Describes `len` bytes at `address` in the PRD table. The kernel maps
+    /// its memory at the same physical addresses, so the buffer is one
+    /// physical region, cut where it crosses a 64 KiB boundary.
+    fn build_prdt(&self, address: usize, len: usize) -> Result<(), DmaError> {
+        if address & 1 != 0 || len & 1 != 0 || len == 0 {
+            return Err(DmaError::Unsupported);
+        }
+
+        let table = self.prdt.as_mut_slice();
+        let (mut address, end) = (address, address + len);
+        let mut count = 0;
+        while address < end {
+            if count == table.len() {
+                return Err(DmaError::Unsupported);
+            }
+            let boundary = (address & !(PRD_BOUNDARY - 1)) + PRD_BOUNDARY;
+            let size = boundary.min(end) - address;
+            table[count] = address as u64 | ((size % PRD_BOUNDARY) as u64) << 32;
+            address += size;
+            count += 1;
+        }
+        table[count - 1] |= PRD_END_OF_TABLE;
+        Ok(())
+    }
+
+    /// Loads the PRD table for `buf` and arms the controller. The transfer
+    /// starts with `start` once the drive has its command.
+    pub fn prepare(&self, buf: *const u8, len: usize, to_memory: bool) -> Result<(), DmaError> {
+        self.build_prdt(buf as usize, len)?;
+        let direction = if to_memory { BM_COMMAND_TO_MEMORY } else { 0 };
+        unsafe {
+            outb(self.base + BM_REG_COMMAND, direction);
+            outl(self.base + BM_REG_PRDT, self.prdt.as_ptr() as u32);
+            // Error and interrupt bits clear when written as 1.
+            outb(self.base + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+        }
+        Ok(())
+    }
+
+    pub fn start(&self) {
+        unsafe {
+            let command = inb(self.base + BM_REG_COMMAND);
+            outb(self.base + BM_REG_COMMAND, command | BM_COMMAND_START);
+        }
+    }
+
+    /// Waits until the controller has moved every region, then stops it.
+    /// Completion is read from the controller rather than waited for on the
+    /// IRQ: the interrupt handler may run on another CPU and clear it first.
+    pub fn finish(&self) -> Result<(), DmaError> {
+        let mut timeout = BM_WAIT_TIMEOUT;
+        let status = loop {
+            let status = self.status();
+            if status & BM_STATUS_ACTIVE == 0 || status & BM_STATUS_ERROR != 0 {
+                break status;
+            }
+            if timeout == 0 {
+                self.stop();
+                return Err(DmaError::Timeout);
+            }
+            timeout -= 1;
+            core::hint::spin_loop();
+        };
+
+        self.stop();
+        if status & BM_STATUS_ERROR != 0 {
+            return Err(DmaError::IoError);
+        }
+        Ok(())
+    }
+
+    fn stop(&self) {
+        unsafe {
+            let command = inb(self.base + BM_REG_COMMAND);
+            outb(self.base + BM_REG_COMMAND, command & !BM_COMMAND_START);
+            outb(self.base + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+        }
+    }
+
+    /// Acknowledges a completion interrupt. Returns whether the controller
+    /// raised it.
+    pub fn acknowledge(base: u16) -> bool {
+        let status = unsafe { inb(base + BM_REG_STATUS) };
+        if status & BM_STATUS_IRQ == 0 {
+            return false;
+        }
+        unsafe { outb(base + BM_REG_STATUS, BM_STATUS_IRQ) };
+        true
+    }
+}
@@ -74,3 +74,32 @@ pub unsafe fn outl(port: u16, value: u32) {
         );
     }
 }
+
+/// Fills `buf` with words read from `port` by one `rep insw`. The buffer
+/// needs no particular alignment; an odd last byte is left alone.
+pub unsafe fn insw(port: u16, buf: &mut [u8]) {
+    unsafe {
+        asm!(
+            "cld",
+            "rep insw",
+            in("dx") port,
+            inout("edi") buf.as_mut_ptr() => _,
+            inout("ecx") buf.len() / 2 => _,
+            options(nostack),
+        );
+    }
+}
+
+/// Writes `buf` to `port` as words by one `rep outsw`.
+pub unsafe fn outsw(port: u16, buf: &[u8]) {
+    unsafe {
+        asm!(
+            "cld",
+            "rep outsw",
+            in("dx") port,
+            inout("esi") buf.as_ptr() => _,
+            inout("ecx") buf.len() / 2 => _,
+            options(nostack, readonly),
+        );
+    }
+}
@@ -207,6 +207,7 @@ impl FileOps for KeyboardFile {
             mode: 0o666,
             size: 0,
             is_dir: false,
+            modified: 0,
         })
     }
 }
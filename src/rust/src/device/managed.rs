@@ -11,6 +11,9 @@ use crate::interrupts::without_interrupts;
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum ManagedDeviceError {
     AlreadyProbed,
+    NotProbed,
+    /// Another CPU holds the device.
+    Busy,
 }
 
 pub struct ManagedDevice<T> {
@@ -80,4 +83,17 @@ impl<T> ManagedDevice<T> {
             }
         })
     }
+
+    /// Like `with_mut`, but fails instead of waiting for the device.
+    pub fn try_with_mut<R>(&self, f: impl FnOnce(&mut T) -> R) -> Result<R, ManagedDeviceError> {
+        without_interrupts(|| {
+            let _guard = self.critical.try_lock().ok_or(ManagedDeviceError::Busy)?;
+            let ptr = self.ptr.load(Ordering::Acquire);
+            if ptr.is_null() {
+                Err(ManagedDeviceError::NotProbed)
+            } else {
+                Ok(unsafe { f(&mut *ptr) })
+            }
+        })
+    }
 }
@@ -1,9 +1,13 @@
+pub mod ahci;
+pub mod block_cache;
 pub mod block_dev;
+pub mod block_queue;
 pub mod bufstream;
 pub mod console;
 pub mod control;
 pub mod disk;
 pub mod driver;
+pub mod ide_dma;
 pub mod io;
 pub mod keyboard;
 pub mod managed;
@@ -11,9 +15,13 @@ pub mod network;
 pub mod node;
 pub mod null;
 pub mod pci;
+pub mod ram_disk;
+pub mod readahead;
 pub mod screen;
 pub mod serial;
 pub mod timer;
+pub mod virtio_blk;
+pub mod writeback;
 pub mod zero;
 
 #[allow(unused_imports)]
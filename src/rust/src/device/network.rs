@@ -3,13 +3,13 @@
 use alloc::vec::Vec;
 
 use crate::{
-    constant::{PIC_MASTER_DATA_PORT, PIC_SLAVE_DATA_PORT, PIC_SLAVE_IRQ_MASK, irq_to_vector},
+    constant::irq_to_vector,
     device::{
         DeviceDriver, DeviceProbeStage, ManagedDevice,
         io::{inb as port_inb, inw as port_inw, outb, outl, outw},
         pci::{PciBar, PciDevice, find_device},
     },
-    interrupts::{InterruptDevice, InterruptSource},
+    interrupts::{InterruptDevice, InterruptSource, enable_irq_line},
     memory::Page,
     net::{self, InterfaceId, NetworkDevice, NetworkError},
 };
@@ -422,26 +422,3 @@ impl Rtl8139 {
         unsafe { outl(self.io_base + offset, value) };
     }
 }
-
-fn enable_irq_line(irq_line: u8) {
-    if irq_line >= 16 {
-        return;
-    }
-
-    let mut master_mask = unsafe { port_inb(PIC_MASTER_DATA_PORT) };
-    let mut slave_mask = unsafe { port_inb(PIC_SLAVE_DATA_PORT) };
-
-    if irq_line < 8 {
-        master_mask &= !1u8.wrapping_shl(irq_line as u32);
-        unsafe { outb(PIC_MASTER_DATA_PORT, master_mask) };
-        return;
-    }
-
-    master_mask &= !PIC_SLAVE_IRQ_MASK;
-    slave_mask &= !1u8.wrapping_shl((irq_line - 8) as u32);
-
-    unsafe {
-        outb(PIC_MASTER_DATA_PORT, master_mask);
-        outb(PIC_SLAVE_DATA_PORT, slave_mask);
-    }
-}
@@ -0,0 +1,225 @@
+use alloc::{boxed::Box, vec::Vec};
+use core::{
+    ops::Range,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use crate::{
+    constant::RAM_DISK_SECTORS,
+    fs::{FileHandle, FileMetadata, FileOps, FsError},
+};
+
+use super::{
+    block_cache::SECTOR_SIZE,
+    block_dev::{BlockDevice, BlockDeviceError, register_block_device},
+    driver::{DeviceDriver, DeviceProbeStage},
+    managed::ManagedDevice,
+};
+
+/// Block device over kernel memory. It has no cache and no controller to
+/// wait on, so FAT and VFS costs can be measured on it alone.
+#[derive(Debug)]
+pub struct RamDisk {
+    data: Vec<u8>,
+}
+
+impl RamDisk {
+    fn new(sectors: usize) -> Self {
+        Self {
+            data: vec![0u8; sectors * SECTOR_SIZE],
+        }
+    }
+
+    fn sectors(&self) -> u64 {
+        (self.data.len() / SECTOR_SIZE) as u64
+    }
+
+    /// Bytes of `count` sectors from `lba`, checked against the disk and a
+    /// buffer of `len` bytes.
+    fn range(&self, lba: u64, count: usize, len: usize) -> Result<Range<usize>, BlockDeviceError> {
+        if len < count * SECTOR_SIZE {
+            return Err(BlockDeviceError::InvalidArgument);
+        }
+        let end = lba
+            .checked_add(count as u64)
+            .filter(|&end| end <= self.sectors())
+            .ok_or(BlockDeviceError::OutOfRange)?;
+        Ok(lba as usize * SECTOR_SIZE..end as usize * SECTOR_SIZE)
+    }
+
+    /// Takes `image` as the start of the disk, growing the disk to fit.
+    fn load(&mut self, mut image: Vec<u8>) {
+        let len = image
+            .len()
+            .max(self.data.len())
+            .next_multiple_of(SECTOR_SIZE);
+        image.resize(len, 0);
+        self.data = image;
+    }
+}
+
+pub struct RamDiskDriver {
+    device: ManagedDevice<RamDisk>,
+    block_device_id: AtomicUsize,
+}
+
+impl core::fmt::Debug for RamDiskDriver {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("RamDiskDriver")
+            .field("block_device_id", &self.block_device_id())
+            .finish()
+    }
+}
+
+impl RamDiskDriver {
+    pub const fn new() -> Self {
+        Self {
+            device: ManagedDevice::new(),
+            block_device_id: AtomicUsize::new(usize::MAX),
+        }
+    }
+
+    pub fn block_device_id(&self) -> Option<usize> {
+        let id = self.block_device_id.load(Ordering::Acquire);
+        if id == usize::MAX { None } else { Some(id) }
+    }
+
+    /// Replaces the contents with `image`, for a volume prepared on the
+    /// host. Nothing may be mounted from the disk yet.
+    pub fn load(&self, image: Vec<u8>) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| disk.load(image))
+            .ok_or(BlockDeviceError::NotFound)
+    }
+}
+
+pub static RAM_DISK_DRIVER: RamDiskDriver = RamDiskDriver::new();
+
+impl BlockDevice for RamDiskDriver {
+    fn read_sectors(
+        &self,
+        lba: u64,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, BlockDeviceError> {
+        self.device
+            .with(|disk| {
+                let range = disk.range(lba, count, buf.len())?;
+                buf[..range.len()].copy_from_slice(&disk.data[range]);
+                Ok(count)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn write_sectors(&self, lba: u64, count: usize, buf: &[u8]) -> Result<usize, BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                let range = disk.range(lba, count, buf.len())?;
+                let len = range.len();
+                disk.data[range].copy_from_slice(&buf[..len]);
+                Ok(count)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn sector_count(&self) -> u64 {
+        self.device.with(|disk| disk.sectors()).unwrap_or(0)
+    }
+}
+
+impl DeviceDriver for RamDiskDriver {
+    fn name(&self) -> &'static str {
+        "ram-disk"
+    }
+
+    fn stage(&self) -> DeviceProbeStage {
+        DeviceProbeStage::Normal
+    }
+
+    fn probe(&self) {
+        if RAM_DISK_SECTORS == 0 {
+            return;
+        }
+
+        self.device
+            .probe(RamDisk::new(RAM_DISK_SECTORS))
+            .expect("ram disk already probed");
+        let id = register_block_device(&RAM_DISK_DRIVER);
+        self.block_device_id.store(id, Ordering::Release);
+        serial_println!(
+            "ram-disk: {} sectors as block device {}",
+            RAM_DISK_SECTORS,
+            id
+        );
+    }
+
+    fn remove(&self) {
+        self.device.remove();
+        self.block_device_id.store(usize::MAX, Ordering::Release);
+    }
+}
+
+crate::register_device_driver!(RAM_DISK_DRIVER_REG, RAM_DISK_DRIVER);
+
+/// `/dev/ram0`: the disk's bytes, for copying images in and out.
+struct RamDiskFile {
+    pos: usize,
+}
+
+impl FileOps for RamDiskFile {
+    fn read(&mut self, buf: &mut [u8]) -> Result<usize, FsError> {
+        let read = RAM_DISK_DRIVER
+            .device
+            .with(|disk| {
+                let start = self.pos.min(disk.data.len());
+                let len = buf.len().min(disk.data.len() - start);
+                buf[..len].copy_from_slice(&disk.data[start..start + len]);
+                len
+            })
+            .ok_or(FsError::NotFound)?;
+        self.pos += read;
+        Ok(read)
+    }
+
+    fn write(&mut self, buf: &[u8]) -> Result<usize, FsError> {
+        let written = RAM_DISK_DRIVER
+            .device
+            .with_mut(|disk| {
+                let start = self.pos.min(disk.data.len());
+                let len = buf.len().min(disk.data.len() - start);
+                disk.data[start..start + len].copy_from_slice(&buf[..len]);
+                len
+            })
+            .ok_or(FsError::NotFound)?;
+        if written == 0 && !buf.is_empty() {
+            return Err(FsError::NoSpace);
+        }
+        self.pos += written;
+        Ok(written)
+    }
+
+    fn seek(&mut self, pos: usize) -> Result<usize, FsError> {
+        self.pos = pos;
+        Ok(pos)
+    }
+
+    fn stat(&self) -> Result<FileMetadata, FsError> {
+        Ok(FileMetadata {
+            uid: 0,
+            gid: 0,
+            mode: 0o660,
+            size: RAM_DISK_DRIVER
+                .device
+                .with(|disk| disk.data.len() as u64)
+                .unwrap_or(0),
+            is_dir: false,
+            modified: 0,
+        })
+    }
+}
+
+fn open_ram_disk() -> FileHandle {
+    FileHandle::new(Box::new(RamDiskFile { pos: 0 }))
+}
+
+crate::register_device_node!(RAM_DISK_DEVICE_NODE_REG, ["ram0"], open_ram_disk);
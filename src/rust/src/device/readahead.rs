@@ -0,0 +1,132 @@
+use core::sync::atomic::{AtomicU8, Ordering};
+
+use crate::constant::READ_AHEAD_MAX_SECTORS;
+
+/// Window a stream starts from once it is known to be sequential.
+const READ_AHEAD_MIN_SECTORS: usize = 8;
+/// Sequential streams followed at once on one device, such as a file's
+/// data and its FAT, or two files read in turns.
+const READ_AHEAD_STREAMS: usize = 4;
+
+/// What the file being read says about its access pattern. The FAT file
+/// sets it around each call into the filesystem.
+#[repr(u8)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum ReadAheadHint {
+    /// Only read ahead of streams the device sees going sequential.
+    Normal,
+    /// The file is read in order; start with a small window.
+    Sequential,
+    /// Advised sequential; start with the whole window.
+    Streaming,
+    /// Advised random; never read ahead.
+    Random,
+    /// Drop the whole blocks a read covers from the cache instead of
+    /// reading them, and return zeros for them. Partial blocks, such as FAT
+    /// entries, are still read.
+    Discard,
+}
+
+/// Hint shared between a filesystem's files and its block stream.
+#[derive(Debug)]
+pub struct HintCell(AtomicU8);
+
+impl HintCell {
+    pub const fn new() -> Self {
+        Self(AtomicU8::new(ReadAheadHint::Normal as u8))
+    }
+
+    pub fn set(&self, hint: ReadAheadHint) {
+        self.0.store(hint as u8, Ordering::Relaxed);
+    }
+
+    pub fn get(&self) -> ReadAheadHint {
+        match self.0.load(Ordering::Relaxed) {
+            1 => ReadAheadHint::Sequential,
+            2 => ReadAheadHint::Streaming,
+            3 => ReadAheadHint::Random,
+            4 => ReadAheadHint::Discard,
+            _ => ReadAheadHint::Normal,
+        }
+    }
+}
+
+#[derive(Clone, Copy, Debug, Default)]
+struct Stream {
+    /// Sector after the last read.
+    next: u64,
+    /// Sector after the last one read ahead.
+    ahead: u64,
+    window: usize,
+    /// Read clock at the last use, to replace the stalest stream.
+    used: u32,
+}
+
+/// Sequential read detection for one block device.
+///
+/// A read that starts where a stream stopped, or inside what was read ahead
+/// for it, continues that stream and doubles its window. Once less than half
+/// the window is left ahead of the reader, the next window is read along
+/// with the request, so the device sees one large command instead of one per
+/// block and later reads hit the cache.
+#[derive(Debug, Default)]
+pub struct ReadAhead {
+    streams: [Stream; READ_AHEAD_STREAMS],
+    clock: u32,
+}
+
+impl ReadAhead {
+    /// Accounts for a read of `count` sectors from `lba` and returns the
+    /// sectors to read ahead with it, if any.
+    pub fn plan(&mut self, lba: u64, count: usize, hint: ReadAheadHint) -> Option<(u64, usize)> {
+        if matches!(hint, ReadAheadHint::Random | ReadAheadHint::Discard) {
+            return None;
+        }
+
+        self.clock = self.clock.wrapping_add(1);
+        let clock = self.clock;
+        let end = lba + count as u64;
+        let index = match self
+            .streams
+            .iter()
+            .position(|stream| lba >= stream.next && lba <= stream.ahead.max(stream.next))
+        {
+            Some(index) => {
+                let stream = &mut self.streams[index];
+                stream.window = match hint {
+                    ReadAheadHint::Streaming => READ_AHEAD_MAX_SECTORS,
+                    _ => (stream.window * 2).clamp(READ_AHEAD_MIN_SECTORS, READ_AHEAD_MAX_SECTORS),
+                };
+                index
+            }
+            None => {
+                let index = (0..READ_AHEAD_STREAMS)
+                    .max_by_key(|&index| clock.wrapping_sub(self.streams[index].used))
+                    .unwrap_or(0);
+                self.streams[index] = Stream {
+                    next: end,
+                    ahead: end,
+                    window: match hint {
+                        ReadAheadHint::Streaming => READ_AHEAD_MAX_SECTORS,
+                        ReadAheadHint::Sequential => READ_AHEAD_MIN_SECTORS,
+                        _ => 0,
+                    },
+                    used: 0,
+                };
+                index
+            }
+        };
+
+        let stream = &mut self.streams[index];
+        stream.used = clock;
+        stream.next = end;
+        stream.ahead = stream.ahead.max(end);
+        if stream.window == 0 || stream.ahead >= end + (stream.window / 2) as u64 {
+            return None;
+        }
+
+        let start = stream.ahead;
+        stream.ahead = end + stream.window as u64;
+        Some((start, (stream.ahead - start) as usize))
+    }
+}
@@ -179,6 +179,7 @@ impl FileOps for ScreenFile {
             mode: 0o666,
             size: 0,
             is_dir: false,
+            modified: 0,
         })
     }
 }
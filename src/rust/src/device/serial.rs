@@ -110,6 +110,7 @@ impl FileOps for SerialFile {
             mode: 0o666,
             size: 0,
             is_dir: false,
+            modified: 0,
         })
     }
 }
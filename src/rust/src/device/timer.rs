@@ -1,48 +1,250 @@
+use spin::Mutex;
+
 use crate::{
-    constant::{PIT_BASE_FREQUENCY_HZ, TIMER_HZ},
-    device::{DeviceDriver, DeviceProbeStage, io::outb},
+    constant::{PIT_BASE_FREQUENCY_HZ, TIMER_DYNAMIC_TICK, TIMER_HZ},
+    device::{
+        DeviceDriver, DeviceProbeStage,
+        io::{inb, outb},
+    },
+    interrupts::without_interrupts,
+    utils::rdtsc,
 };
 
 const PIT_COMMAND_PORT: u16 = 0x43;
 const PIT_CHANNEL0_PORT: u16 = 0x40;
+const PIT_CHANNEL2_PORT: u16 = 0x42;
+const PIT_CHANNEL2_GATE_PORT: u16 = 0x61;
 
+const PIT_SELECT_CHANNEL2: u8 = 0x80;
 const PIT_ACCESS_LO_HI: u8 = 0x30;
+const PIT_MODE_INTERRUPT_ON_TERMINAL_COUNT: u8 = 0x00;
 const PIT_MODE_RATE_GENERATOR: u8 = 0x04;
 const PIT_BINARY_MODE: u8 = 0x00;
 
-pub struct TimerDriver;
+const PIT_CHANNEL2_GATE: u8 = 0x01;
+const PIT_CHANNEL2_SPEAKER: u8 = 0x02;
+const PIT_CHANNEL2_OUTPUT: u8 = 0x20;
+
+const PIT_COUNTS_PER_TICK: u32 = PIT_BASE_FREQUENCY_HZ / TIMER_HZ;
+/// Ticks measured against PIT channel 2 to calibrate the TSC.
+const CALIBRATION_TICKS: u32 = 10;
+/// Gives up on calibration if channel 2 never reaches terminal count.
+const CALIBRATION_MAX_POLLS: u32 = 10_000_000;
+
+/// Time source for `current_tick`.
+#[derive(Clone, Copy)]
+enum TimerMode {
+    /// Not probed yet.
+    Stopped,
+    /// Channel 0 fires every tick and each interrupt advances the clock.
+    Periodic { ticks: u64 },
+    /// Time comes from the TSC; channel 0 is programmed in one-shot mode
+    /// only when the scheduler needs an interrupt.
+    Dynamic {
+        tsc_base: u64,
+        cycles_per_tick: u64,
+        armed: Option<u64>,
+    },
+}
+
+pub struct TimerDriver {
+    mode: Mutex<TimerMode>,
+}
 
 impl TimerDriver {
     pub const fn new() -> Self {
-        Self
+        Self {
+            mode: Mutex::new(TimerMode::Stopped),
+        }
     }
 
     fn configure(&self) {
-        let divisor_u32 = (PIT_BASE_FREQUENCY_HZ / TIMER_HZ)
-            .max(1)
-            .min(u16::MAX as u32);
-        let divisor = divisor_u32 as u16;
-
-        unsafe {
-            // Channel 0, low/high byte, mode 2 (rate generator), binary counter.
-            outb(
-                PIT_COMMAND_PORT,
-                PIT_ACCESS_LO_HI | PIT_MODE_RATE_GENERATOR | PIT_BINARY_MODE,
-            );
-            outb(PIT_CHANNEL0_PORT, (divisor & 0x00FF) as u8);
-            outb(PIT_CHANNEL0_PORT, (divisor >> 8) as u8);
-        }
+        let calibration = if TIMER_DYNAMIC_TICK {
+            calibrate_tsc()
+        } else {
+            None
+        };
 
-        serial_println!(
-            "timer: PIT configured at {} Hz (divisor={})",
-            TIMER_HZ,
-            divisor
-        );
+        let mode = match calibration {
+            Some(cycles_per_tick) => {
+                // Leave channel 0 disarmed until the scheduler asks for an event.
+                pit_oneshot_stop();
+                serial_println!(
+                    "timer: dynamic tick, TSC at {} cycles per {} Hz tick",
+                    cycles_per_tick,
+                    TIMER_HZ
+                );
+                TimerMode::Dynamic {
+                    tsc_base: rdtsc(),
+                    cycles_per_tick,
+                    armed: None,
+                }
+            }
+            None => {
+                pit_periodic_start();
+                serial_println!(
+                    "timer: PIT configured at {} Hz (divisor={})",
+                    TIMER_HZ,
+                    PIT_COUNTS_PER_TICK
+                );
+                TimerMode::Periodic { ticks: 0 }
+            }
+        };
+
+        without_interrupts(|| *self.mode.lock() = mode);
+    }
+
+    /// Ticks since the timer was probed.
+    pub fn current_tick(&self) -> u64 {
+        without_interrupts(|| match *self.mode.lock() {
+            TimerMode::Stopped => 0,
+            TimerMode::Periodic { ticks } => ticks,
+            TimerMode::Dynamic {
+                tsc_base,
+                cycles_per_tick,
+                ..
+            } => rdtsc().wrapping_sub(tsc_base) / cycles_per_tick,
+        })
+    }
+
+    /// Called from the clock interrupt before the scheduler looks at time.
+    pub fn handle_interrupt(&self) {
+        without_interrupts(|| match &mut *self.mode.lock() {
+            TimerMode::Periodic { ticks } => *ticks = ticks.wrapping_add(1),
+            TimerMode::Dynamic { armed, .. } => *armed = None,
+            TimerMode::Stopped => {}
+        });
+    }
+
+    /// Requests the next clock interrupt at `deadline` (in ticks), or none at
+    /// all. Only the dynamic mode honours this; periodic mode always ticks.
+    ///
+    /// Deadlines past the PIT range fire early; the scheduler re-arms then.
+    pub fn set_next_event(&self, deadline: Option<u64>) {
+        without_interrupts(|| {
+            let mut mode = self.mode.lock();
+            let TimerMode::Dynamic {
+                tsc_base,
+                cycles_per_tick,
+                armed,
+            } = &mut *mode
+            else {
+                return;
+            };
+
+            if *armed == deadline {
+                return;
+            }
+            *armed = deadline;
+
+            let Some(deadline) = deadline else {
+                pit_oneshot_stop();
+                return;
+            };
+
+            let now = rdtsc().wrapping_sub(*tsc_base) / *cycles_per_tick;
+            let delta = deadline.saturating_sub(now).max(1);
+            let counts = delta
+                .saturating_mul(PIT_COUNTS_PER_TICK as u64)
+                .min(u16::MAX as u64) as u16;
+            pit_oneshot_start(counts);
+        });
     }
 }
 
 pub static TIMER_DRIVER: TimerDriver = TimerDriver::new();
 
+fn pit_periodic_start() {
+    let divisor = PIT_COUNTS_PER_TICK.clamp(1, u16::MAX as u32) as u16;
+    unsafe {
+        // Channel 0, low/high byte, mode 2 (rate generator), binary counter.
+        outb(
+            PIT_COMMAND_PORT,
+            PIT_ACCESS_LO_HI | PIT_MODE_RATE_GENERATOR | PIT_BINARY_MODE,
+        );
+        outb(PIT_CHANNEL0_PORT, (divisor & 0x00FF) as u8);
+        outb(PIT_CHANNEL0_PORT, (divisor >> 8) as u8);
+    }
+}
+
+fn pit_oneshot_start(counts: u16) {
+    unsafe {
+        // Channel 0, mode 0: one interrupt when the count reaches zero.
+        outb(
+            PIT_COMMAND_PORT,
+            PIT_ACCESS_LO_HI | PIT_MODE_INTERRUPT_ON_TERMINAL_COUNT | PIT_BINARY_MODE,
+        );
+        outb(PIT_CHANNEL0_PORT, (counts & 0x00FF) as u8);
+        outb(PIT_CHANNEL0_PORT, (counts >> 8) as u8);
+    }
+}
+
+fn pit_oneshot_stop() {
+    // In mode 0 the counter halts after a control word until a count is
+    // written, so this alone cancels a pending one-shot.
+    unsafe {
+        outb(
+            PIT_COMMAND_PORT,
+            PIT_ACCESS_LO_HI | PIT_MODE_INTERRUPT_ON_TERMINAL_COUNT | PIT_BINARY_MODE,
+        );
+    }
+}
+
+/// Measures TSC cycles per tick by timing a one-shot count on PIT channel 2.
+fn calibrate_tsc() -> Option<u64> {
+    let cycles = measure_ticks(CALIBRATION_TICKS, rdtsc)?;
+    let cycles_per_tick = cycles / CALIBRATION_TICKS as u64;
+    (cycles_per_tick > 0).then_some(cycles_per_tick)
+}
+
+/// Returns how far `counter` advances during `ticks` timer ticks, timed with a
+/// one-shot count on PIT channel 2, which is gated through port 0x61 and
+/// raises no interrupt. Also used to calibrate the local APIC timers.
+pub fn measure_ticks(ticks: u32, mut counter: impl FnMut() -> u64) -> Option<u64> {
+    let counts = PIT_COUNTS_PER_TICK * ticks;
+    if counts > u16::MAX as u32 {
+        return None;
+    }
+
+    without_interrupts(|| unsafe {
+        let gate = inb(PIT_CHANNEL2_GATE_PORT);
+        outb(
+            PIT_CHANNEL2_GATE_PORT,
+            (gate & !PIT_CHANNEL2_SPEAKER) & !PIT_CHANNEL2_GATE,
+        );
+        outb(
+            PIT_COMMAND_PORT,
+            PIT_SELECT_CHANNEL2
+                | PIT_ACCESS_LO_HI
+                | PIT_MODE_INTERRUPT_ON_TERMINAL_COUNT
+                | PIT_BINARY_MODE,
+        );
+        outb(PIT_CHANNEL2_PORT, (counts & 0xFF) as u8);
+        outb(PIT_CHANNEL2_PORT, (counts >> 8) as u8);
+
+        outb(
+            PIT_CHANNEL2_GATE_PORT,
+            (gate & !PIT_CHANNEL2_SPEAKER) | PIT_CHANNEL2_GATE,
+        );
+        let start = counter();
+        let mut polls: u32 = 0;
+        while inb(PIT_CHANNEL2_GATE_PORT) & PIT_CHANNEL2_OUTPUT == 0 {
+            polls += 1;
+            if polls == CALIBRATION_MAX_POLLS {
+                outb(PIT_CHANNEL2_GATE_PORT, gate);
+                return None;
+            }
+        }
+        let end = counter();
+        outb(PIT_CHANNEL2_GATE_PORT, gate);
+        Some(end.wrapping_sub(start))
+    })
+}
+
+pub fn current_tick() -> u64 {
+    TIMER_DRIVER.current_tick()
+}
+
 impl DeviceDriver for TimerDriver {
     fn name(&self) -> &'static str {
         "timer"
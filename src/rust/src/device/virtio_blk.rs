@@ -0,0 +1,774 @@
+use core::{
+    cell::Cell,
+    sync::atomic::{AtomicUsize, Ordering, fence},
+};
+
+use crate::{
+    constant::{BLOCK_CACHE_SECTORS, irq_to_vector},
+    interrupts::{InterruptDevice, InterruptSource, enable_irq_line},
+    memory::Page,
+};
+
+use super::{
+    block_cache::{BlockCache, SECTOR_SIZE},
+    block_dev::{BlockDevice, BlockDeviceError, CacheInfo, WriteBackState, register_block_device},
+    driver::{DeviceDriver, DeviceProbeStage},
+    io::{inb, inl, inw, outb, outl, outw},
+    managed::ManagedDevice,
+    pci::{PciBar, PciDevice, find_device},
+};
+
+const VIRTIO_VENDOR_ID: u16 = 0x1AF4;
+/// Transitional virtio-blk, which still has the legacy I/O port interface.
+const VIRTIO_BLK_LEGACY_DEVICE_ID: u16 = 0x1001;
+
+const VIRTIO_REG_DEVICE_FEATURES: u16 = 0x00;
+const VIRTIO_REG_GUEST_FEATURES: u16 = 0x04;
+const VIRTIO_REG_QUEUE_PFN: u16 = 0x08;
+const VIRTIO_REG_QUEUE_SIZE: u16 = 0x0C;
+const VIRTIO_REG_QUEUE_SELECT: u16 = 0x0E;
+const VIRTIO_REG_QUEUE_NOTIFY: u16 = 0x10;
+const VIRTIO_REG_DEVICE_STATUS: u16 = 0x12;
+const VIRTIO_REG_ISR_STATUS: u16 = 0x13;
+const VIRTIO_REG_BLK_CAPACITY: u16 = 0x14;
+const VIRTIO_REG_BLK_SIZE_MAX: u16 = 0x1C;
+const VIRTIO_REG_BLK_SEG_MAX: u16 = 0x20;
+
+const VIRTIO_STATUS_ACKNOWLEDGE: u8 = 1;
+const VIRTIO_STATUS_DRIVER: u8 = 2;
+const VIRTIO_STATUS_DRIVER_OK: u8 = 4;
+const VIRTIO_STATUS_FAILED: u8 = 0x80;
+
+const VIRTIO_BLK_F_SIZE_MAX: u32 = 1 << 1;
+const VIRTIO_BLK_F_SEG_MAX: u32 = 1 << 2;
+const VIRTIO_BLK_F_FLUSH: u32 = 1 << 9;
+const VIRTIO_RING_F_INDIRECT_DESC: u32 = 1 << 28;
+
+const VIRTIO_BLK_T_IN: u32 = 0;
+const VIRTIO_BLK_T_OUT: u32 = 1;
+const VIRTIO_BLK_T_FLUSH: u32 = 4;
+const VIRTIO_BLK_S_OK: u8 = 0;
+
+const VRING_DESC_F_NEXT: u16 = 1;
+const VRING_DESC_F_WRITE: u16 = 2;
+const VRING_DESC_F_INDIRECT: u16 = 4;
+/// Completions are polled, so the device need not interrupt for them.
+const VRING_AVAIL_F_NO_INTERRUPT: u16 = 1;
+const VRING_DESC_SIZE: usize = 16;
+const VRING_ALIGN: usize = 4096;
+
+/// Requests in flight at once, each with its own header, status and
+/// descriptor table.
+const VIRTIO_MAX_IN_FLIGHT: usize = 32;
+/// Data segments of one request, besides its header and status.
+const VIRTIO_MAX_SEGMENTS: usize = 14;
+const VIRTIO_REQUEST_SECTORS: usize = 256;
+const VIRTIO_SLOT_HEADER: usize = 0;
+const VIRTIO_SLOT_STATUS: usize = 16;
+const VIRTIO_SLOT_TABLE: usize = 32;
+const VIRTIO_SLOT_BYTES: usize = VIRTIO_SLOT_TABLE + (VIRTIO_MAX_SEGMENTS + 2) * VRING_DESC_SIZE;
+/// Sectors a cache miss run may span; its requests are queued together.
+const VIRTIO_MAX_TRANSFER_SECTORS: usize = VIRTIO_REQUEST_SECTORS * VIRTIO_MAX_IN_FLIGHT;
+const VIRTIO_WAIT_TIMEOUT: usize = 10_000_000;
+
+#[derive(Debug)]
+pub enum VirtioError {
+    NotFound,
+    Unsupported,
+    Timeout,
+    IoError,
+}
+
+/// Split virtqueue in the legacy layout: descriptor table, available ring,
+/// then the used ring on the next page. Ring fields are shared with the
+/// device and only touched through volatile accesses.
+#[derive(Debug)]
+struct Virtqueue {
+    memory: Page<u8>,
+    size: u16,
+    used_offset: usize,
+    avail_index: Cell<u16>,
+    last_used: Cell<u16>,
+}
+
+impl Virtqueue {
+    fn new(size: u16) -> Option<Self> {
+        let size_usize = size as usize;
+        let avail_end = size_usize * VRING_DESC_SIZE + 6 + 2 * size_usize;
+        let used_offset = avail_end.div_ceil(VRING_ALIGN) * VRING_ALIGN;
+        Some(Self {
+            memory: Page::new(used_offset + 6 + 8 * size_usize)?,
+            size,
+            used_offset,
+            avail_index: Cell::new(0),
+            last_used: Cell::new(0),
+        })
+    }
+
+    fn base(&self) -> *mut u8 {
+        self.memory.as_ptr() as *mut u8
+    }
+
+    /// Empties the rings, for a device that was reset.
+    fn clear(&self) {
+        unsafe { core::ptr::write_bytes(self.base(), 0, self.memory.len()) };
+        self.avail_index.set(0);
+        self.last_used.set(0);
+    }
+
+    fn avail_offset(&self) -> usize {
+        self.size as usize * VRING_DESC_SIZE
+    }
+
+    fn write<T>(&self, offset: usize, value: T) {
+        unsafe { core::ptr::write_volatile(self.base().add(offset) as *mut T, value) }
+    }
+
+    fn read<T>(&self, offset: usize) -> T {
+        unsafe { core::ptr::read_volatile(self.base().add(offset) as *const T) }
+    }
+
+    /// Makes the chain starting at descriptor `head` available.
+    fn push(&self, head: u16) {
+        let index = self.avail_index.get();
+        let slot = (index % self.size) as usize;
+        self.write(self.avail_offset() + 4 + slot * 2, head);
+        self.avail_index.set(index.wrapping_add(1));
+    }
+
+    /// Publishes every pushed chain to the device.
+    fn publish(&self) {
+        fence(Ordering::SeqCst);
+        self.write(self.avail_offset() + 2, self.avail_index.get());
+        fence(Ordering::SeqCst);
+    }
+
+    /// Takes the next chain the device finished, by head descriptor.
+    fn pop_used(&self) -> Option<u16> {
+        let last = self.last_used.get();
+        if self.read::<u16>(self.used_offset + 2) == last {
+            return None;
+        }
+        fence(Ordering::SeqCst);
+        let slot = (last % self.size) as usize;
+        let head = self.read::<u32>(self.used_offset + 4 + slot * 8);
+        self.last_used.set(last.wrapping_add(1));
+        Some(head as u16)
+    }
+}
+
+fn write_descriptor(table: *mut u8, index: usize, address: u32, len: u32, flags: u16, next: u16) {
+    unsafe {
+        let entry = table.add(index * VRING_DESC_SIZE);
+        core::ptr::write_volatile(entry as *mut u64, address as u64);
+        core::ptr::write_volatile(entry.add(8) as *mut u32, len);
+        core::ptr::write_volatile(entry.add(12) as *mut u16, flags);
+        core::ptr::write_volatile(entry.add(14) as *mut u16, next);
+    }
+}
+
+/// Legacy virtio-blk function with one request queue. Each in-flight
+/// request owns a slot of `requests`: its header, its status byte and, with
+/// indirect descriptors, the table the ring entry points to.
+#[derive(Debug)]
+struct VirtioPort {
+    io_base: u16,
+    queue: Virtqueue,
+    requests: Page<u8>,
+    /// Requests in flight at once.
+    slots: usize,
+    indirect: bool,
+    flush: bool,
+    /// Features agreed with the device, offered again after a reset.
+    features: u32,
+    /// Bytes one data segment may carry, 0 without a limit.
+    segment_max: usize,
+    /// Data segments one request may carry.
+    segments: usize,
+    sectors: u64,
+}
+
+impl VirtioPort {
+    fn new(pci: &PciDevice) -> Result<Self, VirtioError> {
+        let Some(PciBar::Io(io_base)) = pci.bar(0) else {
+            return Err(VirtioError::NotFound);
+        };
+        pci.enable_io_space();
+        pci.enable_bus_mastering();
+
+        unsafe {
+            outb(io_base + VIRTIO_REG_DEVICE_STATUS, 0);
+            outb(
+                io_base + VIRTIO_REG_DEVICE_STATUS,
+                VIRTIO_STATUS_ACKNOWLEDGE,
+            );
+            outb(
+                io_base + VIRTIO_REG_DEVICE_STATUS,
+                VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER,
+            );
+        }
+
+        let offered = unsafe { inl(io_base + VIRTIO_REG_DEVICE_FEATURES) };
+        let features = offered
+            & (VIRTIO_BLK_F_SIZE_MAX
+                | VIRTIO_BLK_F_SEG_MAX
+                | VIRTIO_BLK_F_FLUSH
+                | VIRTIO_RING_F_INDIRECT_DESC);
+        unsafe { outl(io_base + VIRTIO_REG_GUEST_FEATURES, features) };
+
+        let segment_max = if features & VIRTIO_BLK_F_SIZE_MAX != 0 {
+            unsafe { inl(io_base + VIRTIO_REG_BLK_SIZE_MAX) as usize }
+        } else {
+            0
+        };
+        let mut segments = VIRTIO_MAX_SEGMENTS;
+        if features & VIRTIO_BLK_F_SEG_MAX != 0 {
+            let seg_max = unsafe { inl(io_base + VIRTIO_REG_BLK_SEG_MAX) as usize };
+            segments = segments.min(seg_max.max(1));
+        }
+
+        unsafe { outw(io_base + VIRTIO_REG_QUEUE_SELECT, 0) };
+        let size = unsafe { inw(io_base + VIRTIO_REG_QUEUE_SIZE) };
+        if size == 0 {
+            Self::fail(io_base);
+            return Err(VirtioError::Unsupported);
+        }
+        let Some(queue) = Virtqueue::new(size) else {
+            Self::fail(io_base);
+            return Err(VirtioError::IoError);
+        };
+
+        // Without indirect descriptors a request's whole chain sits in the
+        // ring, so fewer of them fit.
+        let indirect = features & VIRTIO_RING_F_INDIRECT_DESC != 0;
+        let slots = if indirect {
+            VIRTIO_MAX_IN_FLIGHT.min(size as usize)
+        } else {
+            VIRTIO_MAX_IN_FLIGHT.min(size as usize / (segments + 2))
+        };
+        if slots == 0 {
+            Self::fail(io_base);
+            return Err(VirtioError::Unsupported);
+        }
+        let Some(requests) = Page::new(slots * VIRTIO_SLOT_BYTES) else {
+            Self::fail(io_base);
+            return Err(VirtioError::IoError);
+        };
+
+        let sectors = unsafe {
+            inl(io_base + VIRTIO_REG_BLK_CAPACITY) as u64
+                | (inl(io_base + VIRTIO_REG_BLK_CAPACITY + 4) as u64) << 32
+        };
+
+        let port = Self {
+            io_base,
+            queue,
+            requests,
+            slots,
+            indirect,
+            flush: features & VIRTIO_BLK_F_FLUSH != 0,
+            features,
+            segment_max,
+            segments,
+            sectors,
+        };
+        port.start();
+        Ok(port)
+    }
+
+    /// Hands queue 0 to the device and lets it run.
+    fn start(&self) {
+        self.queue
+            .write(self.queue.avail_offset(), VRING_AVAIL_F_NO_INTERRUPT);
+        unsafe {
+            outw(self.io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+            outl(
+                self.io_base + VIRTIO_REG_QUEUE_PFN,
+                (self.queue.memory.as_ptr() as usize / VRING_ALIGN) as u32,
+            );
+            outb(
+                self.io_base + VIRTIO_REG_DEVICE_STATUS,
+                VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK,
+            );
+        }
+    }
+
+    /// Resets the device and starts it again on empty rings. After a reset
+    /// it no longer touches the buffers of requests it did not finish, so
+    /// their slots can be queued again.
+    fn reset(&self) {
+        let io_base = self.io_base;
+        unsafe {
+            outb(io_base + VIRTIO_REG_DEVICE_STATUS, 0);
+            outb(
+                io_base + VIRTIO_REG_DEVICE_STATUS,
+                VIRTIO_STATUS_ACKNOWLEDGE,
+            );
+            outb(
+                io_base + VIRTIO_REG_DEVICE_STATUS,
+                VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER,
+            );
+            outl(io_base + VIRTIO_REG_GUEST_FEATURES, self.features);
+        }
+        self.queue.clear();
+        self.start();
+    }
+
+    fn fail(io_base: u16) {
+        unsafe { outb(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED) };
+    }
+
+    fn slot(&self, slot: usize) -> *mut u8 {
+        unsafe { (self.requests.as_ptr() as *mut u8).add(slot * VIRTIO_SLOT_BYTES) }
+    }
+
+    /// Sectors one request may move within the segment limits.
+    fn request_sectors(&self) -> usize {
+        if self.segment_max == 0 {
+            return VIRTIO_REQUEST_SECTORS;
+        }
+        let bytes = self.segment_max * self.segments;
+        (bytes / SECTOR_SIZE).clamp(1, VIRTIO_REQUEST_SECTORS)
+    }
+
+    /// Queues request `slot`: its header, `len` bytes at `data` cut into
+    /// segments, and its status byte. With indirect descriptors the chain
+    /// lives in the slot's table and takes one ring descriptor.
+    fn queue_request(&self, slot: usize, kind: u32, lba: u64, data: *mut u8, len: usize) {
+        let request = self.slot(slot);
+        unsafe {
+            core::ptr::write_volatile(request.add(VIRTIO_SLOT_HEADER) as *mut u32, kind);
+            core::ptr::write_volatile(request.add(VIRTIO_SLOT_HEADER + 4) as *mut u32, 0);
+            core::ptr::write_volatile(request.add(VIRTIO_SLOT_HEADER + 8) as *mut u64, lba);
+            core::ptr::write_volatile(request.add(VIRTIO_SLOT_STATUS), 0xff);
+        }
+
+        let per_request = self.segments + 2;
+        let (table, first) = if self.indirect {
+            (unsafe { request.add(VIRTIO_SLOT_TABLE) }, 0)
+        } else {
+            (self.queue.base(), slot * per_request)
+        };
+
+        let mut index = first;
+        let link = |index: &mut usize, address: usize, len: usize, flags: u16, last: bool| {
+            let flags = if last {
+                flags
+            } else {
+                flags | VRING_DESC_F_NEXT
+            };
+            write_descriptor(
+                table,
+                *index,
+                address as u32,
+                len as u32,
+                flags,
+                (*index + 1) as u16,
+            );
+            *index += 1;
+        };
+
+        link(
+            &mut index,
+            request as usize + VIRTIO_SLOT_HEADER,
+            16,
+            0,
+            false,
+        );
+        let data_flags = if kind == VIRTIO_BLK_T_IN {
+            VRING_DESC_F_WRITE
+        } else {
+            0
+        };
+        let mut offset = 0;
+        while offset < len {
+            let size = if self.segment_max == 0 {
+                len - offset
+            } else {
+                (len - offset).min(self.segment_max)
+            };
+            link(&mut index, data as usize + offset, size, data_flags, false);
+            offset += size;
+        }
+        link(
+            &mut index,
+            request as usize + VIRTIO_SLOT_STATUS,
+            1,
+            VRING_DESC_F_WRITE,
+            true,
+        );
+
+        if self.indirect {
+            write_descriptor(
+                self.queue.base(),
+                slot,
+                table as u32,
+                ((index - first) * VRING_DESC_SIZE) as u32,
+                VRING_DESC_F_INDIRECT,
+                0,
+            );
+            self.queue.push(slot as u16);
+        } else {
+            self.queue.push(first as u16);
+        }
+    }
+
+    /// Waits until `count` queued requests completed, then checks their
+    /// status bytes. On timeout the device is reset, so it cannot finish
+    /// them later into buffers that were given back.
+    fn wait(&self, count: usize) -> Result<(), VirtioError> {
+        let mut done = 0;
+        let mut failed = false;
+        let mut timeout = VIRTIO_WAIT_TIMEOUT;
+        while done < count {
+            let Some(head) = self.queue.pop_used() else {
+                if timeout == 0 {
+                    self.reset();
+                    return Err(VirtioError::Timeout);
+                }
+                timeout -= 1;
+                core::hint::spin_loop();
+                continue;
+            };
+            let slot = if self.indirect {
+                head as usize
+            } else {
+                head as usize / (self.segments + 2)
+            };
+            let status =
+                unsafe { core::ptr::read_volatile(self.slot(slot).add(VIRTIO_SLOT_STATUS)) };
+            failed |= status != VIRTIO_BLK_S_OK;
+            done += 1;
+        }
+        if failed {
+            return Err(VirtioError::IoError);
+        }
+        Ok(())
+    }
+
+    /// Moves the whole sectors of `len` bytes at `buf` from `lba`, with up to
+    /// `slots` requests in flight and one notification per batch.
+    fn transfer(&self, lba: u64, buf: *mut u8, len: usize, write: bool) -> Result<(), VirtioError> {
+        let count = len / SECTOR_SIZE;
+        if lba + count as u64 > self.sectors {
+            return Err(VirtioError::IoError);
+        }
+
+        let kind = if write {
+            VIRTIO_BLK_T_OUT
+        } else {
+            VIRTIO_BLK_T_IN
+        };
+        let per_request = self.request_sectors();
+        let mut start = 0;
+        while start < count {
+            let mut queued = 0;
+            while queued < self.slots && start < count {
+                let sectors = (count - start).min(per_request);
+                let data = unsafe { buf.add(start * SECTOR_SIZE) };
+                self.queue_request(
+                    queued,
+                    kind,
+                    lba + start as u64,
+                    data,
+                    sectors * SECTOR_SIZE,
+                );
+                start += sectors;
+                queued += 1;
+            }
+            self.notify();
+            self.wait(queued)?;
+        }
+        Ok(())
+    }
+
+    fn notify(&self) {
+        self.queue.publish();
+        unsafe { outw(self.io_base + VIRTIO_REG_QUEUE_NOTIFY, 0) };
+    }
+
+    fn read_sectors(&self, lba: u64, buf: &mut [u8]) -> Result<(), VirtioError> {
+        self.transfer(lba, buf.as_mut_ptr(), buf.len(), false)
+    }
+
+    fn write_sectors(&self, lba: u64, buf: &[u8]) -> Result<(), VirtioError> {
+        self.transfer(lba, buf.as_ptr() as *mut u8, buf.len(), true)
+    }
+
+    /// Asks the host to make completed writes durable.
+    fn flush(&self) -> Result<(), VirtioError> {
+        if !self.flush {
+            return Ok(());
+        }
+        self.queue_request(0, VIRTIO_BLK_T_FLUSH, 0, core::ptr::null_mut(), 0);
+        self.notify();
+        self.wait(1)
+    }
+}
+
+/// virtio-blk disk with its sector cache.
+#[derive(Debug)]
+pub struct VirtioBlk {
+    port: VirtioPort,
+    cache: BlockCache,
+}
+
+unsafe impl Send for VirtioBlk {}
+
+impl VirtioBlk {
+    fn new(pci: &PciDevice) -> Result<Self, VirtioError> {
+        Ok(Self {
+            port: VirtioPort::new(pci)?,
+            cache: BlockCache::new(BLOCK_CACHE_SECTORS),
+        })
+    }
+
+    pub fn read_sectors_internal(
+        &mut self,
+        lba: u64,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<(), VirtioError> {
+        self.cache.read_through(
+            lba,
+            &mut buf[..count * SECTOR_SIZE],
+            VIRTIO_MAX_TRANSFER_SECTORS,
+            |lba, data| self.port.read_sectors(lba, data),
+            |lba, data| self.port.write_sectors(lba, data),
+        )
+    }
+
+    pub fn write_sectors_internal(
+        &mut self,
+        lba: u64,
+        count: usize,
+        buf: &[u8],
+    ) -> Result<(), VirtioError> {
+        self.cache
+            .write_through(lba, &buf[..count * SECTOR_SIZE], |lba, data| {
+                self.port.write_sectors(lba, data)
+            })
+    }
+
+    pub fn sync(&mut self) -> Result<(), VirtioError> {
+        self.cache
+            .flush(|lba, data| self.port.write_sectors(lba, data))?;
+        self.port.flush()
+    }
+
+    pub fn sync_ranges(&mut self, ranges: &[(u64, usize)]) -> Result<(), VirtioError> {
+        self.cache
+            .flush_ranges(ranges, |lba, data| self.port.write_sectors(lba, data))?;
+        self.port.flush()
+    }
+
+    /// Leaves the host's cache alone; only `sync` asks for stable storage.
+    pub fn write_back(&mut self, now: u64, max: usize) -> Result<WriteBackState, VirtioError> {
+        self.cache
+            .flush_due(now, max, |lba, data| self.port.write_sectors(lba, data))
+    }
+
+    pub fn cache_info(&self) -> CacheInfo {
+        CacheInfo {
+            sectors: self.cache.len(),
+            capacity: self.cache.capacity(),
+            dirty: self.cache.dirty(),
+            stats: self.cache.stats(),
+        }
+    }
+}
+
+pub struct VirtioBlkDriver {
+    device: ManagedDevice<VirtioBlk>,
+    block_device_id: AtomicUsize,
+    /// I/O base for the interrupt handler, 0 before probe.
+    io_base: AtomicUsize,
+    /// Used-ring interrupts taken.
+    interrupts: AtomicUsize,
+}
+
+impl core::fmt::Debug for VirtioBlkDriver {
+    fn fmt(&self, f: &mut core::fmt::Formatter<'_>) -> core::fmt::Result {
+        f.debug_struct("VirtioBlkDriver")
+            .field("block_device_id", &self.block_device_id())
+            .finish()
+    }
+}
+
+impl VirtioBlkDriver {
+    pub const fn new() -> Self {
+        Self {
+            device: ManagedDevice::new(),
+            block_device_id: AtomicUsize::new(usize::MAX),
+            io_base: AtomicUsize::new(0),
+            interrupts: AtomicUsize::new(0),
+        }
+    }
+
+    pub fn block_device_id(&self) -> Option<usize> {
+        let id = self.block_device_id.load(Ordering::Acquire);
+        if id == usize::MAX { None } else { Some(id) }
+    }
+}
+
+pub static VIRTIO_BLK_DRIVER: VirtioBlkDriver = VirtioBlkDriver::new();
+
+impl BlockDevice for VirtioBlkDriver {
+    fn read_sectors(
+        &self,
+        lba: u64,
+        count: usize,
+        buf: &mut [u8],
+    ) -> Result<usize, BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.read_sectors_internal(lba, count, buf)
+                    .map_err(|_| BlockDeviceError::IoError)?;
+                Ok(count)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn write_sectors(&self, lba: u64, count: usize, buf: &[u8]) -> Result<usize, BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.write_sectors_internal(lba, count, buf)
+                    .map_err(|_| BlockDeviceError::IoError)?;
+                Ok(count)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn sync(&self) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| disk.sync().map_err(|_| BlockDeviceError::IoError))
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn sync_ranges(&self, ranges: &[(u64, usize)]) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                disk.sync_ranges(ranges)
+                    .map_err(|_| BlockDeviceError::IoError)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn write_back(&self, now: u64, max_sectors: usize) -> Result<WriteBackState, BlockDeviceError> {
+        self.device.try_with_mut(|disk| {
+            disk.write_back(now, max_sectors)
+                .map_err(|_| BlockDeviceError::IoError)
+        })?
+    }
+
+    fn sector_count(&self) -> u64 {
+        self.device.with(|disk| disk.port.sectors).unwrap_or(0)
+    }
+
+    fn cache_info(&self) -> Option<CacheInfo> {
+        self.device.with(|disk| disk.cache_info())
+    }
+
+    fn set_cache_capacity(&self, sectors: usize) -> Result<(), BlockDeviceError> {
+        self.device
+            .with_mut(|disk| {
+                let VirtioBlk { port, cache } = disk;
+                cache
+                    .set_capacity(sectors, |lba, data| port.write_sectors(lba, data))
+                    .map_err(|_| BlockDeviceError::IoError)
+            })
+            .ok_or(BlockDeviceError::NotFound)?
+    }
+
+    fn reset_cache_stats(&self) {
+        self.device.with_mut(|disk| disk.cache.reset_stats());
+    }
+
+    fn discard_cache(&self, lba: u64, count: usize) {
+        self.device.with_mut(|disk| disk.cache.discard(lba, count));
+    }
+}
+
+impl InterruptDevice for VirtioBlkDriver {
+    /// Reading the ISR status acknowledges the interrupt. The CPU that
+    /// queued the requests reaps them from the used ring itself.
+    fn interrupt(&self) {
+        let io_base = self.io_base.load(Ordering::Acquire) as u16;
+        if io_base != 0 && unsafe { inb(io_base + VIRTIO_REG_ISR_STATUS) } & 1 != 0 {
+            self.interrupts.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+impl DeviceDriver for VirtioBlkDriver {
+    fn name(&self) -> &'static str {
+        "virtio-blk"
+    }
+
+    fn stage(&self) -> DeviceProbeStage {
+        DeviceProbeStage::Normal
+    }
+
+    fn probe(&self) {
+        let Some(pci) = find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_LEGACY_DEVICE_ID) else {
+            return;
+        };
+
+        let disk = match VirtioBlk::new(&pci) {
+            Ok(disk) => disk,
+            Err(error) => {
+                serial_println!(
+                    "virtio-blk: init failed for PCI {}:{}:{}: {:?}",
+                    pci.bus,
+                    pci.device,
+                    pci.function,
+                    error
+                );
+                return;
+            }
+        };
+        let port = &disk.port;
+        serial_println!(
+            "virtio-blk: initialized PCI {}:{}:{} io=0x{:x} sectors={} queue={} in_flight={} indirect={}",
+            pci.bus,
+            pci.device,
+            pci.function,
+            port.io_base,
+            port.sectors,
+            port.queue.size,
+            port.slots,
+            port.indirect
+        );
+        self.io_base.store(port.io_base as usize, Ordering::Release);
+
+        // Completions are polled from the used ring and the device is asked
+        // not to interrupt for them. A PCI line may be shared; its first
+        // driver keeps it.
+        let irq_line = pci.interrupt_line();
+        if let Some(vector) = irq_to_vector(irq_line) {
+            let source = InterruptSource::new(vector);
+            if source.device().is_none() {
+                source.register_device(&VIRTIO_BLK_DRIVER);
+                enable_irq_line(irq_line);
+            }
+        }
+
+        self.device
+            .probe(disk)
+            .expect("virtio-blk device already probed");
+        let id = register_block_device(&VIRTIO_BLK_DRIVER);
+        self.block_device_id.store(id, Ordering::Release);
+    }
+
+    fn remove(&self) {
+        if let Some(mut disk) = self.device.remove() {
+            let _ = disk.sync();
+            // Writing 0 to the status resets the device and stops the queue.
+            unsafe { outb(disk.port.io_base + VIRTIO_REG_DEVICE_STATUS, 0) };
+        }
+        self.io_base.store(0, Ordering::Release);
+        self.block_device_id.store(usize::MAX, Ordering::Release);
+    }
+}
+
+crate::register_device_driver!(VIRTIO_BLK_DRIVER_REG, VIRTIO_BLK_DRIVER);
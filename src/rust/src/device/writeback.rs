@@ -0,0 +1,202 @@
+use alloc::vec::Vec;
+use spin::Mutex;
+
+use crate::{
+    constant::{
+        DIRTY_BACKGROUND_RATIO, DIRTY_RATIO, WRITEBACK_EXPIRE_TICKS, WRITEBACK_INTERVAL_TICKS,
+        WRITEBACK_PASS_SECTORS,
+    },
+    device::timer::current_tick,
+    interrupts::without_interrupts,
+    kernel::KERNEL,
+};
+
+use super::block_dev::{BlockDeviceError, WriteBackState, block_device, block_devices};
+
+/// Spans a file keeps before they are merged; past it they collapse into
+/// one span covering them all.
+const MAX_LOGGED_SPANS: usize = 64;
+
+/// Tick of the next flusher pass, `None` while no cache was dirtied since
+/// the last one.
+static NEXT_PASS: Mutex<Option<u64>> = Mutex::new(None);
+
+pub fn next_pass() -> Option<u64> {
+    *NEXT_PASS.lock()
+}
+
+fn dirty_percent(dirty: usize, capacity: usize) -> usize {
+    dirty * 100 / capacity.max(1)
+}
+
+/// Sectors of a cache with `dirty` of `capacity` sectors dirty are due for
+/// write-back at tick `now` if they went dirty at or before the returned
+/// tick: once expired, or all of them past `DIRTY_BACKGROUND_RATIO`.
+pub(super) fn due_before(dirty: usize, capacity: usize, now: u64) -> u64 {
+    if dirty_percent(dirty, capacity) >= DIRTY_BACKGROUND_RATIO {
+        u64::MAX
+    } else {
+        now.saturating_sub(WRITEBACK_EXPIRE_TICKS)
+    }
+}
+
+/// Moves the next pass to `deadline` if that is sooner. Returns whether it
+/// moved.
+fn schedule_pass(deadline: u64) -> bool {
+    // The clock interrupt takes the lock too.
+    without_interrupts(|| {
+        let mut next = NEXT_PASS.lock();
+        if next.is_some_and(|next| next <= deadline) {
+            return false;
+        }
+        *next = Some(deadline);
+        true
+    })
+}
+
+/// Accounts for writes that reached the cache of block device `id`.
+///
+/// Past `DIRTY_RATIO` the writer writes the cache back itself, so one job
+/// cannot fill the cache with dirty sectors. Otherwise the flusher is due
+/// once the sectors expire, or at once past `DIRTY_BACKGROUND_RATIO`.
+pub fn wrote(id: usize) {
+    let Some(device) = block_device(id) else {
+        return;
+    };
+    let Some(info) = device.cache_info().filter(|info| info.dirty > 0) else {
+        return;
+    };
+
+    let now = current_tick();
+    let percent = dirty_percent(info.dirty, info.capacity);
+    if percent >= DIRTY_RATIO {
+        // Past the background ratio every dirty sector is due. The writer
+        // waits for the device like any other caller.
+        while let Err(BlockDeviceError::Busy) = device.write_back(now, usize::MAX) {
+            core::hint::spin_loop();
+        }
+        return;
+    }
+
+    let deadline = if percent >= DIRTY_BACKGROUND_RATIO {
+        now
+    } else {
+        now + WRITEBACK_EXPIRE_TICKS
+    };
+    if schedule_pass(deadline) {
+        KERNEL.with_task_manager(|tm| tm.rearm_timer());
+    }
+}
+
+/// Flusher pass, run from the BSP's clock interrupt. Writes back sectors
+/// dirty for longer than `WRITEBACK_EXPIRE_TICKS`, or all of a cache past
+/// `DIRTY_BACKGROUND_RATIO`, and comes back while any remain. A pass writes
+/// at most `WRITEBACK_PASS_SECTORS` per device and skips devices another
+/// CPU holds; both are picked up again on the next tick.
+pub fn run() {
+    let now = current_tick();
+    {
+        let mut next = NEXT_PASS.lock();
+        match *next {
+            Some(pass) if pass <= now => *next = None,
+            _ => return,
+        }
+    }
+
+    for device in block_devices() {
+        match device.write_back(now, WRITEBACK_PASS_SECTORS) {
+            Ok(WriteBackState::Due) | Err(BlockDeviceError::Busy) => {
+                schedule_pass(now + 1);
+            }
+            Ok(WriteBackState::Waiting) => {
+                schedule_pass(now + WRITEBACK_INTERVAL_TICKS);
+            }
+            Ok(WriteBackState::Clean) | Err(_) => {}
+        }
+    }
+}
+
+/// Sectors a filesystem's block stream writes on behalf of a file, so
+/// `fsync` writes back those instead of every dirty sector of the device.
+#[derive(Debug)]
+pub struct WriteLog {
+    id: usize,
+    /// Spans of the file recording, while one is.
+    spans: Mutex<Option<Vec<(u64, usize)>>>,
+}
+
+impl WriteLog {
+    pub fn new(id: usize) -> Self {
+        Self {
+            id,
+            spans: Mutex::new(None),
+        }
+    }
+
+    /// Runs `f`, adding the sectors it writes to `spans`.
+    pub fn record<R>(&self, spans: &mut Vec<(u64, usize)>, f: impl FnOnce() -> R) -> R {
+        *self.spans.lock() = Some(core::mem::take(spans));
+        let result = f();
+        *spans = self.spans.lock().take().unwrap_or_default();
+        result
+    }
+
+    pub(super) fn add(&self, lba: u64, count: usize) {
+        let mut spans = self.spans.lock();
+        let Some(spans) = spans.as_mut() else {
+            return;
+        };
+
+        if let Some(last) = spans.last_mut()
+            && lba >= last.0
+            && lba <= last.0 + last.1 as u64
+        {
+            last.1 = last.1.max((lba - last.0) as usize + count);
+            return;
+        }
+        spans.push((lba, count));
+        if spans.len() > MAX_LOGGED_SPANS {
+            merge_spans(spans);
+        }
+    }
+
+    /// Writes back the dirty sectors of `spans` and forgets them.
+    pub fn sync(&self, spans: &mut Vec<(u64, usize)>) -> Result<(), BlockDeviceError> {
+        if spans.is_empty() {
+            return Ok(());
+        }
+        let device = block_device(self.id).ok_or(BlockDeviceError::NotFound)?;
+        merge_spans(spans);
+        device.sync_ranges(spans)?;
+        spans.clear();
+        Ok(())
+    }
+}
+
+/// Sorts `spans` and joins the ones that touch. If too many remain, one
+/// span covering them all replaces them; writing back a few extra sectors
+/// is harmless.
+fn merge_spans(spans: &mut Vec<(u64, usize)>) {
+    spans.sort_unstable();
+    let mut merged: Vec<(u64, usize)> = Vec::with_capacity(spans.len());
+    for &(lba, count) in spans.iter() {
+        match merged.last_mut() {
+            Some(last) if lba <= last.0 + last.1 as u64 => {
+                last.1 = last.1.max((lba - last.0) as usize + count);
+            }
+            _ => merged.push((lba, count)),
+        }
+    }
+
+    if merged.len() > MAX_LOGGED_SPANS {
+        let first = merged[0].0;
+        let end = merged
+            .iter()
+            .map(|&(lba, count)| lba + count as u64)
+            .max()
+            .unwrap_or(first);
+        merged.clear();
+        merged.push((first, (end - first) as usize));
+    }
+    *spans = merged;
+}
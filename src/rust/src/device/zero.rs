@@ -30,6 +30,7 @@ fn metadata(mode: u16, is_dir: bool) -> FileMetadata {
         mode,
         size: 0,
         is_dir,
+        modified: 0,
     }
 }
 
@@ -6,6 +6,8 @@ pub enum KernelError {
     Allocation,
     NoTasks,
     Io,
+    /// The file is not a program that can run here.
+    NotExecutable,
 }
 
 impl fmt::Display for KernelError {
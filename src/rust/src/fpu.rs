@@ -0,0 +1,207 @@
+use alloc::boxed::Box;
+use core::{
+    arch::asm,
+    sync::atomic::{AtomicBool, AtomicUsize, Ordering},
+};
+
+use crate::{
+    constant::MAX_CPUS,
+    schedule::task::{Task, TaskId},
+    smp::cpu_id,
+};
+
+const CR0_MP: u32 = 1 << 1;
+const CR0_EM: u32 = 1 << 2;
+const CR0_TS: u32 = 1 << 3;
+const CR0_NE: u32 = 1 << 5;
+const CR4_OSFXSR: u32 = 1 << 9;
+const CR4_OSXMMEXCPT: u32 = 1 << 10;
+
+const CPUID_EDX_FXSR: u32 = 1 << 24;
+const CPUID_EDX_SSE: u32 = 1 << 25;
+
+/// All SIMD exceptions masked, round to nearest.
+const MXCSR_DEFAULT: u32 = 0x1F80;
+
+/// Set once the boot CPU found `fxsave`; CPUs without it fall back to
+/// `fnsave` and user space only gets the x87 unit.
+static FXSR: AtomicBool = AtomicBool::new(false);
+/// Set once the boot CPU found SSE, whose control register needs a reset too.
+static SSE: AtomicBool = AtomicBool::new(false);
+
+/// Task whose state each CPU's FPU registers hold, plus one; 0 for none.
+/// The owner may have been switched out since, in which case its saved
+/// area matches the registers and redispatching it skips the restore.
+static OWNERS: [AtomicUsize; MAX_CPUS] = [const { AtomicUsize::new(0) }; MAX_CPUS];
+
+/// x87, MMX and SSE registers of a task, in the `fxsave` layout.
+#[repr(C, align(16))]
+#[derive(Clone)]
+pub struct FpuState([u8; 512]);
+
+fn read_cr0() -> u32 {
+    let cr0: u32;
+    unsafe { asm!("mov {}, cr0", out(reg) cr0, options(nomem, nostack, preserves_flags)) };
+    cr0
+}
+
+fn write_cr0(cr0: u32) {
+    unsafe { asm!("mov cr0, {}", in(reg) cr0, options(nostack, preserves_flags)) };
+}
+
+/// Makes the next FPU instruction raise #NM.
+fn stts() {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+fn clts() {
+    unsafe { asm!("clts", options(nomem, nostack, preserves_flags)) };
+}
+
+/// Feature flags in `edx` of CPUID leaf 1.
+fn cpuid_features() -> u32 {
+    let edx: u32;
+    unsafe {
+        asm!(
+            "push ebx",
+            "cpuid",
+            "pop ebx",
+            inout("eax") 1 => _,
+            inout("ecx") 0 => _,
+            out("edx") edx,
+            options(nomem, preserves_flags)
+        )
+    };
+    edx
+}
+
+fn owner_tag(task_id: TaskId) -> usize {
+    task_id + 1
+}
+
+/// Enables the FPU and, when the CPU has them, `fxsave` and SSE on `cpu`,
+/// the calling one. Its first use from user space then traps so the state
+/// can be loaded lazily.
+pub fn init(cpu: usize) {
+    let edx = cpuid_features();
+    let fxsr = edx & CPUID_EDX_FXSR != 0;
+    let sse = fxsr && edx & CPUID_EDX_SSE != 0;
+    if cpu == 0 {
+        FXSR.store(fxsr, Ordering::Relaxed);
+        SSE.store(sse, Ordering::Relaxed);
+    }
+
+    write_cr0((read_cr0() & !(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if fxsr {
+        let mut cr4: u32;
+        unsafe { asm!("mov {}, cr4", out(reg) cr4, options(nomem, nostack, preserves_flags)) };
+        cr4 |= CR4_OSFXSR;
+        if sse {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        unsafe { asm!("mov cr4, {}", in(reg) cr4, options(nostack, preserves_flags)) };
+    }
+
+    unsafe { asm!("fninit", options(nomem, nostack)) };
+    OWNERS[cpu].store(0, Ordering::Relaxed);
+    stts();
+}
+
+fn save_registers(state: &mut FpuState) {
+    let area = state.0.as_mut_ptr();
+    if FXSR.load(Ordering::Relaxed) {
+        unsafe { asm!("fxsave [{}]", in(reg) area, options(nostack)) };
+    } else {
+        // `fnsave` reinitializes the unit; reload so the registers still
+        // match the saved area.
+        unsafe { asm!("fnsave [{0}]", "frstor [{0}]", in(reg) area, options(nostack)) };
+    }
+}
+
+fn restore_registers(state: &FpuState) {
+    let area = state.0.as_ptr();
+    if FXSR.load(Ordering::Relaxed) {
+        unsafe { asm!("fxrstor [{}]", in(reg) area, options(nostack, readonly)) };
+    } else {
+        unsafe { asm!("frstor [{}]", in(reg) area, options(nostack, readonly)) };
+    }
+}
+
+/// Loads the state a new program starts with.
+fn reset_registers() {
+    unsafe { asm!("fninit", options(nomem, nostack)) };
+    if SSE.load(Ordering::Relaxed) {
+        let mxcsr = MXCSR_DEFAULT;
+        unsafe { asm!("ldmxcsr [{}]", in(reg) &mxcsr, options(nostack, readonly)) };
+    }
+}
+
+/// Handles #NM from user space: gives the FPU to `task` on this CPU,
+/// loading its saved state unless the registers still hold it. A task's
+/// first use allocates its save area and starts from the reset state.
+pub fn take(task: &mut Task) {
+    clts();
+
+    let cpu = cpu_id();
+    let tag = owner_tag(task.id);
+    if OWNERS[cpu].load(Ordering::Relaxed) == tag {
+        return;
+    }
+
+    match &task.fpu {
+        Some(state) => restore_registers(state),
+        None => {
+            reset_registers();
+            task.fpu = Some(Box::new(FpuState([0; 512])));
+        }
+    }
+
+    // Registers another CPU kept for the task go stale from here on.
+    for (other, owner) in OWNERS.iter().enumerate() {
+        if other != cpu {
+            let _ = owner.compare_exchange(tag, 0, Ordering::Relaxed, Ordering::Relaxed);
+        }
+    }
+    OWNERS[cpu].store(tag, Ordering::Relaxed);
+}
+
+/// Saves the FPU registers of `task`, which runs on this CPU, if it used
+/// them since it was dispatched. Called when switching away so the task can
+/// resume on any CPU without asking this one for its state.
+pub fn save(task: &mut Task) {
+    if OWNERS[cpu_id()].load(Ordering::Relaxed) != owner_tag(task.id) || read_cr0() & CR0_TS != 0 {
+        return;
+    }
+
+    if let Some(state) = task.fpu.as_mut() {
+        save_registers(state);
+    }
+    stts();
+}
+
+/// FPU state of `task`, which runs on this CPU, for a forked child.
+pub fn snapshot(task: &mut Task) -> Option<Box<FpuState>> {
+    save(task);
+    task.fpu.clone()
+}
+
+/// Drops the FPU state of `task` so it starts over from the reset state,
+/// as after `exec`.
+pub fn discard(task: &mut Task) {
+    task.fpu = None;
+    let tag = owner_tag(task.id);
+    for owner in OWNERS.iter() {
+        let _ = owner.compare_exchange(tag, 0, Ordering::Relaxed, Ordering::Relaxed);
+    }
+    stts();
+}
+
+/// Arms or disarms the #NM trap for `task`, which is about to run on this
+/// CPU: no trap if the registers still hold its state.
+pub fn switch_to(task: &Task) {
+    if OWNERS[cpu_id()].load(Ordering::Relaxed) == owner_tag(task.id) {
+        clts();
+    } else {
+        stts();
+    }
+}
@@ -1,8 +1,11 @@
 use alloc::sync::Arc;
 
-use crate::fs::{
-    FsError, MountOptions,
-    vfs::{FileSystem, FileSystemDriver},
+use crate::{
+    device::{block_dev::sync, bufstream::BufStream, readahead::HintCell, writeback::WriteLog},
+    fs::{
+        FsError, MountOptions,
+        vfs::{FileSystem, FileSystemDriver},
+    },
 };
 
 use super::filesystem::Fat16FileSystem;
@@ -10,6 +13,19 @@ use super::filesystem::Fat16FileSystem;
 #[derive(Debug, Default)]
 pub struct FatDriver;
 
+impl FatDriver {
+    /// Writes an empty FAT volume over all of block device `id`, sized by
+    /// fatfs from the sector count.
+    pub fn format(&self, id: usize) -> Result<(), FsError> {
+        let hint = Arc::new(HintCell::new());
+        let log = Arc::new(WriteLog::new(id));
+        let mut stream = BufStream::new(id, hint, log);
+        fatfs::format_volume(&mut stream, fatfs::FormatVolumeOptions::new())
+            .map_err(|_| FsError::IoError)?;
+        sync(id).map_err(|_| FsError::IoError)
+    }
+}
+
 impl FileSystemDriver for FatDriver {
     fn mount(&self, options: &MountOptions) -> Result<Arc<dyn FileSystem>, FsError> {
         let id = options.block_device_id.ok_or(FsError::InvalidArgument)?;
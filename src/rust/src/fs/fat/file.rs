@@ -1,27 +1,59 @@
-use alloc::sync::Arc;
+use alloc::{sync::Arc, vec::Vec};
 use spin::Mutex;
 
 use crate::{
-    device::bufstream::BufStream,
+    constant::BLOCK_CACHE_SECTORS,
+    device::{
+        block_cache::SECTOR_SIZE,
+        bufstream::BufStream,
+        readahead::{HintCell, ReadAheadHint},
+        writeback::WriteLog,
+    },
     fs::{
         FsError,
-        vfs::{FileMetadata, FileOps},
+        vfs::{Advice, FileMetadata, FileOps},
     },
 };
 
 use fatfs::{Read, Seek, SeekFrom, Write};
 
-use super::filesystem::{fat_entry_mode, fat_entry_name, fat_error, fat_parent_and_name};
+use super::filesystem::{
+    ChangeStamps, change_stamp, fat_entry_mode, fat_entry_name, fat_error, fat_parent_and_name,
+    touch_stamp,
+};
+
+/// Most a `WILLNEED` advice reads ahead: half the default block cache, so
+/// it does not evict what it just read.
+const WILL_NEED_MAX_BYTES: usize = BLOCK_CACHE_SECTORS * SECTOR_SIZE / 2;
+const WILL_NEED_CHUNK: usize = 64 * 1024;
 
 pub struct FatFile {
     file:
         Mutex<fatfs::File<'static, BufStream, fatfs::NullTimeProvider, fatfs::LossyOemCpConverter>>,
     fs: Arc<Mutex<fatfs::FileSystem<BufStream>>>,
+    /// Read-ahead hint of the filesystem's block stream.
+    hint: Arc<HintCell>,
+    advice: Advice,
+    /// Offset the last read ended at; a read starting there is sequential.
+    next_read: usize,
+    log: Arc<WriteLog>,
+    /// Sectors written since the last `sync`, data and FAT alike.
+    written: Vec<(u64, usize)>,
+    /// Size at the last `sync`, if known; `fdatasync` skips the directory
+    /// entry while it holds.
+    synced_size: Option<usize>,
+    stamps: ChangeStamps,
     path: Arc<str>,
 }
 
 impl FatFile {
-    pub fn new(fs: Arc<Mutex<fatfs::FileSystem<BufStream>>>, path: &str) -> Result<Self, FsError> {
+    pub fn new(
+        fs: Arc<Mutex<fatfs::FileSystem<BufStream>>>,
+        hint: Arc<HintCell>,
+        log: Arc<WriteLog>,
+        stamps: ChangeStamps,
+        path: &str,
+    ) -> Result<Self, FsError> {
         let file: fatfs::File<'static, _, _, _> = {
             let fs = fs.lock();
             let root_dir = fs.root_dir();
@@ -32,9 +64,61 @@ impl FatFile {
         Ok(FatFile {
             file: Mutex::new(file),
             fs,
+            hint,
+            advice: Advice::Normal,
+            next_read: 0,
+            log,
+            written: Vec::new(),
+            synced_size: None,
+            stamps,
             path: Arc::from(path),
         })
     }
+
+    fn read_hint(&self, pos: usize) -> ReadAheadHint {
+        match self.advice {
+            Advice::Sequential => ReadAheadHint::Streaming,
+            Advice::Random => ReadAheadHint::Random,
+            _ if pos == self.next_read => ReadAheadHint::Sequential,
+            _ => ReadAheadHint::Normal,
+        }
+    }
+
+    /// Reads `len` bytes from `offset` and throws them away, for what the
+    /// block stream does on the way with `hint`. The file position is kept.
+    /// With `Discard` the stream skips the file's whole blocks, so only the
+    /// cluster chain and any partial blocks at the ends are read.
+    fn read_range(&mut self, offset: usize, len: usize, hint: ReadAheadHint) -> Result<(), FsError> {
+        let _fs = self.fs.lock();
+        let mut file = self.file.lock();
+        let pos = file.seek(SeekFrom::Current(0)).map_err(fat_error)?;
+        let size = file.seek(SeekFrom::End(0)).map_err(fat_error)? as usize;
+        let end = match len {
+            0 => size,
+            _ => offset.saturating_add(len).min(size),
+        };
+        let end = match hint {
+            ReadAheadHint::Discard => end,
+            _ => end.min(offset.saturating_add(WILL_NEED_MAX_BYTES)),
+        };
+
+        let mut chunk = vec![0u8; WILL_NEED_CHUNK.min(end.saturating_sub(offset))];
+        let mut at = offset;
+        let mut result = file.seek(SeekFrom::Start(offset as u64)).map(|_| ());
+        self.hint.set(hint);
+        while result.is_ok() && at < end {
+            let len = (end - at).min(chunk.len());
+            match file.read(&mut chunk[..len]) {
+                Ok(0) => break,
+                Ok(read) => at += read,
+                Err(error) => result = Err(error),
+            }
+        }
+        self.hint.set(ReadAheadHint::Normal);
+
+        file.seek(SeekFrom::Start(pos)).map_err(fat_error)?;
+        result.map_err(fat_error)
+    }
 }
 
 impl Drop for FatFile {
@@ -48,11 +132,31 @@ unsafe impl Sync for FatFile {}
 
 impl FileOps for FatFile {
     fn read(&mut self, buf: &mut [u8]) -> Result<usize, FsError> {
-        self.file.lock().read(buf).map_err(fat_error)
+        // The hint belongs to this call until the filesystem is released.
+        let _fs = self.fs.lock();
+        let mut file = self.file.lock();
+        let pos = file.seek(SeekFrom::Current(0)).map_err(fat_error)? as usize;
+        self.hint.set(self.read_hint(pos));
+        let result = file.read(buf);
+        self.hint.set(ReadAheadHint::Normal);
+
+        let read = result.map_err(fat_error)?;
+        self.next_read = pos + read;
+        Ok(read)
     }
 
     fn write(&mut self, buf: &[u8]) -> Result<usize, FsError> {
-        self.file.lock().write(buf).map_err(fat_error)
+        // The log records for this file until the filesystem is released.
+        let _fs = self.fs.lock();
+        let mut file = self.file.lock();
+        let written = self
+            .log
+            .record(&mut self.written, || file.write(buf))
+            .map_err(fat_error)?;
+        if written > 0 {
+            touch_stamp(&self.stamps, self.path.as_ref());
+        }
+        Ok(written)
     }
 
     fn seek(&mut self, pos: usize) -> Result<usize, FsError> {
@@ -64,11 +168,35 @@ impl FileOps for FatFile {
     }
 
     fn truncate(&mut self, size: usize) -> Result<(), FsError> {
+        let _fs = self.fs.lock();
         let mut file = self.file.lock();
         file.seek(SeekFrom::Start(size as u64))
             .map_err(fat_error)?;
-        file.truncate().map_err(fat_error)?;
-        file.flush().map_err(fat_error)
+        self.log
+            .record(&mut self.written, || file.truncate().and_then(|_| file.flush()))
+            .map_err(fat_error)?;
+        touch_stamp(&self.stamps, self.path.as_ref());
+        Ok(())
+    }
+
+    fn sync(&mut self, data_only: bool) -> Result<(), FsError> {
+        let _fs = self.fs.lock();
+        let mut file = self.file.lock();
+        let pos = file.seek(SeekFrom::Current(0)).map_err(fat_error)?;
+        let size = file.seek(SeekFrom::End(0)).map_err(fat_error)? as usize;
+        file.seek(SeekFrom::Start(pos)).map_err(fat_error)?;
+
+        // fatfs writes the directory entry, size included, on flush.
+        if !data_only || self.synced_size != Some(size) {
+            self.log
+                .record(&mut self.written, || file.flush())
+                .map_err(fat_error)?;
+        }
+        self.log
+            .sync(&mut self.written)
+            .map_err(|_| FsError::IoError)?;
+        self.synced_size = Some(size);
+        Ok(())
     }
 
     fn stat(&self) -> Result<FileMetadata, FsError> {
@@ -95,9 +223,24 @@ impl FileOps for FatFile {
                     mode,
                     size,
                     is_dir: e.is_dir(),
+                    modified: change_stamp(&self.stamps, self.path.as_ref()),
                 });
             }
         }
         Err(FsError::NotFound)
     }
+
+    fn advise(&mut self, offset: usize, len: usize, advice: Advice) -> Result<(), FsError> {
+        match advice {
+            Advice::Normal | Advice::Random | Advice::Sequential => {
+                self.advice = advice;
+                Ok(())
+            }
+            Advice::WillNeed => self.read_range(offset, len, ReadAheadHint::Streaming),
+            Advice::DontNeed => {
+                self.next_read = usize::MAX;
+                self.read_range(offset, len, ReadAheadHint::Discard)
+            }
+        }
+    }
 }
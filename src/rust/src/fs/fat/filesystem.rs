@@ -1,12 +1,16 @@
 use crate::{
-    device::{block_dev::BlockDeviceError, bufstream::BufStream},
+    device::{
+        block_dev::BlockDeviceError, bufstream::BufStream, readahead::HintCell,
+        writeback::WriteLog,
+    },
     fs::{
         FsError,
-        vfs::{FileHandle, FileMetadata, FileSystem},
+        vfs::{FileHandle, FileMetadata, FileSystem, next_change_stamp},
     },
 };
 use alloc::{
     boxed::Box,
+    collections::BTreeMap,
     string::{String, ToString},
     sync::Arc,
     vec::Vec,
@@ -19,17 +23,34 @@ type FatFs = fatfs::FileSystem<BufStream>;
 type FatDirEntry<'a> =
     fatfs::DirEntry<'a, BufStream, fatfs::NullTimeProvider, fatfs::LossyOemCpConverter>;
 
+/// Change stamps of the files changed since mount, by lowercase path. FAT
+/// keeps no usable timestamps, so the stamps live only in memory.
+pub(super) type ChangeStamps = Arc<Mutex<BTreeMap<String, u32>>>;
+
 pub struct Fat16FileSystem {
     fs: Arc<Mutex<FatFs>>,
+    /// Read-ahead hint its files give the block stream.
+    hint: Arc<HintCell>,
+    /// Where its files record the sectors they write, for `fsync`.
+    log: Arc<WriteLog>,
+    stamps: ChangeStamps,
 }
 
 impl Fat16FileSystem {
     pub fn new(id: usize) -> Result<Self, BlockDeviceError> {
-        let fs = fatfs::FileSystem::new(BufStream::new(id), fatfs::FsOptions::new())
+        let hint = Arc::new(HintCell::new());
+        let log = Arc::new(WriteLog::new(id));
+        let stream = BufStream::new(id, hint.clone(), log.clone());
+        let fs = fatfs::FileSystem::new(stream, fatfs::FsOptions::new())
             .map_err(|_| BlockDeviceError::IoError)?;
         let fs = Arc::new(Mutex::new(fs));
 
-        Ok(Self { fs })
+        Ok(Self {
+            fs,
+            hint,
+            log,
+            stamps: Arc::new(Mutex::new(BTreeMap::new())),
+        })
     }
 }
 
@@ -37,6 +58,9 @@ impl FileSystem for Fat16FileSystem {
     fn open(&self, path: &str) -> Result<FileHandle, FsError> {
         Ok(FileHandle::new(Box::new(FatFile::new(
             self.fs.clone(),
+            self.hint.clone(),
+            self.log.clone(),
+            self.stamps.clone(),
             path,
         )?)))
     }
@@ -70,13 +94,16 @@ impl FileSystem for Fat16FileSystem {
                 .create_file(path)
                 .map_err(fat_error)?;
         };
+        touch_stamp(&self.stamps, path);
         Ok(())
     }
 
     fn remove(&self, path: &str) -> Result<(), FsError> {
         let fs = self.fs.lock();
         let root_dir = fs.root_dir();
-        root_dir.remove(path).map_err(fat_error)
+        root_dir.remove(path).map_err(fat_error)?;
+        self.stamps.lock().remove(&path.to_lowercase());
+        Ok(())
     }
 
     fn metadata(&self, path: &str) -> Result<FileMetadata, FsError> {
@@ -87,6 +114,7 @@ impl FileSystem for Fat16FileSystem {
                 mode: 0o755,
                 size: 0,
                 is_dir: true,
+                modified: 0,
             });
         }
         let fs = self.fs.lock();
@@ -112,6 +140,7 @@ impl FileSystem for Fat16FileSystem {
                     mode,
                     size,
                     is_dir: e.is_dir(),
+                    modified: change_stamp(&self.stamps, path),
                 });
             }
         }
@@ -162,6 +191,21 @@ pub(super) fn fat_entry_name(entry: &FatDirEntry<'_>) -> String {
         .to_string()
 }
 
+/// Records that the file at `path` changed now.
+pub(super) fn touch_stamp(stamps: &ChangeStamps, path: &str) {
+    stamps
+        .lock()
+        .insert(path.to_lowercase(), next_change_stamp());
+}
+
+pub(super) fn change_stamp(stamps: &ChangeStamps, path: &str) -> u32 {
+    stamps
+        .lock()
+        .get(&path.to_lowercase())
+        .copied()
+        .unwrap_or(0)
+}
+
 pub(super) fn fat_parent_and_name(path: &str) -> (&str, &str) {
     path.rsplit_once('/').unwrap_or(("", path))
 }
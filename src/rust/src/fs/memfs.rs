@@ -9,6 +9,7 @@ use spin::{Mutex, RwLock};
 
 use super::vfs::{
     FileHandle, FileMetadata, FileOps, FileSystem, FileSystemDriver, FsError, MountOptions,
+    next_change_stamp,
 };
 
 #[derive(Debug, Default)]
@@ -45,6 +46,7 @@ impl MemFsVolume {
                 mode: 0o755,
                 size: 0,
                 is_dir: true,
+                modified: 0,
             },
         };
         map.insert("".to_string(), Arc::new(Mutex::new(root)));
@@ -114,6 +116,7 @@ impl FileSystem for MemFsVolume {
             mode: if directory { 0o755 } else { 0o644 },
             size: 0,
             is_dir: directory,
+            modified: next_change_stamp(),
         };
         let new_node = MemNode {
             is_dir: directory,
@@ -191,6 +194,7 @@ impl FileOps for MemFsFile {
         node.data[self.offset..end].copy_from_slice(buf);
         self.offset += buf.len();
         node.meta.size = node.data.len() as u64;
+        node.meta.modified = next_change_stamp();
         Ok(buf.len())
     }
 
@@ -204,6 +208,7 @@ impl FileOps for MemFsFile {
         let mut node = self.inner.lock();
         node.data.resize(size, 0);
         node.meta.size = node.data.len() as u64;
+        node.meta.modified = next_change_stamp();
         self.offset = self.offset.min(node.data.len());
         Ok(())
     }
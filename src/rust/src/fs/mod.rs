@@ -8,8 +8,9 @@ mod vfs;
 pub use devfs::DevFsDriver;
 pub use fat::FatDriver;
 pub use memfs::MemFsDriver;
-pub use pipe::{Pipe, PipeEnd, PipeError};
+pub use pipe::{Pipe, PipeEnd, PipeError, PipeRequest};
 #[allow(unused_imports)]
 pub use vfs::{
-    FileHandle, FileMetadata, FileOps, FileSystem, FileSystemDriver, FsError, MountOptions, Vfs,
+    Advice, FileHandle, FileMetadata, FileOps, FileSystem, FileSystemDriver, FsError, MountOptions,
+    Vfs,
 };
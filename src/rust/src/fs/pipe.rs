@@ -1,6 +1,14 @@
-use alloc::{collections::VecDeque, vec::Vec};
-
-use crate::schedule::task::TaskId;
+use alloc::{collections::VecDeque, sync::Arc};
+
+use crate::{
+    error::KernelError,
+    schedule::{
+        process::Process,
+        task::{TaskId, WaitReason, copy_string_from_task, copy_string_to_task},
+        task_manager::TaskManager,
+        wait_queue::{Resume, WaitQueue},
+    },
+};
 
 pub const PIPE_CAPACITY: usize = 4096;
 
@@ -15,14 +23,25 @@ pub enum PipeError {
     WouldBlock,
     BrokenPipe,
     WrongEnd,
+    /// The buffer of a parked task could not be accessed.
+    Fault,
+}
+
+/// A blocked read or write, completed by whichever task unblocks it.
+pub struct PipeRequest {
+    pub process: Arc<Process>,
+    pub buf_ptr: u32,
+    pub len: usize,
+    /// Turns the outcome into the syscall result of the parked task.
+    pub finish: fn(Result<usize, PipeError>) -> u32,
 }
 
 pub struct Pipe {
     buffer: VecDeque<u8>,
     readers: usize,
     writers: usize,
-    read_waiters: VecDeque<TaskId>,
-    write_waiters: VecDeque<TaskId>,
+    read_waiters: WaitQueue<PipeRequest>,
+    write_waiters: WaitQueue<PipeRequest>,
 }
 
 impl Pipe {
@@ -31,8 +50,8 @@ impl Pipe {
             buffer: VecDeque::new(),
             readers: 1,
             writers: 1,
-            read_waiters: VecDeque::new(),
-            write_waiters: VecDeque::new(),
+            read_waiters: WaitQueue::new(),
+            write_waiters: WaitQueue::new(),
         }
     }
 
@@ -47,16 +66,12 @@ impl Pipe {
         }
     }
 
-    pub fn close_end(&mut self, end: PipeEnd) -> Vec<TaskId> {
+    /// Drops one handle to `end`. Call `serve_waiters` afterwards so that the
+    /// last close releases the tasks parked on the other end.
+    pub fn close_end(&mut self, end: PipeEnd) {
         match end {
-            PipeEnd::Read => {
-                self.readers = self.readers.saturating_sub(1);
-                self.take_write_waiters()
-            }
-            PipeEnd::Write => {
-                self.writers = self.writers.saturating_sub(1);
-                self.take_read_waiters()
-            }
+            PipeEnd::Read => self.readers = self.readers.saturating_sub(1),
+            PipeEnd::Write => self.writers = self.writers.saturating_sub(1),
         }
     }
 
@@ -113,23 +128,99 @@ impl Pipe {
         Ok(to_write)
     }
 
-    pub fn add_read_waiter(&mut self, task_id: TaskId) {
-        if !self.read_waiters.contains(&task_id) {
-            self.read_waiters.push_back(task_id);
-        }
+    /// Parks the current task until a writer fills `request`.
+    pub fn park_reader(
+        &mut self,
+        task_manager: &mut TaskManager,
+        request: PipeRequest,
+        interrupted: u32,
+    ) -> Result<TaskId, KernelError> {
+        let reason = WaitReason::PipeRead(self.id());
+        self.read_waiters
+            .park(task_manager, reason, request, None, interrupted)
+    }
+
+    /// Parks the current task until a reader makes room for `request`.
+    pub fn park_writer(
+        &mut self,
+        task_manager: &mut TaskManager,
+        request: PipeRequest,
+        interrupted: u32,
+    ) -> Result<TaskId, KernelError> {
+        let reason = WaitReason::PipeWrite(self.id());
+        self.write_waiters
+            .park(task_manager, reason, request, None, interrupted)
     }
 
-    pub fn add_write_waiter(&mut self, task_id: TaskId) {
-        if !self.write_waiters.contains(&task_id) {
-            self.write_waiters.push_back(task_id);
+    /// Completes the parked reads and writes the pipe can now satisfy:
+    /// buffered bytes go straight into the buffers of parked readers, parked
+    /// writers fill the free space, and a closed end releases every task
+    /// parked on the other one. Each task wakes with its syscall finished.
+    pub fn serve_waiters(&mut self, task_manager: &mut TaskManager) {
+        loop {
+            let mut progress = false;
+            while !self.buffer.is_empty() {
+                let Some(waiter) = self.read_waiters.pop(task_manager) else {
+                    break;
+                };
+                let result = self.fill_reader(&waiter.data);
+                waiter.resume(task_manager, Resume::Value((waiter.data.finish)(result)));
+                progress = true;
+            }
+
+            while self.readers > 0 && self.buffer.len() < PIPE_CAPACITY {
+                let Some(waiter) = self.write_waiters.pop(task_manager) else {
+                    break;
+                };
+                let result = self.drain_writer(&waiter.data);
+                waiter.resume(task_manager, Resume::Value((waiter.data.finish)(result)));
+                progress = true;
+            }
+
+            if !progress {
+                break;
+            }
+        }
+
+        if self.readers == 0 {
+            self.write_waiters.wake_all(task_manager, |request| {
+                Resume::Value((request.finish)(Err(PipeError::BrokenPipe)))
+            });
+        }
+        if self.writers == 0 && self.buffer.is_empty() {
+            self.read_waiters.wake_all(task_manager, |request| {
+                Resume::Value((request.finish)(Ok(0)))
+            });
         }
     }
 
-    pub fn take_read_waiters(&mut self) -> Vec<TaskId> {
-        self.read_waiters.drain(..).collect()
+    fn fill_reader(&mut self, request: &PipeRequest) -> Result<usize, PipeError> {
+        let count = request.len.min(self.buffer.len());
+        let data = self.buffer.make_contiguous();
+        copy_string_to_task(
+            &request.process.page_directory,
+            data.as_ptr() as u32,
+            request.buf_ptr,
+            count as u32,
+        )
+        .map_err(|_| PipeError::Fault)?;
+        self.buffer.drain(..count);
+        Ok(count)
     }
 
-    pub fn take_write_waiters(&mut self) -> Vec<TaskId> {
-        self.write_waiters.drain(..).collect()
+    fn drain_writer(&mut self, request: &PipeRequest) -> Result<usize, PipeError> {
+        let count = request
+            .len
+            .min(PIPE_CAPACITY.saturating_sub(self.buffer.len()));
+        let mut data = vec![0u8; count];
+        copy_string_from_task(
+            &request.process.page_directory,
+            request.buf_ptr,
+            data.as_mut_ptr() as u32,
+            count as u32,
+        )
+        .map_err(|_| PipeError::Fault)?;
+        self.buffer.extend(data);
+        Ok(count)
     }
 }
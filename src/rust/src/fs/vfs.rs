@@ -1,6 +1,9 @@
 #![allow(unused)]
 
-use core::fmt::Debug;
+use core::{
+    fmt::Debug,
+    sync::atomic::{AtomicU32, Ordering},
+};
 
 use alloc::{
     boxed::Box,
@@ -37,7 +40,17 @@ pub struct FileMetadata {
     pub mode: u16,
     pub size: u64,
     pub is_dir: bool,
-    // etc. e.g. timestamps if you want
+    /// Change stamp from `next_change_stamp`, taken when the file was last
+    /// created, written or truncated; 0 if it was not since boot. Stands in
+    /// for a modification time, which the filesystems do not keep.
+    pub modified: u32,
+}
+
+static CHANGE_STAMP: AtomicU32 = AtomicU32::new(0);
+
+/// Stamp for a file change, greater than any handed out before.
+pub fn next_change_stamp() -> u32 {
+    CHANGE_STAMP.fetch_add(1, Ordering::Relaxed) + 1
 }
 
 #[derive(Clone, Default)]
@@ -63,6 +76,16 @@ pub trait FileSystem: Send + Sync {
     fn chown(&self, path: &str, uid: u32, gid: u32) -> Result<(), FsError>;
 }
 
+/// Access pattern announced for a range of a file, as `posix_fadvise`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Advice {
+    Normal,
+    Random,
+    Sequential,
+    WillNeed,
+    DontNeed,
+}
+
 pub trait FileOps {
     fn read(&mut self, buf: &mut [u8]) -> Result<usize, FsError>;
     fn write(&mut self, buf: &[u8]) -> Result<usize, FsError>;
@@ -79,6 +102,16 @@ pub trait FileOps {
         Err(FsError::Unsupported)
     }
     fn stat(&self) -> Result<FileMetadata, FsError>;
+    /// Advice about how `len` bytes from `offset` will be read, 0 meaning to
+    /// the end. Files without a cache below them can ignore it.
+    fn advise(&mut self, _offset: usize, _len: usize, _advice: Advice) -> Result<(), FsError> {
+        Ok(())
+    }
+    /// Writes the file's data back to its device, and its metadata unless
+    /// `data_only`. Files not backed by a block device have nothing to do.
+    fn sync(&mut self, _data_only: bool) -> Result<(), FsError> {
+        Ok(())
+    }
 }
 
 pub struct FileHandle {
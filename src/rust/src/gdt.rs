@@ -1,8 +1,14 @@
-use core::arch::asm;
+use alloc::boxed::Box;
+use core::{
+    arch::asm,
+    cell::UnsafeCell,
+    sync::atomic::{AtomicPtr, Ordering},
+};
 use lazy_static::lazy_static;
 
 use crate::{
-    constant::TOTAL_GDT_SEGMENTS,
+    constant::{MAX_CPUS, TOTAL_GDT_SEGMENTS, USER_TLS_ENTRY},
+    smp::cpu_id,
     tss::{Tss, ltr},
 };
 
@@ -23,19 +29,32 @@ lazy_static! {
     pub static ref GDT: Gdt = Gdt::new();
 }
 
+/// GDT loaded on each CPU, for updating its TLS descriptor.
+static CPU_GDTS: [AtomicPtr<Gdt>; MAX_CPUS] =
+    [const { AtomicPtr::new(core::ptr::null_mut()) }; MAX_CPUS];
+
 lazy_static! {
     pub static ref TSS: Tss = Tss::new_with_kernel_stack(0x600000, KERNEL_DATA_SELECTOR as u32);
 }
 
 #[derive(Debug)]
 pub struct Gdt {
-    pub entries: [GdtEntryRaw; TOTAL_GDT_SEGMENTS],
+    /// Only the TLS descriptor changes after loading, and only from the CPU
+    /// that uses this table.
+    entries: UnsafeCell<[GdtEntryRaw; TOTAL_GDT_SEGMENTS]>,
 }
 
+unsafe impl Sync for Gdt {}
+
 impl Gdt {
     pub fn new() -> Self {
-        lazy_static::initialize(&TSS);
-        let tss_base = (&*TSS as *const _ as usize) as u32;
+        Self::for_tss(&TSS)
+    }
+
+    /// GDT whose TSS descriptor points at `tss`. Every CPU needs its own pair
+    /// because `ltr` marks the descriptor busy and `esp0` is per CPU.
+    pub fn for_tss(tss: &Tss) -> Self {
+        let tss_base = (tss as *const _ as usize) as u32;
         let tss_limit = tss_base + core::mem::size_of::<Tss>() as u32;
 
         let entries = [
@@ -45,16 +64,21 @@ impl Gdt {
             GdtEntryRaw::encode_from(0x00, 0xFFFFFFFF, TYPE_UCODE, 0xCF), // user code segment
             GdtEntryRaw::encode_from(0x00, 0xFFFFFFFF, TYPE_UDATA, 0xCF), // user data segment
             GdtEntryRaw::encode_from(tss_base, tss_limit, TYPE_TSS, 0x00), // TSS segment
+            GdtEntryRaw::encode_from(0x00, 0xFFFFFFFF, TYPE_UDATA, 0xCF), // user TLS segment
         ];
 
-        Self { entries }
+        Self {
+            entries: UnsafeCell::new(entries),
+        }
     }
 
-    pub fn init_gdt(&self) {
+    /// Loads the table on `cpu`, which owns it from then on.
+    pub fn init_gdt(&'static self, cpu: usize) {
         let gdt_ptr = GdtDescriptor {
-            limit: (core::mem::size_of::<GdtEntryRaw>() * self.entries.len() - 1) as u16,
-            base: &self.entries as *const _ as u32,
+            limit: (core::mem::size_of::<[GdtEntryRaw; TOTAL_GDT_SEGMENTS]>() - 1) as u16,
+            base: self.entries.get() as u32,
         };
+        CPU_GDTS[cpu].store(self as *const Gdt as *mut Gdt, Ordering::Release);
 
         unsafe {
             lgdt(&gdt_ptr);
@@ -78,6 +102,32 @@ impl Gdt {
     }
 }
 
+/// Loads a GDT and TSS of its own on application processor `cpu`, with
+/// `esp0` at the top of its kernel stack. Both live as long as the CPU does.
+pub fn init_ap_gdt(cpu: usize, esp0: u32) {
+    let tss: &'static Tss = Box::leak(Box::new(Tss::new_with_kernel_stack(
+        esp0,
+        KERNEL_DATA_SELECTOR as u32,
+    )));
+    let gdt: &'static Gdt = Box::leak(Box::new(Gdt::for_tss(tss)));
+    gdt.init_gdt(cpu);
+}
+
+/// Points the TLS descriptor of this CPU at `base`. The new base takes
+/// effect the next time `gs` is loaded, which every return to user mode does.
+pub fn set_tls_base(base: u32) {
+    let gdt = CPU_GDTS[cpu_id()].load(Ordering::Acquire);
+    if gdt.is_null() {
+        return;
+    }
+
+    let entry = GdtEntryRaw::encode_from(base, 0xFFFFFFFF, TYPE_UDATA, 0xCF);
+    unsafe {
+        let entries = (*gdt).entries.get() as *mut GdtEntryRaw;
+        entries.add(USER_TLS_ENTRY as usize).write_volatile(entry);
+    }
+}
+
 #[repr(C, packed)]
 #[derive(Clone, Copy, Default, Debug)]
 pub struct GdtEntryRaw {
@@ -1,10 +1,37 @@
 use crate::{
-    interrupts::interrupt_frame::InterruptFrame, kernel::KERNEL, schedule::task::task_next,
+    device::{timer::TIMER_DRIVER, writeback},
+    interrupts::interrupt_frame::InterruptFrame,
+    kernel::KERNEL,
+    schedule::task::task_next,
 };
 
 pub fn idt_clock(_frame: &InterruptFrame) {
     KERNEL.kernel_page();
+    TIMER_DRIVER.handle_interrupt();
     KERNEL.with_task_manager(|tm| tm.tick());
+    // Devices are locked with interrupts off, so none is held by this CPU;
+    // one another CPU holds is skipped until the next pass.
+    writeback::run();
 
     task_next();
 }
+
+/// Local APIC timer of an application processor. Time itself comes from the
+/// TSC, so this only expires timers and ends slices.
+pub fn idt_local_timer(_frame: &InterruptFrame) {
+    KERNEL.kernel_page();
+    KERNEL.with_task_manager(|tm| tm.tick());
+
+    task_next();
+}
+
+/// Another CPU queued work for this one or removed the task running here.
+pub fn idt_reschedule(_frame: &InterruptFrame) {
+    KERNEL.kernel_page();
+
+    task_next();
+}
+
+/// Another CPU changed the page tables of the address space running here.
+/// Entering the kernel already reloaded CR3, which is all it waits for.
+pub fn idt_tlb_shootdown(_frame: &InterruptFrame) {}
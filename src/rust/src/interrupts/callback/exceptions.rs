@@ -1,5 +1,7 @@
 use crate::{
+    fpu,
     interrupts::{interrupt_frame::InterruptFrame, utils::get_cr2},
+    kernel::KERNEL,
     schedule::{process_manager::process_terminate, task::task_next},
 };
 
@@ -13,6 +15,20 @@ pub fn idt_handle_exception_error(_frame: &InterruptFrame, _error_code: u32) {
     task_next();
 }
 
+/// #NM: a user task used the FPU while `CR0.TS` was set. The kernel is built
+/// without FPU instructions, so one from ring 0 is a bug.
+pub fn idt_device_not_available(frame: &InterruptFrame) {
+    if { frame.cs } & 3 != 3 {
+        panic!("FPU used in kernel mode at 0x{:x}", { frame.ip });
+    }
+
+    KERNEL.with_task_manager(|tm| {
+        if let Some(current_task) = tm.get_current() {
+            fpu::take(&mut current_task.write());
+        }
+    });
+}
+
 pub fn idt_page_fault(frame: &InterruptFrame, code_error: u32) {
     let faulting_address = get_cr2();
 
@@ -36,6 +52,17 @@ pub fn idt_page_fault(frame: &InterruptFrame, code_error: u32) {
         }
     }
 
+    // First touch of a demand-paged program page.
+    if p == 0 && u != 0 {
+        let handled = crate::kernel::KERNEL
+            .with_task_manager(|tm| tm.get_current().map(|t| t.read().process.clone()))
+            .is_some_and(|process| process.page_directory.fault_in(faulting_address));
+
+        if handled {
+            return;
+        }
+    }
+
     serial_print!("Page fault( ");
     if p != 0 {
         serial_print!("protection violation ");
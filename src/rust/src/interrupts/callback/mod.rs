@@ -1,7 +1,8 @@
 mod clock;
 mod exceptions;
 
-pub use clock::idt_clock;
+pub use clock::{idt_clock, idt_local_timer, idt_reschedule, idt_tlb_shootdown};
 pub use exceptions::{
-    idt_general_protection_fault, idt_handle_exception, idt_handle_exception_error, idt_page_fault,
+    idt_device_not_available, idt_general_protection_fault, idt_handle_exception,
+    idt_handle_exception_error, idt_page_fault,
 };
@@ -23,7 +23,7 @@ pub extern "C" fn interrupt_handler(interrupt: u32, frame: &InterruptFrame) {
         }
     }
 
-    task_page();
+    task_page(frame);
 }
 
 #[unsafe(no_mangle)]
@@ -36,7 +36,7 @@ pub extern "C" fn interrupt_handler_error(error_code: u32, interrupt: u32, frame
         cb(frame, error_code);
     }
 
-    task_page();
+    task_page(frame);
 }
 
 #[unsafe(no_mangle)]
@@ -46,7 +46,7 @@ pub extern "C" fn syscall_handler(frame: &mut InterruptFrame) -> u32 {
     let res = syscall_handle(frame);
     frame.eax = res;
     task_current_save_state(frame);
-    task_page();
+    task_page(frame);
     res
 }
 
@@ -3,11 +3,15 @@ use paste::paste;
 use seq_macro::seq;
 
 use crate::{
-    constant::{KERNEL_CODE_SELECTOR, irq_to_vector},
+    constant::{
+        KERNEL_CODE_SELECTOR, LAPIC_TIMER_VECTOR, RESCHEDULE_VECTOR, TLB_SHOOTDOWN_VECTOR,
+        irq_to_vector,
+    },
     interrupts::{
         callback::{
-            idt_clock, idt_general_protection_fault, idt_handle_exception,
-            idt_handle_exception_error, idt_page_fault,
+            idt_clock, idt_device_not_available, idt_general_protection_fault,
+            idt_handle_exception, idt_handle_exception_error, idt_local_timer, idt_page_fault,
+            idt_reschedule, idt_tlb_shootdown,
         },
         handler::{default_handler, syscall_wrapper},
         interrupt::{InterruptHandlerKind, InterruptSource},
@@ -133,11 +137,15 @@ fn idt_set(interrupt_no: usize, address: unsafe extern "C" fn()) {
     desc.type_attr = 0xEE;
 }
 
-pub fn idt_init() {
-    let idtr_descriptor = Idtr {
+fn idt_descriptor() -> Idtr {
+    Idtr {
         base: { &raw const IDT_DESCRIPTORS } as u32,
         limit: (IDT_TOTAL_INTERRUPTS * core::mem::size_of::<IdtDesc>() - 1) as u16,
-    };
+    }
+}
+
+pub fn idt_init() {
+    let idtr_descriptor = idt_descriptor();
 
     for (i, handler) in INTERRUPT_POINTER_TABLE.iter().enumerate() {
         idt_set(i, *handler);
@@ -162,8 +170,19 @@ pub fn idt_init() {
     )
     .register(InterruptHandlerKind::Plain(idt_clock));
 
+    InterruptSource::new(LAPIC_TIMER_VECTOR).register(InterruptHandlerKind::Plain(idt_local_timer));
+    InterruptSource::new(RESCHEDULE_VECTOR).register(InterruptHandlerKind::Plain(idt_reschedule));
+    InterruptSource::new(TLB_SHOOTDOWN_VECTOR)
+        .register(InterruptHandlerKind::Plain(idt_tlb_shootdown));
+
+    InterruptSource::new(0x7).register(InterruptHandlerKind::Plain(idt_device_not_available));
     InterruptSource::new(0xE).register(InterruptHandlerKind::Error(idt_page_fault));
     InterruptSource::new(0xD).register(InterruptHandlerKind::Error(idt_general_protection_fault));
 
     idt_load(&idtr_descriptor);
 }
+
+/// Loads the shared IDT on an application processor.
+pub fn idt_init_ap() {
+    idt_load(&idt_descriptor());
+}
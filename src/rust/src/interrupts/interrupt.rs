@@ -36,4 +36,12 @@ impl InterruptSource {
             Self::Error(_) => panic!("mismatched interrupt handler type"),
         }
     }
+
+    /// Device already taking this vector, for lines shared by PCI devices.
+    pub fn device(&self) -> Option<&'static dyn InterruptDevice> {
+        match self {
+            Self::Plain(v) => v.get_device_callback(),
+            Self::Error(_) => None,
+        }
+    }
 }
@@ -12,9 +12,13 @@ mod utils;
 pub use interrupt::{InterruptHandlerKind, InterruptSource};
 pub use interrupt_frame::InterruptFrame;
 pub use register::InterruptDevice;
-pub use utils::{disable_interrupts, enable_interrupts, without_interrupts};
+pub use syscall::{SyscallTrace, release_futexes};
+pub use utils::{disable_interrupts, enable_interrupts, enable_irq_line, without_interrupts};
 
 pub fn interrupts_init() {
     idt::idt_init();
-    syscall::syscall_init();
+}
+
+pub fn interrupts_init_ap() {
+    idt::idt_init_ap();
 }
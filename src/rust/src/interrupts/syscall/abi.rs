@@ -3,7 +3,9 @@
 pub const EPERM: i32 = 1;
 pub const ENOENT: i32 = 2;
 pub const ESRCH: i32 = 3;
+pub const EINTR: i32 = 4;
 pub const EIO: i32 = 5;
+pub const ENOEXEC: i32 = 8;
 pub const EBADF: i32 = 9;
 pub const ECHILD: i32 = 10;
 pub const EAGAIN: i32 = 11;
@@ -17,6 +19,8 @@ pub const EISDIR: i32 = 21;
 pub const EINVAL: i32 = 22;
 pub const EMFILE: i32 = 24;
 pub const ENOTTY: i32 = 25;
+pub const ETXTBSY: i32 = 26;
+pub const ESPIPE: i32 = 29;
 pub const EPIPE: i32 = 32;
 pub const ENOSYS: i32 = 38;
 pub const ENOTEMPTY: i32 = 39;
@@ -24,6 +28,7 @@ pub const EMSGSIZE: i32 = 90;
 pub const ENOTSUP: i32 = 95;
 pub const ENETDOWN: i32 = 100;
 pub const ENOTCONN: i32 = 107;
+pub const ETIMEDOUT: i32 = 110;
 
 pub const ERROR: u32 = (-EINVAL) as u32;
 pub const WAIT_TIMEOUT: u32 = (-EAGAIN) as u32;
@@ -7,88 +7,111 @@ use super::io::*;
 use super::misc::*;
 use super::network::*;
 use super::process::*;
-use super::register::{syscall_get_handler, syscall_register};
+use super::register::{SyscallHandler, SyscallSlots};
 use super::signal::*;
 use super::sync::*;
+use super::thread::*;
+use super::trace;
 use super::types::SyscallId;
 
-pub fn syscall_init() {
-    syscall_register(SyscallId::Execve, syscall_execve);
-    syscall_register(SyscallId::Fork, syscall_fork);
-    syscall_register(SyscallId::Exit, syscall_exit);
-    syscall_register(SyscallId::WaitPid, syscall_waitpid);
-    syscall_register(SyscallId::GetPid, syscall_getpid);
-    syscall_register(SyscallId::GetUid, syscall_getuid);
-    syscall_register(SyscallId::GetPpid, syscall_getppid);
-    syscall_register(SyscallId::GetGid, syscall_getgid);
-    syscall_register(SyscallId::GetEuid, syscall_geteuid);
-    syscall_register(SyscallId::GetEgid, syscall_getegid);
-    syscall_register(SyscallId::Kill, syscall_kill);
-    syscall_register(SyscallId::SigAction, syscall_sigaction);
-    syscall_register(SyscallId::SigReturn, syscall_sigreturn);
-    syscall_register(SyscallId::PrintMemory, syscall_print_memory);
-    syscall_register(SyscallId::Open, syscall_open);
-    syscall_register(SyscallId::Read, syscall_read);
-    syscall_register(SyscallId::Write, syscall_write);
-    syscall_register(SyscallId::Lseek, syscall_lseek);
-    syscall_register(SyscallId::Stat, syscall_stat);
-    syscall_register(SyscallId::Lstat, syscall_lstat);
-    syscall_register(SyscallId::Fstat, syscall_fstat);
-    syscall_register(SyscallId::Close, syscall_close);
-    syscall_register(SyscallId::Dup, syscall_dup);
-    syscall_register(SyscallId::Dup2, syscall_dup2);
-    syscall_register(SyscallId::Fcntl, syscall_fcntl);
-    syscall_register(SyscallId::Pipe, syscall_pipe);
-    syscall_register(SyscallId::Unlink, syscall_unlink);
-    syscall_register(SyscallId::Chmod, syscall_chmod);
-    syscall_register(SyscallId::Mkdir, syscall_mkdir);
-    syscall_register(SyscallId::Rmdir, syscall_rmdir);
-    syscall_register(SyscallId::Umask, syscall_umask);
-    syscall_register(SyscallId::Chdir, syscall_chdir);
-    syscall_register(SyscallId::Chown, syscall_chown);
-    syscall_register(SyscallId::GetCwd, syscall_getcwd);
-    syscall_register(SyscallId::GetDents, syscall_getdents);
-    syscall_register(SyscallId::Ioctl, syscall_ioctl);
-    syscall_register(SyscallId::Brk, syscall_brk);
-    syscall_register(SyscallId::NanoSleep, syscall_nanosleep);
-    syscall_register(SyscallId::GetTimeOfDay, syscall_gettimeofday);
-    syscall_register(SyscallId::ClockGetTime, syscall_clock_gettime);
-    syscall_register(SyscallId::LinuxReboot, syscall_linux_reboot);
-    syscall_register(SyscallId::NetworkInfo, syscall_network_info);
-    syscall_register(
+/// Every syscall the kernel implements. Dispatch and the per-syscall trace
+/// tables are derived from this list at compile time.
+pub(super) const SYSCALL_HANDLERS: &[(SyscallId, SyscallHandler)] = &[
+    (SyscallId::Execve, syscall_execve),
+    (SyscallId::Fork, syscall_fork),
+    (SyscallId::Spawn, syscall_spawn),
+    (SyscallId::Exit, syscall_exit),
+    (SyscallId::ExitGroup, syscall_exit_group),
+    (SyscallId::Clone, syscall_clone),
+    (SyscallId::GetTid, syscall_gettid),
+    (SyscallId::SetThreadArea, syscall_set_thread_area),
+    (SyscallId::WaitPid, syscall_waitpid),
+    (SyscallId::GetPid, syscall_getpid),
+    (SyscallId::GetUid, syscall_getuid),
+    (SyscallId::GetPpid, syscall_getppid),
+    (SyscallId::GetGid, syscall_getgid),
+    (SyscallId::GetEuid, syscall_geteuid),
+    (SyscallId::GetEgid, syscall_getegid),
+    (SyscallId::Nice, syscall_nice),
+    (SyscallId::GetPriority, syscall_getpriority),
+    (SyscallId::SetPriority, syscall_setpriority),
+    (SyscallId::GetRlimit, syscall_getrlimit),
+    (SyscallId::SetRlimit, syscall_setrlimit),
+    (SyscallId::Kill, syscall_kill),
+    (SyscallId::SigAction, syscall_sigaction),
+    (SyscallId::SigReturn, syscall_sigreturn),
+    (SyscallId::PrintMemory, syscall_print_memory),
+    (SyscallId::Open, syscall_open),
+    (SyscallId::Read, syscall_read),
+    (SyscallId::Write, syscall_write),
+    (SyscallId::Lseek, syscall_lseek),
+    (SyscallId::Readahead, syscall_readahead),
+    (SyscallId::Fadvise64, syscall_fadvise64),
+    (SyscallId::Fsync, syscall_fsync),
+    (SyscallId::Fdatasync, syscall_fdatasync),
+    (SyscallId::Sync, syscall_sync),
+    (SyscallId::Stat, syscall_stat),
+    (SyscallId::Lstat, syscall_lstat),
+    (SyscallId::Fstat, syscall_fstat),
+    (SyscallId::Close, syscall_close),
+    (SyscallId::Dup, syscall_dup),
+    (SyscallId::Dup2, syscall_dup2),
+    (SyscallId::Fcntl, syscall_fcntl),
+    (SyscallId::Pipe, syscall_pipe),
+    (SyscallId::Unlink, syscall_unlink),
+    (SyscallId::Chmod, syscall_chmod),
+    (SyscallId::Mkdir, syscall_mkdir),
+    (SyscallId::Rmdir, syscall_rmdir),
+    (SyscallId::Umask, syscall_umask),
+    (SyscallId::Chdir, syscall_chdir),
+    (SyscallId::Chown, syscall_chown),
+    (SyscallId::GetCwd, syscall_getcwd),
+    (SyscallId::GetDents, syscall_getdents),
+    (SyscallId::Ioctl, syscall_ioctl),
+    (SyscallId::Brk, syscall_brk),
+    (SyscallId::NanoSleep, syscall_nanosleep),
+    (SyscallId::GetTimeOfDay, syscall_gettimeofday),
+    (SyscallId::Times, syscall_times),
+    (SyscallId::GetRusage, syscall_getrusage),
+    (SyscallId::ClockGetTime, syscall_clock_gettime),
+    (SyscallId::LinuxReboot, syscall_linux_reboot),
+    (SyscallId::NetworkInfo, syscall_network_info),
+    (
         SyscallId::NetworkDhcpDiscover,
         syscall_network_dhcp_discover,
-    );
-    syscall_register(SyscallId::NetworkPingGateway, syscall_network_ping_gateway);
-    syscall_register(SyscallId::NetworkPingIpv4, syscall_network_ping_ipv4);
-    syscall_register(SyscallId::NetworkDnsQuery, syscall_network_dns_query);
-    syscall_register(SyscallId::NetworkPingName, syscall_network_ping_name);
-    syscall_register(SyscallId::SocketCall, syscall_socketcall);
-    syscall_register(
+    ),
+    (SyscallId::NetworkPingGateway, syscall_network_ping_gateway),
+    (SyscallId::NetworkPingIpv4, syscall_network_ping_ipv4),
+    (SyscallId::NetworkDnsQuery, syscall_network_dns_query),
+    (SyscallId::NetworkPingName, syscall_network_ping_name),
+    (SyscallId::SocketCall, syscall_socketcall),
+    (
         SyscallId::NetworkRecvFromWait,
         syscall_network_recvfrom_wait,
-    );
-    syscall_register(SyscallId::SemaphoreCreate, syscall_semaphore_create);
-    syscall_register(SyscallId::SemaphoreWait, syscall_semaphore_wait);
-    syscall_register(SyscallId::SemaphoreSignal, syscall_semaphore_signal);
-    syscall_register(SyscallId::SemaphoreClose, syscall_semaphore_close);
-    syscall_register(SyscallId::KernelSelfTest, syscall_kernel_selftest);
-}
+    ),
+    (SyscallId::Futex, syscall_futex),
+    (SyscallId::SemaphoreCreate, syscall_semaphore_create),
+    (SyscallId::SemaphoreWait, syscall_semaphore_wait),
+    (SyscallId::SemaphoreSignal, syscall_semaphore_signal),
+    (SyscallId::SemaphoreClose, syscall_semaphore_close),
+    (SyscallId::KernelSelfTest, syscall_kernel_selftest),
+];
+
+pub(super) const SYSCALL_COUNT: usize = SYSCALL_HANDLERS.len();
+
+static SYSCALL_SLOTS: SyscallSlots = SyscallSlots::new(SYSCALL_HANDLERS);
 
 pub fn syscall_handle(frame: &InterruptFrame) -> u32 {
     let cmd = frame.eax;
-    let cmd = match SyscallId::new(cmd) {
-        Some(c) => c,
-        None => {
-            serial_println!("Unknown syscall command: {}", cmd);
-            return abi::errno(abi::ENOSYS);
-        }
+    let Some(slot) = SYSCALL_SLOTS.get(cmd) else {
+        serial_println!("Unknown syscall command: {}", cmd);
+        return abi::errno(abi::ENOSYS);
     };
 
-    syscall_get_handler(cmd)
-        .map(|handler| handler(frame))
-        .unwrap_or_else(|| {
-            serial_println!("Unknown syscall command: {:?}", cmd);
-            abi::errno(abi::ENOSYS)
-        })
+    let (id, handler) = SYSCALL_HANDLERS[slot];
+    if trace::enabled() {
+        return trace::syscall_traced(slot, id, handler, frame);
+    }
+
+    handler(frame)
 }
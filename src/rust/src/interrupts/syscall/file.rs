@@ -1,17 +1,21 @@
-use alloc::{string::String, sync::Arc, vec::Vec};
+use alloc::{string::String, sync::Arc};
 use spin::Mutex;
 
 use crate::{
     constant::MAX_PATH,
-    fs::{FileHandle, FsError, Pipe, PipeEnd, PipeError, file::FileStat},
+    device::block_dev::sync_all,
+    error::KernelError,
+    fs::{Advice, FileHandle, FsError, Pipe, PipeEnd, PipeError, PipeRequest, file::FileStat},
     interrupts::InterruptFrame,
     kernel::KERNEL,
     schedule::{
+        loader::cache,
         process::{
             ACCESS_EXECUTE, ACCESS_READ, ACCESS_WRITE, DirectoryHandle, FD_CLOEXEC, O_NONBLOCK,
             Process, ProcessDescriptor,
         },
-        task::{Task, TaskId, WaitReason, task_next},
+        task::{Task, TaskId, task_next},
+        task_manager::TaskManager,
     },
 };
 
@@ -45,7 +49,8 @@ struct Dirent {
 
 enum PipeSyscallResult {
     Completed(u32),
-    Block(WaitReason),
+    /// The task is parked on the pipe and must switch away.
+    Parked,
 }
 
 pub fn syscall_open(_frame: &InterruptFrame) -> u32 {
@@ -67,23 +72,29 @@ pub fn syscall_open(_frame: &InterruptFrame) -> u32 {
         return abi::errno(abi::EFAULT);
     };
 
+    open_path(&process, path.as_str(), flags, mode)
+}
+
+/// Opens the resolved `path` into the lowest free descriptor of `process`,
+/// with `open` flags and creation mode. Returns the descriptor or an errno.
+pub(super) fn open_path(process: &Process, path: &str, flags: u32, mode: u16) -> u32 {
     let mut handle = {
         let vfs = KERNEL.vfs.read();
-        match vfs.open(path.as_str()) {
+        match vfs.open(path) {
             Ok(handle) => handle,
             Err(_) if flags & O_CREAT != 0 => {
-                if let Err(error) = vfs.create(path.as_str(), false) {
+                if let Err(error) = vfs.create(path, false) {
                     return fs_errno(error);
                 }
-                apply_created_mode(&process, path.as_str(), mode, false);
+                apply_created_mode(process, path, mode, false);
 
-                match vfs.open(path.as_str()) {
+                match vfs.open(path) {
                     Ok(handle) => handle,
                     Err(error) => return fs_errno(error),
                 }
             }
             Err(error) => {
-                if let Some(fd) = insert_directory_fd(&process, path.as_str(), flags) {
+                if let Some(fd) = insert_directory_fd(process, path, flags) {
                     return fd;
                 }
 
@@ -97,6 +108,11 @@ pub fn syscall_open(_frame: &InterruptFrame) -> u32 {
         Err(error) => return fs_errno(error),
     };
 
+    // A running program reads its pages from the file as it first uses them.
+    if required_permissions & ACCESS_WRITE != 0 && cache::is_mapped(path) {
+        return abi::errno(abi::ETXTBSY);
+    }
+
     if required_permissions != 0 {
         match handle.ops.stat() {
             Ok(metadata) if !process.has_permission(&metadata, required_permissions) => {
@@ -117,7 +133,7 @@ pub fn syscall_open(_frame: &InterruptFrame) -> u32 {
         }
     }
 
-    insert_file_fd(&process, handle, flags)
+    insert_file_fd(process, handle, flags)
 }
 
 pub fn syscall_read(_frame: &InterruptFrame) -> u32 {
@@ -145,10 +161,10 @@ pub fn syscall_read(_frame: &InterruptFrame) -> u32 {
         let result = syscall_pipe_read(&process, fd, pipe.clone(), *end, buf_ptr, len);
         return match result {
             PipeSyscallResult::Completed(value) => value,
-            PipeSyscallResult::Block(reason) => {
+            PipeSyscallResult::Parked => {
                 drop(descriptor);
                 drop(process);
-                block_current_and_restart(reason)
+                task_next()
             }
         };
     }
@@ -197,14 +213,14 @@ pub fn syscall_write(_frame: &InterruptFrame) -> u32 {
     };
 
     if let ProcessDescriptor::Pipe { pipe, end } = &descriptor {
-        let result = syscall_pipe_write(&process, fd, pipe.clone(), *end, data.as_slice());
+        let result = syscall_pipe_write(&process, fd, pipe.clone(), *end, ptr, data.as_slice());
         return match result {
             PipeSyscallResult::Completed(value) => value,
-            PipeSyscallResult::Block(reason) => {
+            PipeSyscallResult::Parked => {
                 drop(descriptor);
                 drop(data);
                 drop(process);
-                block_current_and_restart(reason)
+                task_next()
             }
         };
     }
@@ -222,105 +238,98 @@ pub fn syscall_write(_frame: &InterruptFrame) -> u32 {
 }
 
 fn syscall_pipe_read(
-    process: &Process,
+    process: &Arc<Process>,
     fd: i32,
     pipe: Arc<Mutex<Pipe>>,
     end: PipeEnd,
     buf_ptr: u32,
     len: usize,
 ) -> PipeSyscallResult {
-    let task_id = current_task_id();
+    let nonblocking = process.get_status_flags(fd).unwrap_or(0) & O_NONBLOCK != 0;
     let mut data = vec![0; len];
 
-    let (result, waiters, pipe_id, should_block) = {
+    let read = {
         let mut pipe = pipe.lock();
-        let pipe_id = pipe.id();
         match pipe.read(end, data.as_mut_slice()) {
             Ok(read) => {
-                let waiters = if read > 0 {
-                    pipe.take_write_waiters()
-                } else {
-                    Vec::new()
-                };
-                (Ok(read), waiters, pipe_id, false)
-            }
-            Err(PipeError::WouldBlock)
-                if process.get_status_flags(fd).unwrap_or(0) & O_NONBLOCK == 0 =>
-            {
-                if let Some(task_id) = task_id {
-                    pipe.add_read_waiter(task_id);
-                    (Err(PipeError::WouldBlock), Vec::new(), pipe_id, true)
-                } else {
-                    (Err(PipeError::WouldBlock), Vec::new(), pipe_id, false)
+                if read > 0 {
+                    KERNEL.with_task_manager(|tm| pipe.serve_waiters(tm));
                 }
+                read
+            }
+            Err(PipeError::WouldBlock) if !nonblocking => {
+                // A writer copies straight into `buf_ptr` and wakes us.
+                let request = PipeRequest {
+                    process: process.clone(),
+                    buf_ptr,
+                    len,
+                    finish: pipe_result,
+                };
+                return park_on_pipe(|tm| pipe.park_reader(tm, request, abi::errno(abi::EINTR)));
             }
-            Err(error) => (Err(error), Vec::new(), pipe_id, false),
+            Err(error) => return PipeSyscallResult::Completed(pipe_result(Err(error))),
         }
     };
 
-    wake_pipe_waiters(waiters);
-
-    match result {
-        Ok(read) => {
-            if read != 0
-                && user::copy_to_user(&process.page_directory, buf_ptr, data.as_ptr(), read as u32)
-                    .is_err()
-            {
-                return PipeSyscallResult::Completed(abi::errno(abi::EFAULT));
-            }
-
-            PipeSyscallResult::Completed(read as u32)
-        }
-        Err(PipeError::WouldBlock) if should_block => {
-            PipeSyscallResult::Block(WaitReason::PipeRead(pipe_id))
-        }
-        Err(error) => PipeSyscallResult::Completed(fs_errno(pipe_fs_error(error))),
+    if read != 0
+        && user::copy_to_user(&process.page_directory, buf_ptr, data.as_ptr(), read as u32).is_err()
+    {
+        return PipeSyscallResult::Completed(abi::errno(abi::EFAULT));
     }
+
+    PipeSyscallResult::Completed(read as u32)
 }
 
 fn syscall_pipe_write(
-    process: &Process,
+    process: &Arc<Process>,
     fd: i32,
     pipe: Arc<Mutex<Pipe>>,
     end: PipeEnd,
+    buf_ptr: u32,
     data: &[u8],
 ) -> PipeSyscallResult {
-    let task_id = current_task_id();
+    let nonblocking = process.get_status_flags(fd).unwrap_or(0) & O_NONBLOCK != 0;
+    let mut pipe = pipe.lock();
 
-    let (result, waiters, pipe_id, should_block) = {
-        let mut pipe = pipe.lock();
-        let pipe_id = pipe.id();
-        match pipe.write(end, data) {
-            Ok(written) => {
-                let waiters = if written > 0 {
-                    pipe.take_read_waiters()
-                } else {
-                    Vec::new()
-                };
-                (Ok(written), waiters, pipe_id, false)
+    let result = match pipe.write(end, data) {
+        Ok(written) => {
+            if written > 0 {
+                KERNEL.with_task_manager(|tm| pipe.serve_waiters(tm));
             }
-            Err(PipeError::WouldBlock)
-                if process.get_status_flags(fd).unwrap_or(0) & O_NONBLOCK == 0 =>
-            {
-                if let Some(task_id) = task_id {
-                    pipe.add_write_waiter(task_id);
-                    (Err(PipeError::WouldBlock), Vec::new(), pipe_id, true)
-                } else {
-                    (Err(PipeError::WouldBlock), Vec::new(), pipe_id, false)
-                }
-            }
-            Err(error) => (Err(error), Vec::new(), pipe_id, false),
+            Ok(written)
+        }
+        Err(PipeError::WouldBlock) if !nonblocking => {
+            // A reader pulls from `buf_ptr` once it frees space and wakes us.
+            let request = PipeRequest {
+                process: process.clone(),
+                buf_ptr,
+                len: data.len(),
+                finish: pipe_result,
+            };
+            return park_on_pipe(|tm| pipe.park_writer(tm, request, abi::errno(abi::EINTR)));
         }
+        Err(error) => Err(error),
     };
 
-    wake_pipe_waiters(waiters);
+    PipeSyscallResult::Completed(pipe_result(result))
+}
 
+fn park_on_pipe(
+    park: impl FnOnce(&mut TaskManager) -> Result<TaskId, KernelError>,
+) -> PipeSyscallResult {
+    match KERNEL.with_task_manager(park) {
+        Ok(_) => PipeSyscallResult::Parked,
+        Err(_) => PipeSyscallResult::Completed(abi::errno(abi::EAGAIN)),
+    }
+}
+
+/// Syscall result of a pipe read or write, also for requests completed on
+/// behalf of a parked task.
+fn pipe_result(result: Result<usize, PipeError>) -> u32 {
     match result {
-        Ok(written) => PipeSyscallResult::Completed(written as u32),
-        Err(PipeError::WouldBlock) if should_block => {
-            PipeSyscallResult::Block(WaitReason::PipeWrite(pipe_id))
-        }
-        Err(error) => PipeSyscallResult::Completed(fs_errno(pipe_fs_error(error))),
+        Ok(count) => count as u32,
+        Err(PipeError::Fault) => abi::errno(abi::EFAULT),
+        Err(error) => fs_errno(pipe_fs_error(error)),
     }
 }
 
@@ -359,6 +368,103 @@ pub fn syscall_lseek(_frame: &InterruptFrame) -> u32 {
     }
 }
 
+/// Offset passed as two words, low first. Past what a 32-bit file reaches
+/// it saturates, which leaves an empty range.
+fn split_offset(low: u32, high: u32) -> usize {
+    if high == 0 { low as usize } else { usize::MAX }
+}
+
+pub fn syscall_readahead(_frame: &InterruptFrame) -> u32 {
+    let Some((process, fd, offset, count)) = with_current_task(|task| {
+        Some((
+            task.process.clone(),
+            task.get_stack_item(0) as i32,
+            split_offset(task.get_stack_item(1), task.get_stack_item(2)),
+            task.get_stack_item(3) as usize,
+        ))
+    }) else {
+        return abi::errno(abi::EFAULT);
+    };
+
+    let Some(descriptor) = process.get_fd(fd) else {
+        return abi::errno(abi::EBADF);
+    };
+
+    match descriptor.advise(offset, count, Advice::WillNeed) {
+        Ok(()) => 0,
+        Err(FsError::Unsupported | FsError::IsADirectory) => abi::errno(abi::EINVAL),
+        Err(error) => fs_errno(error),
+    }
+}
+
+pub fn syscall_fadvise64(_frame: &InterruptFrame) -> u32 {
+    let Some((process, fd, offset, len, advice)) = with_current_task(|task| {
+        Some((
+            task.process.clone(),
+            task.get_stack_item(0) as i32,
+            split_offset(task.get_stack_item(1), task.get_stack_item(2)),
+            task.get_stack_item(3) as usize,
+            task.get_stack_item(4),
+        ))
+    }) else {
+        return abi::errno(abi::EFAULT);
+    };
+
+    let Some(descriptor) = process.get_fd(fd) else {
+        return abi::errno(abi::EBADF);
+    };
+
+    let advice = match advice {
+        0 => Advice::Normal,
+        1 => Advice::Random,
+        2 => Advice::Sequential,
+        3 => Advice::WillNeed,
+        4 => Advice::DontNeed,
+        // NOREUSE is accepted and ignored, as on Linux.
+        5 => return 0,
+        _ => return abi::errno(abi::EINVAL),
+    };
+
+    match descriptor.advise(offset, len, advice) {
+        // Directories take advice and ignore it.
+        Ok(()) | Err(FsError::IsADirectory) => 0,
+        Err(FsError::Unsupported) => abi::errno(abi::ESPIPE),
+        Err(error) => fs_errno(error),
+    }
+}
+
+fn sync_fd(data_only: bool) -> u32 {
+    let Some((process, fd)) =
+        with_current_task(|task| Some((task.process.clone(), task.get_stack_item(0) as i32)))
+    else {
+        return abi::errno(abi::EFAULT);
+    };
+
+    let Some(descriptor) = process.get_fd(fd) else {
+        return abi::errno(abi::EBADF);
+    };
+
+    match descriptor.sync(data_only) {
+        Ok(()) => 0,
+        Err(FsError::Unsupported) => abi::errno(abi::EINVAL),
+        Err(error) => fs_errno(error),
+    }
+}
+
+pub fn syscall_fsync(_frame: &InterruptFrame) -> u32 {
+    sync_fd(false)
+}
+
+pub fn syscall_fdatasync(_frame: &InterruptFrame) -> u32 {
+    sync_fd(true)
+}
+
+/// Writes back every block cache.
+pub fn syscall_sync(_frame: &InterruptFrame) -> u32 {
+    sync_all();
+    0
+}
+
 pub fn syscall_fstat(_frame: &InterruptFrame) -> u32 {
     let Some((process, fd, stat_ptr)) = with_current_task(|task| {
         Some((
@@ -808,6 +914,9 @@ fn remove_path(directory: bool) -> u32 {
     match vfs.stat(path.as_str()) {
         Ok(metadata) if directory && !metadata.is_dir => return abi::errno(abi::ENOTDIR),
         Ok(metadata) if !directory && metadata.is_dir => return abi::errno(abi::EISDIR),
+        Ok(_) if !directory && cache::is_mapped(path.as_str()) => {
+            return abi::errno(abi::ETXTBSY);
+        }
         Ok(_) => {}
         Err(error) => return fs_errno(error),
     }
@@ -865,32 +974,6 @@ fn with_current_task<T>(f: impl FnOnce(&Task) -> Option<T>) -> Option<T> {
     })
 }
 
-fn current_task_id() -> Option<TaskId> {
-    KERNEL.with_task_manager(|tm| tm.get_current().map(|task| task.read().id))
-}
-
-fn wake_pipe_waiters(waiters: Vec<TaskId>) {
-    if waiters.is_empty() {
-        return;
-    }
-
-    KERNEL.with_task_manager(|tm| {
-        for task_id in waiters {
-            let _ = tm.wake_task(task_id);
-        }
-    });
-}
-
-fn block_current_and_restart(reason: WaitReason) -> u32 {
-    let blocked =
-        KERNEL.with_task_manager(|tm| tm.block_current_and_restart_syscall(reason).is_ok());
-    if !blocked {
-        return abi::errno(abi::EAGAIN);
-    }
-
-    task_next();
-}
-
 fn seek_for_append(descriptor: &ProcessDescriptor) -> Result<(), FsError> {
     let size = match descriptor.stat() {
         Ok(meta) if !meta.is_dir => meta.size,
@@ -926,7 +1009,7 @@ fn pipe_fs_error(error: PipeError) -> FsError {
     match error {
         PipeError::WouldBlock => FsError::WouldBlock,
         PipeError::BrokenPipe => FsError::BrokenPipe,
-        PipeError::WrongEnd => FsError::InvalidArgument,
+        PipeError::WrongEnd | PipeError::Fault => FsError::InvalidArgument,
     }
 }
 
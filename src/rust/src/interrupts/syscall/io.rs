@@ -2,7 +2,11 @@ use crate::{
     constant::TIMER_HZ,
     interrupts::InterruptFrame,
     kernel::KERNEL,
-    schedule::task::{task_current_set_return_value, task_next},
+    schedule::{
+        process::Process,
+        stats::{TaskStats, process_stats},
+        task::{task_current_set_return_value, task_next},
+    },
 };
 
 use super::{abi, user};
@@ -11,6 +15,9 @@ const CLOCK_REALTIME: u32 = 0;
 const CLOCK_MONOTONIC: u32 = 1;
 const NSEC_PER_SEC: u64 = 1_000_000_000;
 const USEC_PER_SEC: u64 = 1_000_000;
+const RUSAGE_SELF: i32 = 0;
+const RUSAGE_CHILDREN: i32 = -1;
+const RUSAGE_THREAD: i32 = 1;
 
 #[repr(C)]
 #[derive(Clone, Copy, Default)]
@@ -33,6 +40,45 @@ struct TimeZone {
     tz_dsttime: i32,
 }
 
+/// `struct tms`, in clock ticks of `TIMER_HZ`.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct Tms {
+    tms_utime: i32,
+    tms_stime: i32,
+    tms_cutime: i32,
+    tms_cstime: i32,
+}
+
+/// `struct rusage` of i386. Memory, I/O and signal counters stay 0.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct RUsage {
+    ru_utime: TimeVal,
+    ru_stime: TimeVal,
+    ru_maxrss: i32,
+    ru_ixrss: i32,
+    ru_idrss: i32,
+    ru_isrss: i32,
+    ru_minflt: i32,
+    ru_majflt: i32,
+    ru_nswap: i32,
+    ru_inblock: i32,
+    ru_oublock: i32,
+    ru_msgsnd: i32,
+    ru_msgrcv: i32,
+    ru_nsignals: i32,
+    ru_nvcsw: i32,
+    ru_nivcsw: i32,
+}
+
+fn ticks_to_timeval(ticks: u64) -> TimeVal {
+    TimeVal {
+        tv_sec: (ticks / TIMER_HZ as u64) as i32,
+        tv_usec: ((ticks % TIMER_HZ as u64) * USEC_PER_SEC / TIMER_HZ as u64) as i32,
+    }
+}
+
 pub fn syscall_nanosleep(_frame: &InterruptFrame) -> u32 {
     let Some((process, req_ptr)) = KERNEL.with_task_manager(|tm| {
         let current_task = tm.get_current()?;
@@ -42,34 +88,10 @@ pub fn syscall_nanosleep(_frame: &InterruptFrame) -> u32 {
         return abi::errno(abi::EFAULT);
     };
 
-    if req_ptr == 0 {
-        return abi::errno(abi::EFAULT);
-    }
-
-    let mut requested = TimeSpec::default();
-    if user::copy_from_user(
-        &process.page_directory,
-        req_ptr,
-        &mut requested as *mut TimeSpec as *mut u8,
-        core::mem::size_of::<TimeSpec>() as u32,
-    )
-    .is_err()
-    {
-        return abi::errno(abi::EFAULT);
-    }
-
-    if requested.tv_sec < 0 || requested.tv_nsec < 0 || requested.tv_nsec as u64 >= NSEC_PER_SEC {
-        return abi::errno(abi::EINVAL);
-    }
-
-    let sleep_ticks = (requested.tv_sec as u64)
-        .saturating_mul(TIMER_HZ as u64)
-        .saturating_add(
-            (requested.tv_nsec as u64)
-                .saturating_mul(TIMER_HZ as u64)
-                .saturating_add(NSEC_PER_SEC - 1)
-                / NSEC_PER_SEC,
-        );
+    let sleep_ticks = match read_timespec_ticks(&process, req_ptr) {
+        Ok(ticks) => ticks,
+        Err(errno) => return abi::errno(errno),
+    };
 
     if sleep_ticks == 0 {
         return 0;
@@ -90,6 +112,36 @@ pub fn syscall_nanosleep(_frame: &InterruptFrame) -> u32 {
     task_next();
 }
 
+/// Reads a relative `struct timespec` from user memory and rounds it up to
+/// whole timer ticks.
+pub(super) fn read_timespec_ticks(process: &Process, ptr: u32) -> Result<u64, i32> {
+    if ptr == 0 {
+        return Err(abi::EFAULT);
+    }
+
+    let mut requested = TimeSpec::default();
+    user::copy_from_user(
+        &process.page_directory,
+        ptr,
+        &mut requested as *mut TimeSpec as *mut u8,
+        core::mem::size_of::<TimeSpec>() as u32,
+    )
+    .map_err(|_| abi::EFAULT)?;
+
+    if requested.tv_sec < 0 || requested.tv_nsec < 0 || requested.tv_nsec as u64 >= NSEC_PER_SEC {
+        return Err(abi::EINVAL);
+    }
+
+    Ok((requested.tv_sec as u64)
+        .saturating_mul(TIMER_HZ as u64)
+        .saturating_add(
+            (requested.tv_nsec as u64)
+                .saturating_mul(TIMER_HZ as u64)
+                .saturating_add(NSEC_PER_SEC - 1)
+                / NSEC_PER_SEC,
+        ))
+}
+
 pub fn syscall_gettimeofday(_frame: &InterruptFrame) -> u32 {
     let Some((process, tv_ptr, tz_ptr)) = KERNEL.with_task_manager(|tm| {
         let current_task = tm.get_current()?;
@@ -105,10 +157,7 @@ pub fn syscall_gettimeofday(_frame: &InterruptFrame) -> u32 {
 
     let ticks = KERNEL.with_task_manager(|tm| tm.get_tick());
     if tv_ptr != 0 {
-        let tv = TimeVal {
-            tv_sec: (ticks / TIMER_HZ as u64) as i32,
-            tv_usec: ((ticks % TIMER_HZ as u64) * USEC_PER_SEC / TIMER_HZ as u64) as i32,
-        };
+        let tv = ticks_to_timeval(ticks);
         if user::write_value(&process.page_directory, tv_ptr, &tv).is_err() {
             return abi::errno(abi::EFAULT);
         }
@@ -157,6 +206,72 @@ pub fn syscall_clock_gettime(_frame: &InterruptFrame) -> u32 {
     0
 }
 
+/// `times(buf)`: CPU time of the process and of its waited-for children.
+/// Returns the ticks since boot.
+pub fn syscall_times(_frame: &InterruptFrame) -> u32 {
+    let Some((process, buf_ptr)) = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current()?;
+        let task = current_task.read();
+        Some((task.process.clone(), task.get_stack_item(0)))
+    }) else {
+        return abi::errno(abi::EFAULT);
+    };
+
+    let (own, ticks) = KERNEL.with_task_manager(|tm| (process_stats(&process, tm), tm.get_tick()));
+    if buf_ptr != 0 {
+        let children = process.usage.lock().children;
+        let tms = Tms {
+            tms_utime: own.user_ticks as i32,
+            tms_stime: own.system_ticks as i32,
+            tms_cutime: children.user_ticks as i32,
+            tms_cstime: children.system_ticks as i32,
+        };
+        if user::write_value(&process.page_directory, buf_ptr, &tms).is_err() {
+            return abi::errno(abi::EFAULT);
+        }
+    }
+
+    ticks as u32
+}
+
+/// `getrusage(who, usage)` for `RUSAGE_SELF`, `RUSAGE_CHILDREN` and
+/// `RUSAGE_THREAD`.
+pub fn syscall_getrusage(_frame: &InterruptFrame) -> u32 {
+    let Some((process, task_id, who, usage_ptr)) = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current()?;
+        let task = current_task.read();
+        Some((
+            task.process.clone(),
+            task.id,
+            task.get_stack_item(0) as i32,
+            task.get_stack_item(1),
+        ))
+    }) else {
+        return abi::errno(abi::EFAULT);
+    };
+
+    let stats: TaskStats = match who {
+        RUSAGE_SELF => KERNEL.with_task_manager(|tm| process_stats(&process, tm)),
+        RUSAGE_CHILDREN => process.usage.lock().children,
+        RUSAGE_THREAD => KERNEL
+            .with_task_manager(|tm| tm.stats(task_id))
+            .unwrap_or_default(),
+        _ => return abi::errno(abi::EINVAL),
+    };
+
+    let usage = RUsage {
+        ru_utime: ticks_to_timeval(stats.user_ticks),
+        ru_stime: ticks_to_timeval(stats.system_ticks),
+        ru_nvcsw: stats.voluntary_switches as i32,
+        ru_nivcsw: stats.involuntary_switches as i32,
+        ..RUsage::default()
+    };
+    if user::write_value(&process.page_directory, usage_ptr, &usage).is_err() {
+        return abi::errno(abi::EFAULT);
+    }
+    0
+}
+
 pub fn syscall_ioctl(_frame: &InterruptFrame) -> u32 {
     let Some((process, fd, request, arg)) = KERNEL.with_task_manager(|tm| {
         let current_task = tm.get_current()?;
@@ -1,4 +1,5 @@
 use crate::{
+    device::block_dev::sync_all,
     interrupts::InterruptFrame,
     utils::{reboot, shutdown},
 };
@@ -28,9 +29,16 @@ pub fn syscall_linux_reboot(_frame: &InterruptFrame) -> u32 {
         return abi::errno(abi::EINVAL);
     }
 
+    // Block caches are written back lazily; do not lose what they hold.
     match cmd {
-        LINUX_REBOOT_CMD_RESTART => reboot(),
-        LINUX_REBOOT_CMD_HALT | LINUX_REBOOT_CMD_POWER_OFF => shutdown(),
+        LINUX_REBOOT_CMD_RESTART => {
+            sync_all();
+            reboot()
+        }
+        LINUX_REBOOT_CMD_HALT | LINUX_REBOOT_CMD_POWER_OFF => {
+            sync_all();
+            shutdown()
+        }
         _ => return abi::errno(abi::EINVAL),
     }
 
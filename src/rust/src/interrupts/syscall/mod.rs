@@ -9,8 +9,12 @@ mod process;
 mod register;
 mod signal;
 mod sync;
+mod thread;
+mod trace;
 mod types;
 mod user;
 
-pub use dispatcher::{syscall_handle, syscall_init};
+pub use dispatcher::syscall_handle;
+pub use sync::release_futexes;
+pub use trace::SyscallTrace;
 pub use types::SyscallId;
@@ -1,8 +1,12 @@
 use crate::{
+    device::timer::current_tick,
     interrupts::InterruptFrame,
     kernel::KERNEL,
     net,
-    schedule::process::{Process, ProcessDescriptor, SocketHandle},
+    schedule::{
+        process::{Process, ProcessDescriptor, SocketHandle},
+        task::{WaitTimeout, task_next},
+    },
 };
 use alloc::sync::Arc;
 use spin::Mutex;
@@ -298,20 +302,21 @@ pub fn syscall_network_recvfrom_wait(_frame: &InterruptFrame) -> u32 {
         return abi::errno(abi::ESRCH);
     };
 
-    let start_tick = KERNEL.with_task_manager(|tm| tm.get_tick());
-
     loop {
         match net::socket_recv_from(socket_id, args.len as usize) {
             Ok(packet) => return write_recvfrom_result(args, packet),
             Err(net::NetworkError::WouldBlock) => {
-                if timeout_ticks != 0 {
-                    let now = KERNEL.with_task_manager(|tm| tm.get_tick());
-                    if now.saturating_sub(start_tick) >= timeout_ticks {
-                        return abi::WAIT_TIMEOUT;
-                    }
+                // Park until a packet arrives (the socket wakes us and the call
+                // restarts) or the timeout expires with WAIT_TIMEOUT as result.
+                let timeout = (timeout_ticks != 0).then(|| WaitTimeout {
+                    deadline: current_tick().saturating_add(timeout_ticks),
+                    return_value: abi::WAIT_TIMEOUT,
+                });
+                match net::socket_park_receiver(socket_id, timeout, abi::errno(abi::EINTR)) {
+                    Ok(true) => task_next(),
+                    Ok(false) => continue,
+                    Err(error) => return network_errno(error),
                 }
-
-                core::hint::spin_loop();
             }
             Err(error) => {
                 serial_println!("net: recvfrom_wait({}) failed: {:?}", args.socket_id, error);
@@ -2,21 +2,30 @@ use alloc::{string::String, string::ToString, vec::Vec};
 
 use crate::{
     constant::MAX_PATH,
+    error::KernelError,
     fs::FsError,
     interrupts::InterruptFrame,
     kernel::KERNEL,
     schedule::{
-        process::{ACCESS_EXECUTE, ProcessArguments},
+        process::{ACCESS_EXECUTE, Process, ProcessArguments},
         process_manager::process_terminate,
-        task::{WaitReason, task_next},
+        stack::{STACK_LIMIT_MAX, StackLimit},
+        task::{Task, TaskId, task_next},
+        task_manager::{NICE_MAX, NICE_MIN},
     },
 };
 
-use super::{abi, user};
+use super::{abi, file, thread::exit_current_thread, user};
 
 const WNOHANG: u32 = 1;
+const PRIO_PROCESS: u32 = 0;
+const RLIMIT_STACK: u32 = 3;
 const MAX_EXEC_STRINGS: u32 = 512;
 const MAX_EXEC_STRING_LEN: usize = 1024;
+const MAX_SPAWN_ACTIONS: u32 = 16;
+const SPAWN_ACTION_CLOSE: u32 = 1;
+const SPAWN_ACTION_DUP2: u32 = 2;
+const SPAWN_ACTION_OPEN: u32 = 3;
 
 pub fn syscall_waitpid(_frame: &InterruptFrame) -> u32 {
     let args = KERNEL.with_task_manager(|tm| {
@@ -71,14 +80,8 @@ pub fn syscall_execve(_frame: &InterruptFrame) -> u32 {
         return abi::errno(abi::EFAULT);
     };
 
-    match KERNEL.vfs.read().stat(path.as_str()) {
-        Ok(metadata) if metadata.is_dir => return abi::errno(abi::EACCES),
-        Ok(metadata) if !process.has_permission(&metadata, ACCESS_EXECUTE) => {
-            return abi::errno(abi::EACCES);
-        }
-        Ok(_) => {}
-        Err(FsError::NotFound) => return abi::errno(abi::ENOENT),
-        Err(_) => return abi::errno(abi::EACCES),
+    if let Err(errno) = check_executable(&process, path.as_str()) {
+        return abi::errno(errno);
     }
 
     match KERNEL.with_process_manager(|pm| pm.exec(pid, path.as_str(), args)) {
@@ -89,7 +92,209 @@ pub fn syscall_execve(_frame: &InterruptFrame) -> u32 {
         }
         Err(error) => {
             serial_println!("execve({}) failed: {:?}", path, error);
-            abi::errno(abi::ENOENT)
+            abi::errno(load_errno(&error))
+        }
+    }
+}
+
+/// Errno for a program `execve` or `spawn` could not load. Its file was
+/// found by `check_executable` already.
+fn load_errno(error: &KernelError) -> i32 {
+    match error {
+        KernelError::Allocation | KernelError::Paging => abi::ENOMEM,
+        KernelError::NotExecutable => abi::ENOEXEC,
+        KernelError::Io => abi::EIO,
+        KernelError::NoTasks => abi::ESRCH,
+    }
+}
+
+/// Whether `process` may run the program at the resolved `path`.
+fn check_executable(process: &Process, path: &str) -> Result<(), i32> {
+    match KERNEL.vfs.read().stat(path) {
+        Ok(metadata) if metadata.is_dir => Err(abi::EACCES),
+        Ok(metadata) if !process.has_permission(&metadata, ACCESS_EXECUTE) => Err(abi::EACCES),
+        Ok(_) => Ok(()),
+        Err(FsError::NotFound) => Err(abi::ENOENT),
+        Err(_) => Err(abi::EACCES),
+    }
+}
+
+/// `struct polyos_spawn_action` as passed to `spawn`.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct UserSpawnAction {
+    kind: u32,
+    fd: i32,
+    source_fd: i32,
+    flags: u32,
+    mode: u32,
+    path: u32,
+}
+
+/// Descriptor change made in a spawned child before it first runs.
+enum SpawnAction {
+    Close(i32),
+    Dup2 {
+        from: i32,
+        to: i32,
+    },
+    Open {
+        fd: i32,
+        path: String,
+        flags: u32,
+        mode: u16,
+    },
+}
+
+fn read_spawn_actions(task: &Task, actions_ptr: u32, count: u32) -> Result<Vec<SpawnAction>, i32> {
+    if count > MAX_SPAWN_ACTIONS {
+        return Err(abi::EINVAL);
+    }
+    if count != 0 && actions_ptr == 0 {
+        return Err(abi::EFAULT);
+    }
+
+    let size = core::mem::size_of::<UserSpawnAction>() as u32;
+    let mut actions = Vec::with_capacity(count as usize);
+    for index in 0..count {
+        let mut action = UserSpawnAction::default();
+        user::copy_from_user(
+            &task.process.page_directory,
+            actions_ptr + index * size,
+            &mut action as *mut UserSpawnAction as *mut u8,
+            size,
+        )
+        .map_err(|_| abi::EFAULT)?;
+
+        if action.fd < 0 {
+            return Err(abi::EBADF);
+        }
+        actions.push(match action.kind {
+            SPAWN_ACTION_CLOSE => SpawnAction::Close(action.fd),
+            SPAWN_ACTION_DUP2 => SpawnAction::Dup2 {
+                from: action.source_fd,
+                to: action.fd,
+            },
+            SPAWN_ACTION_OPEN => {
+                if action.path == 0 {
+                    return Err(abi::EFAULT);
+                }
+                let raw_path =
+                    user::read_c_string(task, action.path, MAX_PATH).ok_or(abi::EFAULT)?;
+                SpawnAction::Open {
+                    fd: action.fd,
+                    path: task
+                        .process
+                        .resolve_path(raw_path.as_str())
+                        .ok_or(abi::ENOENT)?,
+                    flags: action.flags,
+                    mode: action.mode as u16,
+                }
+            }
+            _ => return Err(abi::EINVAL),
+        });
+    }
+    Ok(actions)
+}
+
+fn apply_spawn_action(child: &Process, action: &SpawnAction) -> Result<(), i32> {
+    match action {
+        SpawnAction::Close(fd) => {
+            child.remove_fd(*fd).ok_or(abi::EBADF)?.close();
+            Ok(())
+        }
+        SpawnAction::Dup2 { from, to } => child
+            .duplicate_fd_to(*from, *to)
+            .map(|_| ())
+            .map_err(|_| abi::EBADF),
+        SpawnAction::Open {
+            fd,
+            path,
+            flags,
+            mode,
+        } => {
+            let opened = file::open_path(child, path.as_str(), *flags, *mode) as i32;
+            if opened < 0 {
+                return Err(-opened);
+            }
+            if opened != *fd {
+                let moved = child.duplicate_fd_to(opened, *fd);
+                if let Some(descriptor) = child.remove_fd(opened) {
+                    descriptor.close();
+                }
+                moved.map_err(|_| abi::EBADF)?;
+            }
+            Ok(())
+        }
+    }
+}
+
+/// `spawn(path, argv, envp, actions, action_count)`: starts `path` in a new
+/// child process, as `fork` then `execve` would, but builds the child from
+/// the program directly instead of copying the caller first. The descriptor
+/// actions are applied to the child in order before it runs. Returns the
+/// child's pid; backs `posix_spawn`.
+pub fn syscall_spawn(_frame: &InterruptFrame) -> u32 {
+    let request = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current().ok_or(abi::ESRCH)?;
+        let task = current_task.read();
+        let [path_ptr, argv_ptr, envp_ptr, actions_ptr, action_count]: [u32; 5] =
+            core::array::from_fn(|i| task.get_stack_item(i));
+        if path_ptr == 0 {
+            return Err(abi::EFAULT);
+        }
+
+        let raw_path = user::read_c_string(&task, path_ptr, MAX_PATH).ok_or(abi::EFAULT)?;
+        let path = task
+            .process
+            .resolve_path(raw_path.as_str())
+            .ok_or(abi::ENOENT)?;
+        let args = read_argv_from_task(&task, raw_path.as_str(), argv_ptr).ok_or(abi::EFAULT)?;
+        let env = if envp_ptr == 0 {
+            task.process.env.lock().clone()
+        } else {
+            read_string_array_from_task(&task, envp_ptr).ok_or(abi::EFAULT)?
+        };
+        let actions = read_spawn_actions(&task, actions_ptr, action_count)?;
+        Ok((
+            task.process.clone(),
+            task.nice,
+            path,
+            ProcessArguments { args, env },
+            actions,
+        ))
+    });
+
+    let (parent, nice, path, args, actions) = match request {
+        Ok(request) => request,
+        Err(errno) => return abi::errno(errno),
+    };
+    if let Err(errno) = check_executable(&parent, path.as_str()) {
+        return abi::errno(errno);
+    }
+
+    // Loading the program is the slow part; no lock is held meanwhile. The
+    // child only takes a pid once it starts.
+    let child = match Process::spawn_from(&parent, path.as_str(), args) {
+        Ok(child) => child,
+        Err(error) => {
+            serial_println!("spawn({}) failed: {:?}", path, error);
+            return abi::errno(load_errno(&error));
+        }
+    };
+
+    for action in actions.iter() {
+        if let Err(errno) = apply_spawn_action(&child, action) {
+            child.close_descriptors();
+            return abi::errno(errno);
+        }
+    }
+
+    match KERNEL.with_process_manager(|pm| pm.start_child(&parent, child, nice)) {
+        Ok(pid) => pid,
+        Err(error) => {
+            serial_println!("spawn({}) failed: {:?}", path, error);
+            abi::errno(abi::EAGAIN)
         }
     }
 }
@@ -100,14 +305,19 @@ pub fn syscall_fork(_frame: &InterruptFrame) -> u32 {
         let task = current_task.read();
         let mut child_registers = task.registers;
         child_registers.eax = 0;
-        Some((task.process.clone(), child_registers, task.priority))
+        Some((
+            task.process.clone(),
+            child_registers,
+            task.nice,
+            task.tls_base,
+        ))
     });
 
-    let Some((parent, child_registers, priority)) = fork_context else {
+    let Some((parent, child_registers, nice, tls_base)) = fork_context else {
         return abi::errno(abi::EAGAIN);
     };
 
-    match KERNEL.with_process_manager(|pm| pm.fork(parent, child_registers, priority)) {
+    match KERNEL.with_process_manager(|pm| pm.fork(parent, child_registers, nice, tls_base)) {
         Ok(pid) => pid,
         Err(error) => {
             serial_println!("fork failed: {:?}", error);
@@ -116,7 +326,13 @@ pub fn syscall_fork(_frame: &InterruptFrame) -> u32 {
     }
 }
 
-pub fn syscall_exit(_frame: &InterruptFrame) -> u32 {
+/// Ends the calling thread; for the main thread that is the whole process.
+pub fn syscall_exit(frame: &InterruptFrame) -> u32 {
+    exit_current_thread();
+    syscall_exit_group(frame)
+}
+
+pub fn syscall_exit_group(_frame: &InterruptFrame) -> u32 {
     let code = KERNEL.with_task_manager(|tm| {
         let current_task = tm.get_current()?;
         Some(current_task.read().get_stack_item(0) as i32)
@@ -159,6 +375,192 @@ pub fn syscall_getegid(_frame: &InterruptFrame) -> u32 {
     current_process_id_field(|process| process.egid)
 }
 
+pub fn syscall_nice(_frame: &InterruptFrame) -> u32 {
+    let Some((task_id, euid, nice, increment)) = KERNEL.with_task_manager(|tm| {
+        let task = tm.get_current()?.read();
+        Some((
+            task.id,
+            task.process.euid,
+            task.nice,
+            task.get_stack_item(0) as i32,
+        ))
+    }) else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    if increment < 0 && euid != 0 {
+        return abi::errno(abi::EPERM);
+    }
+
+    let nice = nice.saturating_add(increment).clamp(NICE_MIN, NICE_MAX);
+    match KERNEL.with_task_manager(|tm| tm.set_nice(task_id, nice)) {
+        Ok(()) => 0,
+        Err(_) => abi::errno(abi::ESRCH),
+    }
+}
+
+/// Like Linux, returns `20 - nice` so that the result is never negative.
+pub fn syscall_getpriority(_frame: &InterruptFrame) -> u32 {
+    let Some((which, who)) = KERNEL.with_task_manager(|tm| {
+        let task = tm.get_current()?.read();
+        Some((task.get_stack_item(0), task.get_stack_item(1)))
+    }) else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    let task_id = match priority_target(which, who) {
+        Ok(task_id) => task_id,
+        Err(error) => return error,
+    };
+
+    KERNEL.with_task_manager(|tm| {
+        tm.get(task_id)
+            .map(|task| (20 - task.read().nice) as u32)
+            .unwrap_or_else(|| abi::errno(abi::ESRCH))
+    })
+}
+
+pub fn syscall_setpriority(_frame: &InterruptFrame) -> u32 {
+    let Some((euid, which, who, nice)) = KERNEL.with_task_manager(|tm| {
+        let task = tm.get_current()?.read();
+        Some((
+            task.process.euid,
+            task.get_stack_item(0),
+            task.get_stack_item(1),
+            task.get_stack_item(2) as i32,
+        ))
+    }) else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    let task_id = match priority_target(which, who) {
+        Ok(task_id) => task_id,
+        Err(error) => return error,
+    };
+
+    let nice = nice.clamp(NICE_MIN, NICE_MAX);
+    KERNEL.with_task_manager(|tm| {
+        let Some((target_uid, target_euid, current_nice)) = tm.get(task_id).map(|task| {
+            let task = task.read();
+            (task.process.uid, task.process.euid, task.nice)
+        }) else {
+            return abi::errno(abi::ESRCH);
+        };
+
+        if euid != 0 {
+            if euid != target_uid && euid != target_euid {
+                return abi::errno(abi::EPERM);
+            }
+            if nice < current_nice {
+                return abi::errno(abi::EACCES);
+            }
+        }
+
+        match tm.set_nice(task_id, nice) {
+            Ok(()) => 0,
+            Err(_) => abi::errno(abi::ESRCH),
+        }
+    })
+}
+
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct RLimit {
+    rlim_cur: u32,
+    rlim_max: u32,
+}
+
+/// `getrlimit(resource, rlim)`; only `RLIMIT_STACK` is kept per process.
+pub fn syscall_getrlimit(_frame: &InterruptFrame) -> u32 {
+    let Some((process, resource, rlim_ptr)) = KERNEL.with_task_manager(|tm| {
+        let task = tm.get_current()?.read();
+        Some((
+            task.process.clone(),
+            task.get_stack_item(0),
+            task.get_stack_item(1),
+        ))
+    }) else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    if resource != RLIMIT_STACK {
+        return abi::errno(abi::EINVAL);
+    }
+
+    let limit = process.stack.limit();
+    let rlim = RLimit {
+        rlim_cur: limit.current,
+        rlim_max: limit.maximum,
+    };
+    if user::write_value(&process.page_directory, rlim_ptr, &rlim).is_err() {
+        return abi::errno(abi::EFAULT);
+    }
+    0
+}
+
+/// `setrlimit(resource, rlim)` for `RLIMIT_STACK`. Values above what the
+/// stack reserve can hold, such as `RLIM_INFINITY`, are capped to it.
+pub fn syscall_setrlimit(_frame: &InterruptFrame) -> u32 {
+    let Some((process, resource, rlim_ptr)) = KERNEL.with_task_manager(|tm| {
+        let task = tm.get_current()?.read();
+        Some((
+            task.process.clone(),
+            task.get_stack_item(0),
+            task.get_stack_item(1),
+        ))
+    }) else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    if resource != RLIMIT_STACK {
+        return abi::errno(abi::EINVAL);
+    }
+
+    let mut rlim = RLimit::default();
+    if user::copy_from_user(
+        &process.page_directory,
+        rlim_ptr,
+        &mut rlim as *mut RLimit as *mut u8,
+        core::mem::size_of::<RLimit>() as u32,
+    )
+    .is_err()
+    {
+        return abi::errno(abi::EFAULT);
+    }
+    if rlim.rlim_cur > rlim.rlim_max {
+        return abi::errno(abi::EINVAL);
+    }
+
+    let limit = StackLimit {
+        current: rlim.rlim_cur.min(STACK_LIMIT_MAX),
+        maximum: rlim.rlim_max.min(STACK_LIMIT_MAX),
+    };
+    if limit.maximum > process.stack.limit().maximum && process.euid != 0 {
+        return abi::errno(abi::EPERM);
+    }
+    process.stack.set_limit(limit);
+    0
+}
+
+/// Task whose priority `getpriority`/`setpriority` act on. Only
+/// `PRIO_PROCESS` is supported; `who == 0` names the caller.
+fn priority_target(which: u32, who: u32) -> Result<TaskId, u32> {
+    if which != PRIO_PROCESS {
+        return Err(abi::errno(abi::EINVAL));
+    }
+
+    if who == 0 {
+        return KERNEL
+            .with_task_manager(|tm| tm.get_current_id())
+            .ok_or(abi::errno(abi::ESRCH));
+    }
+
+    KERNEL
+        .with_process_manager(|pm| pm.get(who))
+        .and_then(|process| *process.tasks.read())
+        .ok_or(abi::errno(abi::ESRCH))
+}
+
 fn current_process_id_field(read: impl FnOnce(&crate::schedule::process::Process) -> u32) -> u32 {
     KERNEL.with_task_manager(|tm| {
         tm.get_current()
@@ -174,11 +576,10 @@ fn wait_for_process_unix(child_pid: u32, status_ptr: u32, no_hang: bool) -> u32
 fn wait_for_process(child_pid: u32, status_ptr: u32, no_hang: bool) -> u32 {
     let wait_context = KERNEL.with_task_manager(|tm| {
         let current_task = tm.get_current()?;
-        let task = current_task.read();
-        Some((task.id, task.process.pid))
+        Some(current_task.read().process.pid)
     });
 
-    let Some((task_id, parent_pid)) = wait_context else {
+    let Some(parent_pid) = wait_context else {
         return abi::errno(abi::ECHILD);
     };
 
@@ -192,8 +593,8 @@ fn wait_for_process(child_pid: u32, status_ptr: u32, no_hang: bool) -> u32 {
             return Err(crate::error::KernelError::NoTasks);
         }
 
-        let waiter = (!no_hang).then_some((task_id, status_ptr, child_pid));
-        pm.wait_for_exit(parent_pid, child_pid, waiter)
+        let waiter = (!no_hang).then_some((status_ptr, child_pid));
+        pm.wait_for_exit(parent_pid, child_pid, waiter, abi::errno(abi::EINTR))
     });
 
     match wait {
@@ -205,18 +606,7 @@ fn wait_for_process(child_pid: u32, status_ptr: u32, no_hang: bool) -> u32 {
             child_pid
         }
         Ok(None) if no_hang => 0,
-        Ok(None) => {
-            let blocked = KERNEL.with_task_manager(|tm| {
-                tm.block_current(WaitReason::Process(child_pid as usize))
-                    .is_ok()
-            });
-
-            if !blocked {
-                return abi::errno(abi::ECHILD);
-            }
-
-            task_next();
-        }
+        Ok(None) => task_next(),
         Err(_) => abi::errno(abi::ECHILD),
     }
 }
@@ -1,25 +1,37 @@
 use crate::interrupts::{interrupt_frame::InterruptFrame, syscall::SyscallId};
-use alloc::sync::Arc;
-use lazy_static::lazy_static;
-use spin::RwLock;
 
 const MAX_SYSCALLS: usize = 1024;
+const NO_SLOT: u16 = u16::MAX;
 
 pub type SyscallHandler = fn(frame: &InterruptFrame) -> u32;
 
-lazy_static! {
-    static ref SYSCALL_TABLE: Arc<RwLock<[Option<SyscallHandler>; MAX_SYSCALLS]>> =
-        Arc::new(RwLock::new([None; MAX_SYSCALLS]));
+/// Maps raw syscall numbers to dense slots in a handler list.
+///
+/// Built at compile time so dispatch is a single array lookup without locks,
+/// and so per-syscall tables (see `trace`) can be sized to the handler count.
+pub struct SyscallSlots {
+    slots: [u16; MAX_SYSCALLS],
 }
 
-#[inline]
-pub fn syscall_register(id: SyscallId, handler: SyscallHandler) {
-    let mut table = SYSCALL_TABLE.write();
-    table[id as usize] = Some(handler);
-}
+impl SyscallSlots {
+    pub const fn new(handlers: &[(SyscallId, SyscallHandler)]) -> Self {
+        let mut slots = [NO_SLOT; MAX_SYSCALLS];
+        let mut i = 0;
+        while i < handlers.len() {
+            let id = handlers[i].0 as usize;
+            assert!(id < MAX_SYSCALLS, "syscall id out of range");
+            assert!(slots[id] == NO_SLOT, "syscall registered twice");
+            slots[id] = i as u16;
+            i += 1;
+        }
+        Self { slots }
+    }
 
-#[inline]
-pub fn syscall_get_handler(id: SyscallId) -> Option<SyscallHandler> {
-    let table = SYSCALL_TABLE.read();
-    table[id as usize]
+    #[inline]
+    pub fn get(&self, number: u32) -> Option<usize> {
+        match self.slots.get(number as usize) {
+            Some(&slot) if slot != NO_SLOT => Some(slot as usize),
+            _ => None,
+        }
+    }
 }
@@ -1,21 +1,46 @@
-use alloc::collections::BTreeMap;
+use alloc::{collections::BTreeMap, sync::Arc};
 use lazy_static::lazy_static;
 use spin::Mutex;
 
 use crate::{
+    device::timer::current_tick,
     interrupts::InterruptFrame,
     kernel::KERNEL,
     schedule::{
+        process::Process,
         semaphore::Semaphore,
-        task::{task_current_set_return_value, task_next},
+        task::{WaitReason, WaitTimeout, task_next},
         task_manager::TaskManager,
+        wait_queue::{Resume, WaitQueue},
     },
 };
 
-use super::abi;
+use super::{abi, io::read_timespec_ticks, user};
+
+const FUTEX_WAIT: u32 = 0;
+const FUTEX_WAKE: u32 = 1;
+/// Linux marks process-private futexes with this; all of ours are.
+const FUTEX_PRIVATE_FLAG: u32 = 128;
 
 lazy_static! {
     static ref SEMAPHORES: Mutex<SemaphoreTable> = Mutex::new(SemaphoreTable::new());
+    static ref FUTEXES: Mutex<BTreeMap<FutexKey, WaitQueue>> = Mutex::new(BTreeMap::new());
+}
+
+/// A futex word: its user address within one address space.
+#[derive(Clone, Copy, PartialEq, Eq, PartialOrd, Ord)]
+struct FutexKey {
+    address_space: usize,
+    address: u32,
+}
+
+impl FutexKey {
+    fn new(process: &Process, address: u32) -> Self {
+        Self {
+            address_space: process.page_directory.directory.as_ptr() as usize,
+            address,
+        }
+    }
 }
 
 struct SemaphoreTable {
@@ -42,7 +67,7 @@ impl SemaphoreTable {
         self.semaphores
             .get_mut(&id)
             .ok_or(abi::EINVAL)?
-            .wait(task_manager)
+            .wait(task_manager, abi::errno(abi::EINTR))
             .map_err(|_| abi::ESRCH)
     }
 
@@ -84,14 +109,9 @@ pub fn syscall_semaphore_wait(_frame: &InterruptFrame) -> u32 {
         return abi::errno(abi::ESRCH);
     };
 
-    let wait_result = KERNEL.with_task_manager(|tm| SEMAPHORES.lock().wait(id, tm));
-
-    match wait_result {
+    match KERNEL.with_task_manager(|tm| SEMAPHORES.lock().wait(id, tm)) {
         Ok(true) => 0,
-        Ok(false) => {
-            task_current_set_return_value(0);
-            task_next();
-        }
+        Ok(false) => task_next(),
         Err(errno) => abi::errno(errno),
     }
 }
@@ -123,3 +143,131 @@ pub fn syscall_semaphore_close(_frame: &InterruptFrame) -> u32 {
         Err(errno) => abi::errno(errno),
     }
 }
+
+/// `futex(uaddr, op, val, timeout)`: FUTEX_WAIT parks the caller while the
+/// word at `uaddr` still holds `val`, for at most the relative `timeout`;
+/// FUTEX_WAKE wakes up to `val` tasks parked on `uaddr`.
+pub fn syscall_futex(_frame: &InterruptFrame) -> u32 {
+    let Some((process, address, op, value, timeout_ptr)) = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current()?;
+        let task = current_task.read();
+        Some((
+            task.process.clone(),
+            task.get_stack_item(0),
+            task.get_stack_item(1),
+            task.get_stack_item(2),
+            task.get_stack_item(3),
+        ))
+    }) else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    if address == 0 {
+        return abi::errno(abi::EFAULT);
+    }
+    if address % 4 != 0 {
+        return abi::errno(abi::EINVAL);
+    }
+
+    let key = FutexKey::new(&process, address);
+    match op & !FUTEX_PRIVATE_FLAG {
+        FUTEX_WAIT => futex_wait(process, key, value, timeout_ptr),
+        FUTEX_WAKE => futex_wake(key, value.min(i32::MAX as u32)),
+        _ => abi::errno(abi::ENOSYS),
+    }
+}
+
+fn futex_wait(process: Arc<Process>, key: FutexKey, expected: u32, timeout_ptr: u32) -> u32 {
+    let timeout = if timeout_ptr == 0 {
+        None
+    } else {
+        match read_timespec_ticks(&process, timeout_ptr) {
+            Ok(0) => return abi::errno(abi::ETIMEDOUT),
+            Ok(ticks) => Some(WaitTimeout {
+                deadline: current_tick().saturating_add(ticks),
+                return_value: abi::errno(abi::ETIMEDOUT),
+            }),
+            Err(errno) => return abi::errno(errno),
+        }
+    };
+
+    // The word is checked under the futex lock, which FUTEX_WAKE also takes,
+    // so a waker that changed it before waking cannot be missed.
+    let parked = KERNEL.with_task_manager(|tm| {
+        let mut futexes = FUTEXES.lock();
+        let mut current = 0u32;
+        user::copy_from_user(
+            &process.page_directory,
+            key.address,
+            &mut current as *mut u32 as *mut u8,
+            core::mem::size_of::<u32>() as u32,
+        )
+        .map_err(|_| abi::EFAULT)?;
+        if current != expected {
+            return Err(abi::EAGAIN);
+        }
+
+        // Waiters that timed out or were interrupted leave their entry
+        // behind; drop those of this word before adding to it.
+        let waiters = futexes.entry(key).or_insert_with(WaitQueue::new);
+        waiters.prune(tm);
+        waiters
+            .park(
+                tm,
+                WaitReason::Futex(key.address as usize),
+                (),
+                timeout,
+                abi::errno(abi::EINTR),
+            )
+            .map_err(|_| abi::ESRCH)
+    });
+
+    match parked {
+        Ok(_) => {
+            drop(process);
+            task_next()
+        }
+        Err(errno) => abi::errno(errno),
+    }
+}
+
+/// Drops the futex queues of an exiting process, whose page directory a
+/// new process may get again.
+pub fn release_futexes(process: &Process) {
+    let address_space = process.page_directory.directory.as_ptr() as usize;
+    FUTEXES
+        .lock()
+        .retain(|key, _| key.address_space != address_space);
+}
+
+/// Zeroes the `CLONE_CHILD_CLEARTID` word of an exiting thread and wakes a
+/// task joining it.
+pub(super) fn clear_child_tid(process: &Process, address: u32) {
+    if address == 0 || address % 4 != 0 {
+        return;
+    }
+    if user::write_value(&process.page_directory, address, &0u32).is_ok() {
+        futex_wake(FutexKey::new(process, address), 1);
+    }
+}
+
+fn futex_wake(key: FutexKey, count: u32) -> u32 {
+    KERNEL.with_task_manager(|tm| {
+        let mut futexes = FUTEXES.lock();
+        let Some(waiters) = futexes.get_mut(&key) else {
+            return 0;
+        };
+
+        let mut woken = 0;
+        while woken < count && waiters.wake_one(tm, |_| Resume::Value(0)) {
+            woken += 1;
+        }
+        // Entries of waiters that timed out or were interrupted go too, so
+        // the queue does not outlive them.
+        waiters.prune(tm);
+        if waiters.is_empty() {
+            futexes.remove(&key);
+        }
+        woken
+    })
+}
@@ -0,0 +1,206 @@
+use crate::{
+    constant::USER_TLS_ENTRY,
+    interrupts::InterruptFrame,
+    kernel::KERNEL,
+    schedule::{process::Process, task::task_next},
+};
+
+use super::{abi, sync::clear_child_tid, user};
+
+const CSIGNAL: u32 = 0x0000_00FF;
+const CLONE_VM: u32 = 0x0000_0100;
+const CLONE_FS: u32 = 0x0000_0200;
+const CLONE_FILES: u32 = 0x0000_0400;
+const CLONE_SIGHAND: u32 = 0x0000_0800;
+const CLONE_THREAD: u32 = 0x0001_0000;
+const CLONE_SYSVSEM: u32 = 0x0004_0000;
+const CLONE_SETTLS: u32 = 0x0008_0000;
+const CLONE_PARENT_SETTID: u32 = 0x0010_0000;
+const CLONE_CHILD_CLEARTID: u32 = 0x0020_0000;
+const CLONE_CHILD_SETTID: u32 = 0x0100_0000;
+/// A thread is another task of the same `Process`, so it shares all of these
+/// or none.
+const CLONE_THREAD_FLAGS: u32 = CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD;
+const CLONE_SUPPORTED: u32 = CSIGNAL
+    | CLONE_THREAD_FLAGS
+    | CLONE_SYSVSEM
+    | CLONE_SETTLS
+    | CLONE_PARENT_SETTID
+    | CLONE_CHILD_CLEARTID
+    | CLONE_CHILD_SETTID;
+
+/// `struct user_desc` of `set_thread_area` and `CLONE_SETTLS`. The TLS
+/// segment is always a flat 4 GiB data segment, so only the entry number and
+/// base address are used.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+struct UserDesc {
+    entry_number: u32,
+    base_addr: u32,
+    limit: u32,
+    flags: u32,
+}
+
+/// Reads the `user_desc` at `ptr` and returns the thread pointer it asks for.
+/// An entry number of -1 picks the TLS slot and is written back.
+fn read_tls_desc(process: &Process, ptr: u32) -> Result<u32, i32> {
+    if ptr == 0 {
+        return Err(abi::EFAULT);
+    }
+
+    let mut desc = UserDesc::default();
+    user::copy_from_user(
+        &process.page_directory,
+        ptr,
+        &mut desc as *mut UserDesc as *mut u8,
+        core::mem::size_of::<UserDesc>() as u32,
+    )
+    .map_err(|_| abi::EFAULT)?;
+
+    match desc.entry_number {
+        USER_TLS_ENTRY => {}
+        u32::MAX => user::write_value(&process.page_directory, ptr, &USER_TLS_ENTRY)
+            .map_err(|_| abi::EFAULT)?,
+        _ => return Err(abi::EINVAL),
+    }
+    Ok(desc.base_addr)
+}
+
+/// `clone(flags, stack, parent_tid, tls, child_tid)`, in the i386 argument
+/// order. With the thread flags it starts a thread on `stack`; without any
+/// of them it forks, optionally onto `stack`.
+pub fn syscall_clone(_frame: &InterruptFrame) -> u32 {
+    let context = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current()?;
+        let task = current_task.read();
+        let mut registers = task.registers;
+        registers.eax = 0;
+        let args: [u32; 5] = core::array::from_fn(|i| task.get_stack_item(i));
+        Some((
+            task.process.clone(),
+            registers,
+            task.nice,
+            task.tls_base,
+            args,
+        ))
+    });
+
+    let Some((process, mut registers, nice, tls_base, args)) = context else {
+        return abi::errno(abi::EAGAIN);
+    };
+    let [flags, stack, parent_tid, tls, child_tid] = args;
+
+    if flags & !CLONE_SUPPORTED != 0 {
+        return abi::errno(abi::EINVAL);
+    }
+    if stack != 0 {
+        registers.esp = stack;
+    }
+
+    if flags & CLONE_THREAD_FLAGS == 0 {
+        if flags & !CSIGNAL != 0 {
+            return abi::errno(abi::EINVAL);
+        }
+        return match KERNEL.with_process_manager(|pm| pm.fork(process, registers, nice, tls_base)) {
+            Ok(pid) => pid,
+            Err(_) => abi::errno(abi::EAGAIN),
+        };
+    }
+
+    // A thread on the caller's stack would corrupt it.
+    if flags & CLONE_THREAD_FLAGS != CLONE_THREAD_FLAGS || stack == 0 {
+        return abi::errno(abi::EINVAL);
+    }
+
+    let tls_base = if flags & CLONE_SETTLS != 0 {
+        match read_tls_desc(&process, tls) {
+            Ok(base) => base,
+            Err(errno) => return abi::errno(errno),
+        }
+    } else {
+        tls_base
+    };
+    let clear_child_tid = if flags & CLONE_CHILD_CLEARTID != 0 {
+        child_tid
+    } else {
+        0
+    };
+    let tid_ptrs = [
+        if flags & CLONE_PARENT_SETTID != 0 {
+            parent_tid
+        } else {
+            0
+        },
+        if flags & CLONE_CHILD_SETTID != 0 {
+            child_tid
+        } else {
+            0
+        },
+    ];
+
+    match KERNEL.with_process_manager(|pm| {
+        pm.spawn_thread(
+            process,
+            registers,
+            nice,
+            tls_base,
+            clear_child_tid,
+            &tid_ptrs,
+        )
+    }) {
+        Ok(task_id) => task_id as u32,
+        Err(_) => abi::errno(abi::EAGAIN),
+    }
+}
+
+/// `set_thread_area(u_info)`: sets the thread pointer of the caller. It takes
+/// effect when the syscall returns.
+pub fn syscall_set_thread_area(_frame: &InterruptFrame) -> u32 {
+    let context = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current()?;
+        let task = current_task.read();
+        Some((task.process.clone(), task.get_stack_item(0)))
+    });
+    let Some((process, desc_ptr)) = context else {
+        return abi::errno(abi::ESRCH);
+    };
+
+    let base = match read_tls_desc(&process, desc_ptr) {
+        Ok(base) => base,
+        Err(errno) => return abi::errno(errno),
+    };
+
+    KERNEL.with_task_manager(|tm| {
+        if let Some(current_task) = tm.get_current() {
+            current_task.write().tls_base = base;
+        }
+    });
+    0
+}
+
+pub fn syscall_gettid(_frame: &InterruptFrame) -> u32 {
+    KERNEL
+        .with_task_manager(|tm| tm.get_current_id())
+        .map_or_else(|| abi::errno(abi::ESRCH), |task_id| task_id as u32)
+}
+
+/// Ends the calling thread and leaves the others running. Returns only for
+/// the main thread, whose exit ends the whole process.
+pub(super) fn exit_current_thread() {
+    let Some((process, task_id)) = KERNEL.with_task_manager(|tm| {
+        let current_task = tm.get_current()?;
+        let task = current_task.read();
+        Some((task.process.clone(), task.id))
+    }) else {
+        return;
+    };
+
+    if *process.tasks.read() == Some(task_id) {
+        return;
+    }
+
+    let clear_tid = KERNEL.with_process_manager(|pm| pm.exit_thread(&process, task_id));
+    clear_child_tid(&process, clear_tid);
+    drop(process);
+    task_next();
+}
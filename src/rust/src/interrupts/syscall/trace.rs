@@ -0,0 +1,314 @@
+use core::{
+    fmt::Write,
+    sync::atomic::{AtomicBool, Ordering},
+};
+
+use alloc::{boxed::Box, collections::VecDeque, format, string::String, vec::Vec};
+use spin::Mutex;
+
+use crate::{
+    fs::{FileHandle, FileMetadata, FileOps, FsError},
+    interrupts::InterruptFrame,
+    kernel::KERNEL,
+    schedule::process::ProcessId,
+    utils::rdtsc,
+};
+
+use super::{
+    dispatcher::{SYSCALL_COUNT, SYSCALL_HANDLERS},
+    register::SyscallHandler,
+    types::SyscallId,
+};
+
+/// Number of recent calls kept per process.
+pub const SYSCALL_TRACE_LEN: usize = 64;
+/// Number of stack arguments captured per traced call.
+pub const SYSCALL_TRACE_ARGS: usize = 4;
+
+/// Histogram bucket `i` counts calls that took less than
+/// `2^(LATENCY_BUCKET_SHIFT + i)` cycles; the last bucket is open ended.
+const LATENCY_BUCKETS: usize = 16;
+const LATENCY_BUCKET_SHIFT: u32 = 9;
+
+static TRACE_ENABLED: AtomicBool = AtomicBool::new(false);
+static STATS: Mutex<[SyscallStats; SYSCALL_COUNT]> =
+    Mutex::new([SyscallStats::EMPTY; SYSCALL_COUNT]);
+
+#[inline(always)]
+pub fn enabled() -> bool {
+    TRACE_ENABLED.load(Ordering::Relaxed)
+}
+
+pub fn set_enabled(enabled: bool) {
+    TRACE_ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+pub fn reset() {
+    *STATS.lock() = [SyscallStats::EMPTY; SYSCALL_COUNT];
+}
+
+#[derive(Clone, Copy)]
+struct SyscallStats {
+    calls: u32,
+    errors: u32,
+    total_cycles: u64,
+    max_cycles: u64,
+    histogram: [u32; LATENCY_BUCKETS],
+}
+
+impl SyscallStats {
+    const EMPTY: Self = Self {
+        calls: 0,
+        errors: 0,
+        total_cycles: 0,
+        max_cycles: 0,
+        histogram: [0; LATENCY_BUCKETS],
+    };
+
+    fn record(&mut self, cycles: u64, failed: bool) {
+        self.calls = self.calls.wrapping_add(1);
+        if failed {
+            self.errors = self.errors.wrapping_add(1);
+        }
+        self.total_cycles = self.total_cycles.wrapping_add(cycles);
+        self.max_cycles = self.max_cycles.max(cycles);
+        let bucket = &mut self.histogram[latency_bucket(cycles)];
+        *bucket = bucket.wrapping_add(1);
+    }
+}
+
+fn latency_bucket(cycles: u64) -> usize {
+    let bits = u64::BITS - cycles.leading_zeros();
+    (bits.saturating_sub(LATENCY_BUCKET_SHIFT) as usize).min(LATENCY_BUCKETS - 1)
+}
+
+fn is_error(result: u32) -> bool {
+    // Same convention as Linux: -4095..=-1 are errno values.
+    result > (-4096i32) as u32
+}
+
+#[derive(Clone, Copy)]
+pub struct SyscallRecord {
+    pub id: SyscallId,
+    pub args: [u32; SYSCALL_TRACE_ARGS],
+    pub result: u32,
+    pub cycles: u64,
+}
+
+/// Ring of the most recent traced calls of one process.
+pub struct SyscallTrace {
+    records: VecDeque<SyscallRecord>,
+    dropped: u32,
+}
+
+impl SyscallTrace {
+    pub const fn new() -> Self {
+        Self {
+            records: VecDeque::new(),
+            dropped: 0,
+        }
+    }
+
+    fn push(&mut self, record: SyscallRecord) {
+        if self.records.len() == SYSCALL_TRACE_LEN {
+            self.records.pop_front();
+            self.dropped = self.dropped.wrapping_add(1);
+        }
+        self.records.push_back(record);
+    }
+}
+
+/// Slow path of `syscall_handle`, only taken while tracing is enabled.
+///
+/// Calls that block through `task_next` never come back here; the restarted
+/// call is recorded once it finally returns.
+pub(super) fn syscall_traced(
+    slot: usize,
+    id: SyscallId,
+    handler: SyscallHandler,
+    frame: &InterruptFrame,
+) -> u32 {
+    let caller = KERNEL.with_task_manager(|tm| {
+        let task = tm.get_current()?.read();
+        let args = core::array::from_fn(|i| task.get_stack_item(i));
+        Some((task.process.clone(), args))
+    });
+
+    let start = rdtsc();
+    let result = handler(frame);
+    let cycles = rdtsc().wrapping_sub(start);
+
+    STATS.lock()[slot].record(cycles, is_error(result));
+    if let Some((process, args)) = caller {
+        process.syscall_trace.lock().push(SyscallRecord {
+            id,
+            args,
+            result,
+            cycles,
+        });
+    }
+
+    result
+}
+
+fn render_stats() -> String {
+    let stats = *STATS.lock();
+    let mut out = String::new();
+    let _ = writeln!(out, "tracing: {}", if enabled() { "on" } else { "off" });
+    let _ = writeln!(
+        out,
+        "{:<20} {:>8} {:>8} {:>10} {:>10}  histogram (bucket i: < 2^({}+i) cycles)",
+        "syscall", "calls", "errors", "avg_cyc", "max_cyc", LATENCY_BUCKET_SHIFT
+    );
+
+    for (slot, stat) in stats.iter().enumerate() {
+        if stat.calls == 0 {
+            continue;
+        }
+        let name = format!("{:?}", SYSCALL_HANDLERS[slot].0);
+        let _ = write!(
+            out,
+            "{:<20} {:>8} {:>8} {:>10} {:>10} ",
+            name,
+            stat.calls,
+            stat.errors,
+            stat.total_cycles / stat.calls as u64,
+            stat.max_cycles
+        );
+        for count in stat.histogram {
+            let _ = write!(out, " {}", count);
+        }
+        out.push('\n');
+    }
+
+    out
+}
+
+fn render_process_trace(pid: ProcessId) -> Result<String, FsError> {
+    let process = KERNEL
+        .with_process_manager(|pm| pm.get(pid))
+        .ok_or(FsError::NotFound)?;
+    let trace = process.syscall_trace.lock();
+
+    let mut out = String::new();
+    let _ = writeln!(out, "pid {} ({} dropped)", pid, trace.dropped);
+    for record in trace.records.iter() {
+        let _ = write!(out, "{:?}(", record.id);
+        for (i, arg) in record.args.iter().enumerate() {
+            let sep = if i == 0 { "" } else { ", " };
+            let _ = write!(out, "{}{:#x}", sep, arg);
+        }
+        let _ = writeln!(
+            out,
+            ") = {} [{} cycles]",
+            record.result as i32, record.cycles
+        );
+    }
+
+    Ok(out)
+}
+
+enum TraceView {
+    Stats,
+    Process(ProcessId),
+}
+
+/// Text snapshot served by the `syscalls` and `strace` device nodes.
+///
+/// The snapshot is rendered on the first read after open or after a write
+/// changed what the file shows.
+struct TraceFile {
+    view: TraceView,
+    text: Option<Vec<u8>>,
+    pos: usize,
+}
+
+impl TraceFile {
+    fn new(view: TraceView) -> Self {
+        Self {
+            view,
+            text: None,
+            pos: 0,
+        }
+    }
+
+    fn invalidate(&mut self) {
+        self.text = None;
+        self.pos = 0;
+    }
+}
+
+impl FileOps for TraceFile {
+    fn read(&mut self, buf: &mut [u8]) -> Result<usize, FsError> {
+        if self.text.is_none() {
+            let text = match self.view {
+                TraceView::Stats => render_stats(),
+                TraceView::Process(pid) => render_process_trace(pid)?,
+            };
+            self.text = Some(text.into_bytes());
+        }
+
+        let text = self.text.as_ref().map(Vec::as_slice).unwrap_or_default();
+        let start = self.pos.min(text.len());
+        let len = buf.len().min(text.len() - start);
+        buf[..len].copy_from_slice(&text[start..start + len]);
+        self.pos = start + len;
+        Ok(len)
+    }
+
+    /// `syscalls` accepts `on`, `off` and `reset`; `strace` accepts the pid
+    /// of the process to show.
+    fn write(&mut self, buf: &[u8]) -> Result<usize, FsError> {
+        let command = core::str::from_utf8(buf)
+            .map_err(|_| FsError::InvalidArgument)?
+            .trim();
+
+        match self.view {
+            TraceView::Stats => match command {
+                "on" => set_enabled(true),
+                "off" => set_enabled(false),
+                "reset" => reset(),
+                _ => return Err(FsError::InvalidArgument),
+            },
+            TraceView::Process(_) => {
+                let pid = command
+                    .parse::<ProcessId>()
+                    .map_err(|_| FsError::InvalidArgument)?;
+                self.view = TraceView::Process(pid);
+            }
+        }
+
+        self.invalidate();
+        Ok(buf.len())
+    }
+
+    fn seek(&mut self, pos: usize) -> Result<usize, FsError> {
+        self.pos = pos;
+        Ok(pos)
+    }
+
+    fn stat(&self) -> Result<FileMetadata, FsError> {
+        Ok(FileMetadata {
+            uid: 0,
+            gid: 0,
+            mode: 0o644,
+            size: 0,
+            is_dir: false,
+            modified: 0,
+        })
+    }
+}
+
+fn open_syscalls() -> FileHandle {
+    FileHandle::new(Box::new(TraceFile::new(TraceView::Stats)))
+}
+
+fn open_strace() -> FileHandle {
+    let pid = KERNEL
+        .with_task_manager(|tm| tm.get_current().map(|task| task.read().process.pid))
+        .unwrap_or(0);
+    FileHandle::new(Box::new(TraceFile::new(TraceView::Process(pid))))
+}
+
+crate::register_device_node!(SYSCALLS_DEVICE_NODE_REG, ["syscalls"], open_syscalls);
+crate::register_device_node!(STRACE_DEVICE_NODE_REG, ["strace"], open_strace);
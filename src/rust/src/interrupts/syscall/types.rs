@@ -16,11 +16,14 @@ pub enum SyscallId {
     Lseek = 19,
     GetPid = 20,
     GetUid = 24,
+    Nice = 34,
+    Sync = 36,
     Kill = 37,
     Mkdir = 39,
     Rmdir = 40,
     Dup = 41,
     Pipe = 42,
+    Times = 43,
     Brk = 45,
     GetGid = 47,
     GetEuid = 49,
@@ -31,17 +34,31 @@ pub enum SyscallId {
     Dup2 = 63,
     GetPpid = 64,
     SigAction = 67,
+    SetRlimit = 75,
+    GetRlimit = 76,
+    GetRusage = 77,
     GetTimeOfDay = 78,
     LinuxReboot = 88,
+    GetPriority = 96,
+    SetPriority = 97,
     SocketCall = 102,
     Stat = 106,
     Lstat = 107,
     Fstat = 108,
+    Fsync = 118,
     SigReturn = 119,
+    Clone = 120,
     GetDents = 141,
+    Fdatasync = 148,
     NanoSleep = 162,
     Chown = 182,
     GetCwd = 183,
+    GetTid = 224,
+    Readahead = 225,
+    Futex = 240,
+    SetThreadArea = 243,
+    Fadvise64 = 250,
+    ExitGroup = 252,
     ClockGetTime = 265,
     // PolyOS-private debug/control calls. Keep custom IDs at 500+.
     PrintMemory = 503,
@@ -52,71 +69,10 @@ pub enum SyscallId {
     NetworkDnsQuery = 524,
     NetworkPingName = 525,
     NetworkRecvFromWait = 529,
+    Spawn = 540,
     SemaphoreCreate = 560,
     SemaphoreWait = 561,
     SemaphoreSignal = 562,
     SemaphoreClose = 563,
     KernelSelfTest = 590,
 }
-
-impl SyscallId {
-    pub const fn new(v: u32) -> Option<Self> {
-        match v {
-            1 => Some(Self::Exit),
-            2 => Some(Self::Fork),
-            3 => Some(Self::Read),
-            4 => Some(Self::Write),
-            5 => Some(Self::Open),
-            6 => Some(Self::Close),
-            7 => Some(Self::WaitPid),
-            10 => Some(Self::Unlink),
-            11 => Some(Self::Execve),
-            12 => Some(Self::Chdir),
-            15 => Some(Self::Chmod),
-            19 => Some(Self::Lseek),
-            20 => Some(Self::GetPid),
-            24 => Some(Self::GetUid),
-            37 => Some(Self::Kill),
-            39 => Some(Self::Mkdir),
-            40 => Some(Self::Rmdir),
-            41 => Some(Self::Dup),
-            42 => Some(Self::Pipe),
-            45 => Some(Self::Brk),
-            47 => Some(Self::GetGid),
-            49 => Some(Self::GetEuid),
-            50 => Some(Self::GetEgid),
-            54 => Some(Self::Ioctl),
-            55 => Some(Self::Fcntl),
-            60 => Some(Self::Umask),
-            63 => Some(Self::Dup2),
-            64 => Some(Self::GetPpid),
-            67 => Some(Self::SigAction),
-            78 => Some(Self::GetTimeOfDay),
-            88 => Some(Self::LinuxReboot),
-            102 => Some(Self::SocketCall),
-            106 => Some(Self::Stat),
-            107 => Some(Self::Lstat),
-            108 => Some(Self::Fstat),
-            119 => Some(Self::SigReturn),
-            141 => Some(Self::GetDents),
-            162 => Some(Self::NanoSleep),
-            182 => Some(Self::Chown),
-            183 => Some(Self::GetCwd),
-            265 => Some(Self::ClockGetTime),
-            503 => Some(Self::PrintMemory),
-            520 => Some(Self::NetworkInfo),
-            521 => Some(Self::NetworkDhcpDiscover),
-            522 => Some(Self::NetworkPingGateway),
-            523 => Some(Self::NetworkPingIpv4),
-            524 => Some(Self::NetworkDnsQuery),
-            525 => Some(Self::NetworkPingName),
-            529 => Some(Self::NetworkRecvFromWait),
-            560 => Some(Self::SemaphoreCreate),
-            561 => Some(Self::SemaphoreWait),
-            562 => Some(Self::SemaphoreSignal),
-            563 => Some(Self::SemaphoreClose),
-            590 => Some(Self::KernelSelfTest),
-            _ => None,
-        }
-    }
-}
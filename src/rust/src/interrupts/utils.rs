@@ -2,11 +2,13 @@ use core::arch::asm;
 
 use crate::{
     constant::{
-        PIC_MASTER_COMMAND_PORT, PIC_MASTER_VECTOR_OFFSET, PIC_SLAVE_COMMAND_PORT,
-        PIC_SLAVE_VECTOR_OFFSET,
+        LAPIC_TIMER_VECTOR, PIC_MASTER_COMMAND_PORT, PIC_MASTER_DATA_PORT,
+        PIC_MASTER_VECTOR_OFFSET, PIC_SLAVE_COMMAND_PORT, PIC_SLAVE_DATA_PORT, PIC_SLAVE_IRQ_MASK,
+        PIC_SLAVE_VECTOR_OFFSET, RESCHEDULE_VECTOR, TLB_SHOOTDOWN_VECTOR,
     },
-    device::io::outb,
+    device::io::{inb, outb},
     interrupts::idt::Idtr,
+    smp,
 };
 
 pub fn idt_load(idtr: &Idtr) {
@@ -47,7 +49,9 @@ pub fn eoi_pic2() {
 
 #[inline(always)]
 pub fn eoi_irq(interrupt: u32) {
-    if interrupt >= PIC_SLAVE_VECTOR_OFFSET as u32 {
+    // Only PIC vectors; a stray EOI would ack another CPU's in-service IRQ.
+    if interrupt >= PIC_SLAVE_VECTOR_OFFSET as u32 && interrupt < PIC_SLAVE_VECTOR_OFFSET as u32 + 8
+    {
         eoi_pic2();
     }
 
@@ -56,6 +60,37 @@ pub fn eoi_irq(interrupt: u32) {
     {
         eoi_pic1();
     }
+
+    if interrupt == LAPIC_TIMER_VECTOR as u32
+        || interrupt == RESCHEDULE_VECTOR as u32
+        || interrupt == TLB_SHOOTDOWN_VECTOR as u32
+    {
+        smp::eoi();
+    }
+}
+
+/// Unmasks `irq_line` on the PICs, and the cascade line for the slave's.
+pub fn enable_irq_line(irq_line: u8) {
+    if irq_line >= 16 {
+        return;
+    }
+
+    let mut master_mask = unsafe { inb(PIC_MASTER_DATA_PORT) };
+    let mut slave_mask = unsafe { inb(PIC_SLAVE_DATA_PORT) };
+
+    if irq_line < 8 {
+        master_mask &= !1u8.wrapping_shl(irq_line as u32);
+        unsafe { outb(PIC_MASTER_DATA_PORT, master_mask) };
+        return;
+    }
+
+    master_mask &= !PIC_SLAVE_IRQ_MASK;
+    slave_mask &= !1u8.wrapping_shl((irq_line - 8) as u32);
+
+    unsafe {
+        outb(PIC_MASTER_DATA_PORT, master_mask);
+        outb(PIC_SLAVE_DATA_PORT, slave_mask);
+    }
 }
 
 #[inline]
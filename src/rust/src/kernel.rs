@@ -6,11 +6,15 @@ use alloc::{string::ToString, sync::Arc};
 use spin::RwLock;
 
 use crate::{
+    constant::RAM_DISK_IMAGE,
     device::{
+        ahci::AHCI_DRIVER,
         disk::DISK_DRIVER,
         driver::{DeviceProbeStage, probe_stage},
+        ram_disk::RAM_DISK_DRIVER,
+        virtio_blk::VIRTIO_BLK_DRIVER,
     },
-    fs::{DevFsDriver, FatDriver, MemFsDriver, MountOptions, Vfs},
+    fs::{DevFsDriver, FatDriver, FsError, MemFsDriver, MountOptions, Vfs},
     interrupts,
     memory::{self, PageDirectory},
     schedule::{process_manager::ProcessManager, task_manager::TaskManager},
@@ -66,17 +70,19 @@ impl Kernel {
             .write()
             .register_fs_driver("fat", Arc::new(FatDriver));
 
+        // The bootloader reads the kernel over IDE, but once the system runs
+        // the same image on virtio-blk is the faster way to it.
+        let root = VIRTIO_BLK_DRIVER
+            .block_device_id()
+            .or_else(|| DISK_DRIVER.block_device_id())
+            .expect("disk block device not probed");
         self.vfs
             .read()
             .mount(
                 "/",
                 &MountOptions {
                     fs_name: "fat".to_string(),
-                    block_device_id: Some(
-                        DISK_DRIVER
-                            .block_device_id()
-                            .expect("disk block device not probed"),
-                    ),
+                    block_device_id: Some(root),
                 },
             )
             .expect("Failed to mount fat at /");
@@ -102,6 +108,60 @@ impl Kernel {
                 },
             )
             .expect("Failed to mount memfs at /tmp");
+
+        // The boot disk stays the root; a SATA disk is a second FAT volume.
+        if let Some(id) = AHCI_DRIVER.block_device_id() {
+            let mounted = self.vfs.read().mount(
+                "/sata",
+                &MountOptions {
+                    fs_name: "fat".to_string(),
+                    block_device_id: Some(id),
+                },
+            );
+            if let Err(error) = mounted {
+                serial_println!("Failed to mount fat at /sata: {:?}", error);
+            }
+        }
+
+        // A RAM disk is a scratch FAT volume with no controller under it.
+        if let Some(id) = RAM_DISK_DRIVER.block_device_id() {
+            if let Err(error) = self.mount_ram_disk(id) {
+                serial_println!("Failed to mount fat at /ram: {:?}", error);
+            }
+        }
+    }
+
+    /// Mounts the RAM disk at /ram, from `RAM_DISK_IMAGE` if the root volume
+    /// has it and formatted empty otherwise.
+    fn mount_ram_disk(&self, id: usize) -> Result<(), FsError> {
+        if !self.load_ram_disk_image()? {
+            FatDriver.format(id)?;
+        }
+        self.vfs.read().mount(
+            "/ram",
+            &MountOptions {
+                fs_name: "fat".to_string(),
+                block_device_id: Some(id),
+            },
+        )
+    }
+
+    fn load_ram_disk_image(&self) -> Result<bool, FsError> {
+        let mut file = match self.vfs.read().open(RAM_DISK_IMAGE) {
+            Ok(file) => file,
+            Err(FsError::NotFound) => return Ok(false),
+            Err(error) => return Err(error),
+        };
+        let mut image = vec![0u8; file.ops.stat()?.size as usize];
+        let mut filled = 0;
+        while filled < image.len() {
+            match file.ops.read(&mut image[filled..])? {
+                0 => return Err(FsError::IoError),
+                read => filled += read,
+            }
+        }
+        RAM_DISK_DRIVER.load(image).map_err(|_| FsError::IoError)?;
+        Ok(true)
     }
 
     fn probe_devices(&self, stage: DeviceProbeStage) {
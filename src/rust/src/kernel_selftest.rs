@@ -1,8 +1,27 @@
+use alloc::{format, sync::Arc, vec::Vec};
+use fatfs::{Read, Seek, SeekFrom, Write};
+
 use crate::{
-    constant::PAGING_PAGE_SIZE,
+    constant::{PAGING_PAGE_SIZE, SCHEDULER_LEVELS},
+    device::{
+        block_cache::SECTOR_SIZE,
+        block_dev::{self, BlockDeviceError},
+        bufstream::BufStream,
+        ram_disk::RAM_DISK_DRIVER,
+        readahead::{HintCell, ReadAheadHint},
+        writeback::WriteLog,
+    },
     kernel::KERNEL,
     memory::{self, Page, PageDirectory},
-    schedule::loader::elf::{ElfFile, PF_W},
+    schedule::{
+        loader::{
+            cache,
+            elf::{ElfFile, PF_W},
+        },
+        task_manager::{NICE_MAX, NICE_MIN, level_quantum, nice_level},
+        timer::TimerQueue,
+    },
+    smp,
 };
 
 struct Runner {
@@ -45,7 +64,11 @@ pub fn run() -> u32 {
     test_page_directory_cow(&mut runner);
     test_vfs_devices(&mut runner);
     test_vfs_memfs(&mut runner);
+    test_bufstream(&mut runner);
     test_elf_loader(&mut runner);
+    test_timer_queue(&mut runner);
+    test_feedback_levels(&mut runner);
+    test_smp_cpu(&mut runner);
 
     runner.finish()
 }
@@ -275,6 +298,104 @@ fn test_vfs_memfs(runner: &mut Runner) {
     runner.check("vfs memfs remove", vfs.remove(path).is_ok());
 }
 
+/// Sectors at the end of the RAM disk the block stream tests use. What
+/// they held is put back afterwards.
+const BUFSTREAM_TEST_SECTORS: usize = 4;
+
+fn test_bufstream(runner: &mut Runner) {
+    // Without a RAM disk there is no device to write on safely.
+    let Some(id) = RAM_DISK_DRIVER.block_device_id() else {
+        return;
+    };
+    let Some(sectors) = block_dev::sector_count(id) else {
+        runner.check("bufstream sector count", false);
+        return;
+    };
+
+    let first = sectors - BUFSTREAM_TEST_SECTORS as u64;
+    let start = first * SECTOR_SIZE as u64;
+    let mut saved = vec![0u8; BUFSTREAM_TEST_SECTORS * SECTOR_SIZE];
+    if block_dev::read_sectors(id, first, BUFSTREAM_TEST_SECTORS, &mut saved).is_err() {
+        runner.check("bufstream save sectors", false);
+        return;
+    }
+
+    let hint = Arc::new(HintCell::new());
+    let mut stream = BufStream::new(id, hint.clone(), Arc::new(WriteLog::new(id)));
+    // What the test sectors should hold, kept up to date with each write.
+    let mut expected = saved.clone();
+
+    // (name, offset in the test sectors, length)
+    let cases = [
+        ("head only", 100, 200),
+        ("tail only", 0, SECTOR_SIZE + 100),
+        ("head and tail", 300, 2 * SECTOR_SIZE + 100),
+        ("aligned", SECTOR_SIZE, 2 * SECTOR_SIZE),
+    ];
+    for (index, &(name, offset, len)) in cases.iter().enumerate() {
+        let data = (0..len)
+            .map(|byte| (byte * 7 + index * 31 + 1) as u8)
+            .collect::<Vec<_>>();
+        expected[offset..offset + len].copy_from_slice(&data);
+
+        let written = stream
+            .seek(SeekFrom::Start(start + offset as u64))
+            .and_then(|_| stream.write(&data));
+        let mut device = vec![0u8; expected.len()];
+        let read_back = block_dev::read_sectors(id, first, BUFSTREAM_TEST_SECTORS, &mut device);
+        runner.check(
+            &format!("bufstream write {}", name),
+            matches!(written, Ok(count) if count == len) && read_back.is_ok() && device == expected,
+        );
+
+        let mut buffer = vec![0u8; len];
+        let read = stream
+            .seek(SeekFrom::Start(start + offset as u64))
+            .and_then(|_| stream.read(&mut buffer));
+        runner.check(
+            &format!("bufstream read {}", name),
+            matches!(read, Ok(count) if count == len)
+                && buffer[..] == expected[offset..offset + len],
+        );
+    }
+
+    // The read-ahead window of the last sector lies past the end of the
+    // device, so only the sector itself can be read.
+    let mut buffer = [0u8; 300];
+    hint.set(ReadAheadHint::Streaming);
+    let read = stream
+        .seek(SeekFrom::End(-(buffer.len() as i64)))
+        .and_then(|_| stream.read(&mut buffer));
+    hint.set(ReadAheadHint::Normal);
+    runner.check(
+        "bufstream read ahead past end",
+        matches!(read, Ok(count) if count == buffer.len())
+            && buffer[..] == expected[expected.len() - buffer.len()..],
+    );
+
+    runner.check(
+        "bufstream seek end",
+        matches!(stream.seek(SeekFrom::End(0)), Ok(pos) if pos == sectors * SECTOR_SIZE as u64),
+    );
+    let _ = stream.seek(SeekFrom::Start(start + 100));
+    runner.check(
+        "bufstream seek current backwards",
+        matches!(stream.seek(SeekFrom::Current(-40)), Ok(pos) if pos == start + 60),
+    );
+    runner.check(
+        "bufstream seek before start",
+        matches!(
+            stream.seek(SeekFrom::Current(-(start as i64) - 61)),
+            Err(BlockDeviceError::InvalidArgument)
+        ),
+    );
+
+    runner.check(
+        "bufstream restore sectors",
+        block_dev::write_sectors(id, first, BUFSTREAM_TEST_SECTORS, &saved).is_ok(),
+    );
+}
+
 fn test_elf_loader(runner: &mut Runner) {
     let elf = match ElfFile::load("/bin/selftest.elf") {
         Ok(elf) => elf,
@@ -299,13 +420,86 @@ fn test_elf_loader(runner: &mut Runner) {
     runner.check("elf writable segment", true);
 
     let bss_start = writable.page_offset() + writable.file_size();
+    let index = bss_start / PAGING_PAGE_SIZE;
+    let page_start = index * PAGING_PAGE_SIZE;
     let bss_end = (writable.page_offset() + writable.memory_size())
-        .min(writable.memory().as_slice().len())
-        .min(bss_start + 64);
-    let bytes = writable.memory().as_slice();
+        .min(bss_start + 64)
+        .min(page_start + PAGING_PAGE_SIZE);
     runner.check("elf has bss", bss_end > bss_start);
     runner.check(
         "elf bss tail zeroed",
-        bss_end > bss_start && bytes[bss_start..bss_end].iter().all(|&byte| byte == 0),
+        bss_end > bss_start
+            && elf.segment_page(writable, index).is_ok_and(|page| {
+                page.as_slice()[bss_start - page_start..bss_end - page_start]
+                    .iter()
+                    .all(|&byte| byte == 0)
+            }),
+    );
+
+    let first = cache::load("/bin/selftest.elf");
+    let second = cache::load("/bin/selftest.elf");
+    runner.check(
+        "elf image cache hit",
+        matches!((&first, &second), (Ok(first), Ok(second)) if Arc::ptr_eq(first, second)),
+    );
+    runner.check(
+        "elf image cache missing file",
+        cache::load("/bin/selftest-missing.elf").is_err(),
+    );
+}
+
+fn test_timer_queue(runner: &mut Runner) {
+    let mut timers = TimerQueue::new();
+    timers.insert(30, 'c');
+    timers.insert(10, 'a');
+    timers.insert(20, 'b');
+    timers.insert(10, 'd');
+
+    runner.check("timer next deadline", timers.next_deadline() == Some(10));
+    runner.check("timer none expired", timers.pop_expired(9).is_none());
+    runner.check(
+        "timer expire first",
+        timers.pop_expired(20) == Some((10, 'a')),
+    );
+    runner.check(
+        "timer equal deadline fifo",
+        timers.pop_expired(20) == Some((10, 'd')),
+    );
+    runner.check(
+        "timer expire second",
+        timers.pop_expired(20) == Some((20, 'b')),
     );
+    runner.check(
+        "timer keeps future",
+        timers.pop_expired(20).is_none() && timers.len() == 1,
+    );
+}
+
+fn test_feedback_levels(runner: &mut Runner) {
+    runner.check("mlfq nice min is top level", nice_level(NICE_MIN) == 0);
+    runner.check(
+        "mlfq nice orders levels",
+        nice_level(-10) <= nice_level(0) && nice_level(0) <= nice_level(NICE_MAX),
+    );
+    runner.check(
+        "mlfq nice leaves room to demote",
+        nice_level(NICE_MAX) < SCHEDULER_LEVELS - 1,
+    );
+    runner.check(
+        "mlfq nice clamps",
+        nice_level(-100) == nice_level(NICE_MIN) && nice_level(100) == nice_level(NICE_MAX),
+    );
+    runner.check(
+        "mlfq quanta grow downwards",
+        (1..SCHEDULER_LEVELS).all(|level| level_quantum(level) >= level_quantum(level - 1)),
+    );
+}
+
+fn test_smp_cpu(runner: &mut Runner) {
+    let cpu = smp::cpu_id();
+    runner.check("smp cpu id in range", cpu < smp::cpu_count());
+    runner.check("smp calling cpu online", smp::is_online(cpu));
+
+    let task_cpu = KERNEL.with_task_manager(|tm| tm.get_current().map(|task| task.read().cpu));
+    runner.check("smp current task on calling cpu", task_cpu == Some(cpu));
 }
@@ -9,6 +9,7 @@ mod constant;
 mod device;
 mod entrypoint;
 mod error;
+mod fpu;
 mod fs;
 mod gdt;
 mod interrupts;
@@ -20,6 +21,7 @@ mod panic;
 mod print;
 mod schedule;
 mod serial;
+mod smp;
 mod tss;
 mod utils;
 
@@ -67,11 +69,14 @@ pub fn kernel_main() -> ! {
 
     interrupts_init();
 
-    GDT.init_gdt();
+    GDT.init_gdt(0);
+    fpu::init(0);
 
     KERNEL.kernel_page();
     enable_paging();
 
+    smp::init();
+
     boot_image();
 
     serial_print_memory();
@@ -58,19 +58,24 @@ pub fn print_memory() {
     serial_println!("{}", memory_usage());
 }
 
+/// Formats `size` with two decimals in the largest fitting unit. Integer
+/// math only: the kernel is built without the FPU.
 fn format_file_size(size: u64) -> String {
     const KB: u64 = 1024;
     const MB: u64 = 1024 * KB;
     const GB: u64 = 1024 * MB;
-    if size < KB {
-        format!("{size}B")
+    let (unit, suffix) = if size < KB {
+        return format!("{size}B");
     } else if size < MB {
-        format!("{:.2}KB", size as f64 / KB as f64)
+        (KB, "KB")
     } else if size < GB {
-        format!("{:.2}MB", size as f64 / MB as f64)
+        (MB, "MB")
     } else {
-        format!("{:.2}GB", size as f64 / GB as f64)
-    }
+        (GB, "GB")
+    };
+
+    let hundredths = (size * 100 + unit / 2) / unit;
+    format!("{}.{:02}{}", hundredths / 100, hundredths % 100, suffix)
 }
 
 fn memory_usage() -> String {
@@ -4,4 +4,4 @@ mod page_directory;
 
 pub use allocator::{init_heap, print_memory, serial_print_memory};
 pub use page::Page;
-pub use page_directory::{PageDirectory, enable_paging, flags::*};
+pub use page_directory::{PageDirectory, PageSource, PagingError, enable_paging, flags::*};
@@ -1,11 +1,15 @@
 use core::arch::asm;
 
+use alloc::{sync::Arc, vec::Vec};
+use spin::Mutex;
+
 use crate::{
     constant::{
         PAGING_PAGE_SIZE, PAGING_PAGE_SIZE_BIT, PAGING_PAGE_TABLE_SIZE, PAGING_PAGE_TABLE_SIZE_BIT,
     },
     interrupts::without_interrupts,
     memory::page::Page,
+    smp,
 };
 
 #[allow(dead_code)]
@@ -16,6 +20,7 @@ pub mod flags {
     pub const WRITE_THROUGH: u32 = 1 << 3;
     pub const CACHE_DISABLED: u32 = 1 << 4;
     pub const COW: u32 = 1 << 9; // Copy on write
+    pub const LAZY: u32 = 1 << 10; // Not present yet; the page source maps it on first use
 }
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
@@ -23,10 +28,17 @@ pub enum PagingError {
     InvalidArg,
 }
 
-#[derive(Debug)]
+/// Provides the pages of an address space that are mapped on first use.
+pub trait PageSource: Send + Sync {
+    /// Maps the page at `address`, which `directory` marks `LAZY`. Returns
+    /// false if the page cannot be provided.
+    fn fault_in(&self, directory: &PageDirectory, address: u32) -> bool;
+}
+
 pub struct PageDirectory {
     pub directory: Page<u32>,
     _entries: Page<u32>,
+    sources: Mutex<Vec<Arc<dyn PageSource>>>,
 }
 
 unsafe impl Send for PageDirectory {}
@@ -54,6 +66,7 @@ impl PageDirectory {
         Some(Self {
             _entries: entries,
             directory,
+            sources: Mutex::new(Vec::new()),
         })
     }
 
@@ -95,10 +108,14 @@ impl PageDirectory {
                 (parent_directory_raw[i] & 0xFFFFF000) | Self::highest_flags(parent_entry);
             directory_raw[i] = (child_entry.as_ptr() as u32) | Self::highest_flags(child_entry);
         }
+        // Threads of the parent on other CPUs may still write through
+        // their old writable entries.
+        self.shoot_down();
 
         Some(Self {
             _entries: new_entries,
             directory: new_directory,
+            sources: Mutex::new(Vec::new()),
         })
     }
 
@@ -112,6 +129,7 @@ impl PageDirectory {
         );
 
         without_interrupts(|| unsafe {
+            smp::loading_space(directory);
             asm!(
                 "mov cr3, eax",
                 in("eax") directory,
@@ -120,6 +138,13 @@ impl PageDirectory {
         });
     }
 
+    /// Flushes the TLB entries other CPUs hold of this address space, after
+    /// its entries lost permissions, changed frames or were removed. Frames
+    /// taken out of it may only be freed after this.
+    pub fn shoot_down(&self) {
+        smp::shoot_down(self.directory.as_ptr() as u32);
+    }
+
     fn is_aligned(address: u32) -> bool {
         address & (PAGING_PAGE_SIZE as u32 - 1) == 0
     }
@@ -237,6 +262,27 @@ impl PageDirectory {
         Ok(table[table_index as usize])
     }
 
+    /// Adds a provider of `LAZY` pages of this address space; each one is
+    /// asked in turn until one maps the page.
+    pub fn add_source(&self, source: Arc<dyn PageSource>) {
+        self.sources.lock().push(source);
+    }
+
+    /// Maps the page holding `address` if it is a `LAZY` one. Returns whether
+    /// it is mapped now.
+    pub fn fault_in(&self, address: u32) -> bool {
+        let page = Self::align_address_down(address);
+        let Ok(entry) = self.get(page) else {
+            return false;
+        };
+        if entry & flags::PRESENT != 0 || entry & flags::LAZY == 0 {
+            return false;
+        }
+
+        let sources = self.sources.lock().clone();
+        sources.iter().any(|source| source.fault_in(self, page))
+    }
+
     pub fn get_physical_address(&self, virtual_address: u32) -> Result<u32, PagingError> {
         let virt_addr_new = Self::align_address_down(virtual_address);
         let difference = virtual_address - virt_addr_new;
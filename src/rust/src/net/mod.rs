@@ -11,6 +11,14 @@ use alloc::{collections::VecDeque, string::String, string::ToString, vec::Vec};
 use lazy_static::lazy_static;
 use spin::Mutex;
 
+use crate::{
+    kernel::KERNEL,
+    schedule::{
+        task::{WaitReason, WaitTimeout},
+        wait_queue::{Resume, WaitQueue},
+    },
+};
+
 use self::packet::{ETHERTYPE_ARP, ETHERTYPE_IPV4, IP_PROTOCOL_ICMP, ethertype, ipv4_packet};
 
 pub type DeviceId = usize;
@@ -102,6 +110,7 @@ struct NetworkSocket {
     peer_ip: Option<[u8; 4]>,
     peer_port: u16,
     recv_queue: VecDeque<SocketPacket>,
+    recv_waiters: WaitQueue,
 }
 
 pub struct SocketPacket {
@@ -299,6 +308,7 @@ pub fn socket_open(domain: u32, socket_type: u32, protocol: u32) -> Result<u32,
         peer_ip: None,
         peer_port: 0,
         recv_queue: VecDeque::new(),
+        recv_waiters: WaitQueue::new(),
     });
     Ok(id)
 }
@@ -313,7 +323,10 @@ pub fn socket_close(socket_id: u32) -> Result<(), NetworkError> {
         return Err(NetworkError::BadSocket);
     };
 
-    stack.sockets.remove(index);
+    let mut socket = stack.sockets.remove(index);
+    drop(stack);
+    // Their receive calls restart and fail on the closed socket.
+    KERNEL.with_task_manager(|tm| socket.recv_waiters.wake_all(tm, |_| Resume::Restart));
     Ok(())
 }
 
@@ -407,6 +420,36 @@ pub fn socket_recv_from(socket_id: u32, max_len: usize) -> Result<SocketPacket,
     Ok(packet)
 }
 
+/// Parks the current task until a packet arrives on the socket or the socket
+/// is closed; the receive call then runs again. Returns false without parking
+/// if a packet is already queued.
+pub fn socket_park_receiver(
+    socket_id: u32,
+    timeout: Option<WaitTimeout>,
+    interrupted: u32,
+) -> Result<bool, NetworkError> {
+    let mut stack = STACK.lock();
+    let socket = stack
+        .sockets
+        .iter_mut()
+        .find(|socket| socket.id == socket_id)
+        .ok_or(NetworkError::BadSocket)?;
+
+    if !socket.recv_queue.is_empty() {
+        return Ok(false);
+    }
+
+    let reason = WaitReason::Socket(socket_id as usize);
+    KERNEL
+        .with_task_manager(|tm| {
+            socket
+                .recv_waiters
+                .park(tm, reason, (), timeout, interrupted)
+        })
+        .map_err(|_| NetworkError::BadSocket)?;
+    Ok(true)
+}
+
 pub fn socket_local_addr(socket_id: u32) -> Result<([u8; 4], u16), NetworkError> {
     let stack = STACK.lock();
     let socket = stack
@@ -1037,6 +1080,7 @@ fn socket_packet_from_ipv4(frame: &[u8], src_ip: [u8; 4], src_port: u16) -> Opti
     })
 }
 
+/// Queues `packet` and wakes one receiver; each packet satisfies one call.
 fn enqueue_socket_packet(stack: &mut NetworkStack, socket_id: u32, packet: SocketPacket) {
     let Some(socket) = stack
         .sockets
@@ -1051,6 +1095,7 @@ fn enqueue_socket_packet(stack: &mut NetworkStack, socket_id: u32, packet: Socke
     }
 
     socket.recv_queue.push_back(packet);
+    KERNEL.with_task_manager(|tm| socket.recv_waiters.wake_one(tm, |_| Resume::Restart));
 }
 
 fn print_ping_start(request: &PingRequest) {
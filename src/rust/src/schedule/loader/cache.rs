@@ -0,0 +1,109 @@
+use alloc::{collections::BTreeMap, string::String, sync::Arc};
+use spin::Mutex;
+
+use crate::kernel::KERNEL;
+
+use super::elf::{ElfError, ElfFile};
+
+/// Images kept at most; the least recently used is dropped first. Processes
+/// still running a dropped image keep their own reference to it.
+const MAX_CACHED_IMAGES: usize = 16;
+
+struct CachedImage {
+    size: u64,
+    modified: u32,
+    last_use: u64,
+    image: Arc<ElfFile>,
+}
+
+/// Parsed executables by path, so a program started again maps the segments
+/// loaded the first time instead of reading and copying the file again.
+struct ImageCache {
+    images: BTreeMap<String, CachedImage>,
+    clock: u64,
+}
+
+static IMAGES: Mutex<ImageCache> = Mutex::new(ImageCache {
+    images: BTreeMap::new(),
+    clock: 0,
+});
+
+/// Processes mapping each image, by lowercase path. Pages are read from the
+/// file as they are first used, so the file must not change meanwhile.
+static MAPPED: Mutex<BTreeMap<String, usize>> = Mutex::new(BTreeMap::new());
+
+/// Whether a running process maps the file at `path`; writing, truncating
+/// or removing it fails with `ETXTBSY` until they are gone.
+pub fn is_mapped(path: &str) -> bool {
+    MAPPED.lock().contains_key(&path.to_lowercase())
+}
+
+pub(super) fn map(image: &ElfFile) {
+    *MAPPED
+        .lock()
+        .entry(image.path().to_lowercase())
+        .or_insert(0) += 1;
+}
+
+pub(super) fn unmap(image: &ElfFile) {
+    let mut mapped = MAPPED.lock();
+    let path = image.path().to_lowercase();
+    if let Some(count) = mapped.get_mut(&path) {
+        *count -= 1;
+        if *count == 0 {
+            mapped.remove(&path);
+        }
+    }
+}
+
+impl ImageCache {
+    fn lookup(&mut self, path: &str, size: u64, modified: u32) -> Option<Arc<ElfFile>> {
+        self.clock += 1;
+        let clock = self.clock;
+        let cached = self.images.get_mut(path)?;
+        if cached.size != size || cached.modified != modified {
+            return None;
+        }
+        cached.last_use = clock;
+        Some(cached.image.clone())
+    }
+
+    fn insert(&mut self, path: &str, size: u64, modified: u32, image: Arc<ElfFile>) {
+        if !self.images.contains_key(path) && self.images.len() >= MAX_CACHED_IMAGES {
+            let oldest = self
+                .images
+                .iter()
+                .min_by_key(|(_, cached)| cached.last_use)
+                .map(|(path, _)| path.clone());
+            if let Some(oldest) = oldest {
+                self.images.remove(&oldest);
+            }
+        }
+
+        self.clock += 1;
+        self.images.insert(
+            String::from(path),
+            CachedImage {
+                size,
+                modified,
+                last_use: self.clock,
+                image,
+            },
+        );
+    }
+}
+
+/// Image of the executable at `path`, loaded from the file only if it is not
+/// cached or changed since: a different size or change stamp.
+pub fn load(path: &str) -> Result<Arc<ElfFile>, ElfError> {
+    let metadata = KERNEL.vfs.read().stat(path).map_err(|_| ElfError::Io)?;
+    if let Some(image) = IMAGES.lock().lookup(path, metadata.size, metadata.modified) {
+        return Ok(image);
+    }
+
+    let image = Arc::new(ElfFile::load(path)?);
+    IMAGES
+        .lock()
+        .insert(path, metadata.size, metadata.modified, image.clone());
+    Ok(image)
+}
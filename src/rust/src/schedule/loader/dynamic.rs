@@ -0,0 +1,447 @@
+use alloc::{
+    collections::BTreeMap,
+    format,
+    string::{String, ToString},
+    sync::Arc,
+    vec::Vec,
+};
+
+use crate::{
+    constant::{
+        PAGING_PAGE_SIZE, PROGRAM_VIRTUAL_ADDRESS, USER_LIBRARY_ADDRESS_END,
+        USER_LIBRARY_ADDRESS_START,
+    },
+    fs::FileHandle,
+    memory::{self, PageDirectory},
+};
+
+use super::{
+    cache,
+    elf::{Elf32Phdr, ElfError, ElfFile, PT_LOAD, as_bytes_mut, read_at},
+    pager::MappedImage,
+};
+
+const DT_NULL: u32 = 0;
+const DT_NEEDED: u32 = 1;
+const DT_PLTRELSZ: u32 = 2;
+const DT_HASH: u32 = 4;
+const DT_STRTAB: u32 = 5;
+const DT_SYMTAB: u32 = 6;
+const DT_RELA: u32 = 7;
+const DT_STRSZ: u32 = 10;
+const DT_REL: u32 = 17;
+const DT_RELSZ: u32 = 18;
+const DT_PLTREL: u32 = 20;
+const DT_TEXTREL: u32 = 22;
+const DT_JMPREL: u32 = 23;
+const DT_FLAGS: u32 = 30;
+const DF_TEXTREL: u32 = 0x4;
+
+const R_386_NONE: u8 = 0;
+const R_386_32: u8 = 1;
+const R_386_PC32: u8 = 2;
+const R_386_COPY: u8 = 5;
+const R_386_GLOB_DAT: u8 = 6;
+const R_386_JMP_SLOT: u8 = 7;
+const R_386_RELATIVE: u8 = 8;
+
+const STB_LOCAL: u8 = 0;
+const STB_WEAK: u8 = 2;
+const SHN_UNDEF: u16 = 0;
+const STN_UNDEF: usize = 0;
+
+/// Libraries a program may pull in, its own dependencies included.
+const MAX_LIBRARIES: usize = 8;
+/// Where `DT_NEEDED` names without a slash are looked up.
+const LIBRARY_DIRECTORY: &str = "/lib";
+
+#[repr(C, packed)]
+#[derive(Clone, Copy, Default)]
+struct Elf32Dyn {
+    d_tag: u32,
+    d_val: u32,
+}
+
+#[repr(C, packed)]
+#[derive(Clone, Copy, Default)]
+struct Elf32Sym {
+    st_name: u32,
+    st_value: u32,
+    st_size: u32,
+    st_info: u8,
+    st_other: u8,
+    st_shndx: u16,
+}
+
+#[repr(C, packed)]
+#[derive(Clone, Copy, Default)]
+struct Elf32Rel {
+    r_offset: u32,
+    r_info: u32,
+}
+
+struct DynamicSymbol {
+    name: String,
+    value: u32,
+    size: u32,
+    binding: u8,
+    defined: bool,
+}
+
+/// Dynamic linking tables of an image, read once when it is loaded so that
+/// starting the program again only applies the relocations.
+pub struct DynamicInfo {
+    needed: Vec<String>,
+    symbols: Vec<DynamicSymbol>,
+    /// Global and weak symbols the image defines, by name.
+    exports: BTreeMap<String, usize>,
+    /// `DT_REL` then `DT_JMPREL` entries; PLT slots are bound up front.
+    relocations: Vec<Elf32Rel>,
+}
+
+impl DynamicInfo {
+    pub(super) fn parse(
+        file: &mut FileHandle,
+        phdrs: &[Elf32Phdr],
+        dynamic: &Elf32Phdr,
+    ) -> Result<Self, ElfError> {
+        let mut entries = vec![Elf32Dyn::default(); dynamic.p_filesz as usize / 8];
+        read_at(file, dynamic.p_offset as usize, as_bytes_mut(&mut entries))?;
+
+        let mut tags = BTreeMap::new();
+        let mut needed_offsets = Vec::new();
+        for entry in entries.iter() {
+            match entry.d_tag {
+                DT_NULL => break,
+                DT_NEEDED => needed_offsets.push(entry.d_val),
+                // Shared text must stay as it is in the file.
+                DT_TEXTREL => return Err(ElfError::InvalidFormat),
+                DT_FLAGS if entry.d_val & DF_TEXTREL != 0 => return Err(ElfError::InvalidFormat),
+                DT_RELA => return Err(ElfError::InvalidFormat),
+                tag => {
+                    tags.insert(tag, entry.d_val);
+                }
+            }
+        }
+        let tag = |tag: u32| tags.get(&tag).copied();
+
+        let (Some(strtab), Some(strsz), Some(symtab), Some(hash)) =
+            (tag(DT_STRTAB), tag(DT_STRSZ), tag(DT_SYMTAB), tag(DT_HASH))
+        else {
+            return Err(ElfError::InvalidFormat);
+        };
+        if tag(DT_JMPREL).is_some() && tag(DT_PLTREL) != Some(DT_REL) {
+            return Err(ElfError::InvalidFormat);
+        }
+
+        let strings: Vec<u8> = read_table(file, phdrs, strtab, strsz as usize)?;
+        // The chain count of the hash table is the symbol count.
+        let hash_header: Vec<u32> = read_table(file, phdrs, hash, 2)?;
+        let raw_symbols: Vec<Elf32Sym> = read_table(file, phdrs, symtab, hash_header[1] as usize)?;
+
+        let mut symbols = Vec::with_capacity(raw_symbols.len());
+        let mut exports = BTreeMap::new();
+        for (index, raw) in raw_symbols.iter().enumerate() {
+            let symbol = DynamicSymbol {
+                name: string_at(&strings, raw.st_name)?,
+                value: raw.st_value,
+                size: raw.st_size,
+                binding: raw.st_info >> 4,
+                defined: raw.st_shndx != SHN_UNDEF,
+            };
+            if symbol.defined && symbol.binding != STB_LOCAL && !symbol.name.is_empty() {
+                exports.insert(symbol.name.clone(), index);
+            }
+            symbols.push(symbol);
+        }
+
+        let mut relocations = Vec::new();
+        for (table, size) in [(DT_REL, DT_RELSZ), (DT_JMPREL, DT_PLTRELSZ)] {
+            if let (Some(address), Some(size)) = (tag(table), tag(size)) {
+                relocations.extend(read_table::<Elf32Rel>(
+                    file,
+                    phdrs,
+                    address,
+                    size as usize / core::mem::size_of::<Elf32Rel>(),
+                )?);
+            }
+        }
+
+        let needed = needed_offsets
+            .into_iter()
+            .map(|offset| string_at(&strings, offset))
+            .collect::<Result<_, _>>()?;
+
+        Ok(Self {
+            needed,
+            symbols,
+            exports,
+            relocations,
+        })
+    }
+
+    /// Libraries the image was linked against, as `DT_NEEDED` names them.
+    pub fn needed(&self) -> &[String] {
+        &self.needed
+    }
+
+    fn export(&self, name: &str) -> Option<&DynamicSymbol> {
+        self.exports.get(name).map(|&index| &self.symbols[index])
+    }
+}
+
+/// `count` entries at `address` of the image, read from the segment that
+/// holds them in the file.
+fn read_table<T: Copy + Default>(
+    file: &mut FileHandle,
+    phdrs: &[Elf32Phdr],
+    address: u32,
+    count: usize,
+) -> Result<Vec<T>, ElfError> {
+    let size = count
+        .checked_mul(core::mem::size_of::<T>())
+        .and_then(|size| u32::try_from(size).ok())
+        .ok_or(ElfError::InvalidFormat)?;
+    let phdr = phdrs
+        .iter()
+        .find(|phdr| {
+            phdr.p_type == PT_LOAD as u32
+                && address >= phdr.p_vaddr
+                && address - phdr.p_vaddr <= phdr.p_filesz
+                && size <= phdr.p_filesz - (address - phdr.p_vaddr)
+        })
+        .ok_or(ElfError::InvalidFormat)?;
+
+    let mut table = vec![T::default(); count];
+    read_at(
+        file,
+        (phdr.p_offset + (address - phdr.p_vaddr)) as usize,
+        as_bytes_mut(&mut table),
+    )?;
+    Ok(table)
+}
+
+fn string_at(strings: &[u8], offset: u32) -> Result<String, ElfError> {
+    let bytes = strings
+        .get(offset as usize..)
+        .ok_or(ElfError::InvalidFormat)?;
+    let len = bytes
+        .iter()
+        .position(|&byte| byte == 0)
+        .ok_or(ElfError::InvalidFormat)?;
+    core::str::from_utf8(&bytes[..len])
+        .map(ToString::to_string)
+        .map_err(|_| ElfError::InvalidFormat)
+}
+
+fn library_path(name: &str) -> String {
+    if name.contains('/') {
+        name.to_string()
+    } else {
+        format!("{}/{}", LIBRARY_DIRECTORY, name)
+    }
+}
+
+/// `image` and every library it needs, directly or not, each with the
+/// address it is loaded at. The program comes first; libraries follow in
+/// breadth-first order from `USER_LIBRARY_ADDRESS_START`, shared through the
+/// image cache with every other process using them.
+pub fn load_objects(image: Arc<ElfFile>) -> Result<Vec<MappedImage>, ElfError> {
+    let base = if image.is_relocatable() {
+        PROGRAM_VIRTUAL_ADDRESS as u32
+    } else {
+        0
+    };
+    let mut objects = vec![MappedImage { image, base }];
+    let mut loaded: Vec<String> = Vec::new();
+    let mut next_base = USER_LIBRARY_ADDRESS_START as u32;
+
+    let mut index = 0;
+    while index < objects.len() {
+        let needed = objects[index]
+            .image
+            .dynamic()
+            .map(|info| info.needed().to_vec())
+            .unwrap_or_default();
+        for name in needed {
+            if loaded.contains(&name) {
+                continue;
+            }
+            if loaded.len() == MAX_LIBRARIES {
+                return Err(ElfError::InvalidFormat);
+            }
+
+            let library = cache::load(&library_path(&name))?;
+            let end = next_base.saturating_add(library.extent());
+            if !library.is_relocatable() || end > USER_LIBRARY_ADDRESS_END as u32 {
+                return Err(ElfError::InvalidFormat);
+            }
+            objects.push(MappedImage {
+                image: library,
+                base: next_base,
+            });
+            next_base = end;
+            loaded.push(name);
+        }
+        index += 1;
+    }
+
+    Ok(objects)
+}
+
+/// Applies the relocations of `objects`, which `directory` maps. Libraries
+/// go first, last loaded first, so the program's copy relocations take
+/// data that is already relocated.
+pub fn link(directory: &PageDirectory, objects: &[MappedImage]) -> Result<(), ElfError> {
+    for index in (0..objects.len()).rev() {
+        relocate(directory, objects, index)?;
+    }
+    Ok(())
+}
+
+fn relocate(
+    directory: &PageDirectory,
+    objects: &[MappedImage],
+    index: usize,
+) -> Result<(), ElfError> {
+    let object = &objects[index];
+    let Some(info) = object.image.dynamic() else {
+        return Ok(());
+    };
+
+    for relocation in info.relocations.iter() {
+        let kind = relocation.r_info as u8;
+        let symbol = (relocation.r_info >> 8) as usize;
+        let place = object.base.wrapping_add(relocation.r_offset);
+
+        let value = match kind {
+            R_386_NONE => continue,
+            R_386_RELATIVE => object.base.wrapping_add(read_word(directory, place)?),
+            R_386_32 => {
+                let (address, _) = resolve(objects, index, symbol, false)?;
+                address.wrapping_add(read_word(directory, place)?)
+            }
+            R_386_PC32 => {
+                let (address, _) = resolve(objects, index, symbol, false)?;
+                address
+                    .wrapping_add(read_word(directory, place)?)
+                    .wrapping_sub(place)
+            }
+            R_386_GLOB_DAT | R_386_JMP_SLOT => resolve(objects, index, symbol, false)?.0,
+            R_386_COPY => {
+                let (address, size) = resolve(objects, index, symbol, true)?;
+                copy_within(directory, address, place, size)?;
+                continue;
+            }
+            _ => return Err(ElfError::InvalidFormat),
+        };
+        write_word(directory, place, value)?;
+    }
+    Ok(())
+}
+
+/// Address and size of symbol `symbol` of object `index`: its own
+/// definition if it is local, else the first one in load order. A copy
+/// relocation skips the object itself to find the library's original.
+/// Symbol `STN_UNDEF` stands for address 0.
+fn resolve(
+    objects: &[MappedImage],
+    index: usize,
+    symbol: usize,
+    skip_self: bool,
+) -> Result<(u32, u32), ElfError> {
+    if symbol == STN_UNDEF {
+        return Ok((0, 0));
+    }
+
+    let object = &objects[index];
+    let symbols = &object
+        .image
+        .dynamic()
+        .ok_or(ElfError::InvalidFormat)?
+        .symbols;
+    let wanted = symbols.get(symbol).ok_or(ElfError::InvalidFormat)?;
+    if wanted.binding == STB_LOCAL && wanted.defined {
+        return Ok((object.base.wrapping_add(wanted.value), wanted.size));
+    }
+
+    for (candidate_index, candidate) in objects.iter().enumerate() {
+        if skip_self && candidate_index == index {
+            continue;
+        }
+        let definition = candidate
+            .image
+            .dynamic()
+            .and_then(|info| info.export(&wanted.name));
+        if let Some(definition) = definition {
+            return Ok((
+                candidate.base.wrapping_add(definition.value),
+                definition.size,
+            ));
+        }
+    }
+
+    if wanted.binding == STB_WEAK {
+        Ok((0, 0))
+    } else {
+        serial_println!("dynamic link: undefined symbol {}", wanted.name);
+        Err(ElfError::UndefinedSymbol)
+    }
+}
+
+/// Kernel address of `address` in the address space of `directory`, whose
+/// page is faulted in first. Relocations only write private pages, never
+/// the ones shared through the image.
+fn kernel_address(directory: &PageDirectory, address: u32, write: bool) -> Result<u32, ElfError> {
+    let page = PageDirectory::align_address_down(address);
+    let mut entry = directory.get(page).map_err(|_| ElfError::InvalidFormat)?;
+    if entry & memory::PRESENT == 0 {
+        if !directory.fault_in(page) {
+            return Err(ElfError::InvalidFormat);
+        }
+        entry = directory.get(page).map_err(|_| ElfError::InvalidFormat)?;
+    }
+
+    if entry & memory::PRESENT == 0
+        || entry & memory::USER_ACCESS == 0
+        || (write && entry & memory::WRITABLE == 0)
+    {
+        return Err(ElfError::InvalidFormat);
+    }
+    Ok((entry & 0xFFFFF000) | (address - page))
+}
+
+fn read_word(directory: &PageDirectory, address: u32) -> Result<u32, ElfError> {
+    if address % 4 != 0 {
+        return Err(ElfError::InvalidFormat);
+    }
+    let pointer = kernel_address(directory, address, false)? as *const u32;
+    Ok(unsafe { pointer.read() })
+}
+
+fn write_word(directory: &PageDirectory, address: u32, value: u32) -> Result<(), ElfError> {
+    if address % 4 != 0 {
+        return Err(ElfError::InvalidFormat);
+    }
+    let pointer = kernel_address(directory, address, true)? as *mut u32;
+    unsafe { pointer.write(value) };
+    Ok(())
+}
+
+/// Copies `size` bytes from `from` to `to`, both in the address space of
+/// `directory`.
+fn copy_within(directory: &PageDirectory, from: u32, to: u32, size: u32) -> Result<(), ElfError> {
+    let mut done = 0;
+    while done < size {
+        let source = from + done;
+        let target = to + done;
+        let page_left = |address: u32| PAGING_PAGE_SIZE as u32 - (address & 0xFFF);
+        let chunk = (size - done).min(page_left(source)).min(page_left(target));
+
+        let source = kernel_address(directory, source, false)? as *const u8;
+        let target = kernel_address(directory, target, true)? as *mut u8;
+        unsafe { core::ptr::copy_nonoverlapping(source, target, chunk as usize) };
+        done += chunk;
+    }
+    Ok(())
+}
@@ -1,7 +1,15 @@
 #![allow(dead_code)]
-use alloc::vec::Vec;
+use alloc::{collections::BTreeMap, string::String, vec::Vec};
+use spin::Mutex;
 
-use crate::{constant::PROGRAM_VIRTUAL_ADDRESS, kernel::KERNEL, memory::Page};
+use crate::{
+    constant::{PAGING_PAGE_SIZE, PROGRAM_VIRTUAL_ADDRESS},
+    fs::FileHandle,
+    kernel::KERNEL,
+    memory::Page,
+};
+
+use super::dynamic::DynamicInfo;
 
 pub const PF_X: u32 = 0x1;
 pub const PF_W: u32 = 0x2;
@@ -50,19 +58,21 @@ pub const SHN_UNDEF: u8 = 0x0;
 pub enum ElfError {
     Io,
     InvalidFormat,
+    /// A symbol no loaded object defines.
+    UndefinedSymbol,
     Unknown,
 }
 
 const ELF_SIGNATURE: [u8; 4] = [0x7F, b'E', b'L', b'F'];
 
 #[repr(C, packed)]
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Clone, Copy, Default)]
 pub struct Elf32Phdr {
-    p_type: u32,
-    p_offset: u32,
+    pub p_type: u32,
+    pub p_offset: u32,
     pub p_vaddr: u32,
     pub p_paddr: u32,
-    p_filesz: u32,
+    pub p_filesz: u32,
     pub p_memsz: u32,
     pub p_flags: u32,
     p_align: u32,
@@ -84,7 +94,7 @@ struct Elf32Shdr {
 }
 
 #[repr(C, packed)]
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Clone, Copy, Default)]
 pub struct ElfHeader {
     e_ident: [u8; 16],
     e_type: u16,
@@ -107,8 +117,9 @@ impl ElfHeader {
         self.e_ident[0..4] == ELF_SIGNATURE
             && matches!(self.e_ident[4], 0 | 1)
             && matches!(self.e_ident[5], 0 | 1)
-            && self.e_type == 2
-            && self.e_entry >= PROGRAM_VIRTUAL_ADDRESS as u32
+            && (self.e_type == ET_DYN as u16
+                || (self.e_type == ET_EXEC as u16
+                    && self.e_entry >= PROGRAM_VIRTUAL_ADDRESS as u32))
             && self.e_phoff != 0
     }
 
@@ -134,14 +145,16 @@ impl ElfHeader {
     }
 }
 
-#[derive(Debug, Clone)]
+/// `PT_LOAD` segment. Its pages are read from the file the first time one
+/// is asked for and kept, so later processes share them.
 pub struct ElfSegment {
     virtual_address: u32,
     flags: u32,
     page_offset: usize,
+    file_offset: usize,
     file_size: usize,
     memory_size: usize,
-    memory: Page<u8>,
+    pages: Mutex<BTreeMap<usize, Page<u8>>>,
 }
 
 impl ElfSegment {
@@ -165,15 +178,42 @@ impl ElfSegment {
         self.memory_size
     }
 
-    pub fn memory(&self) -> &Page<u8> {
-        &self.memory
+    /// Pages the segment spans from `virtual_address`.
+    pub fn page_count(&self) -> usize {
+        (self.page_offset + self.memory_size).div_ceil(PAGING_PAGE_SIZE)
+    }
+
+    pub fn contains(&self, address: u32) -> bool {
+        address >= self.virtual_address
+            && ((address - self.virtual_address) as usize) < self.page_count() * PAGING_PAGE_SIZE
+    }
+
+    /// Bytes of page `index` that come from the file, as a range of offsets
+    /// into the segment's pages; empty for a page of `.bss` only.
+    fn file_range(&self, index: usize) -> core::ops::Range<usize> {
+        let start = index * PAGING_PAGE_SIZE;
+        let from = start.max(self.page_offset);
+        let to = (start + PAGING_PAGE_SIZE).min(self.page_offset + self.file_size);
+        from..to.max(from)
+    }
+
+    /// Whether page `index` is all `.bss`, which needs no read.
+    pub fn is_zero_page(&self, index: usize) -> bool {
+        self.file_range(index).is_empty()
     }
 }
 
-#[derive(Debug, Clone)]
+/// Program or shared library image. Only the headers and dynamic linking
+/// tables are read up front; segment pages come from the file as they are
+/// first used.
 pub struct ElfFile {
-    memory: Page<u8>,
+    entry: u32,
+    /// `ET_DYN`: addresses are relative to wherever the image is loaded.
+    relocatable: bool,
     segments: Vec<ElfSegment>,
+    dynamic: Option<DynamicInfo>,
+    file: Mutex<FileHandle>,
+    path: String,
 }
 
 unsafe impl Send for ElfFile {}
@@ -181,69 +221,141 @@ unsafe impl Sync for ElfFile {}
 
 impl ElfFile {
     pub fn load(filename: &str) -> Result<Self, ElfError> {
-        let mut file = KERNEL.vfs.read().open(filename).map_err(|_| ElfError::Io)?;
-        let stat = file.ops.stat().map_err(|_| ElfError::Io)?;
+        let file = KERNEL.vfs.read().open(filename).map_err(|_| ElfError::Io)?;
+        let mut file = Mutex::new(file);
 
-        let memory = Page::new(stat.size as usize).ok_or(ElfError::Io)?;
+        let mut header = [ElfHeader::default()];
+        read_at(file.get_mut(), 0, as_bytes_mut(&mut header))?;
+        let header = header[0];
+        header.validate()?;
 
-        file.ops
-            .read(memory.as_mut_slice())
-            .map_err(|_| ElfError::Io)?;
+        let mut phdrs = vec![Elf32Phdr::default(); header.e_phnum as usize];
+        read_at(
+            file.get_mut(),
+            header.e_phoff as usize,
+            as_bytes_mut(&mut phdrs),
+        )?;
 
-        let header = unsafe { &*(memory.as_ptr() as *const ElfHeader) };
-        header.validate()?;
+        let mut segments = Vec::new();
+        for phdr in phdrs.iter().filter(|phdr| phdr.p_type == PT_LOAD as u32) {
+            segments.push(Self::load_segment(phdr)?);
+        }
 
-        let mut elf = Self {
-            memory,
-            segments: Vec::new(),
+        let dynamic = match phdrs.iter().find(|phdr| phdr.p_type == PT_DYNAMIC as u32) {
+            Some(phdr) => Some(DynamicInfo::parse(file.get_mut(), &phdrs, phdr)?),
+            None => None,
         };
 
-        elf.load_segments(header)?;
-        Ok(elf)
+        Ok(Self {
+            entry: header.e_entry,
+            relocatable: header.e_type == ET_DYN as u16,
+            segments,
+            dynamic,
+            file,
+            path: String::from(filename),
+        })
     }
 
-    fn load_segments(&mut self, header: &ElfHeader) -> Result<(), ElfError> {
-        for phdr in header.program_headers() {
-            if phdr.p_type == 1 {
-                self.process_load_segment(phdr);
-            }
+    fn load_segment(phdr: &Elf32Phdr) -> Result<ElfSegment, ElfError> {
+        if phdr.p_filesz > phdr.p_memsz {
+            return Err(ElfError::InvalidFormat);
         }
-        Ok(())
-    }
 
-    fn process_load_segment(&mut self, phdr: &Elf32Phdr) {
         let virtual_address = phdr.p_vaddr & 0xFFFFF000;
-        let page_offset = (phdr.p_vaddr - virtual_address) as usize;
-        let size = page_offset + phdr.p_memsz as usize;
-        let Some(segment_memory) = Page::<u8>::new(size) else {
-            return;
-        };
-
-        let source = unsafe {
-            core::slice::from_raw_parts(
-                self.memory.as_ptr().add(phdr.p_offset as usize),
-                phdr.p_filesz as usize,
-            )
-        };
-        let destination =
-            &mut segment_memory.as_mut_slice()[page_offset..page_offset + phdr.p_filesz as usize];
-        destination.copy_from_slice(source);
-
-        self.segments.push(ElfSegment {
+        Ok(ElfSegment {
             virtual_address,
             flags: phdr.p_flags,
-            page_offset,
+            page_offset: (phdr.p_vaddr - virtual_address) as usize,
+            file_offset: phdr.p_offset as usize,
             file_size: phdr.p_filesz as usize,
             memory_size: phdr.p_memsz as usize,
-            memory: segment_memory,
-        });
+            pages: Mutex::new(BTreeMap::new()),
+        })
+    }
+
+    /// Path the image was loaded from.
+    pub fn path(&self) -> &str {
+        &self.path
     }
 
-    pub fn header(&self) -> &ElfHeader {
-        unsafe { &*(self.memory.as_ptr() as *const ElfHeader) }
+    pub fn entry(&self) -> u32 {
+        self.entry
+    }
+
+    pub fn is_relocatable(&self) -> bool {
+        self.relocatable
     }
 
     pub fn segments(&self) -> &[ElfSegment] {
         &self.segments
     }
+
+    /// Symbols, relocations and needed libraries; `None` for a static
+    /// program.
+    pub fn dynamic(&self) -> Option<&DynamicInfo> {
+        self.dynamic.as_ref()
+    }
+
+    /// End of the highest segment, page aligned: the address space the
+    /// image takes from where it is loaded.
+    pub fn extent(&self) -> u32 {
+        self.segments
+            .iter()
+            .map(|segment| {
+                segment.virtual_address + (segment.page_count() * PAGING_PAGE_SIZE) as u32
+            })
+            .max()
+            .unwrap_or(0)
+    }
+
+    /// Page `index` of `segment`, one of this image's: file bytes where the
+    /// segment has them, zeros after. Read on the first call only.
+    pub fn segment_page(&self, segment: &ElfSegment, index: usize) -> Result<Page<u8>, ElfError> {
+        let mut pages = segment.pages.lock();
+        if let Some(page) = pages.get(&index) {
+            return Ok(page.clone());
+        }
+
+        let page = Page::<u8>::new(PAGING_PAGE_SIZE).ok_or(ElfError::Unknown)?;
+        let range = segment.file_range(index);
+        if !range.is_empty() {
+            let start = index * PAGING_PAGE_SIZE;
+            let offset = segment.file_offset + (range.start - segment.page_offset);
+            read_at(
+                &mut self.file.lock(),
+                offset,
+                &mut page.as_mut_slice()[range.start - start..range.end - start],
+            )?;
+        }
+
+        pages.insert(index, page.clone());
+        Ok(page)
+    }
+}
+
+/// Raw bytes of packed header structs, to read them from the file.
+pub(super) fn as_bytes_mut<T: Copy>(values: &mut [T]) -> &mut [u8] {
+    unsafe {
+        core::slice::from_raw_parts_mut(
+            values.as_mut_ptr() as *mut u8,
+            core::mem::size_of_val(values),
+        )
+    }
+}
+
+/// Fills `buf` from `file` at `offset`.
+pub(super) fn read_at(
+    file: &mut FileHandle,
+    offset: usize,
+    buf: &mut [u8],
+) -> Result<(), ElfError> {
+    file.ops.seek(offset).map_err(|_| ElfError::Io)?;
+    let mut filled = 0;
+    while filled < buf.len() {
+        match file.ops.read(&mut buf[filled..]) {
+            Ok(0) | Err(_) => return Err(ElfError::Io),
+            Ok(read) => filled += read,
+        }
+    }
+    Ok(())
 }
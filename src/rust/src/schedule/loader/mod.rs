@@ -1 +1,4 @@
+pub mod cache;
+pub mod dynamic;
 pub mod elf;
+pub mod pager;
@@ -0,0 +1,150 @@
+use alloc::{collections::btree_map::BTreeMap, sync::Arc, vec::Vec};
+use spin::Mutex;
+
+use crate::{
+    constant::PAGING_PAGE_SIZE,
+    memory::{self, Page, PageDirectory, PageSource, PagingError},
+};
+
+use super::{
+    cache,
+    elf::{ElfFile, PF_W},
+};
+
+/// Image mapped into a process, with the address its own addresses are
+/// relative to: 0 for a program, the load address for a shared library.
+#[derive(Clone)]
+pub struct MappedImage {
+    pub image: Arc<ElfFile>,
+    pub base: u32,
+}
+
+/// Maps the segments of a program and its libraries into one process as
+/// they are touched. Read-only pages are the images' own and shared with
+/// every process running them; writable ones are copied for this process,
+/// and pages of `.bss` only start out zeroed without reading the file.
+pub struct ElfPager {
+    objects: Vec<MappedImage>,
+    /// This process's writable pages, by virtual address.
+    private: Mutex<BTreeMap<u32, Page<u8>>>,
+}
+
+unsafe impl Send for ElfPager {}
+unsafe impl Sync for ElfPager {}
+
+impl ElfPager {
+    pub fn new(objects: Vec<MappedImage>) -> Self {
+        Self::with_private(objects, BTreeMap::new())
+    }
+
+    fn with_private(objects: Vec<MappedImage>, private: BTreeMap<u32, Page<u8>>) -> Self {
+        for object in objects.iter() {
+            cache::map(&object.image);
+        }
+        Self {
+            objects,
+            private: Mutex::new(private),
+        }
+    }
+
+    /// The program first, then its libraries.
+    pub fn objects(&self) -> &[MappedImage] {
+        &self.objects
+    }
+
+    /// Marks every segment page of `directory` to be mapped on first use.
+    pub fn map_lazy(&self, directory: &PageDirectory) -> Result<(), PagingError> {
+        for object in self.objects.iter() {
+            for segment in object.image.segments() {
+                let start = object.base + segment.virtual_address();
+                for index in 0..segment.page_count() {
+                    directory.set(start + (index * PAGING_PAGE_SIZE) as u32, memory::LAZY)?;
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// Pager of a forked child. The pages mapped so far stay shared until
+    /// either side writes them, like the rest of the address space.
+    pub fn fork(&self) -> Self {
+        Self::with_private(self.objects.clone(), self.private.lock().clone())
+    }
+}
+
+impl Drop for ElfPager {
+    fn drop(&mut self) {
+        for object in self.objects.iter() {
+            cache::unmap(&object.image);
+        }
+    }
+}
+
+impl PageSource for ElfPager {
+    fn fault_in(&self, directory: &PageDirectory, address: u32) -> bool {
+        // Segments may share a page at their boundary; the later one wins, as
+        // it did when segments were mapped in file order.
+        let Some((object, segment)) = self.objects.iter().find_map(|object| {
+            let relative = address.checked_sub(object.base)?;
+            object
+                .image
+                .segments()
+                .iter()
+                .rev()
+                .find(|segment| segment.contains(relative))
+                .map(|segment| (object, segment))
+        }) else {
+            return false;
+        };
+        let image = &object.image;
+        let index =
+            ((address - object.base - segment.virtual_address()) as usize) / PAGING_PAGE_SIZE;
+
+        let mut private = self.private.lock();
+        // Another thread of the process may have mapped it meanwhile.
+        if directory
+            .get(address)
+            .is_ok_and(|entry| entry & memory::PRESENT != 0)
+        {
+            return true;
+        }
+
+        if segment.flags() & PF_W == 0 {
+            let Ok(page) = image.segment_page(segment, index) else {
+                return false;
+            };
+            return directory
+                .map(
+                    address,
+                    page.as_ptr() as u32,
+                    memory::PRESENT | memory::USER_ACCESS,
+                )
+                .is_ok();
+        }
+
+        let page = if segment.is_zero_page(index) {
+            Page::new(PAGING_PAGE_SIZE)
+        } else {
+            image
+                .segment_page(segment, index)
+                .ok()
+                .and_then(|page| page.copy())
+        };
+        let Some(page) = page else {
+            return false;
+        };
+
+        if directory
+            .map(
+                address,
+                page.as_ptr() as u32,
+                memory::PRESENT | memory::USER_ACCESS | memory::WRITABLE,
+            )
+            .is_err()
+        {
+            return false;
+        }
+        private.insert(address, page);
+        true
+    }
+}
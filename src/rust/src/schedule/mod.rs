@@ -2,5 +2,9 @@ pub(crate) mod loader;
 pub mod process;
 pub mod process_manager;
 pub mod semaphore;
+pub mod stack;
+pub mod stats;
 pub mod task;
 pub mod task_manager;
+pub mod timer;
+pub mod wait_queue;
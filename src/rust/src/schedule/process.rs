@@ -9,17 +9,21 @@ use spin::{Mutex, RwLock};
 use crate::{
     constant::{
         PAGING_PAGE_SIZE, PROGRAM_VIRTUAL_ADDRESS, USER_HEAP_END, USER_HEAP_START,
-        USER_PROGRAM_STACK_SIZE, USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END,
         USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START,
     },
     error::KernelError,
-    fs::{FileHandle, FileMetadata, FsError, Pipe, PipeEnd, PipeError},
+    fs::{Advice, FileHandle, FileMetadata, FsError, Pipe, PipeEnd, PipeError},
+    interrupts::SyscallTrace,
     kernel::KERNEL,
     memory::{self, Page, PageDirectory},
-    schedule::loader::elf::{ElfFile, PF_W},
+    schedule::loader::{cache, dynamic, elf::ElfError, pager::ElfPager},
 };
 
-use super::task::{Registers, TaskId};
+use super::{
+    stack::UserStack,
+    stats::ProcessUsage,
+    task::{Registers, TaskId},
+};
 
 pub type ProcessId = u32;
 const FIRST_PROCESS_FD: usize = 3;
@@ -132,17 +136,11 @@ impl ProcessDescriptor {
             Self::File(file) => file.lock().ops.read(buf),
             Self::Directory(_) => Err(FsError::IsADirectory),
             Self::Pipe { pipe, end } => {
-                let (result, waiters) = {
-                    let mut pipe = pipe.lock();
-                    let result = pipe.read(*end, buf);
-                    let waiters = if matches!(result, Ok(read) if read > 0) {
-                        pipe.take_write_waiters()
-                    } else {
-                        Vec::new()
-                    };
-                    (result, waiters)
-                };
-                wake_tasks(waiters);
+                let mut pipe = pipe.lock();
+                let result = pipe.read(*end, buf);
+                if matches!(result, Ok(read) if read > 0) {
+                    KERNEL.with_task_manager(|tm| pipe.serve_waiters(tm));
+                }
                 result.map_err(pipe_error)
             }
             Self::Socket(_) => Err(FsError::Unsupported),
@@ -154,17 +152,11 @@ impl ProcessDescriptor {
             Self::File(file) => file.lock().ops.write(buf),
             Self::Directory(_) => Err(FsError::IsADirectory),
             Self::Pipe { pipe, end } => {
-                let (result, waiters) = {
-                    let mut pipe = pipe.lock();
-                    let result = pipe.write(*end, buf);
-                    let waiters = if matches!(result, Ok(written) if written > 0) {
-                        pipe.take_read_waiters()
-                    } else {
-                        Vec::new()
-                    };
-                    (result, waiters)
-                };
-                wake_tasks(waiters);
+                let mut pipe = pipe.lock();
+                let result = pipe.write(*end, buf);
+                if matches!(result, Ok(written) if written > 0) {
+                    KERNEL.with_task_manager(|tm| pipe.serve_waiters(tm));
+                }
                 result.map_err(pipe_error)
             }
             Self::Socket(_) => Err(FsError::Unsupported),
@@ -191,6 +183,25 @@ impl ProcessDescriptor {
         }
     }
 
+    /// Pipes and sockets cannot seek, so there is nothing to advise.
+    pub fn advise(&self, offset: usize, len: usize, advice: Advice) -> Result<(), FsError> {
+        match self {
+            Self::File(file) => file.lock().ops.advise(offset, len, advice),
+            Self::Directory(_) => Err(FsError::IsADirectory),
+            _ => Err(FsError::Unsupported),
+        }
+    }
+
+    /// Directories are written back with the filesystem; pipes and sockets
+    /// cannot be synced.
+    pub fn sync(&self, data_only: bool) -> Result<(), FsError> {
+        match self {
+            Self::File(file) => file.lock().ops.sync(data_only),
+            Self::Directory(_) => Ok(()),
+            _ => Err(FsError::Unsupported),
+        }
+    }
+
     pub fn stat(&self) -> Result<FileMetadata, FsError> {
         match self {
             Self::File(file) => file.lock().ops.stat(),
@@ -227,28 +238,17 @@ impl ProcessDescriptor {
                 }
             }
             Self::Pipe { pipe, end } => {
-                let waiters = pipe.lock().close_end(end);
-                wake_tasks(waiters);
+                let mut pipe = pipe.lock();
+                pipe.close_end(end);
+                KERNEL.with_task_manager(|tm| pipe.serve_waiters(tm));
             }
         }
     }
 }
 
-fn wake_tasks(waiters: Vec<TaskId>) {
-    if waiters.is_empty() {
-        return;
-    }
-
-    KERNEL.with_task_manager(|tm| {
-        for task_id in waiters {
-            let _ = tm.wake_task(task_id);
-        }
-    });
-}
-
-#[derive(Clone)]
 pub enum ProcessFileType {
-    Elf(ElfFile),
+    /// Mapped page by page as the program touches it.
+    Elf(Arc<ElfPager>),
     Binary(Page<u8>),
 }
 
@@ -290,18 +290,27 @@ pub struct Process {
     parent: Mutex<Option<ProcessId>>,
     state: Mutex<ProcessState>,
     pub entrypoint: u32,
+    /// Main thread; signals are delivered to it.
     pub tasks: RwLock<Option<TaskId>>,
+    /// Threads started with `clone`, besides the main one.
+    pub threads: Mutex<Vec<TaskId>>,
     pub cwd: Mutex<String>,
     pub umask: Mutex<u16>,
     pub env: Mutex<Vec<String>>,
     pub filetype: ProcessFileType,
     pub page_directory: PageDirectory,
-    pub stack: Page<u8>,
+    /// Stack of the main thread; the others run on stacks the program
+    /// allocated itself.
+    pub stack: Arc<UserStack>,
     pub start_stack: usize,
     pub brk: Mutex<u32>,
     signal_actions: Mutex<[SignalAction; MAX_SIGNAL + 1]>,
     brk_pages: Mutex<BTreeMap<u32, Page<u8>>>,
     cow_pages: Mutex<BTreeMap<u32, Page<u8>>>,
+    pub syscall_trace: Mutex<SyscallTrace>,
+    /// Command name shown by `ps` and `top`: the last component of argv[0].
+    pub name: String,
+    pub usage: Mutex<ProcessUsage>,
 }
 
 unsafe impl Send for Process {}
@@ -314,7 +323,7 @@ impl Process {
         filename: &str,
         args: Option<ProcessArguments>,
     ) -> Result<Self, KernelError> {
-        let mut process = if let Some(elf) = Self::load_elf(filename) {
+        let mut process = if let Some(elf) = Self::load_elf(filename)? {
             elf
         } else {
             Self::load_binary(filename)?
@@ -331,16 +340,23 @@ impl Process {
         });
 
         serial_println!("Process {} args: {:?}", pid, args.args);
+        if let Some(arg0) = args.args.first() {
+            process.name = command_name(arg0);
+        }
 
-        let stack = process.stack.as_mut_slice();
+        // Only the pages holding the arguments are mapped; the stack grows
+        // below them on demand.
+        let block = Page::<u8>::new(argument_block_size(&args)).ok_or(KernelError::Allocation)?;
+        let base = USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START - block.len();
+        let stack = block.as_mut_slice();
         let mut stack_pointer = stack.len();
 
-        let argv = push_stack_strings(stack, &mut stack_pointer, &args.args)?;
-        let envp = push_stack_strings(stack, &mut stack_pointer, &args.env)?;
+        let argv = push_stack_strings(stack, &mut stack_pointer, base, &args.args)?;
+        let envp = push_stack_strings(stack, &mut stack_pointer, base, &args.env)?;
         stack_pointer &= !0xF;
 
-        let envp_ptr = push_stack_pointer_array(stack, &mut stack_pointer, &envp)?;
-        let argv_ptr = push_stack_pointer_array(stack, &mut stack_pointer, &argv)?;
+        let envp_ptr = push_stack_pointer_array(stack, &mut stack_pointer, base, &envp)?;
+        let argv_ptr = push_stack_pointer_array(stack, &mut stack_pointer, base, &argv)?;
 
         push_stack_u32(stack, &mut stack_pointer, envp_ptr as u32)?;
         push_stack_u32(stack, &mut stack_pointer, argv_ptr as u32)?;
@@ -348,16 +364,26 @@ impl Process {
 
         process.env = Mutex::new(args.env);
 
-        process.start_stack = USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END + stack_pointer;
+        process
+            .stack
+            .map_top(&process.page_directory, block)
+            .map_err(|_| KernelError::Paging)?;
+        process.start_stack = base + stack_pointer;
 
         Ok(process)
     }
 
-    fn load_elf(filename: &str) -> Option<Self> {
-        let elf = ElfFile::load(filename).ok()?;
-        let entrypoint = elf.header().e_entry;
-        let page_directory = PageDirectory::new_4gb(memory::PRESENT)?;
-        Some(Self {
+    /// `None` if `filename` is not an ELF image; an error if it is one but
+    /// the libraries it needs cannot be loaded.
+    fn load_elf(filename: &str) -> Result<Option<Self>, KernelError> {
+        let Ok(image) = cache::load(filename) else {
+            return Ok(None);
+        };
+        let objects = dynamic::load_objects(image).map_err(load_error)?;
+        let entrypoint = objects[0].base + objects[0].image.entry();
+        let page_directory =
+            PageDirectory::new_4gb(memory::PRESENT).ok_or(KernelError::Allocation)?;
+        Ok(Some(Self {
             pid: 0,
             uid: 0,
             gid: 0,
@@ -368,9 +394,10 @@ impl Process {
             parent: Mutex::new(None),
             state: Mutex::new(ProcessState::Running),
             tasks: RwLock::new(None),
-            filetype: ProcessFileType::Elf(elf),
+            threads: Mutex::new(Vec::new()),
+            filetype: ProcessFileType::Elf(Arc::new(ElfPager::new(objects))),
             page_directory,
-            stack: Page::new(USER_PROGRAM_STACK_SIZE)?,
+            stack: Arc::new(UserStack::new()),
             start_stack: USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START,
             entrypoint,
             brk: Mutex::new(USER_HEAP_START as u32),
@@ -380,7 +407,10 @@ impl Process {
             cwd: Mutex::new("/".to_string()),
             umask: Mutex::new(0o022),
             env: Mutex::new(default_environment()),
-        })
+            syscall_trace: Mutex::new(SyscallTrace::new()),
+            name: command_name(filename),
+            usage: Mutex::new(ProcessUsage::default()),
+        }))
     }
 
     fn load_binary(filename: &str) -> Result<Self, KernelError> {
@@ -409,9 +439,10 @@ impl Process {
             parent: Mutex::new(None),
             state: Mutex::new(ProcessState::Running),
             tasks: RwLock::new(None),
+            threads: Mutex::new(Vec::new()),
             filetype: ProcessFileType::Binary(memory),
             page_directory,
-            stack: Page::new(USER_PROGRAM_STACK_SIZE).ok_or(KernelError::Allocation)?,
+            stack: Arc::new(UserStack::new()),
             start_stack: USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START,
             entrypoint: PROGRAM_VIRTUAL_ADDRESS as u32,
             brk: Mutex::new(USER_HEAP_START as u32),
@@ -421,6 +452,9 @@ impl Process {
             cwd: Mutex::new("/".to_string()),
             umask: Mutex::new(0o022),
             env: Mutex::new(default_environment()),
+            syscall_trace: Mutex::new(SyscallTrace::new()),
+            name: command_name(filename),
+            usage: Mutex::new(ProcessUsage::default()),
         })
     }
 
@@ -464,6 +498,17 @@ impl Process {
             .collect();
         let signal_actions = *parent.signal_actions.lock();
 
+        let filetype = match &parent.filetype {
+            ProcessFileType::Elf(pager) => {
+                let pager = Arc::new(pager.fork());
+                page_directory.add_source(pager.clone());
+                ProcessFileType::Elf(pager)
+            }
+            ProcessFileType::Binary(memory) => ProcessFileType::Binary(memory.clone()),
+        };
+        let stack = Arc::new(parent.stack.fork());
+        page_directory.add_source(stack.clone());
+
         Ok(Self {
             pid,
             uid: parent.uid,
@@ -475,9 +520,10 @@ impl Process {
             parent: Mutex::new(Some(parent.pid)),
             state: Mutex::new(ProcessState::Running),
             tasks: RwLock::new(None),
-            filetype: parent.filetype.clone(),
+            threads: Mutex::new(Vec::new()),
+            filetype,
             page_directory,
-            stack: parent.stack.clone(),
+            stack,
             start_stack: parent.start_stack,
             entrypoint: parent.entrypoint,
             brk: Mutex::new(*parent.brk.lock()),
@@ -487,29 +533,57 @@ impl Process {
             cwd: Mutex::new(parent.cwd.lock().clone()),
             umask: Mutex::new(*parent.umask.lock()),
             env: Mutex::new(parent.env.lock().clone()),
+            syscall_trace: Mutex::new(SyscallTrace::new()),
+            name: parent.name.clone(),
+            usage: Mutex::new(ProcessUsage::default()),
         })
     }
 
+    /// Child of `parent` running `filename`, in the state `fork` followed by
+    /// `execve` would leave it: same credentials, directory, umask and
+    /// descriptors minus close-on-exec ones, caught signals back to default.
+    /// None of the parent's memory is copied. It gets its pid once started.
+    pub fn spawn_from(
+        parent: &Process,
+        filename: &str,
+        args: ProcessArguments,
+    ) -> Result<Self, KernelError> {
+        let mut process = Self::new(0, Some(parent.pid), filename, Some(args))?;
+        process.uid = parent.uid;
+        process.gid = parent.gid;
+        process.euid = parent.euid;
+        process.egid = parent.egid;
+
+        let fd_table = parent
+            .fd_table
+            .lock()
+            .iter()
+            .map(|descriptor| match descriptor {
+                Some(fd) if fd.flags & FD_CLOEXEC == 0 => Some(fd.duplicate_for_fork()),
+                _ => None,
+            })
+            .collect();
+        *process.fd_table.lock() = fd_table;
+        process.set_cwd(parent.cwd.lock().clone());
+        process.set_umask(*parent.umask.lock());
+        process.replace_signal_actions(parent.signal_actions_for_exec());
+        process.stack.set_limit(parent.stack.limit());
+        Ok(process)
+    }
+
     fn map_memory(&mut self) -> Result<(), KernelError> {
-        self.page_directory
-            .map_page(
-                USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END as u32,
-                &self.stack,
-                memory::PRESENT | memory::WRITABLE | memory::USER_ACCESS,
-            )
+        self.stack
+            .map_lazy(&self.page_directory)
             .map_err(|_| KernelError::Paging)?;
+        self.page_directory.add_source(self.stack.clone());
 
         match self.filetype {
-            ProcessFileType::Elf(ref elf) => {
-                for segment in elf.segments() {
-                    let mut flags = memory::PRESENT | memory::USER_ACCESS;
-                    if (segment.flags() & PF_W) != 0 {
-                        flags |= memory::WRITABLE;
-                    }
-                    self.page_directory
-                        .map_page(segment.virtual_address(), segment.memory(), flags)
-                        .map_err(|_| KernelError::Paging)?;
-                }
+            ProcessFileType::Elf(ref pager) => {
+                pager
+                    .map_lazy(&self.page_directory)
+                    .map_err(|_| KernelError::Paging)?;
+                self.page_directory.add_source(pager.clone());
+                dynamic::link(&self.page_directory, pager.objects()).map_err(load_error)?;
             }
             ProcessFileType::Binary(ref memory) => {
                 self.page_directory
@@ -565,14 +639,20 @@ impl Process {
                 addr = addr.saturating_add(PAGING_PAGE_SIZE as u32);
             }
         } else if new_mapped_end < old_mapped_end {
+            // The frames are freed on return, once no CPU can reach them.
+            let mut unmapped = Vec::new();
             let mut addr = new_mapped_end;
             while addr < old_mapped_end {
-                if self.brk_pages.lock().remove(&addr).is_some() {
+                if let Some(page) = self.brk_pages.lock().remove(&addr) {
                     let _ = self.page_directory.set(addr, 0);
-                    self.remove_cow_pages_in_range(addr, PAGING_PAGE_SIZE as u32);
+                    unmapped.push(page);
                 }
                 addr = addr.saturating_add(PAGING_PAGE_SIZE as u32);
             }
+            if !unmapped.is_empty() {
+                self.page_directory.shoot_down();
+                self.remove_cow_pages_in_range(new_mapped_end, old_mapped_end - new_mapped_end);
+            }
         }
 
         *current_break = requested_break;
@@ -581,9 +661,13 @@ impl Process {
 
     fn unmap_brk_pages(&self, pages: &[u32]) {
         let mut brk_pages = self.brk_pages.lock();
+        let mut unmapped = Vec::new();
         for &addr in pages {
-            brk_pages.remove(&addr);
+            unmapped.extend(brk_pages.remove(&addr));
             let _ = self.page_directory.set(addr, 0);
+        }
+        self.page_directory.shoot_down();
+        for &addr in pages {
             self.remove_cow_pages_in_range(addr, PAGING_PAGE_SIZE as u32);
         }
     }
@@ -773,15 +857,18 @@ impl Process {
         table.resize(FIRST_PROCESS_FD, None);
     }
 
+    /// Unmaps and frees the brk and COW pages. The threads of the process
+    /// must be removed from the task manager first, so no CPU maps them again.
     pub fn cleanup(&self) {
         for addr in self.brk_pages.lock().keys() {
             let _ = self.page_directory.set(*addr, 0);
         }
-        self.brk_pages.lock().clear();
-
         for addr in self.cow_pages.lock().keys() {
             let _ = self.page_directory.set(*addr, 0);
         }
+        self.page_directory.shoot_down();
+
+        self.brk_pages.lock().clear();
         self.cow_pages.lock().clear();
     }
 
@@ -920,6 +1007,9 @@ impl Process {
         self.page_directory
             .map(page_address, new_page.as_ptr() as u32, flags)
             .map_err(|_| KernelError::Paging)?;
+        // Other threads may still read the old frame, which the insert can
+        // free.
+        self.page_directory.shoot_down();
 
         self.cow_pages.lock().insert(page_address, new_page);
 
@@ -950,9 +1040,28 @@ fn default_environment() -> Vec<String> {
     vec!["PATH=/bin".to_string()]
 }
 
+fn command_name(path: &str) -> String {
+    path.rsplit('/').next().unwrap_or(path).to_string()
+}
+
+/// Bytes the argument block of a new process takes at the top of its stack:
+/// the strings, the `argv` and `envp` arrays and `main`'s arguments, in
+/// whole pages.
+fn argument_block_size(args: &ProcessArguments) -> usize {
+    let strings: usize = args
+        .args
+        .iter()
+        .chain(args.env.iter())
+        .map(|value| value.len() + 1)
+        .sum();
+    let pointers = (args.args.len() + 1 + args.env.len() + 1 + 3) * core::mem::size_of::<u32>();
+    align_up((strings + 0xF + pointers) as u32) as usize
+}
+
 fn push_stack_strings(
     stack: &mut [u8],
     stack_pointer: &mut usize,
+    base: usize,
     values: &[String],
 ) -> Result<Vec<usize>, KernelError> {
     let mut pointers = Vec::with_capacity(values.len());
@@ -965,7 +1074,7 @@ fn push_stack_strings(
         *stack_pointer -= bytes.len() + 1;
         stack[*stack_pointer..*stack_pointer + bytes.len()].copy_from_slice(bytes);
         stack[*stack_pointer + bytes.len()] = 0;
-        pointers.push(USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END + *stack_pointer);
+        pointers.push(base + *stack_pointer);
     }
 
     pointers.reverse();
@@ -975,6 +1084,7 @@ fn push_stack_strings(
 fn push_stack_pointer_array(
     stack: &mut [u8],
     stack_pointer: &mut usize,
+    base: usize,
     pointers: &[usize],
 ) -> Result<usize, KernelError> {
     push_stack_u32(stack, stack_pointer, 0)?;
@@ -982,7 +1092,7 @@ fn push_stack_pointer_array(
         push_stack_u32(stack, stack_pointer, pointer as u32)?;
     }
 
-    Ok(USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END + *stack_pointer)
+    Ok(base + *stack_pointer)
 }
 
 fn push_stack_u32(
@@ -1004,6 +1114,15 @@ fn pipe_error(error: PipeError) -> FsError {
     match error {
         PipeError::WouldBlock => FsError::WouldBlock,
         PipeError::BrokenPipe => FsError::BrokenPipe,
-        PipeError::WrongEnd => FsError::InvalidArgument,
+        PipeError::WrongEnd | PipeError::Fault => FsError::InvalidArgument,
+    }
+}
+
+/// Objects that do not load or link make a program that cannot run; only
+/// failing to read them is an I/O error.
+fn load_error(error: ElfError) -> KernelError {
+    match error {
+        ElfError::Io => KernelError::Io,
+        _ => KernelError::NotExecutable,
     }
 }
@@ -1,24 +1,21 @@
-use alloc::{
-    collections::{BTreeMap, VecDeque},
-    sync::Arc,
-    vec::Vec,
-};
+use alloc::{collections::BTreeMap, sync::Arc, vec::Vec};
 
 use crate::{
     error::KernelError,
+    fpu,
+    interrupts::release_futexes,
     kernel::KERNEL,
     schedule::{
-        task::{Registers, TaskId, copy_string_to_task},
+        stats::TaskStats,
+        task::{Registers, Task, TaskId, WaitReason, copy_string_to_task},
         task_manager::TaskManager,
+        wait_queue::{Resume, WaitQueue},
     },
 };
 
-use super::{
-    process::{
-        Process, ProcessArguments, ProcessId, SIG_DFL, SIG_IGN, SIGCHLD, SIGKILL,
-        SIGNAL_FRAME_MAGIC, SIGSTOP, SignalAction, SignalFrame, signal_default_ignored,
-    },
-    task::TaskState,
+use super::process::{
+    Process, ProcessArguments, ProcessId, SIG_DFL, SIG_IGN, SIGCHLD, SIGKILL, SIGNAL_FRAME_MAGIC,
+    SIGSTOP, SignalAction, SignalFrame, signal_default_ignored,
 };
 
 pub enum SignalEffect {
@@ -30,13 +27,12 @@ pub enum SignalEffect {
 pub struct ProcessManager {
     table: BTreeMap<ProcessId, Arc<Process>>,
     zombies: BTreeMap<ProcessId, ZombieProcess>,
-    exit_waiters: BTreeMap<ProcessId, VecDeque<ExitWaiter>>,
+    exit_waiters: BTreeMap<ProcessId, WaitQueue<ExitWaiter>>,
     id: ProcessId,
 }
 
 #[derive(Clone, Copy)]
 struct ExitWaiter {
-    task_id: TaskId,
     status_ptr: u32,
     return_value: u32,
 }
@@ -45,6 +41,8 @@ struct ExitWaiter {
 struct ZombieProcess {
     parent_pid: Option<ProcessId>,
     status: i32,
+    /// CPU usage handed to the parent when it reaps the zombie.
+    usage: TaskStats,
 }
 
 impl ProcessManager {
@@ -83,7 +81,8 @@ impl ProcessManager {
         &mut self,
         parent: Arc<Process>,
         child_registers: Registers,
-        priority: usize,
+        nice: i32,
+        tls_base: u32,
     ) -> Result<ProcessId, KernelError> {
         let pid = self.id;
         self.id += 1;
@@ -93,7 +92,17 @@ impl ProcessManager {
         parent.children.lock().push(pid);
 
         let task_id: TaskId = KERNEL.with_task_manager(|tm| {
-            tm.spawn_with_registers(process.clone(), child_registers, priority)
+            // The caller is the forking task; the child inherits its FPU state.
+            let fpu = tm
+                .get_current()
+                .and_then(|current_task| fpu::snapshot(&mut current_task.write()));
+            let task_id = tm.spawn_with_registers(process.clone(), child_registers, nice)?;
+            if let Some(nn_task) = tm.get(task_id) {
+                let mut task = nn_task.write();
+                task.tls_base = tls_base;
+                task.fpu = fpu;
+            }
+            Ok::<_, KernelError>(task_id)
         })?;
 
         process.tasks.write().replace(task_id);
@@ -101,6 +110,91 @@ impl ProcessManager {
         Ok(pid)
     }
 
+    /// Starts `child`, built outside the manager as by `Process::spawn_from`,
+    /// under a new pid as a child of `parent` with the parent's `nice` value.
+    pub fn start_child(
+        &mut self,
+        parent: &Process,
+        mut child: Process,
+        nice: i32,
+    ) -> Result<ProcessId, KernelError> {
+        let pid = self.id;
+        self.id += 1;
+        child.pid = pid;
+        let process = Arc::new(child);
+        self.table.insert(pid, process.clone());
+        parent.children.lock().push(pid);
+
+        let registers = Task::entry_registers(&process);
+        let task_id = KERNEL
+            .with_task_manager(|tm| tm.spawn_with_registers(process.clone(), registers, nice))?;
+        process.tasks.write().replace(task_id);
+        Ok(pid)
+    }
+
+    /// Starts another thread of `process` with `registers`. It shares the
+    /// address space, descriptors and signal handlers with the others and
+    /// runs with `tls_base` as its thread pointer. Its id is stored at each
+    /// of `tid_ptrs` before it can run.
+    pub fn spawn_thread(
+        &mut self,
+        process: Arc<Process>,
+        registers: Registers,
+        nice: i32,
+        tls_base: u32,
+        clear_child_tid: u32,
+        tid_ptrs: &[u32],
+    ) -> Result<TaskId, KernelError> {
+        let alive = self
+            .table
+            .get(&process.pid)
+            .is_some_and(|current| Arc::ptr_eq(current, &process));
+        if !alive || process.zombie_status().is_some() {
+            return Err(KernelError::NoTasks);
+        }
+
+        let task_id = KERNEL.with_task_manager(|tm| {
+            // Like a forked child, the thread starts with its creator's FPU
+            // state, so it inherits the rounding and exception modes.
+            let fpu = tm
+                .get_current()
+                .and_then(|current_task| fpu::snapshot(&mut current_task.write()));
+            let task_id = tm.spawn_with_registers(process.clone(), registers, nice)?;
+            if let Some(nn_task) = tm.get(task_id) {
+                let mut task = nn_task.write();
+                task.tls_base = tls_base;
+                task.clear_child_tid = clear_child_tid;
+                task.fpu = fpu;
+            }
+            let tid = task_id as u32;
+            for &ptr in tid_ptrs.iter().filter(|&&ptr| ptr != 0) {
+                let _ = copy_string_to_task(
+                    &process.page_directory,
+                    &tid as *const u32 as u32,
+                    ptr,
+                    core::mem::size_of::<u32>() as u32,
+                );
+            }
+            Ok::<_, KernelError>(task_id)
+        })?;
+
+        process.threads.lock().push(task_id);
+        Ok(task_id)
+    }
+
+    /// Ends thread `task_id` of `process`; the other threads keep running.
+    /// Returns the user word the thread asked to have cleared on exit, or 0.
+    pub fn exit_thread(&mut self, process: &Process, task_id: TaskId) -> u32 {
+        process.threads.lock().retain(|&thread| thread != task_id);
+        KERNEL.with_task_manager(|tm| {
+            let clear_child_tid = tm
+                .get(task_id)
+                .map_or(0, |nn_task| nn_task.read().clear_child_tid);
+            tm.remove(task_id);
+            clear_child_tid
+        })
+    }
+
     pub fn get(&self, pid: ProcessId) -> Option<Arc<Process>> {
         self.table.get(&pid).cloned()
     }
@@ -113,7 +207,7 @@ impl ProcessManager {
     ) -> Result<(), KernelError> {
         let old_process = self.table.get(&pid).cloned().ok_or(KernelError::NoTasks)?;
         let parent = old_process.parent_pid();
-        let task_id = *old_process.tasks.read();
+        let task_id = KERNEL.with_task_manager(|tm| tm.get_current_id());
         let children = old_process.children.lock().clone();
         let cwd = old_process.cwd.lock().clone();
         let umask = *old_process.umask.lock();
@@ -129,9 +223,23 @@ impl ProcessManager {
         process.set_cwd(cwd);
         process.set_umask(umask);
         process.replace_signal_actions(signal_actions);
+        process.stack.set_limit(old_process.stack.limit());
         process.children.lock().extend(children);
         *process.tasks.write() = task_id;
 
+        // The other threads end with the old image; the caller carries on
+        // as the only one.
+        KERNEL.with_task_manager(|tm| {
+            let leader = *old_process.tasks.read();
+            let threads = core::mem::take(&mut *old_process.threads.lock());
+            for thread in leader.into_iter().chain(threads) {
+                if Some(thread) != task_id {
+                    tm.remove(thread);
+                }
+            }
+        });
+        *process.usage.lock() = *old_process.usage.lock();
+
         let process = Arc::new(process);
         self.table.insert(pid, process.clone());
         old_process.cleanup();
@@ -143,7 +251,8 @@ impl ProcessManager {
         &mut self,
         parent_pid: ProcessId,
         pid: ProcessId,
-        waiter: Option<(TaskId, u32, u32)>,
+        waiter: Option<(u32, u32)>,
+        interrupted: u32,
     ) -> Result<Option<i32>, KernelError> {
         let Some(parent_process) = self.table.get(&parent_pid) else {
             return Err(KernelError::NoTasks);
@@ -171,15 +280,21 @@ impl ProcessManager {
             return Ok(Some(status));
         }
 
-        if let Some((task_id, status_ptr, return_value)) = waiter {
-            self.exit_waiters
-                .entry(pid)
-                .or_default()
-                .push_back(ExitWaiter {
-                    task_id,
-                    status_ptr,
-                    return_value,
-                });
+        // Parks the current task; the exit writes the status and wakes it.
+        if let Some((status_ptr, return_value)) = waiter {
+            let waiters = self.exit_waiters.entry(pid).or_insert_with(WaitQueue::new);
+            KERNEL.with_task_manager(|tm| {
+                waiters.park(
+                    tm,
+                    WaitReason::Process(pid as usize),
+                    ExitWaiter {
+                        status_ptr,
+                        return_value,
+                    },
+                    None,
+                    interrupted,
+                )
+            })?;
         }
         Ok(None)
     }
@@ -236,48 +351,21 @@ impl ProcessManager {
         };
 
         KERNEL.with_task_manager(|tm| {
+            // Its registers are only saved once that CPU enters the kernel.
+            if tm.running_elsewhere(task_id) {
+                if let Some(nn_task) = tm.get(task_id) {
+                    nn_task.write().pending_signals |= 1 << signal;
+                }
+                tm.kick(task_id);
+                return Ok(());
+            }
+
             let Some(nn_task) = tm.get(task_id) else {
                 return Err(KernelError::NoTasks);
             };
 
-            {
-                let mut task = nn_task.write();
-                let saved_registers = task.registers;
-                let frame = SignalFrame {
-                    magic: SIGNAL_FRAME_MAGIC,
-                    registers: saved_registers,
-                };
-                let frame_size = core::mem::size_of::<SignalFrame>() as u32;
-                let frame_addr = saved_registers
-                    .esp
-                    .checked_sub(frame_size)
-                    .ok_or(KernelError::Paging)?
-                    & !0x3;
-                let call_sp = frame_addr.checked_sub(12).ok_or(KernelError::Paging)?;
-                let call_frame = [action.restorer, signal, frame_addr];
-
-                copy_string_to_task(
-                    &process.page_directory,
-                    &frame as *const SignalFrame as u32,
-                    frame_addr,
-                    frame_size,
-                )
-                .map_err(|_| KernelError::Paging)?;
-
-                copy_string_to_task(
-                    &process.page_directory,
-                    call_frame.as_ptr() as u32,
-                    call_sp,
-                    core::mem::size_of_val(&call_frame) as u32,
-                )
-                .map_err(|_| KernelError::Paging)?;
-
-                task.registers.ip = action.handler;
-                task.registers.esp = call_sp;
-                task.registers.eax = signal;
-                task.state = TaskState::Runnable;
-            }
-
+            push_signal_frame(&mut nn_task.write(), signal, action)?;
+            // Ends a sleep or wait; parked tasks leave with their interrupted value.
             tm.wake_task(task_id)
         })
     }
@@ -289,36 +377,47 @@ impl ProcessManager {
 
         self.reparent_children(pid);
         process.close_descriptors();
-        process.cleanup();
         process.mark_zombie(wait_status);
         KERNEL.with_task_manager(|tm| {
             let task = process.tasks.read();
             if let Some(task) = task.as_ref() {
                 tm.remove(*task);
             }
+            for thread in core::mem::take(&mut *process.threads.lock()) {
+                tm.remove(thread);
+            }
         });
+        // Only now can no thread return to the address space; cleanup waits
+        // for the CPUs still in it to leave before freeing its frames.
+        process.cleanup();
+        release_futexes(&process);
 
         // pid 0 is the init-like reaper, so orphaned children do not linger as zombies.
         let mut should_reap = matches!(process.parent_pid(), None | Some(0));
         if let Some(mut waiters) = self.exit_waiters.remove(&pid) {
-            KERNEL.with_task_manager(|tm| {
-                while let Some(waiter) = waiters.pop_front() {
-                    if waiter.status_ptr != 0
+            let woken = KERNEL.with_task_manager(|tm| {
+                let mut woken = 0;
+                while let Some(waiter) = waiters.pop(tm) {
+                    if waiter.data.status_ptr != 0
                         && let Some(task) = tm.get(waiter.task_id)
                     {
                         let task = task.read();
                         let _ = copy_string_to_task(
                             &task.process.page_directory,
                             &wait_status as *const i32 as u32,
-                            waiter.status_ptr,
+                            waiter.data.status_ptr,
                             core::mem::size_of::<i32>() as u32,
                         );
                     }
 
-                    let _ = tm.wake_task_with_return_value(waiter.task_id, waiter.return_value);
+                    if waiter.resume(tm, Resume::Value(waiter.data.return_value)) {
+                        woken += 1;
+                    }
                 }
+                woken
             });
-            should_reap = true;
+            // A parent interrupted out of waitpid reaps the zombie later.
+            should_reap |= woken > 0;
         }
 
         if let Some(parent_pid) = process.parent_pid() {
@@ -337,6 +436,7 @@ impl ProcessManager {
                 ZombieProcess {
                     parent_pid: process.parent_pid(),
                     status: wait_status,
+                    usage: process.usage.lock().total(),
                 },
             );
             self.table.remove(&pid);
@@ -344,8 +444,17 @@ impl ProcessManager {
     }
 
     fn reap_child(&mut self, parent_pid: ProcessId, pid: ProcessId) {
+        let usage = match self.zombies.get(&pid) {
+            Some(zombie) => zombie.usage,
+            None => self
+                .table
+                .get(&pid)
+                .map(|child| child.usage.lock().total())
+                .unwrap_or_default(),
+        };
         if let Some(parent_process) = self.table.get(&parent_pid) {
             parent_process.children.lock().retain(|&x| x != pid);
+            parent_process.usage.lock().children.add(&usage);
         }
         self.exit_waiters.remove(&pid);
         self.zombies.remove(&pid);
@@ -437,3 +546,62 @@ fn encode_exit_status(code: i32) -> i32 {
 fn encode_signal_status(signal: u32) -> i32 {
     (signal & 0x7f) as i32
 }
+
+/// Makes `task` enter the handler of `action` with a frame for `sigreturn`
+/// on its user stack.
+fn push_signal_frame(
+    task: &mut Task,
+    signal: u32,
+    action: SignalAction,
+) -> Result<(), KernelError> {
+    let saved_registers = task.registers;
+    let frame = SignalFrame {
+        magic: SIGNAL_FRAME_MAGIC,
+        registers: saved_registers,
+    };
+    let frame_size = core::mem::size_of::<SignalFrame>() as u32;
+    let frame_addr = saved_registers
+        .esp
+        .checked_sub(frame_size)
+        .ok_or(KernelError::Paging)?
+        & !0x3;
+    let call_sp = frame_addr.checked_sub(12).ok_or(KernelError::Paging)?;
+    let call_frame = [action.restorer, signal, frame_addr];
+
+    copy_string_to_task(
+        &task.process.page_directory,
+        &frame as *const SignalFrame as u32,
+        frame_addr,
+        frame_size,
+    )
+    .map_err(|_| KernelError::Paging)?;
+
+    copy_string_to_task(
+        &task.process.page_directory,
+        call_frame.as_ptr() as u32,
+        call_sp,
+        core::mem::size_of_val(&call_frame) as u32,
+    )
+    .map_err(|_| KernelError::Paging)?;
+
+    task.registers.ip = action.handler;
+    task.registers.esp = call_sp;
+    task.registers.eax = signal;
+    Ok(())
+}
+
+/// Delivers the signals queued for `task` while it ran on another CPU, now
+/// that its registers are saved. Actions changed in between still apply.
+pub fn deliver_pending_signals(task: &mut Task) {
+    while task.pending_signals != 0 {
+        let signal = task.pending_signals.trailing_zeros();
+        task.pending_signals &= !(1 << signal);
+
+        let Some(action) = task.process.get_signal_action(signal) else {
+            continue;
+        };
+        if action.handler != SIG_DFL && action.handler != SIG_IGN && action.restorer != 0 {
+            let _ = push_signal_frame(task, signal, action);
+        }
+    }
+}
@@ -1,18 +1,17 @@
 #![allow(dead_code)]
 
-use alloc::collections::VecDeque;
-
 use crate::error::KernelError;
 
 use super::{
-    task::{TaskId, WaitReason},
+    task::WaitReason,
     task_manager::TaskManager,
+    wait_queue::{Resume, WaitQueue},
 };
 
 pub struct Semaphore {
     id: usize,
     count: isize,
-    waiters: VecDeque<TaskId>,
+    waiters: WaitQueue,
 }
 
 impl Semaphore {
@@ -20,7 +19,7 @@ impl Semaphore {
         Self {
             id,
             count,
-            waiters: VecDeque::new(),
+            waiters: WaitQueue::new(),
         }
     }
 
@@ -28,32 +27,37 @@ impl Semaphore {
         self.count
     }
 
-    pub fn wait(&mut self, task_manager: &mut TaskManager) -> Result<bool, KernelError> {
+    /// Takes a unit, or parks the current task until `signal` hands one over.
+    /// A parked task returns 0 from its syscall, or `interrupted` if a signal
+    /// ends the wait.
+    pub fn wait(
+        &mut self,
+        task_manager: &mut TaskManager,
+        interrupted: u32,
+    ) -> Result<bool, KernelError> {
         if self.count > 0 {
             self.count -= 1;
             return Ok(true);
         }
 
-        let task_id = task_manager.block_current(WaitReason::Semaphore(self.id))?;
-        if !self.waiters.contains(&task_id) {
-            self.waiters.push_back(task_id);
-        }
+        self.waiters.park(
+            task_manager,
+            WaitReason::Semaphore(self.id),
+            (),
+            None,
+            interrupted,
+        )?;
         Ok(false)
     }
 
     pub fn signal(&mut self, task_manager: &mut TaskManager) {
-        while let Some(task_id) = self.waiters.pop_front() {
-            if task_manager.wake_task_with_return_value(task_id, 0).is_ok() {
-                return;
-            }
+        if !self.waiters.wake_one(task_manager, |_| Resume::Value(0)) {
+            self.count = self.count.saturating_add(1);
         }
-
-        self.count = self.count.saturating_add(1);
     }
 
     pub fn close(&mut self, task_manager: &mut TaskManager, return_value: u32) {
-        while let Some(task_id) = self.waiters.pop_front() {
-            let _ = task_manager.wake_task_with_return_value(task_id, return_value);
-        }
+        self.waiters
+            .wake_all(task_manager, |_| Resume::Value(return_value));
     }
 }
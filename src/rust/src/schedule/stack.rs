@@ -0,0 +1,137 @@
+use alloc::collections::btree_map::BTreeMap;
+use spin::Mutex;
+
+use crate::{
+    constant::{
+        PAGING_PAGE_SIZE, USER_PROGRAM_STACK_SIZE, USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END,
+        USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START,
+    },
+    memory::{self, Page, PageDirectory, PageSource, PagingError},
+};
+
+/// Largest stack a process may have: the reserve minus its guard page.
+pub const STACK_LIMIT_MAX: u32 = (USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START
+    - USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END
+    - PAGING_PAGE_SIZE) as u32;
+
+/// Soft and hard stack size limits, as `getrlimit(RLIMIT_STACK)` reports them.
+#[derive(Clone, Copy, Debug)]
+pub struct StackLimit {
+    pub current: u32,
+    pub maximum: u32,
+}
+
+impl Default for StackLimit {
+    fn default() -> Self {
+        Self {
+            current: USER_PROGRAM_STACK_SIZE as u32,
+            maximum: STACK_LIMIT_MAX,
+        }
+    }
+}
+
+/// Main thread stack of a process. Only the pages the program has touched
+/// are mapped; the rest of the reserve below the top is `LAZY` and mapped
+/// zeroed on the first fault, as long as it lies within the stack limit.
+pub struct UserStack {
+    /// Mapped pages by virtual address; the argument block may span several.
+    pages: Mutex<BTreeMap<u32, Page<u8>>>,
+    limit: Mutex<StackLimit>,
+}
+
+unsafe impl Send for UserStack {}
+unsafe impl Sync for UserStack {}
+
+impl UserStack {
+    pub fn new() -> Self {
+        Self {
+            pages: Mutex::new(BTreeMap::new()),
+            limit: Mutex::new(StackLimit::default()),
+        }
+    }
+
+    /// Stack of a forked child: same pages, shared until either side writes
+    /// them, and same limits.
+    pub fn fork(&self) -> Self {
+        Self {
+            pages: Mutex::new(self.pages.lock().clone()),
+            limit: Mutex::new(*self.limit.lock()),
+        }
+    }
+
+    /// Marks the reserve of `directory` to be mapped on first use, except
+    /// for the guard page at its bottom.
+    pub fn map_lazy(&self, directory: &PageDirectory) -> Result<(), PagingError> {
+        let guard = USER_PROGRAM_VIRTUAL_STACK_ADDRESS_END as u32;
+        directory.set(guard, 0)?;
+
+        let mut address = guard + PAGING_PAGE_SIZE as u32;
+        while address < USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START as u32 {
+            directory.set(address, memory::LAZY)?;
+            address += PAGING_PAGE_SIZE as u32;
+        }
+        Ok(())
+    }
+
+    /// Maps `block`, the initial stack with the program arguments, at the
+    /// top of the reserve. Returns its start address.
+    pub fn map_top(&self, directory: &PageDirectory, block: Page<u8>) -> Result<u32, PagingError> {
+        let size = block.len() as u32;
+        if size > self.limit.lock().current {
+            return Err(PagingError::InvalidArg);
+        }
+
+        let address = USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START as u32 - size;
+        directory.map_page(
+            address,
+            &block,
+            memory::PRESENT | memory::WRITABLE | memory::USER_ACCESS,
+        )?;
+        self.pages.lock().insert(address, block);
+        Ok(address)
+    }
+
+    pub fn limit(&self) -> StackLimit {
+        *self.limit.lock()
+    }
+
+    /// Pages already mapped beyond a lowered limit stay mapped.
+    pub fn set_limit(&self, limit: StackLimit) {
+        *self.limit.lock() = limit;
+    }
+}
+
+impl PageSource for UserStack {
+    fn fault_in(&self, directory: &PageDirectory, address: u32) -> bool {
+        let top = USER_PROGRAM_VIRTUAL_STACK_ADDRESS_START as u32;
+        let lowest = top - self.limit.lock().current.min(STACK_LIMIT_MAX);
+        if address < PageDirectory::align_address_down(lowest) || address >= top {
+            return false;
+        }
+
+        let mut pages = self.pages.lock();
+        // Another thread of the process may have mapped it meanwhile.
+        if directory
+            .get(address)
+            .is_ok_and(|entry| entry & memory::PRESENT != 0)
+        {
+            return true;
+        }
+
+        let Some(page) = Page::new(PAGING_PAGE_SIZE) else {
+            return false;
+        };
+        if directory
+            .map(
+                address,
+                page.as_ptr() as u32,
+                memory::PRESENT | memory::USER_ACCESS | memory::WRITABLE,
+            )
+            .is_err()
+        {
+            return false;
+        }
+        pages.insert(address, page);
+        true
+    }
+}
@@ -0,0 +1,276 @@
+use alloc::{boxed::Box, string::String, vec::Vec};
+use core::fmt::Write;
+
+use crate::{
+    constant::TIMER_HZ,
+    device::timer::current_tick,
+    fs::{FileHandle, FileMetadata, FileOps, FsError},
+    kernel::KERNEL,
+};
+
+use super::{
+    process::{Process, ProcessId},
+    task::{TaskId, TaskState},
+    task_manager::TaskManager,
+};
+
+/// CPU time and scheduling counters of a task. Times are in ticks.
+#[derive(Clone, Copy, Debug, Default)]
+pub struct TaskStats {
+    pub user_ticks: u64,
+    pub system_ticks: u64,
+    /// Switches away because the task went to sleep or blocked.
+    pub voluntary_switches: u64,
+    /// Switches away because its slice ended or a more urgent task woke.
+    pub involuntary_switches: u64,
+    /// Dispatches from a ready queue.
+    pub dispatches: u64,
+    /// Ticks spent runnable in a ready queue before those dispatches.
+    pub ready_wait_ticks: u64,
+    pub max_ready_wait_ticks: u64,
+}
+
+impl TaskStats {
+    pub fn add(&mut self, other: &TaskStats) {
+        self.user_ticks += other.user_ticks;
+        self.system_ticks += other.system_ticks;
+        self.voluntary_switches += other.voluntary_switches;
+        self.involuntary_switches += other.involuntary_switches;
+        self.dispatches += other.dispatches;
+        self.ready_wait_ticks += other.ready_wait_ticks;
+        self.max_ready_wait_ticks = self.max_ready_wait_ticks.max(other.max_ready_wait_ticks);
+    }
+
+    pub fn cpu_ticks(&self) -> u64 {
+        self.user_ticks + self.system_ticks
+    }
+
+    /// Records a dispatch after `waited` ticks in a ready queue.
+    pub fn record_dispatch(&mut self, waited: u64) {
+        self.dispatches += 1;
+        self.ready_wait_ticks += waited;
+        self.max_ready_wait_ticks = self.max_ready_wait_ticks.max(waited);
+    }
+}
+
+/// Usage a process keeps besides that of its live threads.
+#[derive(Clone, Copy, Debug, Default)]
+pub struct ProcessUsage {
+    /// Threads that already ended.
+    pub exited: TaskStats,
+    /// Children that were waited for, with their own children.
+    pub children: TaskStats,
+}
+
+impl ProcessUsage {
+    /// What the process adds to its parent's children usage once reaped.
+    pub fn total(&self) -> TaskStats {
+        let mut total = self.exited;
+        total.add(&self.children);
+        total
+    }
+}
+
+/// Usage of all threads of `process`, live and ended.
+pub fn process_stats(process: &Process, task_manager: &TaskManager) -> TaskStats {
+    let mut total = process.usage.lock().exited;
+    let leader = *process.tasks.read();
+    let threads = process.threads.lock().clone();
+    for task_id in leader.into_iter().chain(threads) {
+        if let Some(stats) = task_manager.stats(task_id) {
+            total.add(&stats);
+        }
+    }
+    total
+}
+
+struct TaskRow {
+    pid: ProcessId,
+    tid: TaskId,
+    state: char,
+    cpu: usize,
+    nice: i32,
+    level: usize,
+    stats: TaskStats,
+    name: String,
+}
+
+fn collect_rows() -> Vec<TaskRow> {
+    KERNEL.with_task_manager(|tm| {
+        tm.iter()
+            .map(|nn_task| {
+                let task = nn_task.read();
+                let state = match task.state {
+                    TaskState::Runnable if task.running => 'R',
+                    TaskState::Runnable => 'W',
+                    TaskState::Sleeping { .. } => 'S',
+                    TaskState::Blocked { .. } => 'D',
+                };
+                TaskRow {
+                    pid: task.process.pid,
+                    tid: task.id,
+                    state,
+                    cpu: task.cpu,
+                    nice: task.nice,
+                    level: task.priority,
+                    stats: tm.stats(task.id).unwrap_or_default(),
+                    name: task.process.name.clone(),
+                }
+            })
+            .collect()
+    })
+}
+
+/// Formats `ticks` as seconds with millisecond precision.
+fn ticks_to_seconds(ticks: u64) -> (u64, u64) {
+    let hz = TIMER_HZ as u64;
+    (ticks / hz, (ticks % hz) * 1000 / hz)
+}
+
+fn render_top() -> String {
+    let mut rows = collect_rows();
+    rows.sort_by(|a, b| b.stats.cpu_ticks().cmp(&a.stats.cpu_ticks()));
+
+    let (up_s, up_ms) = ticks_to_seconds(current_tick());
+    let switches: u64 = rows
+        .iter()
+        .map(|row| row.stats.voluntary_switches + row.stats.involuntary_switches)
+        .sum();
+    let running = rows.iter().filter(|row| row.state == 'R').count();
+    let waiting = rows.iter().filter(|row| row.state == 'W').count();
+
+    let mut out = String::new();
+    let _ = writeln!(
+        out,
+        "up {}.{:03}s, {} tasks, {} running, {} ready, {} switches (ticks of 1/{} s)",
+        up_s,
+        up_ms,
+        rows.len(),
+        running,
+        waiting,
+        switches,
+        TIMER_HZ
+    );
+    let _ = writeln!(
+        out,
+        "{:>5} {:>5} S {:>3} {:>3} {:>3} {:>8} {:>8} {:>7} {:>7} {:>7} {:>6} {:>6}  CMD",
+        "PID", "TID", "CPU", "NI", "LVL", "USER", "SYS", "VCSW", "IVCSW", "RUNS", "AVGW", "MAXW"
+    );
+    for row in rows {
+        let stats = &row.stats;
+        let avg_wait = stats.ready_wait_ticks / stats.dispatches.max(1);
+        let _ = writeln!(
+            out,
+            "{:>5} {:>5} {} {:>3} {:>3} {:>3} {:>8} {:>8} {:>7} {:>7} {:>7} {:>6} {:>6}  {}",
+            row.pid,
+            row.tid,
+            row.state,
+            row.cpu,
+            row.nice,
+            row.level,
+            stats.user_ticks,
+            stats.system_ticks,
+            stats.voluntary_switches,
+            stats.involuntary_switches,
+            stats.dispatches,
+            avg_wait,
+            stats.max_ready_wait_ticks,
+            row.name
+        );
+    }
+    out
+}
+
+fn render_ps() -> String {
+    let mut rows = collect_rows();
+    rows.sort_by_key(|row| (row.pid, row.tid));
+
+    let mut out = String::new();
+    let _ = writeln!(out, "{:>5} {:>5} S {:>10}  CMD", "PID", "TID", "TIME");
+    for row in rows {
+        let (seconds, millis) = ticks_to_seconds(row.stats.cpu_ticks());
+        let _ = writeln!(
+            out,
+            "{:>5} {:>5} {} {:>6}.{:03}  {}",
+            row.pid, row.tid, row.state, seconds, millis, row.name
+        );
+    }
+    out
+}
+
+#[derive(Clone, Copy)]
+enum TaskView {
+    /// Tasks by CPU time with all counters.
+    Top,
+    /// Tasks by id with their total CPU time.
+    List,
+}
+
+/// Text snapshot served by the `top` and `ps` device nodes, rendered on the
+/// first read after open or after a seek back to the start.
+struct TaskFile {
+    view: TaskView,
+    text: Option<Vec<u8>>,
+    pos: usize,
+}
+
+impl FileOps for TaskFile {
+    fn read(&mut self, buf: &mut [u8]) -> Result<usize, FsError> {
+        if self.text.is_none() {
+            let text = match self.view {
+                TaskView::Top => render_top(),
+                TaskView::List => render_ps(),
+            };
+            self.text = Some(text.into_bytes());
+        }
+
+        let text = self.text.as_ref().map(Vec::as_slice).unwrap_or_default();
+        let start = self.pos.min(text.len());
+        let len = buf.len().min(text.len() - start);
+        buf[..len].copy_from_slice(&text[start..start + len]);
+        self.pos = start + len;
+        Ok(len)
+    }
+
+    fn write(&mut self, _buf: &[u8]) -> Result<usize, FsError> {
+        Err(FsError::Unsupported)
+    }
+
+    fn seek(&mut self, pos: usize) -> Result<usize, FsError> {
+        if pos == 0 {
+            self.text = None;
+        }
+        self.pos = pos;
+        Ok(pos)
+    }
+
+    fn stat(&self) -> Result<FileMetadata, FsError> {
+        Ok(FileMetadata {
+            uid: 0,
+            gid: 0,
+            mode: 0o444,
+            size: 0,
+            is_dir: false,
+            modified: 0,
+        })
+    }
+}
+
+fn open_top() -> FileHandle {
+    FileHandle::new(Box::new(TaskFile {
+        view: TaskView::Top,
+        text: None,
+        pos: 0,
+    }))
+}
+
+fn open_ps() -> FileHandle {
+    FileHandle::new(Box::new(TaskFile {
+        view: TaskView::List,
+        text: None,
+        pos: 0,
+    }))
+}
+
+crate::register_device_node!(TOP_DEVICE_NODE_REG, ["top"], open_top);
+crate::register_device_node!(PS_DEVICE_NODE_REG, ["ps"], open_ps);
@@ -1,15 +1,22 @@
-use alloc::sync::Arc;
+use alloc::{boxed::Box, sync::Arc};
 use core::arch::{asm, naked_asm};
 
 use crate::{
-    constant::{PAGING_PAGE_SIZE, USER_CODE_SEGMENT, USER_DATA_SEGMENT},
+    constant::{PAGING_PAGE_SIZE, USER_CODE_SEGMENT, USER_DATA_SEGMENT, USER_TLS_SEGMENT},
+    device::timer::current_tick,
+    fpu::FpuState,
+    gdt,
     interrupts::{InterruptFrame, enable_interrupts, without_interrupts},
     kernel::KERNEL,
     memory::{self, PageDirectory},
+    smp::cpu_id,
     utils::halt,
 };
 
-use super::process::Process;
+use super::{
+    process::Process, process_manager::deliver_pending_signals, stats::TaskStats,
+    task_manager::nice_level,
+};
 
 pub type TaskId = usize;
 
@@ -21,24 +28,45 @@ pub enum WaitReason {
     PipeRead(usize),
     PipeWrite(usize),
     Semaphore(usize),
+    Socket(usize),
+    Futex(usize),
+}
+
+impl WaitReason {
+    /// Waits on pipes, sockets and devices; the scheduler favours tasks that
+    /// wake from these over tasks that only use the CPU.
+    pub fn is_io(self) -> bool {
+        matches!(
+            self,
+            Self::Io | Self::PipeRead(_) | Self::PipeWrite(_) | Self::Socket(_)
+        )
+    }
+}
+
+/// Deadline of a blocked task; on expiry the task resumes with `return_value`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub struct WaitTimeout {
+    pub deadline: u64,
+    pub return_value: u32,
 }
 
 #[allow(dead_code)]
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum TaskState {
     Runnable,
-    Sleeping { wake_tick: u64 },
-    Blocked { reason: WaitReason },
+    Sleeping {
+        wake_tick: u64,
+    },
+    Blocked {
+        reason: WaitReason,
+        timeout: Option<WaitTimeout>,
+    },
 }
 
 impl TaskState {
     pub fn is_runnable(self) -> bool {
         matches!(self, Self::Runnable)
     }
-
-    pub fn is_waiting(self) -> bool {
-        matches!(self, Self::Sleeping { .. } | Self::Blocked { .. })
-    }
 }
 
 #[repr(C, packed)]
@@ -62,37 +90,76 @@ pub struct Task {
     pub id: TaskId,
     pub registers: Registers,
     pub process: Arc<Process>,
+    /// Current feedback queue level (0 = highest).
     pub priority: usize,
-    #[allow(dead_code)]
-    pub time_slice: u32,
+    /// Unix nice value; sets the highest level the task may reach.
+    pub nice: i32,
+    /// Ticks run at the current level; the task drops a level once this
+    /// reaches the level's quantum.
+    pub slice_used: u64,
+    /// Ready queue holding this task's live entry, if it is queued.
+    pub(super) queued_level: Option<usize>,
+    /// CPU whose ready queues hold the live entry, or that last ran the task.
+    pub cpu: usize,
+    /// Set while a CPU executes the task; its saved registers are stale then.
+    pub(super) running: bool,
+    /// Set when a wake reaches the task before it got to block; blocking
+    /// then returns at once, so a waker on another CPU is not missed.
+    pub(super) pending_wake: bool,
+    /// Signals sent while the task ran on another CPU, delivered when it next
+    /// enters the scheduler.
+    pub pending_signals: u32,
     pub state: TaskState,
+    /// Base of the `gs` segment while the task runs (`set_thread_area`).
+    pub tls_base: u32,
+    /// User word zeroed and futex-woken when the thread exits, for
+    /// `pthread_join` (`CLONE_CHILD_CLEARTID`).
+    pub clear_child_tid: u32,
+    /// CPU time and scheduling counters.
+    pub stats: TaskStats,
+    /// Tick up to which CPU time has been charged to `stats`.
+    pub(super) charged_until: u64,
+    /// Tick at which the task last entered a ready queue.
+    pub(super) ready_since: u64,
+    /// Set from entering the kernel until returning to user mode; time in
+    /// between counts as system time.
+    pub(super) in_kernel: bool,
+    /// Saved FPU/SSE registers, allocated on the first FPU instruction.
+    pub fpu: Option<Box<FpuState>>,
 }
 
 impl Task {
-    pub fn new(id: TaskId, process: Arc<Process>, priority: usize) -> Self {
-        Self {
-            id,
-            registers: Self::entry_registers(&process),
-            process,
-            priority,
-            time_slice: 0,
-            state: TaskState::Runnable,
-        }
+    pub fn new(id: TaskId, process: Arc<Process>, nice: i32) -> Self {
+        let registers = Self::entry_registers(&process);
+        Self::from_registers(id, process, nice, registers)
     }
 
     pub fn from_registers(
         id: TaskId,
         process: Arc<Process>,
-        priority: usize,
+        nice: i32,
         registers: Registers,
     ) -> Self {
         Self {
             id,
             registers,
             process,
-            priority,
-            time_slice: 0,
+            priority: nice_level(nice),
+            nice,
+            slice_used: 0,
+            queued_level: None,
+            cpu: 0,
+            running: false,
+            pending_wake: false,
+            pending_signals: 0,
             state: TaskState::Runnable,
+            tls_base: 0,
+            clear_child_tid: 0,
+            stats: TaskStats::default(),
+            charged_until: 0,
+            ready_since: 0,
+            in_kernel: false,
+            fpu: None,
         }
     }
 
@@ -117,10 +184,6 @@ impl Task {
         self.state.is_runnable()
     }
 
-    pub fn is_waiting(&self) -> bool {
-        self.state.is_waiting()
-    }
-
     pub fn set_state(&mut self, state: &InterruptFrame) {
         self.registers.edi = state.edi;
         self.registers.esi = state.esi;
@@ -143,6 +206,50 @@ impl Task {
         });
     }
 
+    /// Charges the time since the last charge to user or system time,
+    /// depending on where the task was running.
+    pub(super) fn charge_cpu_time(&mut self, now: u64) {
+        let ran = now.saturating_sub(self.charged_until);
+        if self.in_kernel {
+            self.stats.system_ticks += ran;
+        } else {
+            self.stats.user_ticks += ran;
+        }
+        self.charged_until = now;
+    }
+
+    /// Called on every entry from user mode.
+    pub fn enter_kernel(&mut self, now: u64) {
+        self.charge_cpu_time(now);
+        self.in_kernel = true;
+    }
+
+    /// Called on every return to user mode.
+    pub fn leave_kernel(&mut self, now: u64) {
+        self.charge_cpu_time(now);
+        self.in_kernel = false;
+    }
+
+    /// `stats` as of `now`, counting the time a running task has not been
+    /// charged for yet.
+    pub fn stats_at(&self, now: u64) -> TaskStats {
+        let mut stats = self.stats;
+        if self.running {
+            let ran = now.saturating_sub(self.charged_until);
+            if self.in_kernel {
+                stats.system_ticks += ran;
+            } else {
+                stats.user_ticks += ran;
+            }
+        }
+        stats
+    }
+
+    /// Makes this CPU's TLS segment point at the task's thread area.
+    pub fn load_tls(&self) {
+        gdt::set_tls_base(self.tls_base);
+    }
+
     pub fn get_stack_item(&self, index: usize) -> u32 {
         let stack_pointer = self.registers.esp as *const u32;
         self.page_task();
@@ -176,7 +283,9 @@ pub fn task_next() -> ! {
                     let Some(current_task) = tm.get_current() else {
                         return TaskSwitch::NoTasks;
                     };
-                    let task = current_task.read();
+                    let mut task = current_task.write();
+                    task.leave_kernel(current_tick());
+                    deliver_pending_signals(&mut task);
                     TaskSwitch::Run(task.registers)
                 }
                 ScheduleOutcome::Idle => TaskSwitch::Idle,
@@ -191,6 +300,11 @@ pub fn task_next() -> ! {
                 enable_interrupts();
                 halt();
             }
+            // Application processors wait for work even with no tasks at all.
+            TaskSwitch::NoTasks if cpu_id() != 0 => {
+                enable_interrupts();
+                halt();
+            }
             TaskSwitch::NoTasks => {
                 panic!("scheduler stopped: no runnable tasks and no sleeping/blocked tasks")
             }
@@ -198,10 +312,19 @@ pub fn task_next() -> ! {
     }
 }
 
-pub fn task_page() {
-    KERNEL.with_task_manager(|tm| {
-        let _ = tm.task_page();
+/// Switches back to the address space of the interrupted task. If another
+/// CPU removed that task meanwhile, schedule instead of returning to it.
+pub fn task_page(frame: &InterruptFrame) {
+    let from_user = { frame.cs } & 3 == 3;
+    let resumed = KERNEL.with_task_manager(|tm| {
+        if from_user && let Some(current_task) = tm.get_current() {
+            current_task.write().leave_kernel(current_tick());
+        }
+        tm.task_page().is_ok()
     });
+    if !resumed && from_user {
+        task_next();
+    }
 }
 
 pub fn task_current_save_state(frame: &InterruptFrame) {
@@ -213,6 +336,11 @@ pub fn task_current_save_state(frame: &InterruptFrame) {
         };
         let mut task = current_task.write();
         task.set_state(frame);
+        // A wake recorded before this entry was for a wait that is over.
+        task.pending_wake = false;
+        if { frame.cs } & 3 == 3 {
+            task.enter_kernel(current_tick());
+        }
     });
 }
 
@@ -232,6 +360,8 @@ pub fn copy_string_from_task(
     phys: u32,
     size: u32,
 ) -> Result<(), ()> {
+    prepare_user_range(directory, virt, size, false)?;
+
     without_interrupts(|| {
         let mut remain = size;
         let flags = memory::PRESENT | memory::USER_ACCESS | memory::WRITABLE;
@@ -266,12 +396,53 @@ pub fn copy_string_from_task(
     })
 }
 
+/// Maps the demand-paged pages that `size` bytes at `virt` cover, since
+/// the copy cannot fault them in itself. Fails if one cannot be, or, for a
+/// `write`, if one is a user page the program may not write, such as
+/// executable text shared with other processes: copies run in ring 0, which
+/// would otherwise write through read-only mappings.
+fn prepare_user_range(
+    directory: &PageDirectory,
+    virt: u32,
+    size: u32,
+    write: bool,
+) -> Result<(), ()> {
+    let end = virt.saturating_add(size);
+    let mut page = PageDirectory::align_address_down(virt);
+    while page < end {
+        let mut entry = directory.get(page).map_err(|_| ())?;
+        if entry & memory::LAZY != 0 && entry & memory::PRESENT == 0 {
+            if !directory.fault_in(page) {
+                return Err(());
+            }
+            entry = directory.get(page).map_err(|_| ())?;
+        }
+        // Such as the guard page below the stack.
+        if entry & memory::PRESENT == 0 {
+            return Err(());
+        }
+        if write
+            && entry & memory::USER_ACCESS != 0
+            && entry & (memory::WRITABLE | memory::COW) == 0
+        {
+            return Err(());
+        }
+        let Some(next) = page.checked_add(PAGING_PAGE_SIZE as u32) else {
+            break;
+        };
+        page = next;
+    }
+    Ok(())
+}
+
 pub fn copy_string_to_task(
     directory: &PageDirectory,
     buff: u32,
     virt: u32,
     size: u32,
 ) -> Result<(), ()> {
+    prepare_user_range(directory, virt, size, true)?;
+
     without_interrupts(|| {
         let mut remain = size;
         let flags = memory::PRESENT | memory::USER_ACCESS | memory::WRITABLE;
@@ -311,8 +482,9 @@ pub fn user_registers() {
             "mov ds, ax",
             "mov es, ax",
             "mov fs, ax",
-            "mov gs, ax",
-            in("ax") 0x23u16,
+            "mov gs, cx",
+            in("ax") USER_DATA_SEGMENT as u16,
+            in("cx") USER_TLS_SEGMENT as u16,
             options(nostack, preserves_flags)
         );
     }
@@ -338,6 +510,7 @@ pub unsafe extern "C" fn task_return(regs: &Registers) -> ! {
         "mov  ds, ax",
         "mov  es, ax",
         "mov  fs, ax",
+        "mov  ax, {tls}",
         "mov  gs, ax",
         "mov  edi, [ebx + 0]",
         "mov  esi, [ebx + 4]",
@@ -348,5 +521,6 @@ pub unsafe extern "C" fn task_return(regs: &Registers) -> ! {
         "mov  ebx, [ebx + 12]", // restore EBX last
         "sti",
         "iretd", // 32-bit: assembles to IRETD
+        tls = const USER_TLS_SEGMENT,
     );
 }
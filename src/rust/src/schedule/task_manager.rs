@@ -1,19 +1,45 @@
 use alloc::{
     collections::{BTreeMap, VecDeque},
     sync::Arc,
-    vec::Vec,
 };
 use spin::RwLock;
 
-use crate::{error::KernelError, interrupts::without_interrupts, schedule::task::user_registers};
+use crate::{
+    constant::{MAX_CPUS, SCHEDULER_BOOST_TICKS, SCHEDULER_LEVELS, SCHEDULER_TIME_SLICE_TICKS},
+    device::{
+        timer::{TIMER_DRIVER, current_tick},
+        writeback,
+    },
+    error::KernelError,
+    fpu,
+    interrupts::without_interrupts,
+    schedule::task::user_registers,
+    smp::{self, cpu_id, is_online, send_reschedule},
+};
 
 use super::{
     process::Process,
-    task::{Registers, Task, TaskId, TaskState, WaitReason},
+    stats::TaskStats,
+    task::{Registers, Task, TaskId, TaskState, WaitReason, WaitTimeout},
+    timer::TimerQueue,
 };
 
-/// Maximum scheduler priority (0 = highest)
-const MAX_PRIORITY: usize = 1;
+/// Range of Unix nice values accepted by `setpriority`.
+pub const NICE_MIN: i32 = -20;
+pub const NICE_MAX: i32 = 19;
+
+/// Highest feedback level a task with `nice` may reach. Nice values are spread
+/// over the upper half of the levels; the lower half is only reached by
+/// running out of quanta.
+pub fn nice_level(nice: i32) -> usize {
+    let steps = (nice.clamp(NICE_MIN, NICE_MAX) - NICE_MIN) as usize;
+    steps * (SCHEDULER_LEVELS / 2) / (NICE_MAX - NICE_MIN + 1) as usize
+}
+
+/// Ticks a task may run at `level` before it drops to the next one.
+pub fn level_quantum(level: usize) -> u64 {
+    SCHEDULER_TIME_SLICE_TICKS << (level / 2)
+}
 
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum ScheduleOutcome {
@@ -22,33 +48,86 @@ pub enum ScheduleOutcome {
     NoTasks,
 }
 
+/// Scheduling state of one CPU.
+struct CpuQueue {
+    ready: [VecDeque<TaskId>; SCHEDULER_LEVELS],
+    /// Live entries in `ready`; stale ones are not counted.
+    queued: usize,
+    current: Option<TaskId>,
+    /// Keeps the address space this CPU may still be using alive until it
+    /// switches away, even if another CPU removes the task meanwhile.
+    current_process: Option<Arc<Process>>,
+    /// Tick at which the current task was dispatched.
+    slice_start: u64,
+    /// Tick at which the current task should yield if others are ready.
+    slice_end: u64,
+}
+
+impl CpuQueue {
+    fn new() -> Self {
+        Self {
+            ready: core::array::from_fn(|_| VecDeque::new()),
+            queued: 0,
+            current: None,
+            current_process: None,
+            slice_start: 0,
+            slice_end: 0,
+        }
+    }
+
+    fn is_idle(&self) -> bool {
+        self.current.is_none() && self.queued == 0
+    }
+
+    fn ready_above(&self, level: usize) -> bool {
+        self.ready[..level].iter().any(|queue| !queue.is_empty())
+    }
+}
+
+/// Multilevel feedback queue scheduler.
+///
+/// Tasks start at the level given by their nice value and drop one level each
+/// time they use up that level's quantum, which doubles every two levels.
+/// Waking from I/O moves a task back up, and every `SCHEDULER_BOOST_TICKS`
+/// all tasks return to their top level.
+///
+/// Each CPU has its own ready queues. A task is queued on the CPU it last ran
+/// on unless another CPU sits idle; a CPU that runs out of work steals from
+/// the busiest one, and a CPU with much less queued than another pulls one
+/// task over at each scheduling decision.
+///
+/// Ready queues may hold stale ids of exited tasks or of tasks that changed
+/// level while queued; `Task::queued_level` and `Task::cpu` tell which entry
+/// is live, so queueing and removal never scan a queue.
 pub struct TaskManager {
     tasks: BTreeMap<TaskId, RwLock<Task>>,
-    ready: [VecDeque<TaskId>; MAX_PRIORITY],
-    current: Option<TaskId>,
+    cpus: [CpuQueue; MAX_CPUS],
     next_task_id: TaskId,
-    tick: u64,
+    /// Tick of the next periodic priority boost.
+    next_boost: u64,
+    /// Deadlines of sleeping tasks and of blocked tasks with a timeout. The
+    /// BSP keeps the clock armed for them.
+    timers: TimerQueue<TaskId>,
 }
 
 impl TaskManager {
     pub fn new() -> Self {
         TaskManager {
             tasks: BTreeMap::new(),
-            ready: [VecDeque::new()],
-            current: None,
+            cpus: core::array::from_fn(|_| CpuQueue::new()),
             next_task_id: 0,
-            tick: 0,
+            next_boost: SCHEDULER_BOOST_TICKS,
+            timers: TimerQueue::new(),
         }
     }
 
     pub fn spawn(&mut self, process: Arc<Process>) -> Result<TaskId, KernelError> {
-        let priority = 0;
         let id = self.next_task_id;
         self.next_task_id += 1;
-        let task = Task::new(id, process, priority);
+        let task = Task::new(id, process, 0);
         let nn = RwLock::new(task);
         self.tasks.insert(id, nn);
-        self.queue_ready(id, priority);
+        self.queue_ready(id);
         Ok(id)
     }
 
@@ -56,226 +135,450 @@ impl TaskManager {
         &mut self,
         process: Arc<Process>,
         registers: Registers,
-        priority: usize,
+        nice: i32,
     ) -> Result<TaskId, KernelError> {
-        let priority = priority.min(MAX_PRIORITY - 1);
         let id = self.next_task_id;
         self.next_task_id += 1;
-        let task = Task::from_registers(id, process, priority, registers);
+        let mut task = Task::from_registers(id, process, nice, registers);
+        // Start next to the parent; `queue_ready` moves it if a CPU is idle.
+        task.cpu = cpu_id();
         self.tasks.insert(id, RwLock::new(task));
-        self.queue_ready(id, priority);
+        self.queue_ready(id);
         Ok(id)
     }
 
     pub fn task_page(&self) -> Result<(), KernelError> {
-        if let Some(cur) = self.current
-            && let Some(nn_cur) = self.tasks.get(&cur)
-        {
-            let process = &nn_cur.read().process;
-            without_interrupts(|| {
-                user_registers();
-                process.page_directory.switch();
-            });
+        if let Some(nn_cur) = self.get_current() {
+            switch_to(&nn_cur.read());
             return Ok(());
         }
         Err(KernelError::NoTasks)
     }
 
     pub fn schedule(&mut self) -> ScheduleOutcome {
-        if let Some(cur) = self.current
+        let outcome = self.pick_next();
+        self.update_timer();
+        outcome
+    }
+
+    fn pick_next(&mut self) -> ScheduleOutcome {
+        let cpu = cpu_id();
+        let now = current_tick();
+        if now >= self.next_boost {
+            self.boost_all();
+            self.next_boost = now.saturating_add(SCHEDULER_BOOST_TICKS);
+        }
+
+        if let Some(cur) = self.cpus[cpu].current
             && let Some(nn_cur) = self.tasks.get(&cur)
         {
-            let prio = {
+            let (runnable, level) = {
                 let task = nn_cur.read();
-                task.is_runnable().then_some(task.priority)
+                (task.is_runnable(), task.priority)
+            };
+
+            // Interrupts and syscalls land here too; only give up the CPU when
+            // the slice is over or something more urgent is ready.
+            let queue = &self.cpus[cpu];
+            if runnable && now < queue.slice_end && !queue.ready_above(level) {
+                switch_to(&nn_cur.read());
+                return ScheduleOutcome::Switched;
+            }
+
+            let requeue = {
+                let mut task = nn_cur.write();
+                charge(&mut task, now.saturating_sub(queue.slice_start));
+                task.leave_kernel(now);
+                fpu::save(&mut task);
+                if task.is_runnable() {
+                    task.stats.involuntary_switches += 1;
+                } else {
+                    task.stats.voluntary_switches += 1;
+                }
+                task.running = false;
+                task.pending_wake = false;
+                // A signal that arrived on its way to block ends the wait.
+                if task.pending_signals != 0 {
+                    task.state = TaskState::Runnable;
+                }
+                task.is_runnable()
             };
-            if let Some(prio) = prio {
-                self.queue_ready(cur, prio);
+            // Count this CPU as free so the task stays here unless another
+            // task is waiting for it.
+            self.cpus[cpu].current = None;
+            if requeue {
+                self.queue_ready(cur);
             }
         }
+        self.cpus[cpu].current = None;
 
-        for prio in 0..MAX_PRIORITY {
-            while let Some(next_id) = self.ready[prio].pop_front() {
-                let Some(nn_next) = self.tasks.get(&next_id) else {
-                    continue;
-                };
+        self.balance(cpu);
+        let next = self.pop_ready(cpu, false).or_else(|| {
+            let victim = self.busiest_cpu(cpu)?;
+            self.pop_ready(victim, true)
+        });
+
+        if let Some(next_id) = next
+            && let Some(nn_next) = self.tasks.get(&next_id)
+        {
+            let (process, remaining) = {
+                let mut task = nn_next.write();
+                task.cpu = cpu;
+                task.running = true;
+                task.pending_wake = false;
+                task.charged_until = now;
+                let waited = now.saturating_sub(task.ready_since);
+                task.stats.record_dispatch(waited);
+                let quantum = level_quantum(task.priority);
+                (
+                    task.process.clone(),
+                    quantum.saturating_sub(task.slice_used).max(1),
+                )
+            };
 
-                let process = {
-                    let task = nn_next.read();
-                    if !task.is_runnable() {
-                        continue;
-                    }
+            switch_to(&nn_next.read());
+            let queue = &mut self.cpus[cpu];
+            queue.current = Some(next_id);
+            queue.current_process = Some(process);
+            queue.slice_start = now;
+            queue.slice_end = now.saturating_add(remaining);
+            return ScheduleOutcome::Switched;
+        }
+
+        self.cpus[cpu].current_process = None;
+
+        // Every transition to Runnable queues the task, so any task left
+        // is sleeping, blocked or running on another CPU.
+        if self.tasks.is_empty() {
+            ScheduleOutcome::NoTasks
+        } else {
+            ScheduleOutcome::Idle
+        }
+    }
 
-                    task.process.clone()
+    /// Pops the most urgent live entry from the ready queues of `cpu`, from
+    /// the back when stealing so the owner keeps its FIFO order. Stale
+    /// entries, and tasks still running on the CPU they were preempted or
+    /// woken on, are dropped on the way; that CPU requeues those itself.
+    fn pop_ready(&mut self, cpu: usize, from_back: bool) -> Option<TaskId> {
+        let queue = &mut self.cpus[cpu];
+        for level in 0..SCHEDULER_LEVELS {
+            loop {
+                let next = if from_back {
+                    queue.ready[level].pop_back()
+                } else {
+                    queue.ready[level].pop_front()
+                };
+                let Some(next_id) = next else {
+                    break;
+                };
+                let Some(nn_next) = self.tasks.get(&next_id) else {
+                    continue;
                 };
 
-                self.current = Some(next_id);
-                without_interrupts(|| {
-                    user_registers();
-                    process.page_directory.switch();
-                });
-                return ScheduleOutcome::Switched;
+                let mut task = nn_next.write();
+                if task.queued_level != Some(level) || task.cpu != cpu {
+                    continue;
+                }
+                task.queued_level = None;
+                queue.queued = queue.queued.saturating_sub(1);
+                if task.is_runnable() && !task.running {
+                    return Some(next_id);
+                }
             }
         }
+        None
+    }
 
-        self.current = None;
+    /// Online CPU other than `cpu` with the most queued tasks.
+    fn busiest_cpu(&self, cpu: usize) -> Option<usize> {
+        (0..MAX_CPUS)
+            .filter(|&other| other != cpu && is_online(other))
+            .filter(|&other| self.cpus[other].queued > 0)
+            .max_by_key(|&other| self.cpus[other].queued)
+    }
 
-        if let Some((task_id, process)) = self.find_runnable_task() {
-            self.current = Some(task_id);
-            without_interrupts(|| {
-                user_registers();
-                process.page_directory.switch();
-            });
-            return ScheduleOutcome::Switched;
+    /// Pulls one task from the busiest CPU when it has at least two more
+    /// queued than `cpu`, so load evens out before anyone goes idle.
+    fn balance(&mut self, cpu: usize) {
+        let Some(victim) = self.busiest_cpu(cpu) else {
+            return;
+        };
+        if self.cpus[victim].queued < self.cpus[cpu].queued + 2 {
+            return;
         }
 
-        if self.has_waiting_tasks() {
-            ScheduleOutcome::Idle
-        } else {
-            ScheduleOutcome::NoTasks
+        let Some(task_id) = self.pop_ready(victim, true) else {
+            return;
+        };
+        let Some(nn_task) = self.tasks.get(&task_id) else {
+            return;
+        };
+        let ready_since = {
+            let mut task = nn_task.write();
+            task.cpu = cpu;
+            task.ready_since
+        };
+        self.queue_ready(task_id);
+        // Moving the task does not restart its wait.
+        if let Some(nn_task) = self.tasks.get(&task_id) {
+            nn_task.write().ready_since = ready_since;
+        }
+    }
+
+    /// Moves every task back to the top level its nice value allows.
+    fn boost_all(&mut self) {
+        for (&id, nn_task) in self.tasks.iter() {
+            let mut task = nn_task.write();
+            let top = nice_level(task.nice);
+            task.priority = top;
+            task.slice_used = 0;
+            if task.queued_level.is_some_and(|level| level != top) {
+                task.queued_level = Some(top);
+                self.cpus[task.cpu].ready[top].push_back(id);
+            }
         }
     }
 
     pub fn get_current(&self) -> Option<&RwLock<Task>> {
-        if let Some(cur) = self.current {
-            self.tasks.get(&cur)
-        } else {
-            None
+        self.cpus[cpu_id()]
+            .current
+            .and_then(|cur| self.tasks.get(&cur))
+    }
+
+    pub fn get_current_id(&self) -> Option<TaskId> {
+        self.cpus[cpu_id()].current
+    }
+
+    /// Id of the task running on this CPU, if it still exists.
+    fn current_id(&mut self) -> Result<TaskId, KernelError> {
+        let queue = &mut self.cpus[cpu_id()];
+        let Some(cur) = queue.current else {
+            return Err(KernelError::NoTasks);
+        };
+        if !self.tasks.contains_key(&cur) {
+            queue.current = None;
+            return Err(KernelError::NoTasks);
         }
+        Ok(cur)
     }
 
     pub fn get(&self, task_id: TaskId) -> Option<&RwLock<Task>> {
         self.tasks.get(&task_id)
     }
 
+    pub fn iter(&self) -> impl Iterator<Item = &RwLock<Task>> {
+        self.tasks.values()
+    }
+
+    /// Counters of `task_id` up to now.
+    pub fn stats(&self, task_id: TaskId) -> Option<TaskStats> {
+        let task = self.tasks.get(&task_id)?.read();
+        Some(task.stats_at(current_tick()))
+    }
+
+    /// Whether `task_id` is executing on a CPU other than the caller's; its
+    /// saved registers are stale until that CPU enters the kernel.
+    pub fn running_elsewhere(&self, task_id: TaskId) -> bool {
+        self.tasks.get(&task_id).is_some_and(|nn_task| {
+            let task = nn_task.read();
+            task.running && task.cpu != cpu_id()
+        })
+    }
+
+    /// Makes the CPU running `task_id` enter the scheduler.
+    pub fn kick(&self, task_id: TaskId) {
+        if let Some(nn_task) = self.tasks.get(&task_id) {
+            send_reschedule(nn_task.read().cpu);
+        }
+    }
+
     pub fn remove(&mut self, task_id: TaskId) {
-        if let Some(task) = self.tasks.remove(&task_id) {
-            let prio = task.read().priority.min(MAX_PRIORITY - 1);
-            self.ready[prio].retain(|&x| x != task_id);
+        // Ready queue entries of the task go stale and are skipped when popped.
+        let Some(nn_task) = self.tasks.remove(&task_id) else {
+            return;
+        };
+
+        let mut task = nn_task.into_inner();
+        if task.running {
+            task.charge_cpu_time(current_tick());
+        }
+        task.process.usage.lock().exited.add(&task.stats);
+
+        let queue = &mut self.cpus[task.cpu];
+        if task.queued_level.is_some() {
+            queue.queued = queue.queued.saturating_sub(1);
         }
-        if self.current == Some(task_id) {
-            self.current = None;
+        if queue.current == Some(task_id) {
+            queue.current = None;
+            // Take the CPU away from the task if it runs somewhere else.
+            send_reschedule(task.cpu);
         }
     }
 
     pub fn get_tick(&self) -> u64 {
-        self.tick
+        current_tick()
     }
 
+    /// Expires timers up to the current tick. Called from the clock
+    /// interrupts, which no longer fire every tick in dynamic mode.
     pub fn tick(&mut self) {
-        self.tick = self.tick.wrapping_add(1);
+        let now = current_tick();
+        while let Some((deadline, task_id)) = self.timers.pop_expired(now) {
+            self.expire_timer(task_id, deadline);
+        }
+    }
+
+    /// Wakes `task_id` if it is still waiting on the timer that expired at
+    /// `deadline`. Timers of tasks that were woken earlier or exited are stale
+    /// and ignored.
+    fn expire_timer(&mut self, task_id: TaskId, deadline: u64) {
+        let Some(nn_task) = self.tasks.get(&task_id) else {
+            return;
+        };
 
-        let now = self.tick;
-        let mut wake: Vec<(TaskId, usize)> = Vec::new();
-        for (task_id, nn_task) in &self.tasks {
+        {
             let mut task = nn_task.write();
-            if let TaskState::Sleeping { wake_tick } = task.state
-                && now >= wake_tick
-            {
-                task.state = TaskState::Runnable;
-                wake.push((*task_id, task.priority));
+            match task.state {
+                TaskState::Sleeping { wake_tick } if wake_tick == deadline => {}
+                TaskState::Blocked {
+                    timeout: Some(timeout),
+                    ..
+                } if timeout.deadline == deadline => {
+                    task.registers.eax = timeout.return_value;
+                }
+                _ => return,
             }
+            task.state = TaskState::Runnable;
         }
 
-        for (task_id, prio) in wake {
-            self.queue_ready(task_id, prio);
+        self.queue_ready(task_id);
+    }
+
+    /// Adds a timer; the BSP is told to re-arm if it is now the earliest.
+    fn insert_timer(&mut self, deadline: u64, task_id: TaskId) {
+        let earliest = self
+            .timers
+            .next_deadline()
+            .is_none_or(|next| deadline < next);
+        self.timers.insert(deadline, task_id);
+        if earliest {
+            send_reschedule(0);
         }
     }
 
     pub fn sleep_current_until(&mut self, wake_tick: u64) -> Result<(), KernelError> {
-        let Some(cur) = self.current else {
-            return Err(KernelError::NoTasks);
-        };
-
+        let cur = self.current_id()?;
         let Some(nn_task) = self.tasks.get(&cur) else {
-            self.current = None;
             return Err(KernelError::NoTasks);
         };
 
-        let mut task = nn_task.write();
-        task.state = TaskState::Sleeping {
-            wake_tick: wake_tick.max(self.tick.wrapping_add(1)),
-        };
+        let wake_tick = wake_tick.max(current_tick().wrapping_add(1));
+        nn_task.write().state = TaskState::Sleeping { wake_tick };
+        self.insert_timer(wake_tick, cur);
         Ok(())
     }
 
     #[allow(dead_code)]
     pub fn block_current(&mut self, reason: WaitReason) -> Result<TaskId, KernelError> {
-        let Some(cur) = self.current else {
-            return Err(KernelError::NoTasks);
-        };
-
+        let cur = self.current_id()?;
         let Some(nn_task) = self.tasks.get(&cur) else {
-            self.current = None;
             return Err(KernelError::NoTasks);
         };
 
-        nn_task.write().state = TaskState::Blocked { reason };
+        let mut task = nn_task.write();
+        if !core::mem::take(&mut task.pending_wake) {
+            task.state = TaskState::Blocked {
+                reason,
+                timeout: None,
+            };
+        }
         Ok(cur)
     }
 
-    pub fn block_current_and_restart_syscall(
+    /// Blocks the current task until it is woken or `deadline` passes. On
+    /// timeout the task resumes with `timeout_value` as its syscall result.
+    pub fn block_current_until(
         &mut self,
         reason: WaitReason,
+        deadline: u64,
+        timeout_value: u32,
     ) -> Result<TaskId, KernelError> {
-        let Some(cur) = self.current else {
-            return Err(KernelError::NoTasks);
-        };
-
+        let cur = self.current_id()?;
         let Some(nn_task) = self.tasks.get(&cur) else {
-            self.current = None;
             return Err(KernelError::NoTasks);
         };
 
-        let mut task = nn_task.write();
-        task.registers.ip = task.registers.ip.saturating_sub(2);
-        task.state = TaskState::Blocked { reason };
+        if core::mem::take(&mut nn_task.write().pending_wake) {
+            return Ok(cur);
+        }
+
+        let deadline = deadline.max(current_tick().wrapping_add(1));
+        nn_task.write().state = TaskState::Blocked {
+            reason,
+            timeout: Some(WaitTimeout {
+                deadline,
+                return_value: timeout_value,
+            }),
+        };
+        self.insert_timer(deadline, cur);
         Ok(cur)
     }
 
-    #[allow(dead_code)]
+    /// Makes a sleeping or blocked task runnable and queues it. A task still
+    /// running, on its way to block on another CPU, is marked in
+    /// `Task::pending_wake` so that blocking returns at once instead of
+    /// missing the wake.
     pub fn wake_task(&mut self, task_id: TaskId) -> Result<(), KernelError> {
         let Some(nn_task) = self.tasks.get(&task_id) else {
             return Err(KernelError::NoTasks);
         };
 
-        let priority = {
+        {
             let mut task = nn_task.write();
-            task.state = TaskState::Runnable;
-            task.priority
-        };
+            if task.state.is_runnable() {
+                if task.running {
+                    task.pending_wake = true;
+                }
+                return Ok(());
+            }
+            make_runnable(&mut task);
+        }
 
-        self.queue_ready(task_id, priority);
+        self.queue_ready(task_id);
         Ok(())
     }
 
-    pub fn wake_task_with_return_value(
+    pub fn is_blocked_on(&self, task_id: TaskId, reason: WaitReason) -> bool {
+        self.tasks.get(&task_id).is_some_and(|task| {
+            matches!(task.read().state, TaskState::Blocked { reason: blocked, .. } if blocked == reason)
+        })
+    }
+
+    /// Wakes a task blocked on `reason`, letting `resume` set up the registers
+    /// it continues with. Returns false if the task no longer waits there.
+    pub fn resume_blocked(
         &mut self,
         task_id: TaskId,
-        return_value: u32,
-    ) -> Result<(), KernelError> {
-        let Some(nn_task) = self.tasks.get(&task_id) else {
-            return Err(KernelError::NoTasks);
-        };
+        reason: WaitReason,
+        resume: impl FnOnce(&mut Registers),
+    ) -> bool {
+        if !self.is_blocked_on(task_id, reason) {
+            return false;
+        }
 
-        let priority = {
+        if let Some(nn_task) = self.tasks.get(&task_id) {
             let mut task = nn_task.write();
-            task.registers.eax = return_value;
-            task.state = TaskState::Runnable;
-            task.priority
-        };
-
-        self.queue_ready(task_id, priority);
-        Ok(())
+            resume(&mut task.registers);
+            make_runnable(&mut task);
+        }
+        self.queue_ready(task_id);
+        true
     }
 
     pub fn exec_current(&mut self, process: Arc<Process>) -> Result<(), KernelError> {
-        let Some(cur) = self.current else {
-            return Err(KernelError::NoTasks);
-        };
-
+        let cur = self.current_id()?;
         let Some(nn_task) = self.tasks.get(&cur) else {
-            self.current = None;
             return Err(KernelError::NoTasks);
         };
 
@@ -283,27 +586,167 @@ impl TaskManager {
         task.registers = Task::entry_registers(&process);
         task.process = process;
         task.state = TaskState::Runnable;
+        task.tls_base = 0;
+        task.clear_child_tid = 0;
+        fpu::discard(&mut task);
+        Ok(())
+    }
+
+    /// Changes the nice value of `task_id` and moves it to the matching level.
+    pub fn set_nice(&mut self, task_id: TaskId, nice: i32) -> Result<(), KernelError> {
+        let Some(nn_task) = self.tasks.get(&task_id) else {
+            return Err(KernelError::NoTasks);
+        };
+
+        let queued = {
+            let mut task = nn_task.write();
+            task.nice = nice.clamp(NICE_MIN, NICE_MAX);
+            task.priority = nice_level(task.nice);
+            task.slice_used = 0;
+            task.queued_level.is_some()
+        };
+
+        if queued {
+            self.queue_ready(task_id);
+        }
         Ok(())
     }
 
-    fn queue_ready(&mut self, task_id: TaskId, priority: usize) {
-        let priority = priority.min(MAX_PRIORITY - 1);
-        if !self.ready[priority].contains(&task_id) {
-            self.ready[priority].push_back(task_id);
+    /// Appends `task_id` to a ready queue unless it is already there. New
+    /// entries go to the CPU the task last ran on, or to an idle CPU if that
+    /// one is busy; a queued task that changed level stays on its CPU.
+    fn queue_ready(&mut self, task_id: TaskId) {
+        let Some(nn_task) = self.tasks.get(&task_id) else {
+            return;
+        };
+
+        let (cpu, level) = {
+            let mut task = nn_task.write();
+            let level = task.priority.min(SCHEDULER_LEVELS - 1);
+            if task.queued_level == Some(level) {
+                return;
+            }
+
+            if task.queued_level.is_none() {
+                task.cpu = place(&self.cpus, task.cpu);
+                task.ready_since = current_tick();
+                self.cpus[task.cpu].queued += 1;
+            }
+            task.queued_level = Some(level);
+            (task.cpu, level)
+        };
+        self.cpus[cpu].ready[level].push_back(task_id);
+
+        let queue = &self.cpus[cpu];
+        let Some(cur) = queue.current.filter(|&cur| cur != task_id) else {
+            if cpu != cpu_id() && queue.current.is_none() {
+                send_reschedule(cpu);
+            }
+            return;
+        };
+
+        // A task woken above the running one preempts it at the next clock
+        // interrupt instead of waiting for the slice to end.
+        let current_level = self.tasks.get(&cur).map(|task| task.read().priority);
+        let preempt = current_level.is_some_and(|current_level| level < current_level);
+        if preempt {
+            let queue = &mut self.cpus[cpu];
+            queue.slice_end = queue.slice_end.min(current_tick());
+        }
+
+        // A running task alone has no slice timer; arm it now there is
+        // company. Another CPU does that itself once interrupted.
+        if cpu == cpu_id() {
+            self.update_timer();
+        } else if preempt || self.cpus[cpu].queued == 1 {
+            send_reschedule(cpu);
         }
     }
 
-    fn find_runnable_task(&self) -> Option<(TaskId, Arc<Process>)> {
-        self.tasks.iter().find_map(|(task_id, nn_task)| {
-            let task = nn_task.read();
-            task.is_runnable()
-                .then(|| (*task_id, Arc::clone(&task.process)))
-        })
+    /// Earliest tick this CPU needs a clock interrupt for: the end of the
+    /// current slice if another task is waiting for a CPU, and on the BSP
+    /// the next timer deadline or flusher pass. `None` lets the clock stop
+    /// entirely.
+    fn next_timer_event(&self, cpu: usize) -> Option<u64> {
+        let queue = &self.cpus[cpu];
+        let contended = queue.current.is_some() && self.cpus.iter().any(|queue| queue.queued > 0);
+        let slice_end = contended.then_some(queue.slice_end);
+        let deadline = if cpu == 0 {
+            match (self.timers.next_deadline(), writeback::next_pass()) {
+                (Some(deadline), Some(pass)) => Some(deadline.min(pass)),
+                (deadline, pass) => deadline.or(pass),
+            }
+        } else {
+            None
+        };
+
+        match (deadline, slice_end) {
+            (Some(deadline), Some(slice_end)) => Some(deadline.min(slice_end)),
+            (deadline, slice_end) => deadline.or(slice_end),
+        }
+    }
+
+    /// Has the BSP re-arm its clock for a deadline kept outside the task
+    /// manager, such as the flusher's.
+    pub fn rearm_timer(&self) {
+        if cpu_id() == 0 {
+            self.update_timer();
+        } else {
+            send_reschedule(0);
+        }
+    }
+
+    fn update_timer(&self) {
+        let cpu = cpu_id();
+        let event = self.next_timer_event(cpu);
+        if cpu == 0 {
+            TIMER_DRIVER.set_next_event(event);
+        } else {
+            smp::set_next_event(event);
+        }
+    }
+}
+
+/// CPU that should queue a task last run on `preferred`: that one unless it
+/// is busy while another online CPU sits idle.
+fn place(cpus: &[CpuQueue; MAX_CPUS], preferred: usize) -> usize {
+    let preferred = if is_online(preferred) { preferred } else { 0 };
+    if cpus[preferred].is_idle() {
+        return preferred;
     }
+    (0..MAX_CPUS)
+        .find(|&cpu| is_online(cpu) && cpus[cpu].is_idle())
+        .unwrap_or(preferred)
+}
+
+fn switch_to(task: &Task) {
+    without_interrupts(|| {
+        task.load_tls();
+        fpu::switch_to(task);
+        user_registers();
+        task.process.page_directory.switch();
+    });
+}
+
+/// Charges `ran` ticks to `task` at its current level and demotes it once the
+/// level's quantum is used up, however often it gave up the CPU in between.
+fn charge(task: &mut Task, ran: u64) {
+    task.slice_used = task.slice_used.saturating_add(ran);
+    if task.slice_used >= level_quantum(task.priority) {
+        task.priority = (task.priority + 1).min(SCHEDULER_LEVELS - 1);
+        task.slice_used = 0;
+    }
+}
 
-    fn has_waiting_tasks(&self) -> bool {
-        self.tasks
-            .values()
-            .any(|nn_task| nn_task.read().is_waiting())
+/// Marks a woken task runnable. Tasks that waited on I/O move up one level
+/// with a fresh quantum, so interactive tasks stay ahead of CPU-bound ones.
+fn make_runnable(task: &mut Task) {
+    if let TaskState::Blocked { reason, .. } = task.state
+        && reason.is_io()
+        && task.priority > nice_level(task.nice)
+    {
+        task.priority -= 1;
+        task.slice_used = 0;
     }
+    task.state = TaskState::Runnable;
 }
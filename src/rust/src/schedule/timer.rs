@@ -0,0 +1,76 @@
+use alloc::collections::BinaryHeap;
+use core::cmp::Ordering;
+
+/// Min-heap of deadlines measured in scheduler ticks.
+///
+/// Entries are never removed early: owners cancel a timer by changing the
+/// state the entry refers to and ignoring the entry when it expires. That keeps
+/// insertion and expiry at O(log n) without a back-pointer per timer.
+pub struct TimerQueue<T> {
+    heap: BinaryHeap<TimerEntry<T>>,
+    next_seq: u64,
+}
+
+struct TimerEntry<T> {
+    deadline: u64,
+    seq: u64,
+    item: T,
+}
+
+impl<T> TimerQueue<T> {
+    pub const fn new() -> Self {
+        Self {
+            heap: BinaryHeap::new(),
+            next_seq: 0,
+        }
+    }
+
+    pub fn insert(&mut self, deadline: u64, item: T) {
+        let seq = self.next_seq;
+        self.next_seq = self.next_seq.wrapping_add(1);
+        self.heap.push(TimerEntry {
+            deadline,
+            seq,
+            item,
+        });
+    }
+
+    /// Earliest pending deadline, including entries that may be stale.
+    pub fn next_deadline(&self) -> Option<u64> {
+        self.heap.peek().map(|entry| entry.deadline)
+    }
+
+    /// Pops one entry whose deadline is at or before `now`.
+    pub fn pop_expired(&mut self, now: u64) -> Option<(u64, T)> {
+        if self.heap.peek()?.deadline > now {
+            return None;
+        }
+        self.heap.pop().map(|entry| (entry.deadline, entry.item))
+    }
+
+    pub fn len(&self) -> usize {
+        self.heap.len()
+    }
+}
+
+// `BinaryHeap` is a max-heap, so order entries by reversed (deadline, seq).
+// The sequence number keeps timers with equal deadlines in FIFO order.
+impl<T> Ord for TimerEntry<T> {
+    fn cmp(&self, other: &Self) -> Ordering {
+        (other.deadline, other.seq).cmp(&(self.deadline, self.seq))
+    }
+}
+
+impl<T> PartialOrd for TimerEntry<T> {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+impl<T> PartialEq for TimerEntry<T> {
+    fn eq(&self, other: &Self) -> bool {
+        self.deadline == other.deadline && self.seq == other.seq
+    }
+}
+
+impl<T> Eq for TimerEntry<T> {}
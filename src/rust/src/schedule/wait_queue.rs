@@ -0,0 +1,152 @@
+use alloc::collections::VecDeque;
+
+use crate::error::KernelError;
+
+use super::{
+    task::{TaskId, WaitReason, WaitTimeout},
+    task_manager::TaskManager,
+};
+
+/// How a parked task continues once it is woken.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Resume {
+    /// The waker finished the operation; the syscall returns this value.
+    Value(u32),
+    /// The syscall runs again from the start.
+    Restart,
+}
+
+/// A task parked on a `WaitQueue`, with what it asked for.
+pub struct Waiter<T> {
+    pub task_id: TaskId,
+    pub data: T,
+    reason: WaitReason,
+    /// Syscall number the task entered with, for `Resume::Restart`.
+    syscall: u32,
+}
+
+impl<T> Waiter<T> {
+    /// Makes the task runnable again. Returns false if it stopped waiting in
+    /// the meantime (timeout, signal or exit).
+    pub fn resume(&self, task_manager: &mut TaskManager, resume: Resume) -> bool {
+        let syscall = self.syscall;
+        task_manager.resume_blocked(self.task_id, self.reason, |registers| match resume {
+            Resume::Value(value) => registers.eax = value,
+            Resume::Restart => {
+                registers.eax = syscall;
+                registers.ip = registers.ip.saturating_sub(2);
+            }
+        })
+    }
+}
+
+/// FIFO of tasks blocked on one kernel object. Parking and waking both run
+/// under the task manager lock together with the lock of the object, so a
+/// wake can never fall between the check that made a task wait and the
+/// task blocking.
+///
+/// Entries of tasks that stopped waiting are not removed eagerly; `pop`
+/// skips them.
+pub struct WaitQueue<T = ()> {
+    waiters: VecDeque<Waiter<T>>,
+}
+
+impl<T> WaitQueue<T> {
+    pub const fn new() -> Self {
+        Self {
+            waiters: VecDeque::new(),
+        }
+    }
+
+    /// Whether no entries are queued, live or stale.
+    pub fn is_empty(&self) -> bool {
+        self.waiters.is_empty()
+    }
+
+    /// Blocks the current task on `reason` and queues it with `data`. The
+    /// caller switches away with `task_next` afterwards.
+    ///
+    /// The task leaves with the value its waker chooses, with the timeout's
+    /// value once `timeout` passes, or with `interrupted` if a signal ends
+    /// the wait.
+    pub fn park(
+        &mut self,
+        task_manager: &mut TaskManager,
+        reason: WaitReason,
+        data: T,
+        timeout: Option<WaitTimeout>,
+        interrupted: u32,
+    ) -> Result<TaskId, KernelError> {
+        let (task_id, syscall) = {
+            let mut task = task_manager
+                .get_current()
+                .ok_or(KernelError::NoTasks)?
+                .write();
+            let syscall = task.registers.eax;
+            task.registers.eax = interrupted;
+            (task.id, syscall)
+        };
+
+        match timeout {
+            Some(timeout) => {
+                task_manager.block_current_until(reason, timeout.deadline, timeout.return_value)?
+            }
+            None => task_manager.block_current(reason)?,
+        };
+
+        self.waiters.retain(|waiter| waiter.task_id != task_id);
+        if task_manager.is_blocked_on(task_id, reason) {
+            self.waiters.push_back(Waiter {
+                task_id,
+                data,
+                reason,
+                syscall,
+            });
+        }
+        Ok(task_id)
+    }
+
+    /// Removes the oldest task that is still waiting, dropping stale entries
+    /// on the way.
+    pub fn pop(&mut self, task_manager: &TaskManager) -> Option<Waiter<T>> {
+        while let Some(waiter) = self.waiters.pop_front() {
+            if task_manager.is_blocked_on(waiter.task_id, waiter.reason) {
+                return Some(waiter);
+            }
+        }
+        None
+    }
+
+    /// Drops the entries of tasks that stopped waiting.
+    pub fn prune(&mut self, task_manager: &TaskManager) {
+        self.waiters
+            .retain(|waiter| task_manager.is_blocked_on(waiter.task_id, waiter.reason));
+    }
+
+    /// Wakes the oldest waiting task. Returns false if there was none.
+    pub fn wake_one(
+        &mut self,
+        task_manager: &mut TaskManager,
+        resume: impl FnOnce(&T) -> Resume,
+    ) -> bool {
+        let Some(waiter) = self.pop(task_manager) else {
+            return false;
+        };
+        waiter.resume(task_manager, resume(&waiter.data))
+    }
+
+    /// Wakes every waiting task and returns how many there were.
+    pub fn wake_all(
+        &mut self,
+        task_manager: &mut TaskManager,
+        mut resume: impl FnMut(&T) -> Resume,
+    ) -> usize {
+        let mut woken = 0;
+        while let Some(waiter) = self.pop(task_manager) {
+            if waiter.resume(task_manager, resume(&waiter.data)) {
+                woken += 1;
+            }
+        }
+        woken
+    }
+}
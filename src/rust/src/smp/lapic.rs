@@ -0,0 +1,135 @@
+use core::sync::atomic::{AtomicU32, AtomicUsize, Ordering};
+
+use crate::{
+    constant::{LAPIC_SPURIOUS_VECTOR, LAPIC_TIMER_VECTOR},
+    device::timer::{current_tick, measure_ticks},
+};
+
+use super::tables::DEFAULT_LAPIC_BASE;
+
+const REG_ID: usize = 0x20;
+const REG_TPR: usize = 0x80;
+const REG_EOI: usize = 0xB0;
+const REG_SVR: usize = 0xF0;
+const REG_ICR_LOW: usize = 0x300;
+const REG_ICR_HIGH: usize = 0x310;
+const REG_LVT_TIMER: usize = 0x320;
+const REG_TIMER_INITIAL: usize = 0x380;
+const REG_TIMER_CURRENT: usize = 0x390;
+const REG_TIMER_DIVIDE: usize = 0x3E0;
+
+const SVR_ENABLE: u32 = 1 << 8;
+const LVT_MASKED: u32 = 1 << 16;
+const TIMER_DIVIDE_BY_16: u32 = 0x3;
+
+const ICR_DELIVERY_FIXED: u32 = 0 << 8;
+const ICR_DELIVERY_INIT: u32 = 5 << 8;
+const ICR_DELIVERY_STARTUP: u32 = 6 << 8;
+const ICR_DELIVERY_PENDING: u32 = 1 << 12;
+const ICR_LEVEL_ASSERT: u32 = 1 << 14;
+const ICR_TRIGGER_LEVEL: u32 = 1 << 15;
+
+/// Ticks the timer is counted against PIT channel 2 during calibration.
+const CALIBRATION_TICKS: u32 = 10;
+
+static BASE: AtomicUsize = AtomicUsize::new(DEFAULT_LAPIC_BASE as usize);
+/// Timer counts per scheduler tick. Every local APIC runs off the same bus
+/// clock, so the BSP measures this once for all CPUs.
+static COUNTS_PER_TICK: AtomicU32 = AtomicU32::new(0);
+
+fn read(register: usize) -> u32 {
+    let address = BASE.load(Ordering::Relaxed) + register;
+    unsafe { core::ptr::read_volatile(address as *const u32) }
+}
+
+fn write(register: usize, value: u32) {
+    let address = BASE.load(Ordering::Relaxed) + register;
+    unsafe { core::ptr::write_volatile(address as *mut u32, value) }
+}
+
+pub fn set_base(base: u32) {
+    BASE.store(base as usize, Ordering::Relaxed);
+}
+
+pub fn id() -> u8 {
+    (read(REG_ID) >> 24) as u8
+}
+
+/// Software-enables the local APIC of the calling CPU with its timer masked.
+pub fn enable() {
+    write(REG_TPR, 0);
+    write(REG_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR as u32);
+    write(REG_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    write(REG_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR as u32);
+    write(REG_TIMER_INITIAL, 0);
+}
+
+pub fn eoi() {
+    write(REG_EOI, 0);
+}
+
+fn send_icr(apic_id: u8, command: u32) {
+    while read(REG_ICR_LOW) & ICR_DELIVERY_PENDING != 0 {
+        core::hint::spin_loop();
+    }
+    write(REG_ICR_HIGH, (apic_id as u32) << 24);
+    write(REG_ICR_LOW, command);
+}
+
+pub fn send_ipi(apic_id: u8, vector: u16) {
+    send_icr(
+        apic_id,
+        ICR_DELIVERY_FIXED | ICR_LEVEL_ASSERT | vector as u32,
+    );
+}
+
+pub fn send_init(apic_id: u8) {
+    send_icr(
+        apic_id,
+        ICR_DELIVERY_INIT | ICR_LEVEL_ASSERT | ICR_TRIGGER_LEVEL,
+    );
+    send_icr(apic_id, ICR_DELIVERY_INIT | ICR_TRIGGER_LEVEL);
+}
+
+/// Starts `apic_id` in real mode at physical address `page << 12`.
+pub fn send_startup(apic_id: u8, page: u8) {
+    send_icr(
+        apic_id,
+        ICR_DELIVERY_STARTUP | ICR_LEVEL_ASSERT | page as u32,
+    );
+}
+
+/// Measures the timer rate of the calling CPU against the PIT.
+pub fn calibrate_timer() -> bool {
+    write(REG_TIMER_DIVIDE, TIMER_DIVIDE_BY_16);
+    write(REG_LVT_TIMER, LVT_MASKED | LAPIC_TIMER_VECTOR as u32);
+    write(REG_TIMER_INITIAL, u32::MAX);
+    let counts = measure_ticks(CALIBRATION_TICKS, || {
+        (u32::MAX - read(REG_TIMER_CURRENT)) as u64
+    });
+    write(REG_TIMER_INITIAL, 0);
+
+    let counts_per_tick = counts.unwrap_or(0) / CALIBRATION_TICKS as u64;
+    COUNTS_PER_TICK.store(
+        counts_per_tick.min(u32::MAX as u64) as u32,
+        Ordering::Relaxed,
+    );
+    counts_per_tick > 0
+}
+
+/// Programs a one-shot timer interrupt on the calling CPU at `deadline` (in
+/// ticks), or stops the timer. Deadlines past the counter range fire early;
+/// the scheduler re-arms then.
+pub fn set_next_event(deadline: Option<u64>) {
+    let Some(deadline) = deadline else {
+        write(REG_TIMER_INITIAL, 0);
+        return;
+    };
+
+    let delta = deadline.saturating_sub(current_tick()).max(1);
+    let counts = delta
+        .saturating_mul(COUNTS_PER_TICK.load(Ordering::Relaxed) as u64)
+        .clamp(1, u32::MAX as u64) as u32;
+    write(REG_LVT_TIMER, LAPIC_TIMER_VECTOR as u32);
+    write(REG_TIMER_INITIAL, counts);
+}
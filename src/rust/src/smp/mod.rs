@@ -0,0 +1,175 @@
+mod lapic;
+mod tables;
+mod trampoline;
+
+use core::sync::atomic::{AtomicBool, AtomicU8, AtomicU32, AtomicUsize, Ordering, fence};
+
+use crate::{
+    constant::{
+        AP_KERNEL_STACK_SIZE, MAX_CPUS, RESCHEDULE_VECTOR, SMP_ENABLED, TLB_SHOOTDOWN_VECTOR,
+    },
+    fpu, gdt, interrupts,
+    kernel::KERNEL,
+    memory::enable_paging,
+    schedule::task::task_next,
+};
+
+/// Set once the local APICs are in use; until then everything runs on CPU 0.
+static SMP_ACTIVE: AtomicBool = AtomicBool::new(false);
+static CPU_COUNT: AtomicUsize = AtomicUsize::new(1);
+static CPU_OF_APIC: [AtomicU8; 256] = [const { AtomicU8::new(0) }; 256];
+static APIC_OF_CPU: [AtomicU8; MAX_CPUS] = [const { AtomicU8::new(0) }; MAX_CPUS];
+static ONLINE: [AtomicBool; MAX_CPUS] = [const { AtomicBool::new(false) }; MAX_CPUS];
+static AP_STACK_TOPS: [AtomicUsize; MAX_CPUS] = [const { AtomicUsize::new(0) }; MAX_CPUS];
+/// Page directory each CPU has loaded, and how many it loaded so far.
+static LOADED_SPACE: [AtomicU32; MAX_CPUS] = [const { AtomicU32::new(0) }; MAX_CPUS];
+static SPACE_LOADS: [AtomicUsize; MAX_CPUS] = [const { AtomicUsize::new(0) }; MAX_CPUS];
+
+/// Index of the calling CPU; the BSP is 0.
+pub fn cpu_id() -> usize {
+    if !SMP_ACTIVE.load(Ordering::Relaxed) {
+        return 0;
+    }
+    CPU_OF_APIC[lapic::id() as usize].load(Ordering::Relaxed) as usize
+}
+
+pub fn cpu_count() -> usize {
+    CPU_COUNT.load(Ordering::Relaxed)
+}
+
+/// Whether `cpu` is running the scheduler and may be given tasks.
+pub fn is_online(cpu: usize) -> bool {
+    cpu == 0 || (cpu < MAX_CPUS && ONLINE[cpu].load(Ordering::Acquire))
+}
+
+/// Interrupts `cpu` so it runs the scheduler.
+pub fn send_reschedule(cpu: usize) {
+    if SMP_ACTIVE.load(Ordering::Relaxed) && cpu != cpu_id() && is_online(cpu) {
+        lapic::send_ipi(APIC_OF_CPU[cpu].load(Ordering::Relaxed), RESCHEDULE_VECTOR);
+    }
+}
+
+/// Notes that the calling CPU is about to load page directory `directory`
+/// into CR3. Called before the write, so `shoot_down` cannot miss it.
+pub fn loading_space(directory: u32) {
+    let cpu = cpu_id();
+    LOADED_SPACE[cpu].store(directory, Ordering::SeqCst);
+    SPACE_LOADS[cpu].fetch_add(1, Ordering::SeqCst);
+}
+
+/// Waits until no other CPU holds TLB entries of `directory` from before
+/// the caller changed its page tables. Each CPU that has it loaded is sent
+/// an IPI; entering the kernel loads the kernel's directory, which flushes
+/// them. A CPU leaves the address space without taking any lock on the
+/// way, so the caller may hold any.
+pub fn shoot_down(directory: u32) {
+    if !SMP_ACTIVE.load(Ordering::Relaxed) {
+        return;
+    }
+    // The page table writes must be visible before the loads are sampled.
+    fence(Ordering::SeqCst);
+
+    let this = cpu_id();
+    let mut loads = [None; MAX_CPUS];
+    for cpu in (0..cpu_count()).filter(|&cpu| cpu != this && is_online(cpu)) {
+        let seen = SPACE_LOADS[cpu].load(Ordering::SeqCst);
+        if LOADED_SPACE[cpu].load(Ordering::SeqCst) == directory {
+            loads[cpu] = Some(seen);
+            lapic::send_ipi(
+                APIC_OF_CPU[cpu].load(Ordering::Relaxed),
+                TLB_SHOOTDOWN_VECTOR,
+            );
+        }
+    }
+
+    for (cpu, seen) in loads.into_iter().enumerate() {
+        let Some(seen) = seen else {
+            continue;
+        };
+        while LOADED_SPACE[cpu].load(Ordering::SeqCst) == directory
+            && SPACE_LOADS[cpu].load(Ordering::SeqCst) == seen
+        {
+            core::hint::spin_loop();
+        }
+    }
+}
+
+/// Acknowledges a local APIC interrupt (timer or IPI).
+pub fn eoi() {
+    if SMP_ACTIVE.load(Ordering::Relaxed) {
+        lapic::eoi();
+    }
+}
+
+/// Arms the local APIC timer of the calling AP; the BSP uses the PIT.
+pub fn set_next_event(deadline: Option<u64>) {
+    lapic::set_next_event(deadline);
+}
+
+/// Brings up the application processors. Runs on the BSP once paging is on
+/// and before the first task is spawned.
+pub fn init() {
+    if !SMP_ENABLED {
+        return;
+    }
+
+    let Some(topology) = tables::discover() else {
+        serial_println!("smp: no ACPI MADT or MP table, running on one CPU");
+        return;
+    };
+
+    lapic::set_base(topology.lapic_base);
+    lapic::enable();
+    if !lapic::calibrate_timer() {
+        serial_println!("smp: local APIC timer calibration failed, running on one CPU");
+        return;
+    }
+
+    let bsp = lapic::id();
+    APIC_OF_CPU[0].store(bsp, Ordering::Relaxed);
+    CPU_OF_APIC[bsp as usize].store(0, Ordering::Relaxed);
+    SMP_ACTIVE.store(true, Ordering::Release);
+
+    trampoline::install();
+
+    let mut next = 1;
+    for &apic_id in topology.apic_ids.iter().filter(|&&id| id != bsp) {
+        if next == MAX_CPUS {
+            serial_println!("smp: ignoring CPUs beyond {}", MAX_CPUS);
+            break;
+        }
+
+        let stack = vec![0u8; AP_KERNEL_STACK_SIZE].leak();
+        let stack_top = (stack.as_ptr() as usize + AP_KERNEL_STACK_SIZE) & !0xF;
+        AP_STACK_TOPS[next].store(stack_top, Ordering::Relaxed);
+        APIC_OF_CPU[next].store(apic_id, Ordering::Relaxed);
+        CPU_OF_APIC[apic_id as usize].store(next as u8, Ordering::Release);
+
+        if !trampoline::start_ap(apic_id, next, stack_top, ap_main) {
+            serial_println!("smp: CPU with APIC id {} did not start", apic_id);
+        }
+        // A late AP still owns this index and stack, so never hand them out again.
+        next += 1;
+    }
+
+    CPU_COUNT.store(next, Ordering::Relaxed);
+    let online = (0..next).filter(|&cpu| is_online(cpu)).count();
+    serial_println!("smp: {} of {} CPUs online", online, topology.apic_ids.len());
+}
+
+/// First Rust code an AP runs, on the stack `init` allocated for it.
+extern "C" fn ap_main(cpu: u32) -> ! {
+    let cpu = cpu as usize;
+
+    gdt::init_ap_gdt(cpu, AP_STACK_TOPS[cpu].load(Ordering::Relaxed) as u32);
+    interrupts::interrupts_init_ap();
+    fpu::init(cpu);
+    KERNEL.kernel_page();
+    enable_paging();
+    lapic::enable();
+
+    ONLINE[cpu].store(true, Ordering::Release);
+    serial_println!("smp: CPU {} online (APIC id {})", cpu, lapic::id());
+
+    task_next();
+}
@@ -0,0 +1,171 @@
+use alloc::vec::Vec;
+
+/// Physical address the local APIC registers default to.
+pub const DEFAULT_LAPIC_BASE: u32 = 0xFEE0_0000;
+
+const EBDA_SEGMENT_POINTER: usize = 0x40E;
+const EBDA_SCAN_LEN: usize = 1024;
+const BIOS_ROM_START: usize = 0xE0000;
+const BIOS_ROM_END: usize = 0x100000;
+
+const RSDP_SIGNATURE: &[u8; 8] = b"RSD PTR ";
+const RSDP_V1_LEN: usize = 20;
+const SDT_HEADER_LEN: usize = 36;
+const MADT_SIGNATURE: &[u8; 4] = b"APIC";
+const MADT_ENTRIES_OFFSET: usize = 44;
+const MADT_LOCAL_APIC: u8 = 0;
+const MADT_LAPIC_ADDRESS_OVERRIDE: u8 = 5;
+const MADT_LAPIC_ENABLED: u32 = 1 << 0;
+
+const MP_FLOATING_SIGNATURE: &[u8; 4] = b"_MP_";
+const MP_FLOATING_LEN: usize = 16;
+const MP_CONFIG_SIGNATURE: &[u8; 4] = b"PCMP";
+const MP_CONFIG_HEADER_LEN: usize = 44;
+const MP_ENTRY_PROCESSOR: u8 = 0;
+const MP_PROCESSOR_ENTRY_LEN: usize = 20;
+const MP_OTHER_ENTRY_LEN: usize = 8;
+const MP_PROCESSOR_ENABLED: u8 = 1 << 0;
+
+/// Processors the firmware reports, by local APIC id.
+pub struct CpuTopology {
+    pub lapic_base: u32,
+    pub apic_ids: Vec<u8>,
+}
+
+/// Finds the processors from the ACPI MADT, or from the older Intel MP table
+/// when there is no ACPI.
+pub fn discover() -> Option<CpuTopology> {
+    find_madt()
+        .and_then(parse_madt)
+        .or_else(|| find_mp_config().and_then(parse_mp_config))
+        .filter(|topology| !topology.apic_ids.is_empty())
+}
+
+fn read_u8(address: usize) -> u8 {
+    unsafe { core::ptr::read_volatile(address as *const u8) }
+}
+
+fn read_u16(address: usize) -> u16 {
+    unsafe { core::ptr::read_unaligned(address as *const u16) }
+}
+
+fn read_u32(address: usize) -> u32 {
+    unsafe { core::ptr::read_unaligned(address as *const u32) }
+}
+
+fn matches(address: usize, signature: &[u8]) -> bool {
+    signature
+        .iter()
+        .enumerate()
+        .all(|(i, &byte)| read_u8(address + i) == byte)
+}
+
+fn checksum_ok(address: usize, len: usize) -> bool {
+    (0..len).fold(0u8, |sum, i| sum.wrapping_add(read_u8(address + i))) == 0
+}
+
+/// Scans the first KiB of the EBDA and the BIOS ROM for a 16-byte aligned
+/// structure starting with `signature`.
+fn scan_bios(signature: &[u8], len: usize) -> Option<usize> {
+    let ebda = (read_u16(EBDA_SEGMENT_POINTER) as usize) << 4;
+    let mut ranges = [(ebda, ebda + EBDA_SCAN_LEN), (BIOS_ROM_START, BIOS_ROM_END)];
+    if ebda == 0 {
+        ranges[0] = (0, 0);
+    }
+
+    ranges.into_iter().find_map(|(start, end)| {
+        (start..end)
+            .step_by(16)
+            .find(|&address| matches(address, signature) && checksum_ok(address, len))
+    })
+}
+
+fn find_madt() -> Option<usize> {
+    let rsdp = scan_bios(RSDP_SIGNATURE, RSDP_V1_LEN)?;
+    // The 32-bit RSDT is enough for a 32-bit kernel, even with an XSDT present.
+    let rsdt = read_u32(rsdp + 16) as usize;
+    if rsdt == 0 || !checksum_ok(rsdt, read_u32(rsdt + 4) as usize) {
+        return None;
+    }
+
+    let entries = (read_u32(rsdt + 4) as usize).saturating_sub(SDT_HEADER_LEN) / 4;
+    (0..entries)
+        .map(|i| read_u32(rsdt + SDT_HEADER_LEN + i * 4) as usize)
+        .find(|&table| table != 0 && matches(table, MADT_SIGNATURE))
+}
+
+fn parse_madt(madt: usize) -> Option<CpuTopology> {
+    let len = read_u32(madt + 4) as usize;
+    if !checksum_ok(madt, len) {
+        return None;
+    }
+
+    let mut topology = CpuTopology {
+        lapic_base: read_u32(madt + SDT_HEADER_LEN),
+        apic_ids: Vec::new(),
+    };
+
+    let mut offset = MADT_ENTRIES_OFFSET;
+    while offset + 2 <= len {
+        let entry = madt + offset;
+        let entry_len = read_u8(entry + 1) as usize;
+        if entry_len < 2 {
+            break;
+        }
+
+        match read_u8(entry) {
+            MADT_LOCAL_APIC => {
+                if read_u32(entry + 4) & MADT_LAPIC_ENABLED != 0 {
+                    topology.apic_ids.push(read_u8(entry + 3));
+                }
+            }
+            MADT_LAPIC_ADDRESS_OVERRIDE => {
+                let address = read_u32(entry + 4);
+                if read_u32(entry + 8) == 0 {
+                    topology.lapic_base = address;
+                }
+            }
+            _ => {}
+        }
+        offset += entry_len;
+    }
+
+    Some(topology)
+}
+
+fn find_mp_config() -> Option<usize> {
+    let floating = scan_bios(MP_FLOATING_SIGNATURE, MP_FLOATING_LEN)?;
+    let config = read_u32(floating + 4) as usize;
+    if config == 0 || !matches(config, MP_CONFIG_SIGNATURE) {
+        return None;
+    }
+    checksum_ok(config, read_u16(config + 4) as usize).then_some(config)
+}
+
+fn parse_mp_config(config: usize) -> Option<CpuTopology> {
+    let mut topology = CpuTopology {
+        lapic_base: read_u32(config + 36),
+        apic_ids: Vec::new(),
+    };
+
+    let end = config + read_u16(config + 4) as usize;
+    let mut entry = config + MP_CONFIG_HEADER_LEN;
+    for _ in 0..read_u16(config + 34) {
+        if entry >= end {
+            break;
+        }
+        if read_u8(entry) == MP_ENTRY_PROCESSOR {
+            if read_u8(entry + 3) & MP_PROCESSOR_ENABLED != 0 {
+                topology.apic_ids.push(read_u8(entry + 1));
+            }
+            entry += MP_PROCESSOR_ENTRY_LEN;
+        } else {
+            entry += MP_OTHER_ENTRY_LEN;
+        }
+    }
+
+    if topology.lapic_base == 0 {
+        topology.lapic_base = DEFAULT_LAPIC_BASE;
+    }
+    Some(topology)
+}
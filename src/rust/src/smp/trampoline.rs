@@ -0,0 +1,133 @@
+use core::arch::global_asm;
+
+use crate::{
+    constant::{AP_TRAMPOLINE_ADDRESS, KERNEL_CODE_SELECTOR, KERNEL_DATA_SELECTOR},
+    device::io::outb,
+};
+
+use super::{is_online, lapic};
+
+/// Each write to the POST port takes about a microsecond.
+const POST_PORT: u16 = 0x80;
+/// How long the BSP waits for a started AP to report online.
+const AP_START_TIMEOUT_US: u32 = 1_000_000;
+
+// Real-mode entry of the application processors. It is copied to
+// `AP_TRAMPOLINE_ADDRESS`, so every address is rebased from
+// `ap_trampoline_start`. The code switches to flat protected mode with a
+// temporary GDT, loads the stack the BSP left in the data slots and calls
+// the entry point with the CPU index.
+global_asm!(
+    ".section .text",
+    ".code16",
+    ".global ap_trampoline_start",
+    "ap_trampoline_start:",
+    "    cli",
+    "    cld",
+    "    xorw %ax, %ax",
+    "    movw %ax, %ds",
+    "    lgdtl ({base} + ap_trampoline_gdt_descriptor - ap_trampoline_start)",
+    "    movl %cr0, %eax",
+    "    orl $1, %eax",
+    "    movl %eax, %cr0",
+    "    ljmpl ${code}, $({base} + ap_trampoline_32 - ap_trampoline_start)",
+    ".code32",
+    "ap_trampoline_32:",
+    "    movw ${data}, %ax",
+    "    movw %ax, %ds",
+    "    movw %ax, %es",
+    "    movw %ax, %fs",
+    "    movw %ax, %gs",
+    "    movw %ax, %ss",
+    "    movl ({base} + ap_trampoline_stack - ap_trampoline_start), %esp",
+    "    movl %esp, %ebp",
+    "    fninit",
+    "    pushl ({base} + ap_trampoline_cpu - ap_trampoline_start)",
+    "    movl ({base} + ap_trampoline_entry - ap_trampoline_start), %eax",
+    "    calll *%eax",
+    "1:",
+    "    hlt",
+    "    jmp 1b",
+    ".balign 8",
+    "ap_trampoline_gdt:",
+    "    .quad 0",
+    "    .quad 0x00CF9A000000FFFF",
+    "    .quad 0x00CF92000000FFFF",
+    "ap_trampoline_gdt_descriptor:",
+    "    .word 23",
+    "    .long {base} + ap_trampoline_gdt - ap_trampoline_start",
+    ".balign 4",
+    ".global ap_trampoline_stack",
+    "ap_trampoline_stack:",
+    "    .long 0",
+    ".global ap_trampoline_cpu",
+    "ap_trampoline_cpu:",
+    "    .long 0",
+    ".global ap_trampoline_entry",
+    "ap_trampoline_entry:",
+    "    .long 0",
+    ".global ap_trampoline_end",
+    "ap_trampoline_end:",
+    base = const AP_TRAMPOLINE_ADDRESS,
+    code = const KERNEL_CODE_SELECTOR,
+    data = const KERNEL_DATA_SELECTOR,
+    options(att_syntax)
+);
+
+unsafe extern "C" {
+    static ap_trampoline_start: u8;
+    static ap_trampoline_stack: u8;
+    static ap_trampoline_cpu: u8;
+    static ap_trampoline_entry: u8;
+    static ap_trampoline_end: u8;
+}
+
+/// Address of `symbol` in the copy at `AP_TRAMPOLINE_ADDRESS`.
+fn relocated(symbol: *const u8) -> *mut u32 {
+    let start = &raw const ap_trampoline_start as usize;
+    (AP_TRAMPOLINE_ADDRESS + (symbol as usize - start)) as *mut u32
+}
+
+fn delay_us(us: u32) {
+    for _ in 0..us {
+        unsafe { outb(POST_PORT, 0) };
+    }
+}
+
+/// Copies the start-up code below 1 MiB, where a SIPI can point.
+pub fn install() {
+    let start = &raw const ap_trampoline_start;
+    let len = &raw const ap_trampoline_end as usize - start as usize;
+    unsafe {
+        core::ptr::copy_nonoverlapping(start, AP_TRAMPOLINE_ADDRESS as *mut u8, len);
+    }
+}
+
+/// Runs the INIT-SIPI-SIPI sequence for `apic_id` and waits until the AP
+/// marks CPU `cpu` online.
+pub fn start_ap(apic_id: u8, cpu: usize, stack_top: usize, entry: extern "C" fn(u32) -> !) -> bool {
+    unsafe {
+        relocated(&raw const ap_trampoline_stack).write_volatile(stack_top as u32);
+        relocated(&raw const ap_trampoline_cpu).write_volatile(cpu as u32);
+        relocated(&raw const ap_trampoline_entry).write_volatile(entry as usize as u32);
+    }
+
+    let page = (AP_TRAMPOLINE_ADDRESS >> 12) as u8;
+    lapic::send_init(apic_id);
+    delay_us(10_000);
+    for _ in 0..2 {
+        lapic::send_startup(apic_id, page);
+        delay_us(200);
+        if is_online(cpu) {
+            return true;
+        }
+    }
+
+    for _ in 0..AP_START_TIMEOUT_US / 10 {
+        if is_online(cpu) {
+            return true;
+        }
+        delay_us(10);
+    }
+    false
+}
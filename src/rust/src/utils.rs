@@ -50,6 +50,17 @@ pub fn reboot() {
     halt_forever();
 }
 
+/// Reads the CPU time-stamp counter.
+#[inline(always)]
+pub fn rdtsc() -> u64 {
+    let low: u32;
+    let high: u32;
+    unsafe {
+        asm!("rdtsc", out("eax") low, out("edx") high, options(nomem, nostack, preserves_flags));
+    }
+    ((high as u64) << 32) | low as u64
+}
+
 pub fn halt() {
     unsafe {
         asm!("hlt", options(nostack, nomem));